@@ -10,7 +10,10 @@
 
 #include <wdt/Protocol.h>
 #include <wdt/util/CommonImpl.h>
+#include <wdt/util/PathTable.h>
 
+#include <atomic>
+#include <memory>
 #include <string>
 
 namespace facebook {
@@ -25,9 +28,28 @@ struct SourceMetaData {
   SourceMetaData(const SourceMetaData &that) = delete;
   SourceMetaData &operator=(const SourceMetaData &that) = delete;
 
-  /// full filepath
+  /// @return   relative path of the file
+  std::string getRelPath() const {
+    return pathTable ? pathTable->getRelPath(pathIndex) : relPath;
+  }
+
+  /// @return   full path of the file, materialized from the path table unless
+  ///           explicitly set
+  std::string getFullPath() const {
+    if (!pathTable || !fullPath.empty()) {
+      return fullPath;
+    }
+    return pathTable->getFullPath(pathIndex);
+  }
+
+  /// table holding the path of the file, nullptr if the paths are set below
+  const PathTable *pathTable{nullptr};
+  /// index of the file in pathTable
+  int64_t pathIndex{-1};
+  /// full filepath, only set when not in a path table or not under its root
+  /// (resolved symlinks). Use getFullPath()
   std::string fullPath;
-  /// relative pathname
+  /// relative pathname, only set when not in a path table. Use getRelPath()
   std::string relPath;
   /**
    * Sequence number associated with the file. Sequence number
@@ -44,12 +66,32 @@ struct SourceMetaData {
   FileAllocationStatus allocationStatus{NOT_EXISTS};
   /// if there is a size mismatch, this is the previous sequence id
   int64_t prevSeqId{0};
+  /// modification time of the file in ns since the epoch, -1 if unknown
+  int64_t mtimeNs{-1};
   /// If true, files are read using O_DIRECT or F_NOCACHE
   bool directReads{false};
   /// File descriptor. If this is not -1, then wdt uses this to read
   int fd{-1};
   /// If true, fd was opened by wdt and must be closed after transfer finish
   bool needToClose{false};
+  /**
+   * Physical offset of the first extent of the file on its disk, or its inode
+   * number when the file system can not report extents. Only set when sources
+   * are read in on-disk order, -1 if unknown
+   */
+  int64_t physicalOffset{-1};
+  /// Whether physicalOffset is a physical offset rather than an inode number
+  bool physicalOffsetLocated{false};
+  /// Device (st_dev) of the file, only set when the number of threads per
+  /// device is limited, -1 if unknown
+  int64_t deviceId{-1};
+  /// Number of sources of the file alive
+  std::atomic<int64_t> numSources{0};
+  /**
+   * If true, the metadata is deleted along with the last source of the file,
+   * instead of being kept by the queue till the end of the transfer
+   */
+  bool deleteWithLastSource{false};
 };
 
 class ByteSource {
@@ -57,8 +99,8 @@ class ByteSource {
   virtual ~ByteSource() {
   }
 
-  /// @return identifier for the source
-  virtual const std::string &getIdentifier() const = 0;
+  /// @return identifier for the source, materialized on each call
+  virtual std::string getIdentifier() const = 0;
 
   /// @return number of bytes in this source
   virtual int64_t getSize() const = 0;
@@ -94,6 +136,16 @@ class ByteSource {
   /// Advances ByteSource offset by numBytes
   virtual void advanceOffset(int64_t numBytes) = 0;
 
+  /**
+   * Splits the end of the source off, to be sent separately
+   *
+   * @param size      size the source is cut down to, between 1 and the
+   *                  current size excluded
+   *
+   * @return          source of the bytes past size
+   */
+  virtual std::unique_ptr<ByteSource> splitAt(int64_t size) = 0;
+
   /**
    * open the source for reading
    *
@@ -34,6 +34,9 @@ const int Protocol::DELETE_CMD_VERSION = 26;
 const int Protocol::VARINT_CHANGE = 27;
 const int Protocol::HEART_BEAT_VERSION = 29;
 const int Protocol::PERIODIC_ENCRYPTION_IV_CHANGE_VERSION = 30;
+const int Protocol::DIRECTORY_LIST_VERSION = 31;
+const int Protocol::DELETE_FILES_VERSION = 32;
+const int Protocol::INCREMENTAL_SYNC_VERSION = 33;
 
 /* All methods of Protocol class are static (functions) */
 
@@ -150,15 +153,24 @@ bool Protocol::encodeHeader(int senderProtocolVersion, char *dest, int64_t &off,
             encodeVarI64C(dest, umax, off, blockDetails.offset) &&
             encodeVarI64C(dest, umax, off, blockDetails.fileSize);
   if (ok && senderProtocolVersion >= HEADER_FLAG_AND_PREV_SEQ_ID_VERSION) {
-    uint8_t flags = blockDetails.allocationStatus;
+    const FileAllocationStatus status = blockDetails.allocationStatus;
+    uint8_t flags = status;
+    const bool sendMtime = senderProtocolVersion >= INCREMENTAL_SYNC_VERSION &&
+                           blockDetails.mtimeNs >= 0;
+    if (sendMtime) {
+      flags |= kMtimeFlag;
+    }
     if (off >= max) {
       ok = false;
     } else {
       dest[off++] = static_cast<char>(flags);
-      if (flags == EXISTS_TOO_SMALL || flags == EXISTS_TOO_LARGE) {
+      if (status == EXISTS_TOO_SMALL || status == EXISTS_TOO_LARGE) {
         // prev seq-id is only used in case the size is less on the sender side
         ok = encodeVarI64C(dest, umax, off, blockDetails.prevSeqId);
       }
+      if (ok && sendMtime) {
+        ok = encodeVarI64C(dest, umax, off, blockDetails.mtimeNs);
+      }
     }
   }
   if (!ok) {
@@ -193,6 +205,11 @@ bool Protocol::decodeHeader(int receiverProtocolVersion, char *src,
         blockDetails.allocationStatus == EXISTS_TOO_LARGE) {
       ok = decodeInt64C(br, blockDetails.prevSeqId);
     }
+    blockDetails.mtimeNs = -1;
+    if (ok && receiverProtocolVersion >= INCREMENTAL_SYNC_VERSION &&
+        (flags & kMtimeFlag)) {
+      ok = decodeInt64C(br, blockDetails.mtimeNs);
+    }
   }
   off += offset(br, obr);
   return ok;
@@ -303,6 +320,77 @@ bool Protocol::decodeSize(char *src, int64_t &off, int64_t max,
   return ok;
 }
 
+bool Protocol::encodeDirectories(char *dest, int64_t &off, int64_t max,
+                                 const std::vector<string> &directories) {
+  if (!encodeVarI64C(dest, max, off, directories.size())) {
+    return false;
+  }
+  for (const string &directory : directories) {
+    if (!encodeString(dest, max, off, directory)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool Protocol::decodeDirectories(char *src, int64_t &off, int64_t max,
+                                 std::vector<string> &directories) {
+  ByteRange br = makeByteRange(src, max, off);  // will check for off>0 max>0
+  const ByteRange obr = br;
+  int64_t numDirectories;
+  bool ok = decodeInt64C(br, numDirectories);
+  // every directory takes at least 2 bytes
+  if (ok && (numDirectories < 0 || numDirectories > (int64_t)br.size() / 2)) {
+    WLOG(ERROR) << "Invalid number of directories " << numDirectories;
+    ok = false;
+  }
+  if (ok) {
+    directories.resize(numDirectories);
+    for (int64_t i = 0; ok && i < numDirectories; i++) {
+      ok = decodeString(br, directories[i]);
+    }
+  }
+  off += offset(br, obr);
+  return ok;
+}
+
+bool Protocol::encodeDeleteFiles(char *dest, int64_t &off, int64_t max,
+                                 const std::vector<BlockDetails> &files) {
+  if (!encodeVarI64C(dest, max, off, files.size())) {
+    return false;
+  }
+  for (const BlockDetails &file : files) {
+    if (!encodeVarI64C(dest, max, off, file.seqId) ||
+        !encodeString(dest, max, off, file.fileName)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool Protocol::decodeDeleteFiles(char *src, int64_t &off, int64_t max,
+                                 std::vector<BlockDetails> &files) {
+  ByteRange br = makeByteRange(src, max, off);  // will check for off>0 max>0
+  const ByteRange obr = br;
+  int64_t numFiles;
+  bool ok = decodeInt64C(br, numFiles);
+  // every file takes at least 3 bytes
+  if (ok && (numFiles < 0 || numFiles > (int64_t)br.size() / 3)) {
+    WLOG(ERROR) << "Invalid number of files to delete " << numFiles;
+    ok = false;
+  }
+  if (ok) {
+    files.resize(numFiles);
+    for (int64_t i = 0; ok && i < numFiles; i++) {
+      BlockDetails &file = files[i];
+      ok = decodeInt64C(br, file.seqId) && decodeString(br, file.fileName);
+      file.allocationStatus = TO_BE_DELETED;
+    }
+  }
+  off += offset(br, obr);
+  return ok;
+}
+
 bool Protocol::encodeAbort(char *dest, int64_t &off, const int64_t max,
                            int32_t protocolVersion, ErrorCode errCode,
                            int64_t checkpoint) {
@@ -366,12 +454,19 @@ bool Protocol::decodeChunkInfo(ByteRange &br, Interval &chunk) {
   return decodeInt64C(br, chunk.start_) && decodeInt64C(br, chunk.end_);
 }
 
-bool Protocol::encodeFileChunksInfo(char *dest, int64_t &off, int64_t max,
+bool Protocol::encodeFileChunksInfo(int protocolVersion, char *dest,
+                                    int64_t &off, int64_t max,
                                     const FileChunksInfo &fileChunksInfo) {
   bool ok = encodeVarI64C(dest, max, off, fileChunksInfo.getSeqId()) &&
             encodeString(dest, max, off, fileChunksInfo.getFileName()) &&
-            encodeVarI64C(dest, max, off, fileChunksInfo.getFileSize()) &&
-            encodeVarI64C(dest, max, off, fileChunksInfo.getChunks().size());
+            encodeVarI64C(dest, max, off, fileChunksInfo.getFileSize());
+  if (ok && protocolVersion >= INCREMENTAL_SYNC_VERSION) {
+    // shifted by one, 0 means unknown
+    const int64_t mtimeNs = std::max<int64_t>(fileChunksInfo.getMtimeNs(), -1);
+    ok = encodeVarI64C(dest, max, off, mtimeNs + 1);
+  }
+  ok = ok &&
+       encodeVarI64C(dest, max, off, fileChunksInfo.getChunks().size());
   if (!ok) {
     return false;
   }
@@ -383,18 +478,24 @@ bool Protocol::encodeFileChunksInfo(char *dest, int64_t &off, int64_t max,
   return true;
 }
 
-bool Protocol::decodeFileChunksInfo(ByteRange &br,
+bool Protocol::decodeFileChunksInfo(int protocolVersion, ByteRange &br,
                                     FileChunksInfo &fileChunksInfo) {
   int64_t seqId, fileSize, numChunks;
+  int64_t mtimeNs = 0;
   string fileName;
   bool ok = decodeInt64C(br, seqId) && decodeString(br, fileName) &&
-            decodeInt64C(br, fileSize) && decodeInt64C(br, numChunks);
+            decodeInt64C(br, fileSize);
+  if (ok && protocolVersion >= INCREMENTAL_SYNC_VERSION) {
+    ok = decodeInt64C(br, mtimeNs);
+  }
+  ok = ok && decodeInt64C(br, numChunks);
   if (!ok) {
     return false;
   }
   fileChunksInfo.setSeqId(seqId);
   fileChunksInfo.setFileName(fileName);
   fileChunksInfo.setFileSize(fileSize);
+  fileChunksInfo.setMtimeNs(mtimeNs - 1);
   if (numChunks < 0) {
     WLOG(ERROR) << "Negative number of chunks decoded " << numChunks;
     return false;
@@ -410,13 +511,13 @@ bool Protocol::decodeFileChunksInfo(ByteRange &br,
 }
 
 int64_t Protocol::maxEncodeLen(const FileChunksInfo &fileChunkInfo) {
-  return 10 + 2 + fileChunkInfo.getFileName().size() + 10 + 10 +
+  return 10 + 2 + fileChunkInfo.getFileName().size() + 10 + 10 + 10 +
          fileChunkInfo.getChunks().size() * kMaxChunkEncodeLen;
 }
 
 int64_t Protocol::encodeFileChunksInfoList(
-    char *dest, int64_t &off, int64_t bufSize, int64_t startIndex,
-    const std::vector<FileChunksInfo> &fileChunksInfoList) {
+    int protocolVersion, char *dest, int64_t &off, int64_t bufSize,
+    int64_t startIndex, const std::vector<FileChunksInfo> &fileChunksInfoList) {
   int64_t oldOffset = off;
   int64_t numEncoded = 0;
   const int64_t numFileChunks = fileChunksInfoList.size();
@@ -432,20 +533,20 @@ int64_t Protocol::encodeFileChunksInfoList(
     if (maxLength + off >= bufSize) {
       break;
     }
-    encodeFileChunksInfo(dest, off, bufSize, fileChunksInfo);
+    encodeFileChunksInfo(protocolVersion, dest, off, bufSize, fileChunksInfo);
     numEncoded++;
   }
   return numEncoded;
 }
 
 bool Protocol::decodeFileChunksInfoList(
-    char *src, int64_t &off, int64_t dataSize,
+    int protocolVersion, char *src, int64_t &off, int64_t dataSize,
     std::vector<FileChunksInfo> &fileChunksInfoList) {
   ByteRange br = makeByteRange(src, dataSize, off);
   const ByteRange obr = br;
   while (!br.empty()) {
     FileChunksInfo fileChunkInfo;
-    if (!decodeFileChunksInfo(br, fileChunkInfo)) {
+    if (!decodeFileChunksInfo(protocolVersion, br, fileChunkInfo)) {
       return false;
     }
     fileChunksInfoList.emplace_back(std::move(fileChunkInfo));
@@ -156,6 +156,17 @@ class FileChunksInfo {
     fileSize_ = fileSize;
   }
 
+  /// @return         modification time of the file in ns since the epoch,
+  ///                 -1 if unknown
+  int64_t getMtimeNs() const {
+    return mtimeNs_;
+  }
+
+  /// @param mtimeNs    modification time to be set
+  void setMtimeNs(int64_t mtimeNs) {
+    mtimeNs_ = mtimeNs;
+  }
+
   /// @return         chunks of the file
   const std::vector<Interval> &getChunks() const {
     return chunks_;
@@ -176,7 +187,8 @@ class FileChunksInfo {
     return this->seqId_ == fileChunksInfo.seqId_ &&
            this->fileName_ == fileChunksInfo.fileName_ &&
            this->chunks_ == fileChunksInfo.chunks_ &&
-           this->fileSize_ == fileChunksInfo.fileSize_;
+           this->fileSize_ == fileChunksInfo.fileSize_ &&
+           this->mtimeNs_ == fileChunksInfo.mtimeNs_;
   }
 
   friend std::ostream &operator<<(std::ostream &os,
@@ -189,6 +201,8 @@ class FileChunksInfo {
   std::string fileName_;
   /// size of the file
   int64_t fileSize_{0};
+  /// modification time of the file, only known for incremental sync
+  int64_t mtimeNs_{-1};
   /// list of chunk info
   std::vector<Interval> chunks_;
 };
@@ -218,6 +232,12 @@ struct BlockDetails {
   FileAllocationStatus allocationStatus{NOT_EXISTS};
   /// seq-id of previous transfer, only valid if there is a size mismatch
   int64_t prevSeqId{0};
+  /**
+   * modification time of the file in ns since the epoch, set by the receiver
+   * once the block is written. Only sent for blocks covering a whole file in
+   * incremental sync, -1 otherwise
+   */
+  int64_t mtimeNs{-1};
 };
 
 /// structure representing settings cmd
@@ -272,6 +292,13 @@ class Protocol {
   static const int HEART_BEAT_VERSION;
   /// version from which wdt started to change encryption iv periodically
   static const int PERIODIC_ENCRYPTION_IV_CHANGE_VERSION;
+  /// version from which the sender can ship the directory list up front
+  static const int DIRECTORY_LIST_VERSION;
+  /// version from which files to be deleted are sent in batches
+  static const int DELETE_FILES_VERSION;
+  /// version from which the mtimes of the files are exchanged for
+  /// incremental sync
+  static const int INCREMENTAL_SYNC_VERSION;
 
   /// Both version, magic number and command byte
   enum CMD_MAGIC {
@@ -291,8 +318,10 @@ class Protocol {
                // <num_checkpoints><checkpoint1><checkpoint2>..., and since the
                // number of checkpoints for local checkpoint is 1, we can treat
                // 0x01 to be a separate cmd
-    ENCRYPTION_CMD = 0x65,  // (e)ncryption
-    HEART_BEAT_CMD = 0x48,  // (H)eart-beat
+    ENCRYPTION_CMD = 0x65,    // (e)ncryption
+    HEART_BEAT_CMD = 0x48,    // (H)eart-beat
+    DIRECTORIES_CMD = 0x64,   // (d)irectories
+    DELETE_FILES_CMD = 0x78,  // (x) delete files
   };
 
   // TODO: move the rest of those definitions closer to where they need to be
@@ -302,8 +331,9 @@ class Protocol {
   static constexpr int64_t kMaxTransferIdLength = 50;
   /// 1 byte for cmd, 2 bytes for file-name length, Max size of filename, 4
   /// variants(seq-id, data-size, offset, file-size), 1 byte for flag, 10 bytes
-  /// prev seq-id
-  static constexpr int64_t kMaxHeader = 1 + 2 + PATH_MAX + 4 * 10 + 1 + 10;
+  /// prev seq-id, 10 bytes mtime
+  static constexpr int64_t kMaxHeader =
+      1 + 2 + PATH_MAX + 4 * 10 + 1 + 10 + 10;
   /// min number of bytes that must be send to unblock receiver
   static constexpr int64_t kMinBufLength = 256;
   /// max size of done command encoding(1 byte for cmd, 1 for status, 10 for
@@ -323,12 +353,21 @@ class Protocol {
   /// abort cmd length(4 bytes for protocol, 1 byte for error-code and 8 bytes
   /// for checkpoint)
   static constexpr int64_t kAbortLength = sizeof(int32_t) + 1 + sizeof(int64_t);
+  /// max length of the directories cmd encoding (1 byte for cmd, 2 bytes for
+  /// cmd length, rest for the number of directories and their names)
+  static constexpr int64_t kMaxDirectoriesCmd = kMaxHeader;
+  /// max length of the delete files cmd encoding (1 byte for cmd, 2 bytes for
+  /// cmd length, rest for the number of files and their seq-ids and names)
+  static constexpr int64_t kMaxDeleteFilesCmd = kMaxHeader;
   /// max size of version encoding
   static constexpr int64_t kMaxVersion = 10;
   /// max size of encryption cmd(1 byte for cmd, 1 byte for
   /// encryption type, rest for initialization vector and tag interval)
   static constexpr int64_t kEncryptionCmdLen =
       1 + 1 + 1 + kAESBlockSize + sizeof(int32_t);
+  /// bit of the header flags set when the mtime of the file follows, the
+  /// lower 3 bits hold the allocation status
+  static constexpr uint8_t kMtimeFlag = 1 << 3;
 
   static_assert(kMinBufLength <= kMaxHeader && kMaxSettings <= kMaxHeader,
                 "Minimum buffer size is kMaxHeader. Header and Settings cmd "
@@ -440,6 +479,30 @@ class Protocol {
   static bool decodeSize(char *src, int64_t &off, int64_t max,
                          int64_t &totalNumBytes);
 
+  /// encodes list of directories into dest+off
+  /// moves the off into dest pointer, not going past max
+  /// @return false if there isn't enough room to encode
+  static bool encodeDirectories(char *dest, int64_t &off, int64_t max,
+                                const std::vector<std::string> &directories);
+
+  /// decodes from src+off and consumes/moves off but not past max
+  /// sets directories
+  /// @return false if there isn't enough data in src+off to src+max
+  static bool decodeDirectories(char *src, int64_t &off, int64_t max,
+                                std::vector<std::string> &directories);
+
+  /// encodes seq-ids and names of files to be deleted into dest+off
+  /// moves the off into dest pointer, not going past max
+  /// @return false if there isn't enough room to encode
+  static bool encodeDeleteFiles(char *dest, int64_t &off, int64_t max,
+                                const std::vector<BlockDetails> &files);
+
+  /// decodes from src+off and consumes/moves off but not past max
+  /// sets files, with TO_BE_DELETED allocation status
+  /// @return false if there isn't enough data in src+off to src+max
+  static bool decodeDeleteFiles(char *src, int64_t &off, int64_t max,
+                                std::vector<BlockDetails> &files);
+
   /// encodes checksum or tag into dest+off
   /// moves the off into dest pointer, not going past max
   /// @return false if there isn't enough room to encode
@@ -486,13 +549,14 @@ class Protocol {
 
   /// encodes fileChunksInfo into dest+off
   /// moves the off into dest pointer
-  static bool encodeFileChunksInfo(char *dest, int64_t &off, int64_t max,
+  static bool encodeFileChunksInfo(int protocolVersion, char *dest,
+                                   int64_t &off, int64_t max,
                                    const FileChunksInfo &fileChunksInfo);
 
   /// decodes from src+off and consumes/moves off
   /// sets fileChunksInfo
   /// @return false if there isn't enough data in src+off to src+max
-  static bool decodeFileChunksInfo(folly::ByteRange &br,
+  static bool decodeFileChunksInfo(int protocolVersion, folly::ByteRange &br,
                                    FileChunksInfo &fileChunksInfo);
 
   /**
@@ -508,14 +572,14 @@ class Protocol {
   /// moves the off into dest pointer
   /// returns number of fileChunks encoded
   static int64_t encodeFileChunksInfoList(
-      char *dest, int64_t &off, int64_t bufSize, int64_t startIndex,
-      const std::vector<FileChunksInfo> &fileChunksInfoList);
+      int protocolVersion, char *dest, int64_t &off, int64_t bufSize,
+      int64_t startIndex, const std::vector<FileChunksInfo> &fileChunksInfoList);
 
   /// decodes from src+off and consumes/moves off
   /// sets fileChunksInfoList
   /// @return false if there isn't enough data in src+off to src+max
   static bool decodeFileChunksInfoList(
-      char *src, int64_t &off, int64_t dataSize,
+      int protocolVersion, char *src, int64_t &off, int64_t dataSize,
       std::vector<FileChunksInfo> &fileChunksInfoList);
 };
 }
@@ -9,6 +9,7 @@
 #include <wdt/Receiver.h>
 #include <wdt/util/EncryptionUtils.h>
 #include <wdt/util/ServerSocket.h>
+#include <wdt/util/WritebackController.h>
 
 #include <folly/Bits.h>
 #include <folly/Conv.h>
@@ -19,7 +20,9 @@
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
+#include <algorithm>
 #include <thread>
+#include <unordered_set>
 
 namespace facebook {
 namespace wdt {
@@ -51,22 +54,44 @@ Receiver::Receiver(int port, int numSockets, const std::string &destDir)
 
 void Receiver::traverseDestinationDir(
     std::vector<FileChunksInfo> &fileChunksInfo) {
-  DirectorySourceQueue dirQueue(options_, getDirectory(),
-                                &abortCheckerCallback_);
-  dirQueue.buildQueueSynchronously();
-  auto &discoveredFilesInfo = dirQueue.getDiscoveredFilesMetaData();
-  for (auto &fileInfo : discoveredFilesInfo) {
-    if (fileInfo->relPath == kWdtLogName ||
-        fileInfo->relPath == kWdtBuggyLogName) {
-      // do not include wdt log files
-      WVLOG(1) << "Removing " << fileInfo->relPath
-               << " from the list of existing files";
-      continue;
+  const int numStripes =
+      stripePlacement_ ? stripePlacement_->getNumStripes() : 1;
+  // seq-ids of the stripes are made distinct by offsetting them
+  int64_t seqIdOffset = 0;
+  std::unordered_set<std::string> discoveredFiles;
+  for (int stripe = 0; stripe < numStripes; stripe++) {
+    DirectorySourceQueue dirQueue(
+        options_,
+        stripe == 0 ? getDirectory() : stripePlacement_->getStripeDir(stripe),
+        &abortCheckerCallback_);
+    dirQueue.setNumDiscoveryThreads(options_.discovery_threads);
+    dirQueue.buildQueueSynchronously();
+    auto &discoveredFilesInfo = dirQueue.getDiscoveredFilesMetaData();
+    int64_t maxSeqId = 0;
+    for (auto &fileInfo : discoveredFilesInfo) {
+      maxSeqId = std::max(maxSeqId, fileInfo->seqId);
+      std::string relPath = fileInfo->getRelPath();
+      if (relPath == kWdtLogName || relPath == kWdtBuggyLogName) {
+        // do not include wdt log files
+        WVLOG(1) << "Removing " << relPath
+                 << " from the list of existing files";
+        continue;
+      }
+      if (stripePlacement_) {
+        if (!discoveredFiles.insert(relPath).second) {
+          WLOG(WARNING) << relPath << " found on several stripes, "
+                        << "ignoring the copy on stripe " << stripe;
+          continue;
+        }
+        stripePlacement_->recordStripe(relPath, stripe);
+      }
+      FileChunksInfo chunkInfo(seqIdOffset + fileInfo->seqId, relPath,
+                               fileInfo->size);
+      chunkInfo.setMtimeNs(fileInfo->mtimeNs);
+      chunkInfo.addChunk(Interval(0, fileInfo->size));
+      fileChunksInfo.emplace_back(std::move(chunkInfo));
     }
-    FileChunksInfo chunkInfo(fileInfo->seqId, fileInfo->relPath,
-                             fileInfo->size);
-    chunkInfo.addChunk(Interval(0, fileInfo->size));
-    fileChunksInfo.emplace_back(std::move(chunkInfo));
+    seqIdOffset += maxSeqId + 1;
   }
   return;
 }
@@ -109,7 +134,13 @@ void Receiver::endCurGlobalSession() {
   checkpoints_.clear();
   if (fileCreator_) {
     fileCreator_->clearAllocationMap();
+    fileCreator_->clearDirHandleCache();
   }
+  if (diskFlusher_) {
+    diskFlusher_->clearError();
+  }
+  // the files of the session are closed, the next one starts afresh
+  WritebackController::get().drainClosedRanges();
   // TODO might consider moving closing the transfer log here
   hasNewTransferStarted_.store(false);
 }
@@ -129,9 +160,42 @@ const WdtTransferRequest &Receiver::init() {
   }
   negotiateProtocol();
   auto numThreads = transferRequest_.ports.size();
+  if (!options_.stripe_directories.empty()) {
+    stripePlacement_ =
+        std::make_unique<StripePlacement>(getDirectory(), options_);
+    WLOG(INFO) << "Striping files across " << stripePlacement_->getNumStripes()
+               << " directories";
+    transferLogManager_->setStripePlacement(stripePlacement_.get());
+  }
+#ifdef HAS_FALLOCATE
+  if (options_.preallocation_threads > 0 &&
+      options_.shouldPreallocateFiles()) {
+    WLOG(INFO) << "Allocating files in the background using "
+               << options_.preallocation_threads << " threads";
+    fileAllocator_ = std::make_unique<FileAllocator>(options_);
+    fileAllocator_->startThreads();
+  }
+#endif
   // This creates the destination directory (which is needed for transferLogMgr)
-  fileCreator_.reset(new FileCreator(
-      getDirectory(), numThreads, *transferLogManager_, options_.skip_writes));
+  fileCreator_.reset(new FileCreator(getDirectory(), *transferLogManager_,
+                                     options_.skip_writes,
+                                     fileAllocator_.get()));
+  if (stripePlacement_) {
+    fileCreator_->setStripePlacement(stripePlacement_.get());
+  }
+  fileCreator_->setDirHandleCacheSize(options_.dir_handle_cache_size);
+  if (options_.delete_extra_files) {
+    fileDeleter_ = std::make_unique<FileDeleter>(options_);
+    fileDeleter_->startThreads();
+  }
+
+  if (options_.group_commit &&
+      (options_.fsync || options_.isLogBasedResumption())) {
+    WLOG(INFO) << "Group commit enabled, flush interval "
+               << options_.group_commit_interval_millis << " ms";
+    diskFlusher_ = std::make_unique<DiskFlusher>(options_);
+    diskFlusher_->startThread();
+  }
 
   transferRequest_.downloadResumptionEnabled =
       options_.enable_download_resumption;
@@ -247,6 +311,14 @@ std::unique_ptr<FileCreator> &Receiver::getFileCreator() {
   return fileCreator_;
 }
 
+DiskFlusher *Receiver::getDiskFlusher() {
+  return diskFlusher_.get();
+}
+
+FileDeleter *Receiver::getFileDeleter() {
+  return fileDeleter_.get();
+}
+
 void Receiver::setRecoveryId(const std::string &recoveryId) {
   recoveryId_ = recoveryId;
   WLOG(INFO) << "recovery id " << recoveryId_;
@@ -310,6 +382,17 @@ std::unique_ptr<TransferReport> Receiver::finish() {
   }
 
   setTransferStatus(THREADS_JOINED);
+  if (diskFlusher_) {
+    // threads already waited for their blocks, nothing should be pending
+    diskFlusher_->shutdownThread();
+  }
+  if (fileAllocator_) {
+    fileAllocator_->shutdownThreads();
+  }
+  if (fileDeleter_) {
+    fileDeleter_->shutdownThreads();
+  }
+  WritebackController::get().drainClosedRanges();
 
   if (isJoinable_) {
     // Make sure to join the progress thread.
@@ -10,6 +10,10 @@
 
 #include <wdt/ReceiverThread.h>
 #include <wdt/WdtBase.h>
+#include <wdt/util/DiskFlusher.h>
+#include <wdt/util/FileAllocator.h>
+#include <wdt/util/FileDeleter.h>
+#include <wdt/util/StripePlacement.h>
 #include <wdt/util/FileCreator.h>
 #include <wdt/util/ServerSocket.h>
 #include <wdt/util/TransferLogManager.h>
@@ -106,6 +110,12 @@ class Receiver : public WdtBase {
   /// Get the ref to transfer log manager
   TransferLogManager &getTransferLogManager();
 
+  /// Get the group commit flusher, nullptr if blocks are synced inline
+  DiskFlusher *getDiskFlusher();
+
+  /// Get the deleter of extra files, nullptr if delete_extra_files is off
+  FileDeleter *getFileDeleter();
+
   /// Responsible for basic setup and starting threads
   ErrorCode start();
 
@@ -159,6 +169,9 @@ class Receiver : public WdtBase {
   /// Flag based on which threads finish processing on receiving a done
   bool isJoinable_{false};
 
+  /// Placement of the files across stripe directories, null if not striping
+  std::unique_ptr<StripePlacement> stripePlacement_;
+
   /// Responsible for writing files on the disk
   std::unique_ptr<FileCreator> fileCreator_{nullptr};
 
@@ -179,6 +192,15 @@ class Receiver : public WdtBase {
   /// Transfer log manager
   std::unique_ptr<TransferLogManager> transferLogManager_;
 
+  /// Background flusher used in group commit mode
+  std::unique_ptr<DiskFlusher> diskFlusher_;
+
+  /// Background allocator of destination files
+  std::unique_ptr<FileAllocator> fileAllocator_;
+
+  /// Deleter of the extra files of the destination directory
+  std::unique_ptr<FileDeleter> fileDeleter_;
+
   /// Global list of checkpoints
   std::vector<Checkpoint> checkpoints_;
 
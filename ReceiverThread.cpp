@@ -14,6 +14,7 @@
 #include <folly/ScopeGuard.h>
 #include <folly/String.h>
 #include <wdt/util/FileWriter.h>
+#include <wdt/util/MmapFileWriter.h>
 
 namespace facebook {
 namespace wdt {
@@ -89,6 +90,8 @@ const ReceiverThread::StateFunction ReceiverThread::stateMap_[] = {
     &ReceiverThread::processSettingsCmd,
     &ReceiverThread::processDoneCmd,
     &ReceiverThread::processSizeCmd,
+    &ReceiverThread::processDirectoriesCmd,
+    &ReceiverThread::processDeleteFilesCmd,
     &ReceiverThread::sendFileChunks,
     &ReceiverThread::sendGlobalCheckpoint,
     &ReceiverThread::sendDoneCmd,
@@ -100,9 +103,14 @@ ReceiverThread::ReceiverThread(Receiver *wdtParent, int threadIndex,
                                int32_t port, ThreadsController *controller)
     : WdtThread(wdtParent->options_, threadIndex, port,
                 wdtParent->getProtocolVersion(), controller),
-      wdtParent_(wdtParent) {
+      wdtParent_(wdtParent),
+      bufferSizer_(options_, bufSize_) {
   controller_->registerThread(threadIndex_);
   threadCtx_->setAbortChecker(&wdtParent_->abortCheckerCallback_);
+  if (options_.small_file_batch_size > 0) {
+    smallFileBatch_ = std::make_unique<SmallFileBatch>(
+        *threadCtx_, wdtParent_->getDiskFlusher());
+  }
 }
 
 /**LISTEN STATE***/
@@ -194,6 +202,11 @@ ReceiverState ReceiverThread::acceptFirstConnection() {
 ReceiverState ReceiverThread::acceptWithTimeout() {
   WTLOG(INFO) << "entered ACCEPT_WITH_TIMEOUT state";
 
+  // files fully received before the connection broke are still written
+  ErrorCode batchCode = flushSmallFileBatch();
+  if (batchCode != OK) {
+    threadStats_.setLocalErrorCode(batchCode);
+  }
   // check socket status
   ErrorCode socketErrCode = socket_->getNonRetryableErrCode();
   if (socketErrCode != OK) {
@@ -204,6 +217,13 @@ ReceiverState ReceiverThread::acceptWithTimeout() {
   }
   socket_->closeNoCheck();
   blocksWaitingVerification_.clear();
+  // blocks already written before the connection broke can still be counted
+  // in the local checkpoint once durable
+  ErrorCode flushCode = markFlushedBlocksDurable(true);
+  if (flushCode != OK) {
+    threadStats_.setLocalErrorCode(flushCode);
+    return FINISH_WITH_ERROR;
+  }
 
   auto timeout = options_.accept_window_millis;
   if (senderReadTimeout_ > 0) {
@@ -280,6 +300,12 @@ ReceiverState ReceiverThread::readNextCmd() {
   if (cmd == Protocol::SIZE_CMD) {
     return PROCESS_SIZE_CMD;
   }
+  if (cmd == Protocol::DIRECTORIES_CMD) {
+    return PROCESS_DIRECTORIES_CMD;
+  }
+  if (cmd == Protocol::DELETE_FILES_CMD) {
+    return PROCESS_DELETE_FILES_CMD;
+  }
   WTLOG(ERROR) << "received an unknown cmd " << cmd;
   threadStats_.setLocalErrorCode(PROTOCOL_ERROR);
   return FINISH_WITH_ERROR;
@@ -479,10 +505,39 @@ ReceiverState ReceiverThread::processFileCmd() {
             << " size:" << blockDetails.dataSize << " ooff:" << oldOffset_
             << " off_: " << off_ << " numRead_: " << numRead_;
   auto &fileCreator = wdtParent_->getFileCreator();
-  FileWriter writer(*threadCtx_, &blockDetails, fileCreator.get());
+  const bool isBatched =
+      smallFileBatch_ != nullptr && smallFileBatch_->canBatch(blockDetails);
+  if (!isBatched) {
+    // this block can only be acknowledged after the batched files before it
+    const ErrorCode batchCode = flushSmallFileBatch();
+    if (batchCode != OK) {
+      threadStats_.setLocalErrorCode(batchCode);
+      return SEND_ABORT_CMD;
+    }
+  }
+  const bool isMapped =
+      !isBatched && MmapFileWriter::canMap(options_, blockDetails);
+  FileWriter fileWriter(*threadCtx_, &blockDetails, fileCreator.get(),
+                        wdtParent_->getDiskFlusher());
+  MmapFileWriter mmapFileWriter(*threadCtx_, &blockDetails, fileCreator.get(),
+                                wdtParent_->getDiskFlusher());
+  if (isBatched) {
+    smallFileBatch_->startFile(blockDetails);
+  }
+  auto batchGuard = folly::makeGuard([&] {
+    if (isBatched) {
+      // no-op if the file was committed to the batch
+      smallFileBatch_->abortFile();
+    }
+  });
+  Writer &blockWriter =
+      isMapped ? static_cast<Writer &>(mmapFileWriter) : fileWriter;
+  Writer &writer = isBatched ? smallFileBatch_->getWriter() : blockWriter;
   const auto encryptionType = socket_->getEncryptionType();
   auto writtenGuard = folly::makeGuard([&] {
-    if (!encryptionTypeToTagLen(encryptionType) && footerType_ == NO_FOOTER) {
+    // content of a batched file is lost if the transfer of the file fails
+    if (!isBatched && !encryptionTypeToTagLen(encryptionType) &&
+        footerType_ == NO_FOOTER) {
       // if encryption doesn't have tag verification and checksum verification
       // is disabled, we can consider bytes received before connection break as
       // valid
@@ -548,7 +603,13 @@ ReceiverState ReceiverThread::processFileCmd() {
 
     sendHeartBeat();
 
-    int64_t nres = readAtMost(*socket_, buf_, bufSize_,
+    // receive straight into the destination if the writer exposes it
+    int64_t writeBufferSize = 0;
+    char *writeBuffer = writer.getWriteBuffer(writeBufferSize);
+    char *readBuffer = (writeBuffer != nullptr) ? writeBuffer : buf_;
+    const int64_t readTarget =
+        std::min(bufSize_, blockDetails.dataSize - writer.getTotalWritten());
+    int64_t nres = readAtMost(*socket_, readBuffer, bufSize_,
                               blockDetails.dataSize - writer.getTotalWritten());
     if (nres <= 0) {
       break;
@@ -560,17 +621,23 @@ ReceiverState ReceiverThread::processFileCmd() {
     }
     threadStats_.addDataBytes(nres);
     if (footerType_ == CHECKSUM_FOOTER) {
-      checksum = folly::crc32c((const uint8_t *)buf_, nres, checksum);
+      checksum = folly::crc32c((const uint8_t *)readBuffer, nres, checksum);
     }
 
     sendHeartBeat();
 
-    code = writer.write(buf_, nres);
+    code = (writeBuffer != nullptr) ? writer.commitWriteBuffer(nres)
+                                    : writer.write(buf_, nres);
     if (code != OK) {
       WTLOG(ERROR) << "failed to write to " << blockDetails.fileName;
       threadStats_.setLocalErrorCode(code);
       return SEND_ABORT_CMD;
     }
+    // everything read so far is written, the buffer can be replaced
+    const int64_t newBufSize = bufferSizer_.onRead(readTarget, nres);
+    if (newBufSize != bufSize_) {
+      resizeBuffer(newBufSize);
+    }
   }
 
   // Sync the writer to disk and close it. We need to check for error code each
@@ -581,6 +648,11 @@ ReceiverState ReceiverThread::processFileCmd() {
     threadStats_.setLocalErrorCode(syncCode);
     return SEND_ABORT_CMD;
   }
+  const int64_t flushTicket = isMapped ? mmapFileWriter.getFlushTicket()
+                                       : fileWriter.getFlushTicket();
+  if (flushTicket > 0) {
+    lastFlushTicket_ = flushTicket;
+  }
   const ErrorCode closeCode = writer.close();
   if (closeCode != OK) {
     WTLOG(ERROR) << "could not close " << blockDetails.fileName;
@@ -653,21 +725,49 @@ ReceiverState ReceiverThread::processFileCmd() {
       threadStats_.setLocalErrorCode(CHECKSUM_MISMATCH);
       return ACCEPT_WITH_TIMEOUT;
     }
-    markBlockVerified(blockDetails);
+    if (isBatched) {
+      smallFileBatch_->commitFile();
+    } else {
+      markBlockVerified(blockDetails);
+    }
     int64_t msgLen = off_ - oldOffset_;
     numRead_ -= msgLen;
   } else {
     WDT_CHECK(footerType_ == NO_FOOTER);
-    if (encryptionTypeToTagLen(encryptionType)) {
+    if (isBatched) {
+      // verified once written, see flushSmallFileBatch()
+      smallFileBatch_->commitFile();
+    } else if (encryptionTypeToTagLen(encryptionType)) {
       blocksWaitingVerification_.emplace_back(blockDetails);
     } else {
       markBlockVerified(blockDetails);
     }
   }
+  if (isBatched && smallFileBatch_->isFull()) {
+    const ErrorCode batchCode = flushSmallFileBatch();
+    if (batchCode != OK) {
+      threadStats_.setLocalErrorCode(batchCode);
+      return SEND_ABORT_CMD;
+    }
+  }
+  const ErrorCode flushCode = markFlushedBlocksDurable(false);
+  if (flushCode != OK) {
+    threadStats_.setLocalErrorCode(flushCode);
+    return SEND_ABORT_CMD;
+  }
   return READ_NEXT_CMD;
 }
 
 void ReceiverThread::markBlockVerified(const BlockDetails &blockDetails) {
+  if (wdtParent_->getDiskFlusher() != nullptr) {
+    // every block verified so far was written before lastFlushTicket_
+    blocksWaitingFlush_.emplace_back(lastFlushTicket_, blockDetails);
+    return;
+  }
+  markBlockDurable(blockDetails);
+}
+
+void ReceiverThread::markBlockDurable(const BlockDetails &blockDetails) {
   threadStats_.addEffectiveBytes(0, blockDetails.dataSize);
   threadStats_.incrNumBlocks();
   checkpoint_.incrNumBlocks();
@@ -683,6 +783,29 @@ void ReceiverThread::markBlockVerified(const BlockDetails &blockDetails) {
                                         blockDetails.dataSize);
 }
 
+ErrorCode ReceiverThread::flushSmallFileBatch() {
+  if (smallFileBatch_ == nullptr || smallFileBatch_->isEmpty()) {
+    return OK;
+  }
+  // the batch only has files of the current connection
+  const bool needsTagVerification =
+      footerType_ == NO_FOOTER &&
+      encryptionTypeToTagLen(socket_->getEncryptionType());
+  auto &fileCreator = wdtParent_->getFileCreator();
+  return smallFileBatch_->flush(
+      *fileCreator, [this, needsTagVerification](const BlockDetails &details,
+                                                 int64_t flushTicket) {
+        if (flushTicket > 0) {
+          lastFlushTicket_ = flushTicket;
+        }
+        if (needsTagVerification) {
+          blocksWaitingVerification_.emplace_back(details);
+        } else {
+          markBlockVerified(details);
+        }
+      });
+}
+
 void ReceiverThread::markReceivedBlocksVerified() {
   for (const BlockDetails &blockDetails : blocksWaitingVerification_) {
     markBlockVerified(blockDetails);
@@ -690,6 +813,31 @@ void ReceiverThread::markReceivedBlocksVerified() {
   blocksWaitingVerification_.clear();
 }
 
+ErrorCode ReceiverThread::markFlushedBlocksDurable(bool waitForFlush) {
+  DiskFlusher *diskFlusher = wdtParent_->getDiskFlusher();
+  if (diskFlusher == nullptr) {
+    return OK;
+  }
+  if (waitForFlush) {
+    PerfStatCollector statCollector(*threadCtx_, PerfStatReport::FLUSH_WAIT);
+    diskFlusher->waitForFlush(lastFlushTicket_);
+  }
+  int64_t flushedTicket;
+  const ErrorCode code = diskFlusher->getFlushStatus(flushedTicket);
+  if (code != OK) {
+    WTLOG(ERROR) << "Group commit flush failed, dropping "
+                 << blocksWaitingFlush_.size() << " unflushed blocks";
+    blocksWaitingFlush_.clear();
+    return code;
+  }
+  auto it = blocksWaitingFlush_.begin();
+  for (; it != blocksWaitingFlush_.end() && it->first <= flushedTicket; ++it) {
+    markBlockDurable(it->second);
+  }
+  blocksWaitingFlush_.erase(blocksWaitingFlush_.begin(), it);
+  return OK;
+}
+
 ReceiverState ReceiverThread::processDoneCmd() {
   WTVLOG(1) << "entered PROCESS_DONE_CMD state";
   if (numRead_ != Protocol::kMinBufLength) {
@@ -716,6 +864,18 @@ ReceiverState ReceiverThread::processDoneCmd() {
 
   // received a valid command, applying pending checkpoint write update
   checkpointIndex_ = pendingCheckpointIndex_;
+  // WAIT and DONE cmds acknowledge every block, so all of them (including
+  // blocks still waiting for tag verification) must be durable first
+  const ErrorCode batchCode = flushSmallFileBatch();
+  if (batchCode != OK) {
+    threadStats_.setLocalErrorCode(batchCode);
+    return SEND_ABORT_CMD;
+  }
+  ErrorCode flushCode = markFlushedBlocksDurable(true);
+  if (flushCode != OK) {
+    threadStats_.setLocalErrorCode(flushCode);
+    return SEND_ABORT_CMD;
+  }
   return WAIT_FOR_FINISH_OR_NEW_CHECKPOINT;
 }
 
@@ -736,6 +896,128 @@ ReceiverState ReceiverThread::processSizeCmd() {
   return READ_NEXT_CMD;
 }
 
+ReceiverState ReceiverThread::processDirectoriesCmd() {
+  WTVLOG(1) << "entered PROCESS_DIRECTORIES_CMD state";
+  int16_t cmdLen = folly::loadUnaligned<int16_t>(buf_ + off_);
+  cmdLen = folly::Endian::little(cmdLen);
+  if (cmdLen <= 0 || cmdLen > Protocol::kMaxDirectoriesCmd) {
+    WTLOG(ERROR) << "Invalid directories cmd length " << cmdLen;
+    threadStats_.setLocalErrorCode(PROTOCOL_ERROR);
+    return FINISH_WITH_ERROR;
+  }
+  if (cmdLen > numRead_) {
+    int64_t end = oldOffset_ + numRead_;
+    numRead_ =
+        readAtLeast(*socket_, buf_ + end, bufSize_ - end, cmdLen, numRead_);
+  }
+  if (numRead_ < cmdLen) {
+    WTLOG(ERROR) << "Unable to read full directories cmd " << cmdLen << " "
+                 << numRead_;
+    threadStats_.setLocalErrorCode(SOCKET_READ_ERROR);
+    return ACCEPT_WITH_TIMEOUT;
+  }
+  off_ += sizeof(int16_t);
+  std::vector<std::string> directories;
+  bool success = Protocol::decodeDirectories(buf_, off_, oldOffset_ + cmdLen,
+                                             directories);
+  if (!success || off_ != oldOffset_ + cmdLen) {
+    WTLOG(ERROR) << "Unable to decode directories cmd, decoded "
+                 << off_ - oldOffset_ << " of " << cmdLen;
+    threadStats_.setLocalErrorCode(PROTOCOL_ERROR);
+    return FINISH_WITH_ERROR;
+  }
+  threadStats_.addHeaderBytes(cmdLen);
+  auto &fileCreator = wdtParent_->getFileCreator();
+  if (!fileCreator->createDirectories(*threadCtx_, directories)) {
+    threadStats_.setLocalErrorCode(PROTOCOL_ERROR);
+    return FINISH_WITH_ERROR;
+  }
+  numRead_ -= cmdLen;
+  if (numRead_ == 0) {
+    off_ = 0;
+  } else if (off_ > bufSize_ / 2) {
+    // several of these cmds can come in a row, do not let off_ run out of
+    // the buffer
+    memmove(buf_, buf_ + off_, numRead_);
+    off_ = 0;
+  }
+  return READ_NEXT_CMD;
+}
+
+ReceiverState ReceiverThread::processDeleteFilesCmd() {
+  WTVLOG(1) << "entered PROCESS_DELETE_FILES_CMD state";
+  int16_t cmdLen = folly::loadUnaligned<int16_t>(buf_ + off_);
+  cmdLen = folly::Endian::little(cmdLen);
+  if (cmdLen <= 0 || cmdLen > Protocol::kMaxDeleteFilesCmd) {
+    WTLOG(ERROR) << "Invalid delete files cmd length " << cmdLen;
+    threadStats_.setLocalErrorCode(PROTOCOL_ERROR);
+    return FINISH_WITH_ERROR;
+  }
+  if (cmdLen > numRead_) {
+    int64_t end = oldOffset_ + numRead_;
+    numRead_ =
+        readAtLeast(*socket_, buf_ + end, bufSize_ - end, cmdLen, numRead_);
+  }
+  if (numRead_ < cmdLen) {
+    WTLOG(ERROR) << "Unable to read full delete files cmd " << cmdLen << " "
+                 << numRead_;
+    threadStats_.setLocalErrorCode(SOCKET_READ_ERROR);
+    return ACCEPT_WITH_TIMEOUT;
+  }
+  off_ += sizeof(int16_t);
+  std::vector<BlockDetails> files;
+  bool success =
+      Protocol::decodeDeleteFiles(buf_, off_, oldOffset_ + cmdLen, files);
+  if (!success || off_ != oldOffset_ + cmdLen) {
+    WTLOG(ERROR) << "Unable to decode delete files cmd, decoded "
+                 << off_ - oldOffset_ << " of " << cmdLen;
+    threadStats_.setLocalErrorCode(PROTOCOL_ERROR);
+    return FINISH_WITH_ERROR;
+  }
+  threadStats_.addHeaderBytes(cmdLen);
+  threadStats_.addEffectiveBytes(cmdLen, 0);
+  // these blocks can only be acknowledged after the batched files before them
+  const ErrorCode batchCode = flushSmallFileBatch();
+  if (batchCode != OK) {
+    threadStats_.setLocalErrorCode(batchCode);
+    return SEND_ABORT_CMD;
+  }
+  // received a well formed cmd, apply the pending checkpoint update
+  checkpointIndex_ = pendingCheckpointIndex_;
+  if (options_.delete_extra_files) {
+    PerfStatCollector statCollector(*threadCtx_, PerfStatReport::UNLINK);
+    auto &fileCreator = wdtParent_->getFileCreator();
+    FileDeleter *fileDeleter = wdtParent_->getFileDeleter();
+    WDT_CHECK(fileDeleter != nullptr);
+    const int64_t numDeleted = fileDeleter->deleteFiles(*fileCreator, files);
+    WTVLOG(2) << "Deleted " << numDeleted << " of " << files.size()
+              << " files";
+  }
+  const bool needsTagVerification =
+      footerType_ == NO_FOOTER &&
+      encryptionTypeToTagLen(socket_->getEncryptionType());
+  for (const BlockDetails &blockDetails : files) {
+    if (needsTagVerification) {
+      blocksWaitingVerification_.emplace_back(blockDetails);
+    } else {
+      markBlockVerified(blockDetails);
+    }
+  }
+  numRead_ -= cmdLen;
+  if (numRead_ == 0) {
+    off_ = 0;
+  } else if (off_ > bufSize_ / 2) {
+    memmove(buf_, buf_ + off_, numRead_);
+    off_ = 0;
+  }
+  const ErrorCode flushCode = markFlushedBlocksDurable(false);
+  if (flushCode != OK) {
+    threadStats_.setLocalErrorCode(flushCode);
+    return SEND_ABORT_CMD;
+  }
+  return READ_NEXT_CMD;
+}
+
 ReceiverState ReceiverThread::sendFileChunks() {
   WTLOG(INFO) << "entered SEND_FILE_CHUNKS state";
   WDT_CHECK(senderReadTimeout_ > 0);  // must have received settings
@@ -795,7 +1077,8 @@ ReceiverState ReceiverThread::sendFileChunks() {
         while (numEntriesWritten < numParsedChunksInfo) {
           off = sizeof(int32_t);
           int64_t numEntriesEncoded = Protocol::encodeFileChunksInfoList(
-              buf_, off, bufSize_, numEntriesWritten, fileChunksInfo);
+              threadProtocolVersion_, buf_, off, bufSize_, numEntriesWritten,
+              fileChunksInfo);
           int32_t dataSize = folly::Endian::little(off - sizeof(int32_t));
           folly::storeUnaligned<int32_t>(buf_, dataSize);
           written = socket_->write(buf_, off);
@@ -902,7 +1185,15 @@ ReceiverState ReceiverThread::sendDoneCmd() {
     return ACCEPT_WITH_TIMEOUT;
   }
   markReceivedBlocksVerified();
-  threadStats_.setLocalErrorCode(socket_->closeConnection());
+  // already flushed while processing DONE, this only counts the blocks
+  const ErrorCode flushCode = markFlushedBlocksDurable(true);
+  code = socket_->closeConnection();
+  if (flushCode != OK) {
+    WTLOG(ERROR) << "final flush failed " << errorCodeToStr(flushCode);
+    threadStats_.setLocalErrorCode(flushCode);
+    return END;
+  }
+  threadStats_.setLocalErrorCode(code);
   WTLOG(INFO) << "got ack for DONE and logical eof. Transfer finished";
   return END;
 }
@@ -920,6 +1211,15 @@ ReceiverState ReceiverThread::finishWithError() {
   } else {
     socket_->closeNoCheck();
   }
+  // global checkpoint must only cover durable blocks
+  flushSmallFileBatch();
+  const ErrorCode flushCode = markFlushedBlocksDurable(true);
+  if (flushCode != OK) {
+    // the unflushed blocks were dropped from the checkpoint
+    WTLOG(ERROR) << "flush failed " << errorCodeToStr(flushCode);
+    threadStats_.setLocalErrorCode(getMoreInterestingError(
+        threadStats_.getLocalErrorCode(), flushCode));
+  }
   auto cv = controller_->getCondition(WAIT_FOR_FINISH_OR_CHECKPOINT_CV);
   auto guard = cv->acquire();
   wdtParent_->addCheckpoint(checkpoint_);
@@ -982,6 +1282,21 @@ ReceiverState ReceiverThread::waitForFinishOrNewCheckpoint() {
   }
 }
 
+void ReceiverThread::resizeBuffer(int64_t size) {
+  if (!threadCtx_->resizeBuffer(size)) {
+    WTLOG(WARNING) << "Unable to resize receive buffer from " << bufSize_
+                   << " to " << size;
+    // retried after the next streak of reads
+    bufferSizer_.setSize(bufSize_, threadCtx_->getPerfReport());
+    return;
+  }
+  WTVLOG(1) << "Resized receive buffer from " << bufSize_ << " to " << size;
+  const Buffer *buffer = threadCtx_->getBuffer();
+  buf_ = buffer->getData();
+  bufSize_ = buffer->getSize();
+  bufferSizer_.setSize(bufSize_, threadCtx_->getPerfReport());
+}
+
 void ReceiverThread::start() {
   if (buf_ == nullptr) {
     WTLOG(ERROR) << "Unable to allocate buffer";
@@ -1002,6 +1317,7 @@ void ReceiverThread::start() {
     }
     state = (this->*stateMap_[state])();
   }
+  bufferSizer_.reportStats(threadCtx_->getPerfReport());
   controller_->deRegisterThread(threadIndex_);
   controller_->executeAtEnd([&]() { wdtParent_->endCurGlobalSession(); });
   WDT_CHECK(socket_.get());
@@ -1046,6 +1362,8 @@ void ReceiverThread::reset() {
   threadStats_.reset();
   checkpoints_.clear();
   newCheckpoints_.clear();
+  blocksWaitingFlush_.clear();
+  lastFlushTicket_ = 0;
   checkpoint_ = Checkpoint(socket_->getPort());
 }
 
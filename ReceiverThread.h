@@ -10,7 +10,9 @@
 #include <wdt/Receiver.h>
 #include <wdt/WdtBase.h>
 #include <wdt/WdtThread.h>
+#include <wdt/util/ReceiveBufferSizer.h>
 #include <wdt/util/ServerSocket.h>
+#include <wdt/util/SmallFileBatch.h>
 
 namespace facebook {
 namespace wdt {
@@ -32,6 +34,8 @@ enum ReceiverState {
   PROCESS_SETTINGS_CMD,
   PROCESS_DONE_CMD,
   PROCESS_SIZE_CMD,
+  PROCESS_DIRECTORIES_CMD,
+  PROCESS_DELETE_FILES_CMD,
   SEND_FILE_CHUNKS,
   SEND_GLOBAL_CHECKPOINTS,
   SEND_DONE_CMD,
@@ -197,6 +201,25 @@ class ReceiverThread : public WdtThread {
    *               FINISH_WITH_ERROR(protocol error)
    */
   ReceiverState processSizeCmd();
+  /**
+   * Processes directories cmd. Creates the directories sent by the sender
+   * ahead of the files in them
+   * Previous states : READ_NEXT_CMD,
+   * Next states : READ_NEXT_CMD(success),
+   *               ACCEPT_WITH_TIMEOUT(socket read failure),
+   *               FINISH_WITH_ERROR(protocol error)
+   */
+  ReceiverState processDirectoriesCmd();
+  /**
+   * Processes delete files cmd. Deletes a batch of extra files of the
+   * destination directory, each file counting as a block
+   * Previous states : READ_NEXT_CMD,
+   * Next states : READ_NEXT_CMD(success),
+   *               ACCEPT_WITH_TIMEOUT(socket read failure),
+   *               SEND_ABORT_CMD(pending small files could not be written),
+   *               FINISH_WITH_ERROR(protocol error)
+   */
+  ReceiverState processDeleteFilesCmd();
   /**
    * Sends file chunks that were received successfully in any previous transfer,
    * this is the first step in download resumption.
@@ -269,12 +292,44 @@ class ReceiverThread : public WdtThread {
    */
   ReceiverState finishWithError();
 
-  /// marks a block a verified
+  /**
+   * marks a block a verified. In group commit mode, the block is only counted
+   * once the flush covering it completes
+   */
   void markBlockVerified(const BlockDetails &blockDetails);
 
+  /// counts a verified and durable block in the checkpoint and transfer log
+  void markBlockDurable(const BlockDetails &blockDetails);
+
+  /**
+   * counts the verified blocks which the group commit flusher has already
+   * synced. If a flush failed, the waiting blocks are dropped.
+   *
+   * @param waitForFlush    if true, waits for all the blocks written by this
+   *                        thread to be flushed first
+   * @return                status of the flushes
+   */
+  ErrorCode markFlushedBlocksDurable(bool waitForFlush);
+
   /// verifies received blocks which are not already verified
   void markReceivedBlocksVerified();
 
+  /**
+   * writes the batched small files, and marks them verified (or waiting for
+   * tag verification) in order
+   *
+   * @return    status of the writes, the files after the first failed one
+   *            are dropped
+   */
+  ErrorCode flushSmallFileBatch();
+
+  /**
+   * Replaces the receive buffer, which must not hold unprocessed data
+   *
+   * @param size    new size of the buffer
+   */
+  void resizeBuffer(int64_t size);
+
   /// checks whether heart-beat is enabled, and whether it is time to send
   /// another heart-beat, and if yes, sends a heart-beat
   void sendHeartBeat();
@@ -334,6 +389,19 @@ class ReceiverThread : public WdtThread {
 
   /// list of received blocks which have not yet been verified
   std::vector<BlockDetails> blocksWaitingVerification_;
+
+  /// verified blocks waiting for the group commit flusher, with the flush
+  /// ticket covering each of them
+  std::vector<std::pair<int64_t, BlockDetails>> blocksWaitingFlush_;
+
+  /// flush ticket of the last block written by this thread
+  int64_t lastFlushTicket_{0};
+
+  /// small files received and not yet written, null if batching is disabled
+  std::unique_ptr<SmallFileBatch> smallFileBatch_;
+
+  /// adapts the size of the receive buffer to the connection
+  ReceiveBufferSizer bufferSizer_;
 };
 }
 }
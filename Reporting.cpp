@@ -220,9 +220,31 @@ TransferReport::TransferReport(TransferStats&& globalStats)
   summary_.setLocalErrorCode(summaryErrorCode);
 }
 
+std::ostream& operator<<(std::ostream& os, const BlockSizingStats& stats) {
+  if (stats.adaptive) {
+    os << "Adaptive block sizes : " << stats.minBlockSize << " to "
+       << stats.maxBlockSize << " bytes, " << stats.numTailSplits
+       << " blocks split for the end";
+    if (stats.numTailSplits > 0) {
+      os << " down to " << stats.minTailBlockSize << " bytes";
+    }
+    os << ".";
+  }
+  if (stats.segmented) {
+    os << (stats.adaptive ? " " : "") << "Block segments : "
+       << stats.numSegments << ", " << stats.numStolenRests
+       << " rests taken over by idle threads.";
+  }
+  return os;
+}
+
 std::ostream& operator<<(std::ostream& os, const TransferReport& report) {
   os << report.getSummary();
   os << " Previously sent bytes : " << report.getPreviouslySentBytes() << ".";
+  if (report.blockSizingStats_.adaptive ||
+      report.blockSizingStats_.segmented) {
+    os << " " << report.blockSizingStats_;
+  }
   if (!report.failedSourceStats_.empty()) {
     if (report.summary_.getNumFiles() == 0) {
       os << " All files failed.";
@@ -359,7 +381,12 @@ const std::string PerfStatReport::statTypeDescription_[] = {
     "Directory creation",
     "Ioctl",
     "Unlink",
-    "Fadvise"};
+    "Fadvise",
+    "Flush Wait",
+    "Writeback Wait",
+    "Small File Batch",
+    "Mmap",
+    "Msync"};
 
 PerfStatReport::PerfStatReport(const WdtOptions& options) {
   static_assert(
@@ -408,6 +435,11 @@ void PerfStatReport::addPerfStat(StatType statType, int64_t timeInMicros) {
   sumMicros_[statType] += timeInMicros;
 }
 
+void PerfStatReport::addBufferSizeReads(int64_t bufferSize, int64_t numReads) {
+  folly::RWSpinLock::WriteHolder writeLock(mutex_);
+  bufferSizeReads_[bufferSize] += numReads;
+}
+
 PerfStatReport& PerfStatReport::operator+=(const PerfStatReport& statReport) {
   folly::RWSpinLock::WriteHolder writeLock(mutex_);
   folly::RWSpinLock::ReadHolder readLock(statReport.mutex_);
@@ -425,6 +457,9 @@ PerfStatReport& PerfStatReport::operator+=(const PerfStatReport& statReport) {
     count_[i] += statReport.count_[i];
     sumMicros_[i] += statReport.sumMicros_[i];
   }
+  for (const auto& pair : statReport.bufferSizeReads_) {
+    bufferSizeReads_[pair.first] += pair.second;
+  }
   return *this;
 }
 
@@ -502,6 +537,13 @@ std::ostream& operator<<(std::ostream& os, const PerfStatReport& statReport) {
          << WDT_LOG_PREFIX;
     }
   }
+  if (!statReport.bufferSizeReads_.empty()) {
+    os << "Receive buffer sizes (KB --> reads) :";
+    for (const auto& pair : statReport.bufferSizeReads_) {
+      os << " " << pair.first / 1024 << " --> " << pair.second;
+    }
+    os << '\n' << WDT_LOG_PREFIX;
+  }
   return os;
 }
 }
@@ -18,6 +18,7 @@
 #include <chrono>
 #include <iterator>
 #include <limits>
+#include <map>
 #include <string>
 #include <unordered_map>
 #include <vector>
@@ -332,6 +333,28 @@ class TransferStats {
   friend std::ostream &operator<<(std::ostream &os, const TransferStats &stats);
 };
 
+/// Block sizes picked by the sender with adaptive_block_size
+struct BlockSizingStats {
+  /// whether block sizes were picked per file
+  bool adaptive{false};
+  /// smallest and largest block size picked for a file, -1 if none
+  int64_t minBlockSize{-1};
+  int64_t maxBlockSize{-1};
+  /// number of blocks cut down to spread the end of the transfer
+  int64_t numTailSplits{0};
+  /// smallest size blocks were cut down to, -1 if none
+  int64_t minTailBlockSize{-1};
+  /// whether blocks were sent in segments, see steal_block_tails
+  bool segmented{false};
+  /// number of segments cut from the blocks
+  int64_t numSegments{0};
+  /// number of rests of blocks taken over by idle threads
+  int64_t numStolenRests{0};
+
+  friend std::ostream &operator<<(std::ostream &os,
+                                  const BlockSizingStats &stats);
+};
+
 /**
  * Class representing entire client transfer report.
  * Unit are mebibyte (MiB), ie 1048576 bytes which we call "Mbytes"
@@ -424,6 +447,12 @@ class TransferReport {
   int64_t getPreviouslySentBytes() const {
     return previouslySentBytes_;
   }
+  const BlockSizingStats &getBlockSizingStats() const {
+    return blockSizingStats_;
+  }
+  void setBlockSizingStats(const BlockSizingStats &stats) {
+    blockSizingStats_ = stats;
+  }
   friend std::ostream &operator<<(std::ostream &os,
                                   const TransferReport &report);
 
@@ -449,6 +478,8 @@ class TransferReport {
   int64_t previouslySentBytes_{0};
   /// Is file discovery finished?
   bool fileDiscoveryFinished_{false};
+  /// block sizes picked, if adaptive
+  BlockSizingStats blockSizingStats_;
 };
 
 /**
@@ -544,6 +575,11 @@ class PerfStatReport {
     IOCTL,
     UNLINK,
     FADVISE,
+    FLUSH_WAIT,  // time spent waiting for the group commit flusher
+    WRITEBACK_WAIT,  // time spent waiting for older ranges to be written back
+    SMALL_FILE_BATCH,  // time spent writing a batch of small files
+    MMAP,
+    MSYNC,
     END
   };
 
@@ -555,6 +591,12 @@ class PerfStatReport {
    */
   void addPerfStat(StatType statType, int64_t timeInMicros);
 
+  /**
+   * @param bufferSize    size of the receive buffer
+   * @param numReads      number of socket reads done with that size
+   */
+  void addBufferSizeReads(int64_t bufferSize, int64_t numReads);
+
   friend std::ostream &operator<<(std::ostream &os,
                                   const PerfStatReport &statReport);
   PerfStatReport &operator+=(const PerfStatReport &statReport);
@@ -573,6 +615,8 @@ class PerfStatReport {
   int64_t count_[kNumTypes_] = {0};
   /// sum of all records for different stat types
   int64_t sumMicros_[kNumTypes_] = {0};
+  /// mapping from receive buffer size to number of reads done with it
+  std::map<int64_t, int64_t> bufferSizeReads_;
   /// network timeout in milliseconds
   int networkTimeoutMillis_;
   /// mutex to support synchronized access
@@ -136,6 +136,13 @@ void Sender::setFileChunksInfo(
   fileChunksReceived_ = true;
 }
 
+void Sender::setPreviouslyReceivedChunks(
+    std::vector<FileChunksInfo> receivedChunks) {
+  WDT_CHECK(getTransferStatus() == NOT_STARTED)
+      << "Chunks must be set before the transfer starts";
+  previouslyReceivedChunks_ = std::move(receivedChunks);
+}
+
 const std::string &Sender::getDestination() const {
   return transferRequest_.hostName;
 }
@@ -249,6 +256,7 @@ std::unique_ptr<TransferReport> Sender::finish() {
           totalFileSize, dirQueue_->getCount(),
           dirQueue_->getPreviouslySentBytes(),
           dirQueue_->fileDiscoveryFinished());
+  transferReport->setBlockSizingStats(dirQueue_->getBlockSizingStats());
 
   if (progressReportEnabled) {
     progressReporter_->end(transferReport);
@@ -295,16 +303,48 @@ ErrorCode Sender::start() {
   dirQueue_->setExcludePattern(options_.exclude_regex);
   dirQueue_->setPruneDirPattern(options_.prune_dir_regex);
   dirQueue_->setFollowSymlinks(options_.follow_symlinks);
+  dirQueue_->setNumDiscoveryThreads(options_.discovery_threads);
   dirQueue_->setBlockSizeMbytes(options_.block_size_mbytes);
+  if (options_.adaptive_block_size && options_.block_size_mbytes > 0) {
+    dirQueue_->setAdaptiveBlockSizes(
+        options_.adaptive_min_block_mbytes * kMbToB,
+        options_.adaptive_max_block_mbytes * kMbToB);
+  }
+  if (options_.steal_block_tails && options_.block_size_mbytes > 0) {
+    dirQueue_->setBlockSegmentSize(options_.steal_segment_mbytes * kMbToB);
+  }
   dirQueue_->setNumClientThreads(transferRequest_.ports.size());
   dirQueue_->setOpenFilesDuringDiscovery(options_.open_files_during_discovery);
   dirQueue_->setDirectReads(options_.odirect_reads);
-  if (!transferRequest_.fileInfo.empty() ||
-      transferRequest_.disableDirectoryTraversal) {
+  dirQueue_->setOrderByPhysicalOffset(options_.order_by_physical_offset);
+  dirQueue_->setMaxThreadsPerDevice(options_.max_threads_per_device);
+  // incremental sync compares the current mtimes, see modifyOptions
+  if (!options_.incremental_sync) {
+    dirQueue_->setDiscoveryCacheDir(options_.discovery_cache_dir);
+  }
+  if (options_.precreate_directories) {
+    if (getProtocolVersion() >= Protocol::DIRECTORY_LIST_VERSION) {
+      dirQueue_->enableDirectoryList();
+    } else {
+      WLOG(WARNING) << "Not sending the directory list because of protocol "
+                       "version "
+                    << getProtocolVersion();
+    }
+  }
+  if (!transferRequest_.binaryManifest.empty()) {
+    dirQueue_->setBinaryManifest(transferRequest_.binaryManifest);
+  } else if (!transferRequest_.fileInfo.empty() ||
+             transferRequest_.disableDirectoryTraversal) {
     dirQueue_->setFileInfo(transferRequest_.fileInfo);
   }
-  transferHistoryController_ =
-      std::make_unique<TransferHistoryController>(*dirQueue_);
+  const bool hasReceivedChunks = !previouslyReceivedChunks_.empty();
+  if (hasReceivedChunks) {
+    WLOG(INFO) << "Receiver known to have " << previouslyReceivedChunks_.size()
+               << " of the files";
+    dirQueue_->setPreviouslyReceivedChunks(previouslyReceivedChunks_);
+  }
+  transferHistoryController_ = std::make_unique<TransferHistoryController>(
+      *dirQueue_, options_.full_reporting);
 
   checkAndUpdateBufferSize();
   const bool twoPhases = options_.two_phases;
@@ -315,6 +355,14 @@ ErrorCode Sender::start() {
                                 options_.enable_download_resumption);
   bool deleteExtraFiles = (transferRequest_.downloadResumptionEnabled ||
                            options_.delete_extra_files);
+  if (options_.max_queued_sources > 0) {
+    if (downloadResumptionEnabled_ || twoPhases || hasReceivedChunks) {
+      WLOG(WARNING) << "Not bounding the discovery, download resumption and "
+                       "two phases need all the files to be discovered first";
+    } else {
+      dirQueue_->setMaxQueuedSources(options_.max_queued_sources);
+    }
+  }
   if (!progressReporter_) {
     WVLOG(1) << "No progress reporter provided, making a default one";
     progressReporter_ = std::make_unique<ProgressReporter>(transferRequest_);
@@ -334,7 +382,7 @@ ErrorCode Sender::start() {
   // TODO: fix this ! use transferRequest! (and dup from Receiver)
   senderThreads_ = threadsController_->makeThreads<Sender, SenderThread>(
       this, transferRequest_.ports.size(), transferRequest_.ports);
-  if (downloadResumptionEnabled_ && deleteExtraFiles) {
+  if ((downloadResumptionEnabled_ || hasReceivedChunks) && deleteExtraFiles) {
     if (getProtocolVersion() >= Protocol::DELETE_CMD_VERSION) {
       dirQueue_->enableFileDeletion();
     } else {
@@ -343,6 +391,15 @@ ErrorCode Sender::start() {
                     << getProtocolVersion();
     }
   }
+  if (downloadResumptionEnabled_ && options_.incremental_sync) {
+    if (getProtocolVersion() >= Protocol::INCREMENTAL_SYNC_VERSION) {
+      dirQueue_->setIncrementalSync(true);
+    } else {
+      WLOG(WARNING) << "Comparing the files of the receiver by size only "
+                       "because of protocol version "
+                    << getProtocolVersion();
+    }
+  }
   dirThread_ = dirQueue_->buildQueueAsynchronously();
   if (twoPhases) {
     dirThread_.join();
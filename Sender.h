@@ -107,6 +107,17 @@ class Sender : public WdtBase {
    */
   void setSocketCreator(ISocketCreator *socketCreator);
 
+  /**
+   * Sets what the receiver already has of the files, for callers keeping
+   * track of the receiver themselves (e.g. when replicating a directory)
+   * instead of asking it through download resumption. Only the missing
+   * chunks are sent and, with delete_extra_files, the files which are not
+   * sent are deleted. Must be called before the transfer starts
+   *
+   * @param receivedChunks    chunks the receiver has
+   */
+  void setPreviouslyReceivedChunks(std::vector<FileChunksInfo> receivedChunks);
+
  private:
   friend class SenderThread;
   friend class QueueAbortChecker;
@@ -183,6 +194,8 @@ class Sender : public WdtBase {
   bool downloadResumptionEnabled_{false};
   /// Flags representing whether file chunks have been received or not
   bool fileChunksReceived_{false};
+  /// chunks the receiver has, set by the caller
+  std::vector<FileChunksInfo> previouslyReceivedChunks_;
   /// Thread that is running the discovery of files using the dirQueue_
   std::thread dirThread_;
   /// Threads which are responsible for transfer of the sources
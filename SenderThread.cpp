@@ -13,6 +13,7 @@
 #include <folly/Memory.h>
 #include <folly/String.h>
 #include <sys/stat.h>
+#include <algorithm>
 #include <wdt/Sender.h>
 #include <wdt/util/ClientSocket.h>
 
@@ -26,13 +27,14 @@ std::ostream &operator<<(std::ostream &os, const SenderThread &senderThread) {
 }
 
 const SenderThread::StateFunction SenderThread::stateMap_[] = {
-    &SenderThread::connect,         &SenderThread::readLocalCheckPoint,
-    &SenderThread::sendSettings,    &SenderThread::sendBlocks,
-    &SenderThread::sendDoneCmd,     &SenderThread::sendSizeCmd,
-    &SenderThread::checkForAbort,   &SenderThread::readFileChunks,
-    &SenderThread::readReceiverCmd, &SenderThread::processDoneCmd,
-    &SenderThread::processWaitCmd,  &SenderThread::processErrCmd,
-    &SenderThread::processAbortCmd, &SenderThread::processVersionMismatch};
+    &SenderThread::connect,            &SenderThread::readLocalCheckPoint,
+    &SenderThread::sendSettings,       &SenderThread::sendBlocks,
+    &SenderThread::sendDoneCmd,        &SenderThread::sendSizeCmd,
+    &SenderThread::sendDirectoriesCmd, &SenderThread::sendDeleteFilesCmd,
+    &SenderThread::checkForAbort,      &SenderThread::readFileChunks,
+    &SenderThread::readReceiverCmd,    &SenderThread::processDoneCmd,
+    &SenderThread::processWaitCmd,     &SenderThread::processErrCmd,
+    &SenderThread::processAbortCmd,    &SenderThread::processVersionMismatch};
 
 std::unique_ptr<ClientSocket> SenderThread::connectToReceiver(
     const int port, IAbortChecker const * /*abortChecker*/,
@@ -278,6 +280,16 @@ SenderState SenderThread::sendBlocks() {
       !totalSizeSent_ && dirQueue_->fileDiscoveryFinished()) {
     return SEND_SIZE_CMD;
   }
+  if (options_.precreate_directories &&
+      threadProtocolVersion_ >= Protocol::DIRECTORY_LIST_VERSION &&
+      dirQueue_->hasNewDirectories()) {
+    return SEND_DIRECTORIES_CMD;
+  }
+  if (options_.delete_extra_files &&
+      threadProtocolVersion_ >= Protocol::DELETE_FILES_VERSION &&
+      dirQueue_->hasSourcesToDelete()) {
+    return SEND_DELETE_FILES_CMD;
+  }
   ErrorCode transferStatus;
   std::unique_ptr<ByteSource> source =
       dirQueue_->getNextSource(threadCtx_.get(), transferStatus);
@@ -292,6 +304,7 @@ SenderState SenderThread::sendBlocks() {
   threadStats_ += transferStats;
   source->addTransferStats(transferStats);
   source->close();
+  dirQueue_->releaseSource(*source);
   if (!transferHistory.addSource(source)) {
     // global checkpoint received for this thread. no point in
     // continuing
@@ -318,13 +331,18 @@ TransferStats SenderThread::sendOneByteSource(
   int64_t actualSize = 0;
   const SourceMetaData &metadata = source->getMetaData();
   BlockDetails blockDetails;
-  blockDetails.fileName = metadata.relPath;
+  blockDetails.fileName = metadata.getRelPath();
   blockDetails.seqId = metadata.seqId;
   blockDetails.fileSize = metadata.size;
   blockDetails.offset = source->getOffset();
   blockDetails.dataSize = expectedSize;
   blockDetails.allocationStatus = metadata.allocationStatus;
   blockDetails.prevSeqId = metadata.prevSeqId;
+  if (options_.incremental_sync && blockDetails.offset == 0 &&
+      blockDetails.dataSize == blockDetails.fileSize) {
+    // the receiver can only tell a file is complete if it is a single block
+    blockDetails.mtimeNs = metadata.mtimeNs;
+  }
   Protocol::encodeHeader(wdtParent_->getProtocolVersion(), headerBuf, off,
                          Protocol::kMaxHeader, blockDetails);
   int16_t littleEndianOff = folly::Endian::little((int16_t)off);
@@ -333,7 +351,7 @@ TransferStats SenderThread::sendOneByteSource(
   if (written != off) {
     WTPLOG(ERROR) << "Write error/mismatch " << written << " " << off
                   << ". fd = " << socket_->getFd()
-                  << ". file = " << metadata.relPath
+                  << ". file = " << blockDetails.fileName
                   << ". port = " << socket_->getPort();
     stats.setLocalErrorCode(SOCKET_WRITE_ERROR);
     stats.incrFailedAttempts();
@@ -388,7 +406,7 @@ TransferStats SenderThread::sendOneByteSource(
     if (written != size) {
       WTLOG(ERROR) << "Write error " << written << " (" << size << ")"
                    << ". fd = " << socket_->getFd()
-                   << ". file = " << metadata.relPath
+                   << ". file = " << blockDetails.fileName
                    << ". port = " << socket_->getPort();
       stats.setLocalErrorCode(SOCKET_WRITE_ERROR);
       stats.incrFailedAttempts();
@@ -403,8 +421,9 @@ TransferStats SenderThread::sendOneByteSource(
     WTLOG(ERROR) << "UGH " << source->getIdentifier() << " " << expectedSize
                  << " " << actualSize;
     struct stat fileStat;
-    if (stat(metadata.fullPath.c_str(), &fileStat) != 0) {
-      WTPLOG(ERROR) << "stat failed on path " << metadata.fullPath;
+    const std::string fullPath = metadata.getFullPath();
+    if (stat(fullPath.c_str(), &fileStat) != 0) {
+      WTPLOG(ERROR) << "stat failed on path " << fullPath;
     } else {
       WTLOG(WARNING) << "file " << source->getIdentifier() << " previous size "
                      << metadata.size << " current size " << fileStat.st_size;
@@ -455,6 +474,136 @@ SenderState SenderThread::sendSizeCmd() {
   return SEND_BLOCKS;
 }
 
+SenderState SenderThread::sendDirectoriesCmd() {
+  WTVLOG(1) << "entered SEND_DIRECTORIES_CMD state";
+  // An encoded name takes at most twice its length (names are at least a
+  // character long and their length varint at most 2 bytes), rest of the
+  // space is for the cmd, cmd length and number of directories
+  const int64_t maxNameBytes = (Protocol::kMaxDirectoriesCmd - 1 - 2 - 10) / 2;
+  std::vector<std::string> directories;
+  dirQueue_->getNextDirectories(directories, maxNameBytes);
+  if (directories.empty()) {
+    return SEND_BLOCKS;
+  }
+  int64_t off = 0;
+  buf_[off++] = Protocol::DIRECTORIES_CMD;
+  char *cmdLenPtr = buf_ + off;
+  off += sizeof(int16_t);
+  if (!Protocol::encodeDirectories(buf_, off, Protocol::kMaxDirectoriesCmd,
+                                   directories)) {
+    // receiver creates these along with the files
+    WTLOG(ERROR) << "Unable to encode " << directories.size()
+                 << " directories, skipping them";
+    return SEND_BLOCKS;
+  }
+  int16_t littleEndianOff = folly::Endian::little((int16_t)off);
+  folly::storeUnaligned<int16_t>(cmdLenPtr, littleEndianOff);
+  int64_t written = socket_->write(buf_, off);
+  if (written != off) {
+    WTLOG(ERROR) << "Socket write error " << off << " " << written;
+    threadStats_.setLocalErrorCode(SOCKET_WRITE_ERROR);
+    return CHECK_FOR_ABORT;
+  }
+  threadStats_.addHeaderBytes(off);
+  WTVLOG(2) << "Sent " << directories.size() << " directories";
+  return SEND_BLOCKS;
+}
+
+SenderState SenderThread::sendDeleteFilesCmd() {
+  WTVLOG(1) << "entered SEND_DELETE_FILES_CMD state";
+  // room for the cmd, cmd length and number of files, then each file takes
+  // at most 10 bytes of seq-id and 2 bytes of name length on top of its name
+  const int64_t maxBytes = Protocol::kMaxDeleteFilesCmd - 1 - 2 - 10;
+  const int64_t perFileBytes = 10 + 2;
+  std::vector<std::unique_ptr<ByteSource>> sources;
+  dirQueue_->getNextSourcesToDelete(threadCtx_.get(), sources, maxBytes,
+                                    perFileBytes);
+  // a name too long for the cmd can not be sent by any thread, only that file
+  // fails and the others go on
+  auto tooLong = std::partition(
+      sources.begin(), sources.end(),
+      [&](const std::unique_ptr<ByteSource> &source) {
+        return (int64_t)source->getMetaData().getRelPath().size() +
+                   perFileBytes <=
+               maxBytes;
+      });
+  for (auto it = tooLong; it != sources.end(); ++it) {
+    WTLOG(ERROR) << "Name too long to send the deletion of "
+                 << (*it)->getIdentifier();
+    TransferStats stats;
+    stats.setLocalErrorCode(PROTOCOL_ERROR);
+    stats.incrFailedAttempts();
+    (*it)->addTransferStats(stats);
+    dirQueue_->failSource(std::move(*it));
+  }
+  sources.erase(tooLong, sources.end());
+  if (sources.empty()) {
+    return SEND_BLOCKS;
+  }
+  std::vector<BlockDetails> files(sources.size());
+  for (size_t i = 0; i < sources.size(); i++) {
+    const SourceMetaData &metadata = sources[i]->getMetaData();
+    files[i].fileName = metadata.getRelPath();
+    files[i].seqId = metadata.seqId;
+    files[i].allocationStatus = TO_BE_DELETED;
+  }
+  int64_t off = 0;
+  buf_[off++] = Protocol::DELETE_FILES_CMD;
+  char *cmdLenPtr = buf_ + off;
+  off += sizeof(int16_t);
+  if (!Protocol::encodeDeleteFiles(buf_, off, Protocol::kMaxDeleteFilesCmd,
+                                   files)) {
+    // reported as failed files once no thread can send them
+    WTLOG(ERROR) << "Unable to encode " << files.size() << " files to delete";
+    dirQueue_->returnToQueue(sources);
+    threadStats_.setLocalErrorCode(PROTOCOL_ERROR);
+    return END;
+  }
+  int16_t littleEndianOff = folly::Endian::little((int16_t)off);
+  folly::storeUnaligned<int16_t>(cmdLenPtr, littleEndianOff);
+  int64_t written = socket_->write(buf_, off);
+  const bool success = (written == off);
+  if (!success) {
+    WTLOG(ERROR) << "Socket write error " << off << " " << written;
+  } else {
+    WTVLOG(2) << "Sent " << files.size() << " files to delete";
+  }
+  ThreadTransferHistory &transferHistory = getTransferHistory();
+  bool globalCheckpointReceived = false;
+  for (size_t i = 0; i < sources.size(); i++) {
+    std::unique_ptr<ByteSource> &source = sources[i];
+    TransferStats stats;
+    if (success) {
+      // the cmd bytes are accounted to the first file of the batch
+      stats.addHeaderBytes(i == 0 ? off : 0);
+      stats.setLocalErrorCode(OK);
+      stats.incrNumBlocks();
+      stats.addEffectiveBytes(stats.getHeaderBytes(), 0);
+    } else {
+      stats.setLocalErrorCode(SOCKET_WRITE_ERROR);
+      stats.incrFailedAttempts();
+    }
+    threadStats_ += stats;
+    source->addTransferStats(stats);
+    source->close();
+    // after a global checkpoint, every source is returned to the queue
+    if (!transferHistory.addSource(source)) {
+      globalCheckpointReceived = true;
+    }
+  }
+  if (globalCheckpointReceived) {
+    // global checkpoint received for this thread. no point in continuing
+    WTLOG(ERROR) << "global checkpoint received. Stopping";
+    threadStats_.setLocalErrorCode(CONN_ERROR);
+    return END;
+  }
+  if (!success) {
+    threadStats_.setLocalErrorCode(SOCKET_WRITE_ERROR);
+    return CHECK_FOR_ABORT;
+  }
+  return SEND_BLOCKS;
+}
+
 SenderState SenderThread::sendDoneCmd() {
   WTVLOG(1) << "entered SEND_DONE_CMD state";
 
@@ -593,7 +742,8 @@ SenderState SenderThread::readFileChunks() {
     off = 0;
     // decode function below adds decoded file chunks to fileChunksInfoList
     bool success = Protocol::decodeFileChunksInfoList(
-        chunkBuffer.get(), off, toRead, fileChunksInfoList);
+        threadProtocolVersion_, chunkBuffer.get(), off, toRead,
+        fileChunksInfoList);
     if (!success) {
       WTLOG(ERROR) << "Unable to decode file chunks list";
       threadStats_.setLocalErrorCode(PROTOCOL_ERROR);
@@ -980,6 +1130,8 @@ void SenderThread::start() {
               << threadStats_.getEffectiveTotalBytes() / totalTime / kMbToB
               << " Mbytes/sec";
 
+  // the other threads send the rest of the block this one was sending
+  dirQueue_->returnBlockRest(threadCtx_.get());
   ThreadTransferHistory &transferHistory = getTransferHistory();
   transferHistory.markNotInUse();
   controller_->deRegisterThread(threadIndex_);
@@ -27,6 +27,8 @@ enum SenderState {
   SEND_BLOCKS,
   SEND_DONE_CMD,
   SEND_SIZE_CMD,
+  SEND_DIRECTORIES_CMD,
+  SEND_DELETE_FILES_CMD,
   CHECK_FOR_ABORT,
   READ_FILE_CHUNKS,
   READ_RECEIVER_CMD,
@@ -167,6 +169,10 @@ class SenderThread : public WdtThread {
    * Next states : SEND_BLOCKS(success),
    *               END(global checkpoint received),
    *               CHECK_FOR_ABORT(socket write failure),
+   *               SEND_SIZE_CMD(discovery finished),
+   *               SEND_DIRECTORIES_CMD(new directories discovered),
+   *               SEND_DELETE_FILES_CMD(files to be deleted on the receiver
+   *                                     side),
    *               SEND_DONE_CMD(no more blocks left to transfer)
    */
   SenderState sendBlocks();
@@ -184,6 +190,26 @@ class SenderThread : public WdtThread {
    *               SEND_BLOCKS(success)
    */
   SenderState sendSizeCmd();
+  /**
+   * sends a batch of newly discovered directories to the receiver, so that it
+   * can create them before the files arrive. A batch lost due to a connection
+   * error is not resent, the receiver creates those directories along with
+   * the files.
+   * Previous states : SEND_BLOCKS
+   * Next states : CHECK_FOR_ABORT(failure),
+   *               SEND_BLOCKS(success)
+   */
+  SenderState sendDirectoriesCmd();
+  /**
+   * sends a batch of files to be deleted on the receiver side. Each file
+   * counts as a block and is added to the history, like the blocks sent by
+   * sendBlocks().
+   * Previous states : SEND_BLOCKS
+   * Next states : CHECK_FOR_ABORT(failure),
+   *               END(global checkpoint received),
+   *               SEND_BLOCKS(success)
+   */
+  SenderState sendDeleteFilesCmd();
   /**
    * checks to see if the receiver has sent ABORT or not
    * Previous states : SEND_BLOCKS,
@@ -1,4 +1,5 @@
 #include <wdt/Wdt.h>
+#include <wdt/util/DirectoryWatcher.h>
 #include <wdt/util/WdtFlags.h>
 
 using std::string;
@@ -128,6 +129,61 @@ ErrorCode Wdt::wdtSend(const WdtTransferRequest &req,
   return errCode;
 }
 
+ErrorCode Wdt::wdtReplicate(const WdtTransferRequest &req,
+                            std::shared_ptr<IAbortChecker> abortChecker) {
+  DirectoryWatcher watcher(req.directory, options_);
+  if (!watcher.start()) {
+    return ERROR;
+  }
+  // the deleted files are only sent to the receiver with delete_extra_files
+  WLOG_IF(INFO, !options_.delete_extra_files)
+      << "Setting delete_extra_files to true (watch directory)";
+  int64_t numTransfers = 0;
+  while (true) {
+    if (abortChecker && abortChecker->shouldAbort()) {
+      WLOG(INFO) << "Replication of " << req.directory << " stopped after "
+                 << numTransfers << " transfers";
+      return OK;
+    }
+    // the first transfer sends the whole tree right away
+    if ((numTransfers > 0 || !watcher.hasChanges()) &&
+        !watcher.waitForChanges(options_.watch_interval_millis)) {
+      return ERROR;
+    }
+    if (!watcher.hasChanges()) {
+      continue;
+    }
+    WdtTransferRequest changesReq(req);
+    changesReq.disableDirectoryTraversal = true;
+    changesReq.binaryManifest.clear();
+    std::vector<FileChunksInfo> receivedChunks;
+    watcher.takeChanges(changesReq.fileInfo, receivedChunks);
+    SenderPtr sender;
+    ErrorCode errCode =
+        createWdtSender(changesReq, abortChecker, false, sender);
+    if (errCode == OK) {
+      sender->getWdtOptions().delete_extra_files = true;
+      sender->setPreviouslyReceivedChunks(std::move(receivedChunks));
+      errCode = sender->init().errorCode;
+      if (errCode == OK) {
+        errCode = sender->transfer()->getSummary().getErrorCode();
+      }
+      sender.reset();
+      releaseWdtSender(changesReq);
+    }
+    watcher.endTransfer(errCode == OK);
+    if (errCode != OK && numTransfers == 0) {
+      WLOG(ERROR) << "Initial transfer of " << req.directory << " failed "
+                  << errorCodeToStr(errCode);
+      return errCode;
+    }
+    WLOG_IF(ERROR, errCode != OK)
+        << "Transfer of the changes failed " << errorCodeToStr(errCode)
+        << ", retrying with the next changes";
+    ++numTransfers;
+  }
+}
+
 ErrorCode Wdt::wdtReceiveStart(const std::string &wdtNamespace,
                                WdtTransferRequest &req,
                                const std::string &identifier,
@@ -73,6 +73,22 @@ class Wdt {
       std::shared_ptr<IAbortChecker> abortChecker = nullptr,
       bool terminateExistingOne = false);
 
+  /**
+   * Replicates a directory continuously to a receiver running forever
+   * (ACCEPT_FOREVER, e.g. wdt -run_as_daemon): sends the whole directory,
+   * then watches it and sends the files changed, appended to or deleted
+   * every watch_interval_millis, without discovering the tree again, see
+   * DirectoryWatcher. The senders always run with delete_extra_files, the
+   * receiver needs it too for the deletions to be applied, and should allow
+   * overwrites, for the files whose transfer failed to be sent again. A failed transfer is retried with
+   * the next changes, except the first one.
+   *
+   * @return    OK once aborted between two transfers, the error otherwise
+   */
+  virtual ErrorCode wdtReplicate(
+      const WdtTransferRequest &wdtRequest,
+      std::shared_ptr<IAbortChecker> abortChecker = nullptr);
+
   virtual ErrorCode createWdtSender(const WdtTransferRequest &wdtRequest,
                                     std::shared_ptr<IAbortChecker> abortChecker,
                                     bool terminateExistingOne,
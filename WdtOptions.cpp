@@ -35,6 +35,23 @@ const char* WdtOptions::DISK_OPTION_TYPE = "disk";
 void WdtOptions::modifyOptions(
     const std::string& optionType,
     const std::set<std::string>& userSpecifiedOptions) {
+  if (incremental_sync) {
+    std::string msg("(incremental sync)");
+    CHANGE_IF_NOT_SPECIFIED(enable_download_resumption, userSpecifiedOptions,
+                            true, msg)
+    CHANGE_IF_NOT_SPECIFIED(resume_using_dir_tree, userSpecifiedOptions, true,
+                            msg)
+    CHANGE_IF_NOT_SPECIFIED(delete_extra_files, userSpecifiedOptions, true,
+                            msg)
+    CHANGE_IF_NOT_SPECIFIED(disable_preallocation, userSpecifiedOptions, true,
+                            msg)
+    CHANGE_IF_NOT_SPECIFIED(block_size_mbytes, userSpecifiedOptions, -1, msg)
+    // the files must be compared with their current mtime and size
+    if (!discovery_cache_dir.empty()) {
+      WLOG(WARNING) << "Disabling the discovery cache " << msg;
+      discovery_cache_dir.clear();
+    }
+  }
   if (optionType == DISK_OPTION_TYPE) {
     std::string msg("(disk option type)");
     CHANGE_IF_NOT_SPECIFIED(num_ports, userSpecifiedOptions, 3, msg)
@@ -43,6 +60,8 @@ void WdtOptions::modifyOptions(
                             msg)
     CHANGE_IF_NOT_SPECIFIED(resume_using_dir_tree, userSpecifiedOptions, true,
                             msg)
+    CHANGE_IF_NOT_SPECIFIED(order_by_physical_offset, userSpecifiedOptions,
+                            true, msg)
     return;
   }
   if (optionType != FLASH_OPTION_TYPE) {
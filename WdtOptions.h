@@ -106,6 +106,23 @@ class WdtOptions {
    * as well as while reading on receiver.
    */
   int32_t buffer_size{256 * 1024};
+  /**
+   * If greater than buffer_size, the receiver grows the buffer of a
+   * connection which keeps filling it, up to this size, so that disk writes
+   * are larger. 0 disables adaptive sizing of the receive buffer.
+   */
+  int32_t adaptive_buffer_max_size{0};
+  /**
+   * With adaptive_buffer_max_size, size the receive buffers can shrink to
+   * under memory pressure
+   */
+  int32_t adaptive_buffer_min_size{64 * 1024};
+  /**
+   * With adaptive_buffer_max_size, limit in mbytes of the memory used by the
+   * receive buffers of all connections. Buffers stop growing when the limit is
+   * reached and shrink when it is exceeded. 0 for no limit.
+   */
+  int32_t adaptive_buffer_memory_limit_mb{0};
   /**
    * Maximum number of retries for the sender in case of
    * failures before exiting
@@ -159,7 +176,8 @@ class WdtOptions {
    */
   std::string exclude_regex{""};
   /**
-   * Regex for the directories that shouldn't be explored
+   * Regex for the directories that shouldn't be explored. Like the include and
+   * exclude regexes, it can be a glob prefixed with "glob:" (see PathMatcher)
    */
   std::string prune_dir_regex{""};
 
@@ -189,6 +207,33 @@ class WdtOptions {
    */
   double block_size_mbytes{16};
 
+  /**
+   * If true, block sizes are picked per file between
+   * adaptive_min_block_mbytes and adaptive_max_block_mbytes instead of
+   * block_size_mbytes: large while a lot remains to be sent, to save headers
+   * and acks, and smaller for the end of the transfer to spread it over the
+   * threads. Ignored when block transfer is disabled
+   */
+  bool adaptive_block_size{false};
+
+  /// smallest block size picked by adaptive_block_size
+  double adaptive_min_block_mbytes{1};
+
+  /// largest block size picked by adaptive_block_size
+  double adaptive_max_block_mbytes{64};
+
+  /**
+   * If true, blocks are announced to the receiver in segments of
+   * steal_segment_mbytes, the rest of a block being kept for the thread
+   * sending it. At the end of the transfer, idle sender threads take over
+   * half of the rests of the other threads instead of leaving a slow
+   * connection to send them alone. Ignored when block transfer is disabled
+   */
+  bool steal_block_tails{false};
+
+  /// size of the segments of steal_block_tails
+  double steal_segment_mbytes{4};
+
   /**
    * timeout in accept call at the server
    */
@@ -232,6 +277,20 @@ class WdtOptions {
    */
   double disk_sync_interval_mb{0.5};
 
+  /**
+   * Process wide limit in mb on bytes written by receiver threads which are
+   * not yet written back to disk. Above it, writers wait for the writeback of
+   * their older ranges and the sync interval adapts to the measured disk
+   * bandwidth. A non-positive value disables the limit
+   */
+  double writeback_dirty_limit_mb{-1};
+
+  /**
+   * With writeback_dirty_limit_mb set, the sync interval is sized so that a
+   * range takes about this long to be written back
+   */
+  int32_t writeback_target_latency_millis{100};
+
   /**
    * If true, each file is fsync'ed after its last block is
    * received.
@@ -240,6 +299,27 @@ class WdtOptions {
    */
   bool fsync{true};
 
+  /**
+   * If true, the receiver does not fsync every block inline. Written blocks
+   * are handed to a background flusher which batches the syncs, and blocks are
+   * only checkpointed (and added to the transfer log) once flushed. Only
+   * used if fsync or log based resumption is enabled.
+   */
+  bool group_commit{false};
+
+  /**
+   * Interval in milliseconds at which the group commit flusher syncs pending
+   * files
+   */
+  int32_t group_commit_interval_millis{50};
+
+  /**
+   * If a group commit batch has at least these many distinct files, a single
+   * syncfs of the destination filesystem is used instead of syncing each file.
+   * A non-positive value disables syncfs
+   */
+  int32_t group_commit_syncfs_threshold{256};
+
   /**
    * Intervals in millis after which progress reporter updates current
    * throughput
@@ -313,6 +393,14 @@ class WdtOptions {
    */
   bool disable_preallocation{false};
 
+  /**
+   * Number of background threads allocating space for multi-block files on
+   * the receiver side. The receiver thread getting the first block of a file
+   * then only sets its size and does not block on the allocation. If 0, or
+   * without fallocate(2), space is allocated inline.
+   */
+  int32_t preallocation_threads{0};
+
   /**
    * If true, destination directory tree is trusted during resumption. So, only
    * the remaining portion of the files are transferred. This is only supported
@@ -328,6 +416,86 @@ class WdtOptions {
    */
   int open_files_during_discovery{0};
 
+  /**
+   * Number of threads exploring the directory tree in parallel, on the sender
+   * and for download resumption on the receiver. Directories are spread
+   * across the threads with work stealing.
+   */
+  int32_t discovery_threads{1};
+
+  /**
+   * If true, the sender reads the files in the order of their location on
+   * disk (FIEMAP, or inode number when unavailable) instead of largest first,
+   * so that spinning disks do not seek back and forth. Set by the disk option
+   * type.
+   */
+  bool order_by_physical_offset{false};
+
+  /**
+   * Maximum number of sender threads reading from the same device (st_dev)
+   * at once, and of receiver threads writing to it. The other threads read
+   * and write on the other devices, so that each disk gets its own queue
+   * depth. 0 for no limit.
+   */
+  int32_t max_threads_per_device{0};
+
+  /**
+   * If > 0, bounds the queue of the sender for huge trees: discovery pauses
+   * when that many sources are queued and resumes once half of them are
+   * consumed. The metadata of a file is released once all its blocks are
+   * sent, only a few fields per block are kept till the blocks are
+   * acknowledged, to send them again after an error. Ignored with download
+   * resumption and two phases.
+   */
+  int64_t max_queued_sources{0};
+
+  /**
+   * If not empty, directory where the sender keeps a cache of the discovery
+   * of each tree it sends. Sending the same tree again only rescans the
+   * directories whose mtime changed, the files of the other directories are
+   * only stat'ed. Not used when following symlinks nor with incremental sync.
+   */
+  std::string discovery_cache_dir{""};
+
+  /**
+   * If true, the sender ships the list of directories containing discovered
+   * files to the receiver, which creates them ahead of the file data instead
+   * of lazily for every file
+   */
+  bool precreate_directories{false};
+
+  /**
+   * Number of open directory descriptors cached by the receiver. Files and
+   * directories are then created relative to the descriptor of their parent
+   * instead of resolving their full path. 0 disables the cache
+   */
+  int32_t dir_handle_cache_size{0};
+
+  /**
+   * Number of small files each receiver thread keeps in memory and writes
+   * together, using linked io_uring requests where available. 0 writes every
+   * file as soon as it is received
+   */
+  int32_t small_file_batch_size{0};
+
+  /**
+   * Single block new files up to this size in kbytes are written in batches,
+   * see small_file_batch_size
+   */
+  int32_t small_file_max_size_kb{64};
+
+  /**
+   * If true, the receiver writes blocks of preallocated files by copying the
+   * data into a shared mapping of the file instead of calling write(2)
+   */
+  bool mmap_writes{false};
+
+  /**
+   * With mmap_writes, the receiver reads the data from the socket straight
+   * into the mapping of the file
+   */
+  bool mmap_direct_receive{false};
+
   /**
    * If true, wdt can overwrite existing files
    */
@@ -366,6 +534,45 @@ class WdtOptions {
    */
   bool delete_extra_files{false};
 
+  /**
+   * Number of threads unlinking the extra files on the receiver side, with
+   * delete_extra_files. The receiver thread getting a batch of files to delete
+   * works on it as well. If 0, files are deleted by that thread only.
+   */
+  int32_t deletion_threads{0};
+
+  /**
+   * Mirror-sync the directory: the receiver reports the size and mtime of the
+   * files it has, the sender only sends the files whose size or mtime differ,
+   * whole, and the receiver sets the mtime of the files it gets to the one of
+   * the sender. Extra files are deleted. Needs directory tree based download
+   * resumption and delete_extra_files on the receiver side, which the command
+   * line sets when not specified. Files are only marked unchanged once
+   * completely received, so block mode should be disabled for large files to
+   * be skipped.
+   */
+  bool incremental_sync{false};
+
+  /**
+   * When replicating a directory continuously (wdt -watch_directory), the
+   * changes are batched and sent at most every that many milliseconds
+   */
+  int32_t watch_interval_millis{1000};
+
+  /**
+   * Comma separated list of additional destination directories, usually on
+   * independent disks. If set, the receiver spreads the files across the
+   * destination directory and these, each file going whole to one of them.
+   */
+  std::string stripe_directories{""};
+
+  /**
+   * Placement of the files across the stripe directories. "hash" places them
+   * evenly by a stable hash of their path, "free_space" weights the
+   * directories by their free space when the receiver starts.
+   */
+  std::string stripe_placement{"hash"};
+
   /**
    * If true, fadvise is skipped after block write
    */
@@ -179,6 +179,10 @@ struct WdtTransferRequest {
   /// Use fileInfo even if empty (don't use the directory exploring)
   bool disableDirectoryTraversal{false};
 
+  /// Only used for the sender: binary manifest to read the files to send
+  /// from, instead of fileInfo or directory discovery (see BinaryManifest)
+  std::string binaryManifest;
+
   // download resumption is enabled on the receiver side
   // and is requested from the sender
   bool downloadResumptionEnabled{false};
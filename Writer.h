@@ -37,6 +37,32 @@ class Writer {
    */
   virtual ErrorCode write(char *buf, int64_t size) = 0;
 
+  /**
+   * Returns the destination of the next bytes, for the caller to receive
+   * data into it directly. The bytes are then written by commitWriteBuffer()
+   * instead of write().
+   *
+   * @param size  set to the number of bytes which can be stored
+   *
+   * @return      destination of the next bytes, nullptr if the writer does
+   *              not expose it
+   */
+  virtual char *getWriteBuffer(int64_t & /* size */) {
+    return nullptr;
+  }
+
+  /**
+   * writes size number bytes stored in the buffer returned by
+   * getWriteBuffer()
+   *
+   * @param size  number of bytes stored
+   *
+   * @return      status of the write
+   */
+  virtual ErrorCode commitWriteBuffer(int64_t /* size */) {
+    return ERROR;
+  }
+
   /// @return   total number of bytes written
   virtual int64_t getTotalWritten() = 0;
 
@@ -0,0 +1,166 @@
+/**
+ * Copyright (c) 2014-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+#include <wdt/test/TestCommon.h>
+#include <wdt/util/BinaryManifest.h>
+#include <wdt/util/DirectorySourceQueue.h>
+
+#include <folly/Conv.h>
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <gtest/gtest.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cstdio>
+#include <set>
+#include <thread>
+
+using namespace std;
+
+namespace facebook {
+namespace wdt {
+
+namespace {
+void writeFile(const string &path, const string &content) {
+  FILE *f = fopen(path.c_str(), "w");
+  ASSERT_NE(nullptr, f);
+  fputs(content.c_str(), f);
+  fclose(f);
+}
+
+void writeManifest(const string &path, int numEntries) {
+  BinaryManifestWriter writer(path);
+  ASSERT_TRUE(writer.open());
+  for (int i = 0; i < numEntries; i++) {
+    ASSERT_TRUE(writer.add(folly::to<string>("dir/file", i), i == 1 ? -1 : i,
+                           static_cast<BinaryManifest::DirectReads>(i % 3)));
+  }
+  ASSERT_TRUE(writer.close());
+}
+}
+
+TEST(BinaryManifest, RoundTrip) {
+  TemporaryDirectory tmpDir;
+  const string path = tmpDir.dir() + "/manifest";
+  // larger than the write buffer
+  const int numEntries = 100000;
+  writeManifest(path, numEntries);
+  EXPECT_TRUE(BinaryManifest::isBinaryManifest(path));
+  EXPECT_NE(0, access((path + ".tmp").c_str(), F_OK));
+
+  BinaryManifestReader reader(path);
+  ASSERT_TRUE(reader.open());
+  WdtFileInfo info("", -1, false);
+  for (int i = 0; i < numEntries; i++) {
+    ASSERT_TRUE(reader.next(true, info));
+    EXPECT_EQ(folly::to<string>("dir/file", i), info.fileName);
+    EXPECT_EQ(i == 1 ? -1 : i, info.fileSize);
+    // no preference takes the default
+    EXPECT_EQ(i % 3 != BinaryManifest::DIRECT_READS_OFF, info.directReads);
+  }
+  EXPECT_FALSE(reader.next(true, info));
+  EXPECT_FALSE(reader.hasError());
+  EXPECT_EQ(numEntries, reader.getNumRead());
+}
+
+TEST(BinaryManifest, InvalidManifests) {
+  TemporaryDirectory tmpDir;
+  const string path = tmpDir.dir() + "/manifest";
+  writeFile(path, "dir/file0\t10\n");
+  EXPECT_FALSE(BinaryManifest::isBinaryManifest(path));
+  {
+    BinaryManifestReader reader(path);
+    EXPECT_FALSE(reader.open());
+    EXPECT_TRUE(reader.hasError());
+  }
+  EXPECT_FALSE(BinaryManifest::isBinaryManifest(path + ".missing"));
+
+  writeManifest(path, 10);
+  struct stat fileStat;
+  ASSERT_EQ(0, stat(path.c_str(), &fileStat));
+  // without its end, a truncated manifest is detected
+  ASSERT_EQ(0, truncate(path.c_str(), fileStat.st_size - 2));
+  EXPECT_TRUE(BinaryManifest::isBinaryManifest(path));
+  BinaryManifestReader reader(path);
+  ASSERT_TRUE(reader.open());
+  WdtFileInfo info("", -1, false);
+  while (reader.next(false, info)) {
+  }
+  EXPECT_TRUE(reader.hasError());
+  EXPECT_EQ(10, reader.getNumRead());
+
+  // the files written so far are dropped with an unclosed writer
+  {
+    BinaryManifestWriter writer(path);
+    ASSERT_TRUE(writer.open());
+    EXPECT_FALSE(writer.add("", 1, BinaryManifest::DIRECT_READS_DEFAULT));
+    EXPECT_TRUE(writer.add("file", 1, BinaryManifest::DIRECT_READS_DEFAULT));
+  }
+  EXPECT_NE(0, access((path + ".tmp").c_str(), F_OK));
+}
+
+TEST(BinaryManifest, EnqueuedByTheQueue) {
+  TemporaryDirectory tmpDir;
+  const string rootDir = tmpDir.dir() + "/src/";
+  ASSERT_EQ(0, mkdir(rootDir.c_str(), 0755));
+  writeFile(rootDir + "a", "0123");
+  writeFile(rootDir + "b", "01234567");
+  writeFile(rootDir + "c", "not in the manifest");
+  const string path = tmpDir.dir() + "/manifest";
+  {
+    BinaryManifestWriter writer(path);
+    ASSERT_TRUE(writer.open());
+    // the size of b is found by the queue
+    ASSERT_TRUE(writer.add("a", 2, BinaryManifest::DIRECT_READS_DEFAULT));
+    ASSERT_TRUE(writer.add("b", -1, BinaryManifest::DIRECT_READS_DEFAULT));
+    ASSERT_TRUE(writer.close());
+  }
+  for (int maxQueuedSources : {0, 1}) {
+    WdtOptions options;
+    std::atomic<bool> shouldAbort{false};
+    WdtAbortChecker abortChecker(shouldAbort);
+    DirectorySourceQueue queue(options, rootDir, &abortChecker);
+    queue.setMaxQueuedSources(maxQueuedSources);
+    queue.setBinaryManifest(path);
+    std::thread discoveryThread = queue.buildQueueAsynchronously();
+    set<pair<string, int64_t>> files;
+    ThreadCtx threadCtx(options, false);
+    ErrorCode status;
+    while (true) {
+      std::unique_ptr<ByteSource> source =
+          queue.getNextSource(&threadCtx, status);
+      if (!source) {
+        break;
+      }
+      files.emplace(source->getIdentifier(), source->getSize());
+    }
+    discoveryThread.join();
+    EXPECT_EQ(OK, status);
+    set<pair<string, int64_t>> expected{{"a", 2}, {"b", 8}};
+    EXPECT_EQ(expected, files);
+  }
+
+  WdtOptions options;
+  std::atomic<bool> shouldAbort{false};
+  WdtAbortChecker abortChecker(shouldAbort);
+  DirectorySourceQueue queue(options, rootDir, &abortChecker);
+  queue.setBinaryManifest(rootDir + "c");
+  EXPECT_FALSE(queue.buildQueueSynchronously());
+  EXPECT_EQ(1, queue.getFailedSourceStats().size());
+}
+}
+}  // namespaces
+
+int main(int argc, char *argv[]) {
+  FLAGS_logtostderr = true;
+  testing::InitGoogleTest(&argc, argv);
+  GFLAGS_NAMESPACE::ParseCommandLineFlags(&argc, &argv, true);
+  google::InitGoogleLogging(argv[0]);
+  int ret = RUN_ALL_TESTS();
+  return ret;
+}
@@ -0,0 +1,151 @@
+/**
+ * Copyright (c) 2014-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+#include <wdt/util/ByteSourceQueue.h>
+#include <wdt/util/FileByteSource.h>
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <gtest/gtest.h>
+#include <set>
+#include <thread>
+
+using namespace std;
+
+namespace facebook {
+namespace wdt {
+
+/// metadata of files with seq-ids 1 to numFiles
+vector<unique_ptr<SourceMetaData>> createMetaData(int numFiles) {
+  vector<unique_ptr<SourceMetaData>> files;
+  for (int i = 1; i <= numFiles; i++) {
+    unique_ptr<SourceMetaData> metadata(new SourceMetaData());
+    metadata->relPath = "file" + to_string(i);
+    metadata->seqId = i;
+    files.push_back(move(metadata));
+  }
+  return files;
+}
+
+TEST(ByteSourceQueue, SingleShardOrder) {
+  auto files = createMetaData(3);
+  ByteSourceQueue queue;
+  queue.push(make_unique<FileByteSource>(files[0].get(), 10, 0));
+  queue.push(make_unique<FileByteSource>(files[1].get(), 30, 30));
+  queue.push(make_unique<FileByteSource>(files[1].get(), 30, 0));
+  unique_ptr<ByteSource> retried =
+      make_unique<FileByteSource>(files[2].get(), 100, 0);
+  retried->getTransferStats().incrFailedAttempts();
+  queue.push(move(retried));
+  queue.push(make_unique<FileByteSource>(files[2].get(), 30, 0));
+  EXPECT_EQ(5, queue.size());
+  // largest first, then by offset then seq-id, retries last
+  const vector<pair<int64_t, int64_t>> expected = {
+      {30, 0}, {30, 0}, {30, 30}, {10, 0}, {100, 0}};
+  const vector<int64_t> expectedSeqIds = {2, 3, 2, 1, 3};
+  for (size_t i = 0; i < expected.size(); i++) {
+    unique_ptr<ByteSource> source;
+    ASSERT_TRUE(queue.pop(0, source));
+    EXPECT_EQ(expected[i].first, source->getSize()) << i;
+    EXPECT_EQ(expected[i].second, source->getOffset()) << i;
+    EXPECT_EQ(expectedSeqIds[i], source->getMetaData().seqId) << i;
+  }
+  unique_ptr<ByteSource> source;
+  EXPECT_FALSE(queue.pop(0, source));
+  EXPECT_TRUE(queue.empty());
+}
+
+TEST(ByteSourceQueue, PhysicalOrder) {
+  auto files = createMetaData(4);
+  files[0]->physicalOffset = 8192;
+  files[1]->physicalOffset = 4096;
+  files[2]->physicalOffset = 65536;
+  for (int i = 0; i < 3; i++) {
+    files[i]->physicalOffsetLocated = true;
+  }
+  // inode number, not comparable with the physical offsets
+  files[3]->physicalOffset = 12;
+  ByteSourceQueue queue;
+  queue.setOrder(ByteSourceQueue::BY_PHYSICAL_OFFSET);
+  queue.push(make_unique<FileByteSource>(files[3].get(), 1, 0));
+  queue.push(make_unique<FileByteSource>(files[2].get(), 100, 0));
+  queue.push(make_unique<FileByteSource>(files[0].get(), 10, 10));
+  queue.push(make_unique<FileByteSource>(files[0].get(), 10, 0));
+  queue.push(make_unique<FileByteSource>(files[1].get(), 5, 0));
+  // closest to the start of the disk first, blocks of a file in order, files
+  // not located last
+  const vector<pair<int64_t, int64_t>> expected = {
+      {2, 0}, {1, 0}, {1, 10}, {3, 0}, {4, 0}};
+  for (size_t i = 0; i < expected.size(); i++) {
+    unique_ptr<ByteSource> source;
+    ASSERT_TRUE(queue.pop(0, source));
+    EXPECT_EQ(expected[i].first, source->getMetaData().seqId) << i;
+    EXPECT_EQ(expected[i].second, source->getOffset()) << i;
+  }
+  EXPECT_TRUE(queue.empty());
+}
+
+TEST(ByteSourceQueue, ConcurrentPops) {
+  const int numFiles = 1000;
+  const int numBlocks = 20;
+  const int numThreads = 8;
+  auto files = createMetaData(numFiles);
+  ByteSourceQueue queue(numThreads);
+  for (int i = 0; i < numFiles; i++) {
+    for (int j = 0; j < numBlocks; j++) {
+      queue.push(make_unique<FileByteSource>(files[i].get(), 100, j * 100));
+    }
+  }
+  EXPECT_EQ(numFiles * numBlocks, queue.size());
+  vector<vector<pair<int64_t, int64_t>>> popped(numThreads);
+  vector<thread> threads;
+  for (int t = 0; t < numThreads; t++) {
+    threads.emplace_back([&queue, &popped, t] {
+      unique_ptr<ByteSource> source;
+      while (queue.pop(t, source)) {
+        popped[t].emplace_back(source->getMetaData().seqId,
+                               source->getOffset());
+      }
+    });
+  }
+  for (auto &t : threads) {
+    t.join();
+  }
+  set<pair<int64_t, int64_t>> blocks;
+  for (const auto &threadBlocks : popped) {
+    for (const auto &block : threadBlocks) {
+      EXPECT_TRUE(blocks.insert(block).second);
+    }
+  }
+  EXPECT_EQ(numFiles * numBlocks, blocks.size());
+  EXPECT_TRUE(queue.empty());
+}
+
+TEST(ByteSourceQueue, Drain) {
+  auto files = createMetaData(10);
+  ByteSourceQueue queue(4);
+  for (auto &file : files) {
+    queue.push(make_unique<FileByteSource>(file.get(), 1, 0));
+  }
+  int numDrained = 0;
+  queue.drain([&numDrained](unique_ptr<ByteSource> &) { ++numDrained; });
+  EXPECT_EQ(10, numDrained);
+  EXPECT_TRUE(queue.empty());
+  queue.setNumShards(2);
+}
+}
+}  // namespaces
+
+int main(int argc, char *argv[]) {
+  FLAGS_logtostderr = true;
+  testing::InitGoogleTest(&argc, argv);
+  GFLAGS_NAMESPACE::ParseCommandLineFlags(&argc, &argv, true);
+  google::InitGoogleLogging(argv[0]);
+  int ret = RUN_ALL_TESTS();
+  return ret;
+}
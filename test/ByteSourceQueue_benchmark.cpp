@@ -0,0 +1,141 @@
+/**
+ * Copyright (c) 2014-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+#include <folly/Benchmark.h>
+#include <folly/Conv.h>
+
+#include <wdt/util/ByteSourceQueue.h>
+#include <wdt/util/FileByteSource.h>
+
+DEFINE_int32(num_threads, 32, "number of threads dequeuing");
+DEFINE_int32(blocks_per_file, 4, "number of blocks of each file");
+
+namespace facebook {
+namespace wdt {
+
+const int kNumBlocks = 1000000;  // 1M
+
+/// what DirectorySourceQueue used before: a priority queue under a mutex,
+/// with a comparator making virtual calls
+class GlobalPriorityQueue {
+ public:
+  void push(std::unique_ptr<ByteSource> source) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    queue_.push(std::move(source));
+  }
+
+  /// same interface as ByteSourceQueue, there is a single queue
+  bool pop(int /* threadIndex */, std::unique_ptr<ByteSource> &source) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (queue_.empty()) {
+      return false;
+    }
+    source = std::move(
+        const_cast<std::unique_ptr<ByteSource> &>(queue_.top()));
+    queue_.pop();
+    return true;
+  }
+
+ private:
+  struct SourceComparator {
+    bool operator()(const std::unique_ptr<ByteSource> &source1,
+                    const std::unique_ptr<ByteSource> &source2) {
+      bool toBeDeleted1 =
+          (source1->getMetaData().allocationStatus == TO_BE_DELETED);
+      bool toBeDeleted2 =
+          (source2->getMetaData().allocationStatus == TO_BE_DELETED);
+      if (toBeDeleted1 != toBeDeleted2) {
+        return toBeDeleted2;
+      }
+      auto retryCount1 = source1->getTransferStats().getFailedAttempts();
+      auto retryCount2 = source2->getTransferStats().getFailedAttempts();
+      if (retryCount1 != retryCount2) {
+        return retryCount1 > retryCount2;
+      }
+      if (source1->getSize() != source2->getSize()) {
+        return source1->getSize() < source2->getSize();
+      }
+      if (source1->getOffset() != source2->getOffset()) {
+        return source1->getOffset() > source2->getOffset();
+      }
+      return source1->getIdentifier() > source2->getIdentifier();
+    }
+  };
+
+  std::mutex mutex_;
+  std::priority_queue<std::unique_ptr<ByteSource>,
+                      std::vector<std::unique_ptr<ByteSource>>,
+                      SourceComparator>
+      queue_;
+};
+
+/// fills a queue with the blocks of files of various sizes
+template <typename Queue>
+std::vector<std::unique_ptr<SourceMetaData>> fillQueue(Queue &queue) {
+  folly::BenchmarkSuspender suspender;
+  std::vector<std::unique_ptr<SourceMetaData>> files;
+  const int numFiles = kNumBlocks / FLAGS_blocks_per_file;
+  for (int i = 0; i < numFiles; i++) {
+    std::unique_ptr<SourceMetaData> metadata(new SourceMetaData());
+    metadata->relPath = folly::to<std::string>("dir", i % 100, "/file", i);
+    metadata->seqId = i + 1;
+    const int64_t blockSize = 1024 * (1 + i % 64);
+    for (int j = 0; j < FLAGS_blocks_per_file; j++) {
+      queue.push(std::make_unique<FileByteSource>(metadata.get(), blockSize,
+                                                  j * blockSize));
+    }
+    files.push_back(std::move(metadata));
+  }
+  return files;
+}
+
+/// dequeues every block with FLAGS_num_threads threads
+template <typename Queue>
+unsigned int dequeueAll(Queue &queue) {
+  std::vector<std::thread> threads;
+  for (int i = 0; i < FLAGS_num_threads; i++) {
+    threads.emplace_back([&queue, i] {
+      std::unique_ptr<ByteSource> source;
+      while (queue.pop(i, source)) {
+        folly::doNotOptimizeAway(source->getSize());
+      }
+    });
+  }
+  for (auto &thread : threads) {
+    thread.join();
+  }
+  return kNumBlocks / FLAGS_blocks_per_file * FLAGS_blocks_per_file;
+}
+
+BENCHMARK_MULTI(GlobalPriorityQueue) {
+  GlobalPriorityQueue queue;
+  auto files = fillQueue(queue);
+  return dequeueAll(queue);
+}
+
+BENCHMARK_RELATIVE_MULTI(ShardedByteSourceQueue) {
+  ByteSourceQueue queue(FLAGS_num_threads);
+  auto files = fillQueue(queue);
+  return dequeueAll(queue);
+}
+}
+}
+
+int main(int argc, char **argv) {
+  FLAGS_logtostderr = true;
+  GFLAGS_NAMESPACE::ParseCommandLineFlags(&argc, &argv, true);
+  google::InitGoogleLogging(argv[0]);
+  folly::runBenchmarks();
+  return 0;
+}
@@ -0,0 +1,570 @@
+/**
+ * Copyright (c) 2014-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+#include <wdt/test/TestCommon.h>
+#include <wdt/util/DirectorySourceQueue.h>
+
+#include <folly/Conv.h>
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <gtest/gtest.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <map>
+#include <set>
+#include <thread>
+
+using namespace std;
+
+namespace facebook {
+namespace wdt {
+
+/// creates a tree of depth levels with fanout sub directories and files each
+void createTree(const string &dir, int depth, int fanout) {
+  for (int i = 0; i < fanout; i++) {
+    const string file = folly::to<string>(dir, "/file", i, i % 2 ? ".sst" : "");
+    FILE *f = fopen(file.c_str(), "wb");
+    ASSERT_NE(nullptr, f);
+    fputs(file.c_str(), f);
+    fclose(f);
+    if (depth > 0) {
+      const string subDir = folly::to<string>(dir, "/dir", i);
+      ASSERT_EQ(0, mkdir(subDir.c_str(), 0755));
+      createTree(subDir, depth - 1, fanout);
+    }
+  }
+}
+
+/// sets the mtime of the directories of a tree an hour back
+void ageDirectories(const string &dir) {
+  auto ageDirectory = [](const char *path, const struct stat *, int type,
+                         struct FTW *) {
+    if (type == FTW_D) {
+      struct timespec times[2];
+      times[0].tv_sec = times[1].tv_sec = time(nullptr) - 3600;
+      times[0].tv_nsec = times[1].tv_nsec = 0;
+      EXPECT_EQ(0, utimensat(AT_FDCWD, path, times, 0)) << path;
+    }
+    return 0;
+  };
+  ASSERT_EQ(0, nftw(dir.c_str(), ageDirectory, 16, FTW_PHYS));
+}
+
+/// creates a file of a given size, without data
+void createFile(const string &path, int64_t size) {
+  FILE *f = fopen(path.c_str(), "w");
+  ASSERT_NE(nullptr, f);
+  fclose(f);
+  ASSERT_EQ(0, truncate(path.c_str(), size));
+}
+
+/// queue over a directory, with the options and abort checker it refers to
+struct TestQueue {
+  explicit TestQueue(const string &rootDir)
+      : abortChecker(shouldAbort), queue(options, rootDir, &abortChecker) {
+  }
+
+  WdtOptions options;
+  std::atomic<bool> shouldAbort{false};
+  WdtAbortChecker abortChecker;
+  DirectorySourceQueue queue;
+};
+
+/// @return   relative paths and sizes of the files discovered
+set<pair<string, int64_t>> discover(const string &rootDir, int numThreads,
+                                    const string &excludePattern,
+                                    const string &pruneDirPattern,
+                                    bool followSymlinks,
+                                    const string &discoveryCacheDir = "") {
+  TestQueue testQueue(rootDir);
+  DirectorySourceQueue &queue = testQueue.queue;
+  queue.setNumDiscoveryThreads(numThreads);
+  queue.setExcludePattern(excludePattern);
+  queue.setPruneDirPattern(pruneDirPattern);
+  queue.setFollowSymlinks(followSymlinks);
+  queue.setDiscoveryCacheDir(discoveryCacheDir);
+  EXPECT_TRUE(queue.buildQueueSynchronously());
+  set<pair<string, int64_t>> files;
+  for (SourceMetaData *metadata : queue.getDiscoveredFilesMetaData()) {
+    EXPECT_TRUE(files.emplace(metadata->getRelPath(), metadata->size).second)
+        << metadata->getRelPath();
+  }
+  EXPECT_EQ(files.size(), queue.getCount());
+  return files;
+}
+
+TEST(DirectorySourceQueue, ParallelDiscoveryFindsSameFiles) {
+  TemporaryDirectory tmpDir;
+  createTree(tmpDir.dir(), 3, 5);
+  for (const string &prune : {string(""), string(".*dir2/")}) {
+    for (const string &exclude : {string(""), string(".*\\.sst")}) {
+      const auto expected = discover(tmpDir.dir(), 1, exclude, prune, false);
+      EXPECT_FALSE(expected.empty());
+      for (int numThreads : {2, 8}) {
+        EXPECT_EQ(expected,
+                  discover(tmpDir.dir(), numThreads, exclude, prune, false))
+            << numThreads << " " << exclude << " " << prune;
+      }
+    }
+  }
+}
+
+TEST(DirectorySourceQueue, PatternsFilterFiles) {
+  TemporaryDirectory tmpDir;
+  createTree(tmpDir.dir(), 2, 4);
+  const auto all = discover(tmpDir.dir(), 1, "", "", false);
+  // 4 files in each of the 1 + 4 + 16 directories
+  EXPECT_EQ(84, all.size());
+  const auto noSst = discover(tmpDir.dir(), 1, ".*\\.sst", "", false);
+  EXPECT_EQ(42, noSst.size());
+  for (const auto &file : noSst) {
+    EXPECT_EQ(string::npos, file.first.find(".sst")) << file.first;
+    // the content of a file is its full path
+    EXPECT_EQ(tmpDir.dir().size() + 1 + file.first.size(), file.second);
+  }
+  EXPECT_EQ(noSst, discover(tmpDir.dir(), 2, "glob:*.sst", "", false));
+  const auto pruned = discover(tmpDir.dir(), 1, "", "dir1/", false);
+  EXPECT_EQ(84 - 20, pruned.size());
+  EXPECT_EQ(pruned, discover(tmpDir.dir(), 2, "", "glob:dir1/", false));
+}
+
+TEST(DirectorySourceQueue, ParallelDiscoveryFollowsSymlinks) {
+  TemporaryDirectory tmpDir;
+  const string srcDir = tmpDir.dir() + "/src";
+  const string otherDir = tmpDir.dir() + "/other";
+  ASSERT_EQ(0, mkdir(srcDir.c_str(), 0755));
+  ASSERT_EQ(0, mkdir(otherDir.c_str(), 0755));
+  createTree(srcDir, 2, 4);
+  createTree(otherDir, 1, 3);
+  ASSERT_EQ(0, symlink(otherDir.c_str(), (srcDir + "/link").c_str()));
+  const auto withoutLinks = discover(srcDir, 1, "", "", false);
+  const auto expected = discover(srcDir, 1, "", "", true);
+  EXPECT_GT(expected.size(), withoutLinks.size());
+  EXPECT_EQ(expected, discover(srcDir, 4, "", "", true));
+  EXPECT_EQ(withoutLinks, discover(srcDir, 4, "", "", false));
+}
+
+TEST(DirectorySourceQueue, DiscoveryCache) {
+  TemporaryDirectory tmpDir;
+  const string srcDir = tmpDir.dir() + "/src";
+  const string cacheDir = tmpDir.dir() + "/cache";
+  ASSERT_EQ(0, mkdir(srcDir.c_str(), 0755));
+  ASSERT_EQ(0, mkdir(cacheDir.c_str(), 0755));
+  createTree(srcDir, 2, 4);
+  // directories modified right before a discovery are not cached
+  ageDirectories(srcDir);
+  const auto expected = discover(srcDir, 1, "", "", false);
+  EXPECT_EQ(84, expected.size());
+  // the first discovery fills the cache, the next ones use it
+  EXPECT_EQ(expected, discover(srcDir, 1, "", "", false, cacheDir));
+  EXPECT_EQ(expected, discover(srcDir, 4, "", "", false, cacheDir));
+  // other patterns use another cache
+  EXPECT_EQ(42, discover(srcDir, 1, ".*\\.sst", "", false, cacheDir).size());
+  // rewriting a file in place does not change the mtime of its directory,
+  // which is not rescanned: the file is still stat'ed for its new size
+  FILE *f = fopen((srcDir + "/dir1/file0").c_str(), "ab");
+  ASSERT_NE(nullptr, f);
+  fputs("more", f);
+  fclose(f);
+  const auto rewritten = discover(srcDir, 1, "", "", false);
+  EXPECT_NE(expected, rewritten);
+  EXPECT_EQ(rewritten, discover(srcDir, 1, "", "", false, cacheDir));
+  EXPECT_EQ(rewritten, discover(srcDir, 4, "", "", false, cacheDir));
+  // adding a file changes the mtime of its directory, which is rescanned
+  f = fopen((srcDir + "/dir2/dir3/new").c_str(), "wb");
+  ASSERT_NE(nullptr, f);
+  fclose(f);
+  auto files = discover(srcDir, 2, "", "", false, cacheDir);
+  EXPECT_EQ(rewritten.size() + 1, files.size());
+  EXPECT_EQ(1, files.count(make_pair(string("dir2/dir3/new"), 0)));
+}
+
+TEST(DirectorySourceQueue, PhysicalOrder) {
+  TemporaryDirectory tmpDir;
+  createTree(tmpDir.dir(), 2, 4);
+  TestQueue testQueue(tmpDir.dir());
+  DirectorySourceQueue &queue = testQueue.queue;
+  queue.setOrderByPhysicalOffset(true);
+  EXPECT_TRUE(queue.buildQueueSynchronously());
+  ThreadCtx threadCtx(testQueue.options, false);
+  bool lastLocated = true;
+  int64_t lastPhysicalOffset = -1;
+  int numSources = 0;
+  while (true) {
+    ErrorCode status;
+    auto source = queue.getNextSource(&threadCtx, status);
+    if (!source) {
+      break;
+    }
+    const int64_t physicalOffset = source->getMetaData().physicalOffset;
+    const bool located = source->getMetaData().physicalOffsetLocated;
+    EXPECT_GE(physicalOffset, 0) << source->getIdentifier();
+    // located files first, then the others by inode number
+    EXPECT_TRUE(lastLocated || !located) << source->getIdentifier();
+    if (located != lastLocated) {
+      lastPhysicalOffset = -1;
+    }
+    EXPECT_GE(physicalOffset, lastPhysicalOffset) << source->getIdentifier();
+    lastLocated = located;
+    lastPhysicalOffset = physicalOffset;
+    ++numSources;
+  }
+  EXPECT_EQ(84, numSources);
+}
+
+TEST(DirectorySourceQueue, ThreadsPerDeviceLimit) {
+  TemporaryDirectory tmpDir;
+  createTree(tmpDir.dir(), 1, 4);
+  TestQueue testQueue(tmpDir.dir());
+  DirectorySourceQueue &queue = testQueue.queue;
+  queue.setMaxThreadsPerDevice(1);
+  queue.setNumClientThreads(2);
+  EXPECT_TRUE(queue.buildQueueSynchronously());
+  ThreadCtx threadCtx(testQueue.options, false);
+  ErrorCode status;
+  auto source = queue.getNextSource(&threadCtx, status);
+  ASSERT_NE(nullptr, source);
+  EXPECT_GE(source->getMetaData().deviceId, 0);
+  // the only device is busy, a second thread waits for the release
+  std::atomic<bool> gotSecond{false};
+  std::thread second([&] {
+    ThreadCtx secondThreadCtx(testQueue.options, false);
+    ErrorCode secondStatus;
+    auto secondSource = queue.getNextSource(&secondThreadCtx, secondStatus);
+    EXPECT_NE(nullptr, secondSource);
+    gotSecond = true;
+    queue.releaseSource(*secondSource);
+  });
+  /* sleep override */
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  EXPECT_FALSE(gotSecond.load());
+  queue.releaseSource(*source);
+  second.join();
+  EXPECT_TRUE(gotSecond.load());
+  // 4 files in each of the 1 + 4 directories
+  int numSources = 2;
+  while ((source = queue.getNextSource(&threadCtx, status)) != nullptr) {
+    queue.releaseSource(*source);
+    ++numSources;
+  }
+  EXPECT_EQ(20, numSources);
+}
+
+TEST(DirectorySourceQueue, BoundedDiscovery) {
+  TemporaryDirectory tmpDir;
+  createTree(tmpDir.dir(), 2, 4);
+  TestQueue testQueue(tmpDir.dir());
+  DirectorySourceQueue &queue = testQueue.queue;
+  const int64_t maxQueuedSources = 10;
+  queue.setMaxQueuedSources(maxQueuedSources);
+  queue.setNumDiscoveryThreads(2);
+  std::thread discoveryThread = queue.buildQueueAsynchronously();
+  ThreadCtx threadCtx(testQueue.options, false);
+  set<string> files;
+  int64_t numDequeued = 0;
+  while (true) {
+    ErrorCode status;
+    auto source = queue.getNextSource(&threadCtx, status);
+    if (!source) {
+      break;
+    }
+    ++numDequeued;
+    // every file is a single block, each discovery thread may add one source
+    // over the mark
+    EXPECT_LE(queue.getCount() - numDequeued, maxQueuedSources + 2);
+    EXPECT_TRUE(files.insert(source->getIdentifier()).second);
+    // the metadata is deleted along with the source
+  }
+  discoveryThread.join();
+  EXPECT_EQ(84, files.size());
+  EXPECT_EQ(84, queue.getCount());
+  EXPECT_TRUE(queue.getDiscoveredFilesMetaData().empty());
+}
+
+TEST(DirectorySourceQueue, CompactSentSources) {
+  TemporaryDirectory tmpDir;
+  createTree(tmpDir.dir(), 1, 3);
+  TestQueue testQueue(tmpDir.dir());
+  DirectorySourceQueue &queue = testQueue.queue;
+  queue.setMaxQueuedSources(100);
+  std::thread discoveryThread = queue.buildQueueAsynchronously();
+  ThreadCtx threadCtx(testQueue.options, true);
+  vector<pair<string, DirectorySourceQueue::CompactSource>> sent;
+  while (true) {
+    ErrorCode status;
+    auto source = queue.getNextSource(&threadCtx, status);
+    if (!source) {
+      break;
+    }
+    TransferStats stats;
+    stats.incrNumBlocks();
+    stats.addEffectiveBytes(10, source->getSize());
+    source->addTransferStats(stats);
+    source->close();
+    queue.releaseSource(*source);
+    const string relPath = source->getIdentifier();
+    DirectorySourceQueue::CompactSource compact;
+    ASSERT_TRUE(queue.compactSource(source, false, compact));
+    EXPECT_EQ(nullptr, source);
+    EXPECT_EQ(relPath, queue.getRelPath(compact));
+    sent.emplace_back(relPath, std::move(compact));
+  }
+  discoveryThread.join();
+  EXPECT_EQ(12, sent.size());
+  for (auto &entry : sent) {
+    auto source = queue.rebuildSource(entry.second);
+    EXPECT_EQ(entry.first, source->getIdentifier());
+    EXPECT_EQ(entry.second.seqId, source->getMetaData().seqId);
+    EXPECT_EQ(10, source->getTransferStats().getEffectiveHeaderBytes());
+    // every file holds its own full path
+    const string fullPath = tmpDir.dir() + "/" + entry.first;
+    ASSERT_EQ(OK, source->open(&threadCtx));
+    int64_t size;
+    const char *data = source->read(size);
+    ASSERT_NE(nullptr, data);
+    EXPECT_EQ(fullPath, string(data, size));
+    source->close();
+  }
+}
+
+TEST(DirectorySourceQueue, IncrementalSync) {
+  TemporaryDirectory tmpDir;
+  createTree(tmpDir.dir(), 1, 4);
+  TestQueue testQueue(tmpDir.dir());
+  DirectorySourceQueue &queue = testQueue.queue;
+  queue.setIncrementalSync(true);
+  queue.enableFileDeletion();
+  EXPECT_TRUE(queue.buildQueueSynchronously());
+  // the receiver has all the files
+  vector<FileChunksInfo> received;
+  for (SourceMetaData *metadata : queue.getDiscoveredFilesMetaData()) {
+    EXPECT_GE(metadata->mtimeNs, 0);
+    string relPath = metadata->getRelPath();
+    FileChunksInfo chunkInfo(received.size(), relPath, metadata->size);
+    chunkInfo.setMtimeNs(metadata->mtimeNs);
+    chunkInfo.addChunk(Interval(0, metadata->size));
+    received.emplace_back(std::move(chunkInfo));
+  }
+  ASSERT_EQ(20, received.size());
+  // modified on the sender side since
+  const string changedFile = received[0].getFileName();
+  received[0].setMtimeNs(received[0].getMtimeNs() - 1);
+  // no mtime reported, compared by size
+  received[1].setMtimeNs(-1);
+  // extra file
+  string extraFile = "extra";
+  FileChunksInfo extraInfo(received.size(), extraFile, 10);
+  extraInfo.addChunk(Interval(0, 10));
+  received.emplace_back(std::move(extraInfo));
+  queue.setPreviouslyReceivedChunks(received);
+
+  ThreadCtx threadCtx(testQueue.options, false);
+  ErrorCode status;
+  auto source = queue.getNextSource(&threadCtx, status);
+  ASSERT_NE(nullptr, source);
+  EXPECT_EQ(extraFile, source->getMetaData().getRelPath());
+  EXPECT_EQ(TO_BE_DELETED, source->getMetaData().allocationStatus);
+  source = queue.getNextSource(&threadCtx, status);
+  ASSERT_NE(nullptr, source);
+  // sent whole over the copy of the receiver
+  EXPECT_EQ(changedFile, source->getMetaData().getRelPath());
+  EXPECT_EQ(EXISTS_CORRECT_SIZE, source->getMetaData().allocationStatus);
+  EXPECT_EQ(0, source->getOffset());
+  EXPECT_EQ(source->getMetaData().size, source->getSize());
+  EXPECT_EQ(nullptr, queue.getNextSource(&threadCtx, status));
+}
+
+TEST(DirectorySourceQueue, AdaptiveBlockSizes) {
+  TemporaryDirectory tmpDir;
+  const int64_t kKb = 1024;
+  const int64_t bigSize = 8 * 1024 * kKb;
+  const int64_t smallSize = 10 * kKb;
+  for (const auto &file : {make_pair("small", smallSize),
+                           make_pair("big", bigSize)}) {
+    createFile(tmpDir.dir() + "/" + file.first, file.second);
+  }
+  TestQueue testQueue(tmpDir.dir());
+  DirectorySourceQueue &queue = testQueue.queue;
+  queue.setNumClientThreads(4);
+  queue.setBlockSizeMbytes(16);
+  queue.setAdaptiveBlockSizes(64 * kKb, 1024 * kKb);
+  queue.setFileInfo({WdtFileInfo("small", -1, false),
+                     WdtFileInfo("big", -1, false)});
+  EXPECT_TRUE(queue.buildQueueSynchronously());
+
+  ThreadCtx threadCtx(testQueue.options, false);
+  ErrorCode status;
+  int64_t numSources = 0;
+  std::vector<int64_t> bigBlockSizes;
+  std::map<int64_t, int64_t> bigBlocks;
+  while (auto source = queue.getNextSource(&threadCtx, status)) {
+    ++numSources;
+    if (source->getIdentifier() == "small") {
+      EXPECT_EQ(smallSize, source->getSize());
+      continue;
+    }
+    bigBlockSizes.push_back(source->getSize());
+    EXPECT_GE(source->getSize(), 64 * kKb);
+    EXPECT_EQ(0, source->getSize() % kDiskBlockSize);
+    bigBlocks[source->getOffset()] = source->getSize();
+  }
+  EXPECT_EQ(OK, status);
+  // the blocks cover the file
+  int64_t nextBigOffset = 0;
+  for (const auto &block : bigBlocks) {
+    EXPECT_EQ(nextBigOffset, block.first);
+    nextBigOffset += block.second;
+  }
+  EXPECT_EQ(bigSize, nextBigOffset);
+  // 16 even blocks for 4 blocks per thread of the bytes discovered, the
+  // last ones are cut down to spread the end over the threads
+  EXPECT_EQ(512 * kKb, bigBlockSizes.front());
+  EXPECT_LT(bigBlockSizes.back(), 512 * kKb);
+  EXPECT_EQ(numSources, queue.getNumBlocksAndStatus().first);
+  const BlockSizingStats stats = queue.getBlockSizingStats();
+  EXPECT_TRUE(stats.adaptive);
+  EXPECT_EQ(64 * kKb, stats.minBlockSize);
+  EXPECT_EQ(512 * kKb, stats.maxBlockSize);
+  EXPECT_EQ(numSources - 17, stats.numTailSplits);
+  EXPECT_GT(stats.numTailSplits, 0);
+  EXPECT_GE(stats.minTailBlockSize, 64 * kKb);
+}
+
+TEST(DirectorySourceQueue, ConcurrentCuts) {
+  TemporaryDirectory tmpDir;
+  const int64_t kKb = 1024;
+  const int numFiles = 8;
+  for (int i = 0; i < numFiles; i++) {
+    createFile(tmpDir.dir() + "/file" + to_string(i), (i + 1) * 1024 * kKb);
+  }
+  for (int64_t segmentSize : {int64_t(0), 64 * kKb}) {
+    TestQueue testQueue(tmpDir.dir());
+    DirectorySourceQueue &queue = testQueue.queue;
+    const int numThreads = 4;
+    queue.setNumClientThreads(numThreads);
+    queue.setBlockSizeMbytes(16);
+    queue.setAdaptiveBlockSizes(64 * kKb, 1024 * kKb);
+    queue.setBlockSegmentSize(segmentSize);
+    EXPECT_TRUE(queue.buildQueueSynchronously());
+    // sources are popped without the lock, a thread seeing the end must see
+    // the final number of blocks
+    std::atomic<int64_t> numSources{0};
+    std::atomic<int64_t> numBytes{0};
+    std::vector<int64_t> numBlocksAtEnd(numThreads);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < numThreads; t++) {
+      threads.emplace_back([&, t] {
+        ThreadCtx threadCtx(testQueue.options, false, t);
+        ErrorCode status;
+        while (auto source = queue.getNextSource(&threadCtx, status)) {
+          ++numSources;
+          numBytes += source->getSize();
+        }
+        numBlocksAtEnd[t] = queue.getNumBlocksAndStatus().first;
+      });
+    }
+    for (auto &thread : threads) {
+      thread.join();
+    }
+    EXPECT_EQ(36 * 1024 * kKb, numBytes.load()) << segmentSize;
+    const BlockSizingStats stats = queue.getBlockSizingStats();
+    EXPECT_GT(stats.numTailSplits, 0) << segmentSize;
+    EXPECT_EQ(segmentSize > 0, stats.numSegments > 0) << segmentSize;
+    for (int t = 0; t < numThreads; t++) {
+      EXPECT_EQ(numSources.load(), numBlocksAtEnd[t]) << segmentSize << t;
+    }
+  }
+}
+
+TEST(DirectorySourceQueue, StealBlockRests) {
+  TemporaryDirectory tmpDir;
+  const int64_t kKb = 1024;
+  const int64_t fileSize = 1024 * kKb;
+  const int64_t segmentSize = 64 * kKb;
+  for (const string name : {"a", "b"}) {
+    createFile(tmpDir.dir() + "/" + name, fileSize);
+  }
+  TestQueue testQueue(tmpDir.dir());
+  DirectorySourceQueue &queue = testQueue.queue;
+  queue.setNumClientThreads(2);
+  queue.setBlockSizeMbytes(16);
+  queue.setBlockSegmentSize(segmentSize);
+  queue.setFileInfo(
+      {WdtFileInfo("a", -1, false), WdtFileInfo("b", -1, false)});
+  EXPECT_TRUE(queue.buildQueueSynchronously());
+
+  ThreadCtx stoppingThreadCtx(testQueue.options, false, 0);
+  ErrorCode status;
+  std::map<string, std::map<int64_t, int64_t>> blocks;
+  {
+    // a thread stopping after its first segment gives the rest back
+    auto source = queue.getNextSource(&stoppingThreadCtx, status);
+    ASSERT_TRUE(source != nullptr);
+    EXPECT_EQ(segmentSize, source->getSize());
+    blocks[source->getIdentifier()][source->getOffset()] = source->getSize();
+    queue.returnBlockRest(&stoppingThreadCtx);
+  }
+  // the threads take turns, the idle one taking over the rest of the other
+  ThreadCtx threadCtx1(testQueue.options, false, 0);
+  ThreadCtx threadCtx2(testQueue.options, false, 1);
+  ThreadCtx *threadCtxs[] = {&threadCtx1, &threadCtx2};
+  bool done[] = {false, false};
+  int64_t numBlocksSent = -1;
+  for (int i = 0; !done[0] || !done[1]; i = 1 - i) {
+    if (done[i]) {
+      continue;
+    }
+    auto source = queue.getNextSource(threadCtxs[i], status);
+    if (!source) {
+      // the number of blocks is final once a thread has nothing to send
+      done[i] = true;
+      EXPECT_TRUE(queue.finished());
+      if (numBlocksSent < 0) {
+        numBlocksSent = queue.getNumBlocksAndStatus().first;
+      }
+      continue;
+    }
+    EXPECT_LT(source->getSize(), 2 * segmentSize);
+    EXPECT_EQ(0, source->getSize() % kDiskBlockSize);
+    blocks[source->getIdentifier()][source->getOffset()] = source->getSize();
+  }
+  EXPECT_EQ(OK, status);
+  // the blocks cover the files
+  int64_t numBlocks = 0;
+  for (const auto &file : blocks) {
+    int64_t nextOffset = 0;
+    for (const auto &block : file.second) {
+      EXPECT_EQ(nextOffset, block.first);
+      nextOffset += block.second;
+      ++numBlocks;
+    }
+    EXPECT_EQ(fileSize, nextOffset);
+  }
+  EXPECT_EQ(numBlocks, numBlocksSent);
+  EXPECT_EQ(numBlocks, queue.getNumBlocksAndStatus().first);
+  const BlockSizingStats stats = queue.getBlockSizingStats();
+  EXPECT_FALSE(stats.adaptive);
+  EXPECT_TRUE(stats.segmented);
+  EXPECT_EQ(numBlocks - 2, stats.numSegments);
+  EXPECT_GT(stats.numStolenRests, 0);
+  EXPECT_TRUE(queue.getFailedSourceStats().empty());
+}
+}
+}  // namespaces
+
+int main(int argc, char *argv[]) {
+  FLAGS_logtostderr = true;
+  testing::InitGoogleTest(&argc, argv);
+  GFLAGS_NAMESPACE::ParseCommandLineFlags(&argc, &argv, true);
+  google::InitGoogleLogging(argv[0]);
+  int ret = RUN_ALL_TESTS();
+  return ret;
+}
@@ -0,0 +1,195 @@
+/**
+ * Copyright (c) 2014-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+#include <wdt/test/TestCommon.h>
+#include <wdt/util/DirectoryWatcher.h>
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <gtest/gtest.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <cstdio>
+#include <map>
+
+using namespace std;
+
+namespace facebook {
+namespace wdt {
+
+namespace {
+void writeFile(const string &path, const string &content, const char *mode) {
+  FILE *f = fopen(path.c_str(), mode);
+  ASSERT_NE(nullptr, f);
+  fputs(content.c_str(), f);
+  fclose(f);
+}
+
+/// changes of the next transfer: size sent and chunk the receiver has, -1
+/// for a file only to be deleted or not on the receiver side
+struct Change {
+  int64_t size{-1};
+  int64_t receivedSize{-1};
+  bool operator==(const Change &that) const {
+    return size == that.size && receivedSize == that.receivedSize;
+  }
+};
+
+map<string, Change> takeChanges(DirectoryWatcher &watcher) {
+  vector<WdtFileInfo> fileInfo;
+  vector<FileChunksInfo> receivedChunks;
+  watcher.takeChanges(fileInfo, receivedChunks);
+  map<string, Change> changes;
+  for (const auto &info : fileInfo) {
+    changes[info.fileName].size = info.fileSize;
+  }
+  for (const auto &chunksInfo : receivedChunks) {
+    Change &change = changes[chunksInfo.getFileName()];
+    EXPECT_LE(chunksInfo.getChunks().size(), 1);
+    change.receivedSize = chunksInfo.getChunks().empty()
+                              ? 0
+                              : chunksInfo.getChunks()[0].end_;
+  }
+  return changes;
+}
+
+Change change(int64_t size, int64_t receivedSize) {
+  Change res;
+  res.size = size;
+  res.receivedSize = receivedSize;
+  return res;
+}
+
+/// waits till the events of the changes made are read
+void waitForChanges(DirectoryWatcher &watcher) {
+  for (int i = 0; i < 10 && !watcher.hasChanges(); i++) {
+    ASSERT_TRUE(watcher.waitForChanges(100));
+  }
+  // events of the same change may come in several reads
+  ASSERT_TRUE(watcher.waitForChanges(50));
+}
+}
+
+TEST(DirectoryWatcher, AppendsAndReplacements) {
+  TemporaryDirectory tmpDir;
+  const string dir = tmpDir.dir() + "/";
+  writeFile(dir + "log", "0123", "w");
+  writeFile(dir + "rewritten", "abcd", "w");
+  writeFile(dir + "deleted", "abcd", "w");
+  writeFile(dir + "renamed", "abcd", "w");
+  WdtOptions options;
+  DirectoryWatcher watcher(dir, options);
+  ASSERT_TRUE(watcher.start());
+  EXPECT_EQ(1, watcher.getNumWatches());
+  // the whole tree is sent first
+  auto changes = takeChanges(watcher);
+  EXPECT_EQ(4, changes.size());
+  EXPECT_EQ(change(4, -1), changes["log"]);
+  watcher.endTransfer(true);
+  EXPECT_EQ(4, watcher.getNumFiles());
+  EXPECT_FALSE(watcher.hasChanges());
+
+  writeFile(dir + "log", "4567", "a");
+  // same size, another mtime
+  writeFile(dir + "rewritten", "efgh", "w");
+  struct timeval times[2] = {{1000, 0}, {1000, 0}};
+  ASSERT_EQ(0, utimes((dir + "rewritten").c_str(), times));
+  ASSERT_EQ(0, unlink((dir + "deleted").c_str()));
+  ASSERT_EQ(0, rename((dir + "renamed").c_str(), (dir + "new").c_str()));
+  waitForChanges(watcher);
+  changes = takeChanges(watcher);
+  EXPECT_EQ(5, changes.size());
+  // only the appended bytes are sent
+  EXPECT_EQ(change(8, 4), changes["log"]);
+  EXPECT_EQ(change(4, 0), changes["rewritten"]);
+  EXPECT_EQ(change(-1, 0), changes["deleted"]);
+  EXPECT_EQ(change(-1, 0), changes["renamed"]);
+  EXPECT_EQ(change(4, -1), changes["new"]);
+
+  // a failed transfer is taken again by the next one
+  watcher.endTransfer(false);
+  EXPECT_TRUE(watcher.hasChanges());
+  EXPECT_EQ(changes, takeChanges(watcher));
+  watcher.endTransfer(true);
+  EXPECT_EQ(3, watcher.getNumFiles());
+
+  // touched without being written
+  writeFile(dir + "log", "", "a");
+  waitForChanges(watcher);
+  changes = takeChanges(watcher);
+  EXPECT_EQ(change(8, 8), changes["log"]);
+  watcher.endTransfer(true);
+
+  // truncated and rewritten longer, the start differs from what was sent
+  writeFile(dir + "log", "abcdefghij", "w");
+  waitForChanges(watcher);
+  changes = takeChanges(watcher);
+  EXPECT_EQ(change(10, 0), changes["log"]);
+  watcher.endTransfer(true);
+  writeFile(dir + "log", "kl", "a");
+  waitForChanges(watcher);
+  changes = takeChanges(watcher);
+  EXPECT_EQ(change(12, 10), changes["log"]);
+  watcher.endTransfer(true);
+}
+
+TEST(DirectoryWatcher, Directories) {
+  TemporaryDirectory tmpDir;
+  const string dir = tmpDir.dir() + "/";
+  ASSERT_EQ(0, mkdir((dir + "a").c_str(), 0755));
+  ASSERT_EQ(0, mkdir((dir + "pruned").c_str(), 0755));
+  writeFile(dir + "a/file", "0123", "w");
+  writeFile(dir + "a/excluded", "0123", "w");
+  writeFile(dir + "pruned/file", "0123", "w");
+  WdtOptions options;
+  options.exclude_regex = ".*excluded";
+  options.prune_dir_regex = "pruned/";
+  DirectoryWatcher watcher(dir, options);
+  ASSERT_TRUE(watcher.start());
+  EXPECT_EQ(2, watcher.getNumWatches());
+  auto changes = takeChanges(watcher);
+  EXPECT_EQ(1, changes.size());
+  EXPECT_EQ(change(4, -1), changes["a/file"]);
+  watcher.endTransfer(true);
+
+  // new directories are watched
+  ASSERT_EQ(0, mkdir((dir + "b").c_str(), 0755));
+  ASSERT_TRUE(watcher.waitForChanges(1000));
+  EXPECT_EQ(3, watcher.getNumWatches());
+  writeFile(dir + "b/file", "0123", "w");
+  writeFile(dir + "pruned/new", "0123", "w");
+  waitForChanges(watcher);
+  changes = takeChanges(watcher);
+  EXPECT_EQ(1, changes.size());
+  EXPECT_EQ(change(4, -1), changes["b/file"]);
+  watcher.endTransfer(true);
+
+  // a directory moved away takes its files with it, the tree is rescanned
+  ASSERT_EQ(0, rename((dir + "a").c_str(), (dir + "pruned/a").c_str()));
+  waitForChanges(watcher);
+  changes = takeChanges(watcher);
+  EXPECT_EQ(1, changes.size());
+  EXPECT_EQ(change(-1, 0), changes["a/file"]);
+  watcher.endTransfer(true);
+  EXPECT_EQ(1, watcher.getNumFiles());
+  // the watch of the moved directory is gone
+  writeFile(dir + "pruned/a/file", "4567", "a");
+  ASSERT_TRUE(watcher.waitForChanges(100));
+  EXPECT_FALSE(watcher.hasChanges());
+}
+}
+}  // namespaces
+
+int main(int argc, char *argv[]) {
+  FLAGS_logtostderr = true;
+  testing::InitGoogleTest(&argc, argv);
+  GFLAGS_NAMESPACE::ParseCommandLineFlags(&argc, &argv, true);
+  google::InitGoogleLogging(argv[0]);
+  int ret = RUN_ALL_TESTS();
+  return ret;
+}
@@ -0,0 +1,107 @@
+/**
+ * Copyright (c) 2014-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+#include <map>
+#include <thread>
+#include <vector>
+
+#include <folly/Benchmark.h>
+#include <folly/SpinLock.h>
+
+#include <wdt/util/FileAllocationMap.h>
+
+DEFINE_int32(num_threads, 64, "number of threads");
+DEFINE_int32(blocks_per_file, 4, "number of blocks (lookups) per file");
+
+namespace facebook {
+namespace wdt {
+
+const int kNumFiles = 1000000;  // 1M
+
+template <typename... Args>
+void forkjoin(int numThreads, void (*f)(int, Args...), Args... args) {
+  if (numThreads < 1) {
+    numThreads = 1;
+  }
+  std::vector<std::thread> threads;
+  threads.reserve(numThreads);
+  for (int i = 0; i < numThreads; ++i) {
+    threads.emplace_back(std::thread(f, i, std::forward<Args>(args)...));
+  }
+  for (auto &t : threads) {
+    t.join();
+  }
+}
+
+/// @return   seq-id of the n-th block looked up by a thread, the blocks of a
+///           file are spread across threads like receiver connections
+int64_t getSeqId(int threadIndex, int n) {
+  return ((int64_t)n * FLAGS_num_threads + threadIndex) /
+         FLAGS_blocks_per_file;
+}
+
+/// what FileCreator used before: a single map under a single spin lock
+struct GlobalLockMap {
+  std::map<int64_t, int> fileStatusMap;
+  folly::SpinLock lock;
+};
+
+void runGlobalLockTest(int threadIndex, int lookups, GlobalLockMap *map) {
+  for (int n = 0; n < lookups; ++n) {
+    const int64_t seqId = getSeqId(threadIndex, n);
+    folly::SpinLockGuard guard(map->lock);
+    auto it = map->fileStatusMap.find(seqId);
+    if (it == map->fileStatusMap.end()) {
+      map->fileStatusMap.insert(std::make_pair(seqId, threadIndex));
+      // allocation is a no-op here
+      map->fileStatusMap[seqId] = FileAllocationMap::ALLOCATED;
+    }
+  }
+}
+
+void runShardedTest(int threadIndex, int lookups, FileAllocationMap *map) {
+  for (int n = 0; n < lookups; ++n) {
+    const int64_t seqId = getSeqId(threadIndex, n);
+    bool inserted;
+    FileAllocationMap::Entry *entry =
+        map->findOrInsert(seqId, threadIndex, inserted);
+    if (inserted) {
+      map->finishAllocation(seqId, entry, FileAllocationMap::ALLOCATED);
+    } else {
+      map->waitForAllocation(seqId, entry);
+    }
+  }
+}
+
+int getLookupsPerThread() {
+  return (int64_t)kNumFiles * FLAGS_blocks_per_file / FLAGS_num_threads;
+}
+
+BENCHMARK_MULTI(GlobalLockMap) {
+  GlobalLockMap map;
+  const int lookups = getLookupsPerThread();
+  forkjoin(FLAGS_num_threads, runGlobalLockTest, lookups, &map);
+  return lookups * FLAGS_num_threads;
+}
+
+BENCHMARK_RELATIVE_MULTI(ShardedMap) {
+  FileAllocationMap map;
+  const int lookups = getLookupsPerThread();
+  forkjoin(FLAGS_num_threads, runShardedTest, lookups, &map);
+  return lookups * FLAGS_num_threads;
+}
+}
+}
+
+int main(int argc, char **argv) {
+  FLAGS_logtostderr = true;
+  GFLAGS_NAMESPACE::ParseCommandLineFlags(&argc, &argv, true);
+  google::InitGoogleLogging(argv[0]);
+  folly::runBenchmarks();
+  return 0;
+}
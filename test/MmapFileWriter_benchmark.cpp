@@ -0,0 +1,123 @@
+/**
+ * Copyright (c) 2014-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+#include <string.h>
+#include <unistd.h>
+#include <memory>
+#include <vector>
+
+#include <folly/Benchmark.h>
+#include <folly/Conv.h>
+
+#include <wdt/util/FileCreator.h>
+#include <wdt/util/FileWriter.h>
+#include <wdt/util/MmapFileWriter.h>
+#include <wdt/util/TransferLogManager.h>
+
+DEFINE_string(bench_dir, "/dev/shm",
+              "directory of the written files, tmpfs or a page cache backed "
+              "filesystem");
+DEFINE_int32(file_size_mb, 64, "size of each written file");
+DEFINE_int32(chunk_size_kb, 256, "size of each socket read being simulated");
+
+namespace facebook {
+namespace wdt {
+
+/// writes files through one writer type, the socket read is a memcpy
+class WriterBench {
+ public:
+  WriterBench()
+      : options_(WdtOptions::getMutable()),
+        transferLogManager_(options_, FLAGS_bench_dir),
+        fileCreator_(FLAGS_bench_dir, transferLogManager_, false),
+        threadCtx_(options_, false),
+        source_(FLAGS_chunk_size_kb * 1024, 'w'),
+        buffer_(source_.size()) {
+    options_.disk_sync_interval_mb = -1;
+    options_.skip_fadvise = true;
+    options_.fsync = false;
+    options_.mmap_direct_receive = true;
+  }
+
+  /// @return   bytes written
+  template <typename WriterType>
+  int64_t writeFile(bool directReceive) {
+    BlockDetails blockDetails;
+    blockDetails.fileName = folly::to<std::string>("mmap_bench_", ++seqId_);
+    blockDetails.seqId = seqId_;
+    blockDetails.fileSize = FLAGS_file_size_mb * (int64_t)kMbToB;
+    blockDetails.dataSize = blockDetails.fileSize;
+    WriterType writer(threadCtx_, &blockDetails, &fileCreator_);
+    WDT_CHECK_EQ(OK, writer.open());
+    while (writer.getTotalWritten() < blockDetails.dataSize) {
+      const int64_t size =
+          std::min<int64_t>(source_.size(),
+                            blockDetails.dataSize - writer.getTotalWritten());
+      int64_t available = 0;
+      char *dest = directReceive ? writer.getWriteBuffer(available) : nullptr;
+      if (dest != nullptr) {
+        memcpy(dest, source_.data(), size);
+        WDT_CHECK_EQ(OK, writer.commitWriteBuffer(size));
+      } else {
+        memcpy(buffer_.data(), source_.data(), size);
+        WDT_CHECK_EQ(OK, writer.write(buffer_.data(), size));
+      }
+    }
+    WDT_CHECK_EQ(OK, writer.sync());
+    WDT_CHECK_EQ(OK, writer.close());
+    folly::BenchmarkSuspender suspender;
+    ::unlink((FLAGS_bench_dir + "/" + blockDetails.fileName).c_str());
+    return blockDetails.dataSize;
+  }
+
+ private:
+  WdtOptions &options_;
+  TransferLogManager transferLogManager_;
+  FileCreator fileCreator_;
+  ThreadCtx threadCtx_;
+  std::vector<char> source_;
+  std::vector<char> buffer_;
+  int64_t seqId_{0};
+};
+
+BENCHMARK_MULTI(FileWriter, n) {
+  WriterBench bench;
+  int64_t mbWritten = 0;
+  for (unsigned int i = 0; i < n; i++) {
+    mbWritten += bench.writeFile<FileWriter>(false) / (int64_t)kMbToB;
+  }
+  return mbWritten;
+}
+
+BENCHMARK_RELATIVE_MULTI(MmapFileWriter, n) {
+  WriterBench bench;
+  int64_t mbWritten = 0;
+  for (unsigned int i = 0; i < n; i++) {
+    mbWritten += bench.writeFile<MmapFileWriter>(false) / (int64_t)kMbToB;
+  }
+  return mbWritten;
+}
+
+BENCHMARK_RELATIVE_MULTI(MmapFileWriterDirectReceive, n) {
+  WriterBench bench;
+  int64_t mbWritten = 0;
+  for (unsigned int i = 0; i < n; i++) {
+    mbWritten += bench.writeFile<MmapFileWriter>(true) / (int64_t)kMbToB;
+  }
+  return mbWritten;
+}
+}
+}
+
+int main(int argc, char **argv) {
+  FLAGS_logtostderr = true;
+  GFLAGS_NAMESPACE::ParseCommandLineFlags(&argc, &argv, true);
+  google::InitGoogleLogging(argv[0]);
+  folly::runBenchmarks();
+  return 0;
+}
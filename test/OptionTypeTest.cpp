@@ -59,6 +59,7 @@ TEST(OptionType, FlashOptionTypeTest1) {
   WdtFlags::initializeFromFlags(options);
   EXPECT_EQ(8, options.num_ports);
   EXPECT_EQ(16, options.block_size_mbytes);
+  EXPECT_FALSE(options.order_by_physical_offset);
 }
 
 TEST(OptionType, FlashOptionTypeTest2) {
@@ -75,6 +76,7 @@ TEST(OptionType, DiskOptionTypeTest1) {
   WdtFlags::initializeFromFlags(options);
   EXPECT_EQ(3, options.num_ports);
   EXPECT_EQ(-1, options.block_size_mbytes);
+  EXPECT_TRUE(options.order_by_physical_offset);
 }
 
 TEST(OptionType, DiskOptionTypeTest2) {
@@ -0,0 +1,123 @@
+/**
+ * Copyright (c) 2014-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+#include <wdt/util/PathMatcher.h>
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <gtest/gtest.h>
+#include <random>
+
+using namespace std;
+
+namespace facebook {
+namespace wdt {
+
+/// fixed paths plus random short ones over a small alphabet
+vector<string> testPaths() {
+  vector<string> paths = {"",           "a",          "ab",
+                          "abc",        "aab",        "aaab",
+                          "x.sst",      "dir1/x.sst", "dir12/y",
+                          "dir/y",      "a\nb.sst",   "file1.log",
+                          "d/file1.log", "d/file2.log", "xyzyz",
+                          "abc_1.23",   "A b",        "A\tb",
+                          "--cab",      "aXbYc",      "b"};
+  mt19937 rng(1);
+  const string alphabet = "abcxyz/._-0123\n";
+  for (int i = 0; i < 3000; i++) {
+    string path;
+    const int size = rng() % 10;
+    for (int j = 0; j < size; j++) {
+      path.push_back(alphabet[rng() % alphabet.size()]);
+    }
+    paths.push_back(path);
+  }
+  return paths;
+}
+
+TEST(PathMatcher, SameMatchesAsRegex) {
+  const vector<string> patterns = {
+      ".*\\.sst",     "dir[0-9]+/.*",     "(a|b)*c",       "a{2,3}b?",
+      "^abc$",        "[^/]*",            ".*/file[13]\\.log",
+      "(?:x|yz){1,3}", "\\w+\\.\\d{2}",   "[a-c-]*",       "a.*b.*c",
+      "(a*)*b",       "\\x41\\s\\S",      ".*(\\.sst|\\.log)", "[\\d_]+"};
+  const vector<string> paths = testPaths();
+  for (const auto &pattern : patterns) {
+    PathMatcher matcher(pattern);
+    EXPECT_EQ(PathMatcher::DFA, matcher.getMode()) << pattern;
+    const regex re(pattern);
+    for (const auto &path : paths) {
+      EXPECT_EQ(regex_match(path, re), matcher.matches(path))
+          << pattern << " " << path;
+    }
+  }
+}
+
+TEST(PathMatcher, RegexFallback) {
+  const vector<string> patterns = {"a\\b", "(?=a)a", "(a)\\1", "[[:alpha:]]+",
+                                   ".*a.{20}"};
+  const vector<string> paths = testPaths();
+  for (const auto &pattern : patterns) {
+    PathMatcher matcher(pattern);
+    EXPECT_EQ(PathMatcher::REGEX, matcher.getMode()) << pattern;
+    const regex re(pattern);
+    for (const auto &path : paths) {
+      EXPECT_EQ(regex_match(path, re), matcher.matches(path))
+          << pattern << " " << path;
+    }
+  }
+  EXPECT_THROW(PathMatcher("a("), regex_error);
+}
+
+TEST(PathMatcher, Globs) {
+  struct GlobTest {
+    string glob;
+    PathMatcher::Mode mode;
+    vector<string> matching;
+    vector<string> notMatching;
+  };
+  const vector<GlobTest> tests = {
+      {"*.sst", PathMatcher::SUFFIX, {".sst", "a/b.sst"}, {"a.ssts", "sst"}},
+      {"dir*", PathMatcher::PREFIX, {"dir", "dir1/a"}, {"di", "a/dir"}},
+      {"*tmp*", PathMatcher::CONTAINS, {"tmp", "a/tmp/b"}, {"tm/p"}},
+      {"a\\*b", PathMatcher::EXACT, {"a*b"}, {"ab", "axb"}},
+      {"*/file?.log", PathMatcher::DFA, {"a/file1.log"}, {"file1.log"}},
+      {"[!a]*", PathMatcher::DFA, {"b", "ba"}, {"", "ab"}},
+      {"*[a-c]z", PathMatcher::DFA, {"az", "x/cz"}, {"dz", "z"}},
+      {"[]a]x", PathMatcher::DFA, {"]x", "ax"}, {"x"}},
+      {"[abc", PathMatcher::DFA, {"[abc"}, {"a"}},
+  };
+  for (const auto &test : tests) {
+    PathMatcher matcher(PathMatcher::kGlobPrefix + test.glob);
+    EXPECT_EQ(test.mode, matcher.getMode()) << test.glob;
+    for (const auto &path : test.matching) {
+      EXPECT_TRUE(matcher.matches(path)) << test.glob << " " << path;
+    }
+    for (const auto &path : test.notMatching) {
+      EXPECT_FALSE(matcher.matches(path)) << test.glob << " " << path;
+    }
+  }
+}
+
+TEST(PathMatcher, Empty) {
+  PathMatcher matcher("");
+  EXPECT_TRUE(matcher.empty());
+  EXPECT_FALSE(matcher.matches(""));
+  EXPECT_FALSE(matcher.matches("a"));
+}
+}
+}  // namespaces
+
+int main(int argc, char *argv[]) {
+  FLAGS_logtostderr = true;
+  testing::InitGoogleTest(&argc, argv);
+  GFLAGS_NAMESPACE::ParseCommandLineFlags(&argc, &argv, true);
+  google::InitGoogleLogging(argv[0]);
+  int ret = RUN_ALL_TESTS();
+  return ret;
+}
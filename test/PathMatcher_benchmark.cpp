@@ -0,0 +1,93 @@
+/**
+ * Copyright (c) 2014-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+#include <regex>
+#include <string>
+#include <vector>
+
+#include <folly/Benchmark.h>
+#include <folly/Conv.h>
+
+#include <wdt/util/PathMatcher.h>
+
+namespace facebook {
+namespace wdt {
+
+const int kNumPaths = 1000000;  // 1M
+
+/// paths of a tree of databases, a tenth of the files are sst files
+const std::vector<std::string> &getPaths() {
+  static std::vector<std::string> paths;
+  if (paths.empty()) {
+    folly::BenchmarkSuspender suspender;
+    paths.reserve(kNumPaths);
+    for (int i = 0; i < kNumPaths; i++) {
+      paths.push_back(folly::to<std::string>(
+          "shard", i % 97, "/db", i % 13, "/", (i % 10 ? "MANIFEST-" : ""),
+          100000 + i, (i % 10 ? "" : ".sst")));
+    }
+  }
+  return paths;
+}
+
+unsigned int runRegex(const std::string &pattern) {
+  const auto &paths = getPaths();
+  const std::regex regex(pattern);
+  int64_t numMatches = 0;
+  for (const auto &path : paths) {
+    numMatches += std::regex_match(path, regex);
+  }
+  folly::doNotOptimizeAway(numMatches);
+  return paths.size();
+}
+
+unsigned int runMatcher(const std::string &pattern) {
+  const auto &paths = getPaths();
+  const PathMatcher matcher(pattern);
+  int64_t numMatches = 0;
+  for (const auto &path : paths) {
+    numMatches += matcher.matches(path);
+  }
+  folly::doNotOptimizeAway(numMatches);
+  return paths.size();
+}
+
+const std::string kSuffixRegex = ".*\\.sst";
+const std::string kComplexRegex = "shard[0-9]+/db(1|3|5)/(MANIFEST-)?1[0-9]+";
+
+BENCHMARK_MULTI(SuffixStdRegex) {
+  return runRegex(kSuffixRegex);
+}
+
+BENCHMARK_RELATIVE_MULTI(SuffixDfa) {
+  return runMatcher(kSuffixRegex);
+}
+
+BENCHMARK_RELATIVE_MULTI(SuffixGlob) {
+  return runMatcher(PathMatcher::kGlobPrefix + "*.sst");
+}
+
+BENCHMARK_DRAW_LINE();
+
+BENCHMARK_MULTI(ComplexStdRegex) {
+  return runRegex(kComplexRegex);
+}
+
+BENCHMARK_RELATIVE_MULTI(ComplexDfa) {
+  return runMatcher(kComplexRegex);
+}
+}
+}
+
+int main(int argc, char **argv) {
+  FLAGS_logtostderr = true;
+  GFLAGS_NAMESPACE::ParseCommandLineFlags(&argc, &argv, true);
+  google::InitGoogleLogging(argv[0]);
+  folly::runBenchmarks();
+  return 0;
+}
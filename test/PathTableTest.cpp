@@ -0,0 +1,102 @@
+/**
+ * Copyright (c) 2014-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+#include <wdt/util/PathTable.h>
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <gtest/gtest.h>
+#include <thread>
+
+using namespace std;
+
+namespace facebook {
+namespace wdt {
+
+TEST(PathTable, Trie) {
+  PathTable table;
+  table.setRootDir("/root/");
+  EXPECT_EQ("", table.getDirectoryPath(PathTable::kRootDirectory));
+  const int32_t dir1 = table.addDirectory(PathTable::kRootDirectory, "dir1");
+  const int32_t dir2 = table.addDirectory(dir1, "dir2");
+  EXPECT_EQ(dir1, table.addDirectory(PathTable::kRootDirectory, "dir1"));
+  EXPECT_NE(dir2, table.addDirectory(PathTable::kRootDirectory, "dir2"));
+  EXPECT_EQ("dir1/dir2/", table.getDirectoryPath(dir2));
+  const int64_t file1 = table.addFile(PathTable::kRootDirectory, "file1");
+  const int64_t file2 = table.addFile(dir2, "file2");
+  EXPECT_EQ("file1", table.getRelPath(file1));
+  EXPECT_EQ("dir1/dir2/file2", table.getRelPath(file2));
+  EXPECT_EQ("/root/dir1/dir2/file2", table.getFullPath(file2));
+  EXPECT_EQ(2, table.getNumFiles());
+  EXPECT_EQ(4, table.getNumDirectories());
+}
+
+TEST(PathTable, FilePaths) {
+  PathTable table;
+  const vector<string> paths = {"a/b/c", "a/b/d", "a/e", "f", "g//h", "/i",
+                                "", "j/"};
+  vector<int64_t> files;
+  for (const auto &path : paths) {
+    files.push_back(table.addFilePath(path));
+  }
+  for (size_t i = 0; i < paths.size(); i++) {
+    EXPECT_EQ(paths[i], table.getRelPath(files[i])) << i;
+  }
+  // a, a/b, g, g/, the empty directory of /i and j
+  EXPECT_EQ(7, table.getNumDirectories());
+  // the prefixes are shared
+  const int32_t dirB = table.addDirectory(
+      table.addDirectory(PathTable::kRootDirectory, "a"), "b");
+  EXPECT_EQ("a/b/x", table.getRelPath(table.addFile(dirB, "x")));
+  EXPECT_EQ(7, table.getNumDirectories());
+}
+
+TEST(PathTable, LongNames) {
+  PathTable table;
+  const string longName(200000, 'x');
+  const int32_t dir = table.addDirectory(PathTable::kRootDirectory, longName);
+  const int64_t file = table.addFile(dir, longName);
+  EXPECT_EQ(longName + "/" + longName, table.getRelPath(file));
+  EXPECT_GE(table.getNumBytes(), 2 * longName.size());
+}
+
+TEST(PathTable, ConcurrentAdds) {
+  const int numThreads = 8;
+  const int numFiles = 10000;
+  PathTable table;
+  vector<vector<int64_t>> files(numThreads);
+  vector<thread> threads;
+  for (int t = 0; t < numThreads; t++) {
+    threads.emplace_back([&table, &files, t] {
+      const int32_t dir =
+          table.addDirectory(PathTable::kRootDirectory, "dir" + to_string(t));
+      for (int i = 0; i < numFiles; i++) {
+        files[t].push_back(table.addFile(dir, "file" + to_string(i)));
+        // reads happen while other threads add
+        EXPECT_EQ("dir" + to_string(t) + "/file" + to_string(i),
+                  table.getRelPath(files[t].back()));
+      }
+    });
+  }
+  for (auto &t : threads) {
+    t.join();
+  }
+  EXPECT_EQ(numThreads * numFiles, table.getNumFiles());
+  EXPECT_EQ(numThreads + 1, table.getNumDirectories());
+}
+}
+}  // namespaces
+
+int main(int argc, char *argv[]) {
+  FLAGS_logtostderr = true;
+  testing::InitGoogleTest(&argc, argv);
+  GFLAGS_NAMESPACE::ParseCommandLineFlags(&argc, &argv, true);
+  google::InitGoogleLogging(argv[0]);
+  int ret = RUN_ALL_TESTS();
+  return ret;
+}
@@ -106,10 +106,12 @@ void testFileChunksInfo() {
 
   char buf[128];
   int64_t off = 0;
-  Protocol::encodeFileChunksInfo(buf, off, sizeof(buf), fileChunksInfo);
+  Protocol::encodeFileChunksInfo(Protocol::DOWNLOAD_RESUMPTION_VERSION, buf,
+                                 off, sizeof(buf), fileChunksInfo);
   FileChunksInfo nFileChunksInfo;
   folly::ByteRange br((uint8_t *)buf, sizeof(buf));
-  bool success = Protocol::decodeFileChunksInfo(br, nFileChunksInfo);
+  bool success = Protocol::decodeFileChunksInfo(
+      Protocol::DOWNLOAD_RESUMPTION_VERSION, br, nFileChunksInfo);
   EXPECT_TRUE(success);
   int64_t noff = br.start() - (uint8_t *)buf;
   EXPECT_EQ(noff, off);
@@ -117,14 +119,155 @@ void testFileChunksInfo() {
 
   // test with smaller buffer; exact size:
   br.reset((uint8_t *)buf, off);
-  success = Protocol::decodeFileChunksInfo(br, nFileChunksInfo);
+  success = Protocol::decodeFileChunksInfo(
+      Protocol::DOWNLOAD_RESUMPTION_VERSION, br, nFileChunksInfo);
   EXPECT_TRUE(success);
   // 1 byte missing :
   br.reset((uint8_t *)buf, off - 1);
-  success = Protocol::decodeFileChunksInfo(br, nFileChunksInfo);
+  success = Protocol::decodeFileChunksInfo(
+      Protocol::DOWNLOAD_RESUMPTION_VERSION, br, nFileChunksInfo);
   EXPECT_FALSE(success);
 }
 
+void testIncrementalSync() {
+  BlockDetails bd;
+  bd.fileName = "abc";
+  bd.seqId = 3;
+  bd.dataSize = 10;
+  bd.offset = 0;
+  bd.fileSize = 10;
+  bd.allocationStatus = EXISTS_TOO_SMALL;
+  bd.prevSeqId = 2;
+  bd.mtimeNs = 1500000000123456789LL;
+
+  char buf[128];
+  int64_t off = 0;
+  EXPECT_TRUE(Protocol::encodeHeader(Protocol::INCREMENTAL_SYNC_VERSION, buf,
+                                     off, sizeof(buf), bd));
+  BlockDetails nbd;
+  int64_t noff = 0;
+  EXPECT_TRUE(Protocol::decodeHeader(Protocol::INCREMENTAL_SYNC_VERSION, buf,
+                                     noff, off, nbd));
+  EXPECT_EQ(noff, off);
+  EXPECT_EQ(nbd.allocationStatus, bd.allocationStatus);
+  EXPECT_EQ(nbd.prevSeqId, bd.prevSeqId);
+  EXPECT_EQ(nbd.mtimeNs, bd.mtimeNs);
+  // mtime missing
+  noff = 0;
+  EXPECT_FALSE(Protocol::decodeHeader(Protocol::INCREMENTAL_SYNC_VERSION, buf,
+                                      noff, off - 1, nbd));
+
+  // not sent to older receivers
+  const int64_t newOff = off;
+  off = 0;
+  EXPECT_TRUE(Protocol::encodeHeader(Protocol::DELETE_FILES_VERSION, buf, off,
+                                     sizeof(buf), bd));
+  EXPECT_LT(off, newOff);
+  noff = 0;
+  EXPECT_TRUE(Protocol::decodeHeader(Protocol::DELETE_FILES_VERSION, buf, noff,
+                                     off, nbd));
+  EXPECT_EQ(noff, off);
+  EXPECT_EQ(nbd.allocationStatus, bd.allocationStatus);
+  EXPECT_EQ(nbd.mtimeNs, -1);
+
+  FileChunksInfo fileChunksInfo;
+  fileChunksInfo.setSeqId(10);
+  fileChunksInfo.setFileName("abc");
+  fileChunksInfo.setFileSize(128);
+  fileChunksInfo.setMtimeNs(bd.mtimeNs);
+  fileChunksInfo.addChunk(Interval(0, 128));
+  for (int64_t mtimeNs : {bd.mtimeNs, (int64_t)0, (int64_t)-1}) {
+    fileChunksInfo.setMtimeNs(mtimeNs);
+    off = 0;
+    EXPECT_TRUE(Protocol::encodeFileChunksInfo(
+        Protocol::INCREMENTAL_SYNC_VERSION, buf, off, sizeof(buf),
+        fileChunksInfo));
+    EXPECT_LE(off, Protocol::maxEncodeLen(fileChunksInfo));
+    FileChunksInfo nFileChunksInfo;
+    folly::ByteRange br((uint8_t *)buf, off);
+    EXPECT_TRUE(Protocol::decodeFileChunksInfo(
+        Protocol::INCREMENTAL_SYNC_VERSION, br, nFileChunksInfo));
+    EXPECT_TRUE(br.empty());
+    EXPECT_EQ(nFileChunksInfo, fileChunksInfo);
+  }
+  // older senders do not get the mtime
+  fileChunksInfo.setMtimeNs(bd.mtimeNs);
+  off = 0;
+  EXPECT_TRUE(Protocol::encodeFileChunksInfo(Protocol::DELETE_FILES_VERSION,
+                                             buf, off, sizeof(buf),
+                                             fileChunksInfo));
+  FileChunksInfo nFileChunksInfo;
+  folly::ByteRange br((uint8_t *)buf, off);
+  EXPECT_TRUE(Protocol::decodeFileChunksInfo(Protocol::DELETE_FILES_VERSION,
+                                             br, nFileChunksInfo));
+  EXPECT_TRUE(br.empty());
+  EXPECT_EQ(nFileChunksInfo.getMtimeNs(), -1);
+  EXPECT_EQ(nFileChunksInfo.getChunks(), fileChunksInfo.getChunks());
+}
+
+void testDirectories() {
+  std::vector<string> directories{"a/", "a/b/", "a/b/c/", "dir with space/"};
+
+  char buf[128];
+  int64_t off = 0;
+  EXPECT_TRUE(Protocol::encodeDirectories(buf, off, sizeof(buf), directories));
+  // 1 byte for count, 1 byte length for each name
+  EXPECT_EQ(off, 1 + (1 + 2) + (1 + 4) + (1 + 6) + (1 + 15));
+
+  std::vector<string> ndirectories;
+  int64_t noff = 0;
+  bool success = Protocol::decodeDirectories(buf, noff, off, ndirectories);
+  EXPECT_TRUE(success);
+  EXPECT_EQ(noff, off);
+  EXPECT_EQ(ndirectories, directories);
+
+  // 1 byte missing :
+  noff = 0;
+  success = Protocol::decodeDirectories(buf, noff, off - 1, ndirectories);
+  EXPECT_FALSE(success);
+
+  // not enough room to encode
+  off = 0;
+  EXPECT_FALSE(Protocol::encodeDirectories(buf, off, 10, directories));
+}
+
+void testDeleteFiles() {
+  std::vector<BlockDetails> files(3);
+  files[0].fileName = "a/b";
+  files[0].seqId = 3;
+  files[1].fileName = "file with space";
+  files[1].seqId = 300;
+  files[2].fileName = "c";
+  files[2].seqId = 0;
+
+  char buf[128];
+  int64_t off = 0;
+  EXPECT_TRUE(Protocol::encodeDeleteFiles(buf, off, sizeof(buf), files));
+  // 1 byte for count, seq-id varint and 1 byte length for each name
+  EXPECT_EQ(off, 1 + (1 + 1 + 3) + (2 + 1 + 15) + (1 + 1 + 1));
+
+  std::vector<BlockDetails> nfiles;
+  int64_t noff = 0;
+  bool success = Protocol::decodeDeleteFiles(buf, noff, off, nfiles);
+  EXPECT_TRUE(success);
+  EXPECT_EQ(noff, off);
+  EXPECT_EQ(nfiles.size(), files.size());
+  for (size_t i = 0; i < files.size() && i < nfiles.size(); i++) {
+    EXPECT_EQ(nfiles[i].fileName, files[i].fileName);
+    EXPECT_EQ(nfiles[i].seqId, files[i].seqId);
+    EXPECT_EQ(nfiles[i].allocationStatus, TO_BE_DELETED);
+  }
+
+  // 1 byte missing :
+  noff = 0;
+  success = Protocol::decodeDeleteFiles(buf, noff, off - 1, nfiles);
+  EXPECT_FALSE(success);
+
+  // not enough room to encode
+  off = 0;
+  EXPECT_FALSE(Protocol::encodeDeleteFiles(buf, off, 10, files));
+}
+
 void testSettings() {
   Settings settings;
   int senderProtocolVersion = Protocol::SETTINGS_FLAG_VERSION;
@@ -217,6 +360,13 @@ TEST(Protocol, Simple_Settings) {
 TEST(Protocol, FileChunksInfo) {
   testFileChunksInfo();
 }
+TEST(Protocol, IncrementalSync) {
+  testIncrementalSync();
+}
+TEST(Protocol, Directories) {
+  testDirectories();
+  testDeleteFiles();
+}
 }
 }  // namespaces
 
@@ -0,0 +1,103 @@
+/**
+ * Copyright (c) 2014-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+#include <wdt/util/ReceiveBufferSizer.h>
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <gtest/gtest.h>
+
+namespace facebook {
+namespace wdt {
+
+const int64_t kBaseSize = 256 * 1024;
+
+/// @return   size proposed after the given number of identical reads
+int64_t readTimes(ReceiveBufferSizer &sizer, int times, int64_t target,
+                  int64_t numRead) {
+  int64_t size = sizer.getSize();
+  for (int i = 0; i < times; i++) {
+    size = sizer.onRead(target, numRead);
+  }
+  return size;
+}
+
+TEST(ReceiveBufferSizer, DisabledByDefault) {
+  WdtOptions options;
+  ReceiveBufferSizer sizer(options, kBaseSize);
+  EXPECT_FALSE(sizer.isEnabled());
+  EXPECT_EQ(kBaseSize, readTimes(sizer, 100, kBaseSize, kBaseSize));
+}
+
+TEST(ReceiveBufferSizer, GrowsAndShrinksBack) {
+  WdtOptions options;
+  options.adaptive_buffer_max_size = 4 * kBaseSize;
+  PerfStatReport perfReport(options);
+  ReceiveBufferSizer sizer(options, kBaseSize);
+  // reads limited by the end of the block do not count
+  EXPECT_EQ(kBaseSize, readTimes(sizer, 100, 1000, 1000));
+  const int64_t grownSize = readTimes(sizer, 100, kBaseSize, kBaseSize);
+  EXPECT_EQ(2 * kBaseSize, grownSize);
+  sizer.setSize(grownSize, perfReport);
+  sizer.setSize(readTimes(sizer, 100, grownSize, grownSize), perfReport);
+  EXPECT_EQ(4 * kBaseSize, sizer.getSize());
+  // capped to the maximum
+  EXPECT_EQ(4 * kBaseSize,
+            readTimes(sizer, 100, sizer.getSize(), sizer.getSize()));
+  // small reads go back towards the initial size only
+  sizer.setSize(readTimes(sizer, 100, sizer.getSize(), 1000), perfReport);
+  sizer.setSize(readTimes(sizer, 100, sizer.getSize(), 1000), perfReport);
+  EXPECT_EQ(kBaseSize, sizer.getSize());
+  EXPECT_EQ(kBaseSize, readTimes(sizer, 100, kBaseSize, 1000));
+}
+
+TEST(ReceiveBufferSizer, MemoryLimit) {
+  WdtOptions options;
+  options.adaptive_buffer_max_size = 4 * kBaseSize;
+  options.adaptive_buffer_min_size = kBaseSize / 4;
+  PerfStatReport perfReport(options);
+  const int64_t otherBytes = ReceiveBufferSizer::getTotalBufferBytes();
+  options.adaptive_buffer_memory_limit_mb =
+      (otherBytes + 2 * kBaseSize) / 1024 / 1024 + 1;
+  const int64_t limit = options.adaptive_buffer_memory_limit_mb * 1024 * 1024;
+  ReceiveBufferSizer sizer(options, kBaseSize);
+  // grows while the total stays under the limit
+  while (true) {
+    const int64_t size = readTimes(sizer, 100, sizer.getSize(),
+                                   sizer.getSize());
+    if (size == sizer.getSize()) {
+      break;
+    }
+    sizer.setSize(size, perfReport);
+  }
+  EXPECT_GT(sizer.getSize(), kBaseSize);
+  EXPECT_LE(ReceiveBufferSizer::getTotalBufferBytes(), limit);
+  {
+    // another connection pushes the total over the limit
+    ReceiveBufferSizer other(options, limit);
+    while (sizer.getSize() > kBaseSize / 4) {
+      const int64_t size = sizer.onRead(sizer.getSize(), sizer.getSize());
+      ASSERT_LT(size, sizer.getSize());
+      sizer.setSize(size, perfReport);
+    }
+    EXPECT_EQ(kBaseSize / 4, sizer.onRead(1000, 1000));
+  }
+  EXPECT_EQ(otherBytes + kBaseSize / 4,
+            ReceiveBufferSizer::getTotalBufferBytes());
+}
+}
+}  // namespaces
+
+int main(int argc, char *argv[]) {
+  FLAGS_logtostderr = true;
+  testing::InitGoogleTest(&argc, argv);
+  GFLAGS_NAMESPACE::ParseCommandLineFlags(&argc, &argv, true);
+  google::InitGoogleLogging(argv[0]);
+  int ret = RUN_ALL_TESTS();
+  return ret;
+}
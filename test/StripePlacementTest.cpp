@@ -0,0 +1,136 @@
+/**
+ * Copyright (c) 2014-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+#include <wdt/Wdt.h>
+#include <wdt/test/TestCommon.h>
+#include <wdt/util/StripePlacement.h>
+
+#include <folly/Conv.h>
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <gtest/gtest.h>
+#include <sys/stat.h>
+
+using namespace std;
+
+namespace facebook {
+namespace wdt {
+
+const int kNumStripes = 3;
+
+string stripeDir(const string &baseDir, int stripe) {
+  return folly::to<string>(baseDir, "/stripe", stripe);
+}
+
+/// @return   stripe_directories option for the stripes other than 0
+string stripeDirectories(const string &baseDir) {
+  string stripeDirs;
+  for (int i = 1; i < kNumStripes; i++) {
+    if (i > 1) {
+      stripeDirs.push_back(',');
+    }
+    stripeDirs += stripeDir(baseDir, i);
+  }
+  return stripeDirs;
+}
+
+TEST(StripePlacement, StableAndEven) {
+  TemporaryDirectory tmpDir;
+  WdtOptions options;
+  options.stripe_directories = stripeDirectories(tmpDir.dir());
+  StripePlacement placement(stripeDir(tmpDir.dir(), 0), options);
+  StripePlacement otherPlacement(stripeDir(tmpDir.dir(), 0), options);
+  ASSERT_EQ(kNumStripes, placement.getNumStripes());
+  EXPECT_EQ(stripeDir(tmpDir.dir(), 2) + "/", placement.getStripeDir(2));
+  const int numFiles = 3000;
+  vector<int> numFilesPerStripe(kNumStripes, 0);
+  for (int i = 0; i < numFiles; i++) {
+    const string path = folly::to<string>("dir", i % 7, "/file", i);
+    const int stripe = placement.getStripe(path);
+    ASSERT_GE(stripe, 0);
+    ASSERT_LT(stripe, kNumStripes);
+    EXPECT_EQ(stripe, otherPlacement.getStripe(path));
+    ++numFilesPerStripe[stripe];
+  }
+  for (int count : numFilesPerStripe) {
+    EXPECT_GT(count, numFiles / kNumStripes * 8 / 10);
+    EXPECT_LT(count, numFiles / kNumStripes * 12 / 10);
+  }
+}
+
+TEST(StripePlacement, RecordedStripeWins) {
+  TemporaryDirectory tmpDir;
+  WdtOptions options;
+  options.stripe_directories = stripeDirectories(tmpDir.dir());
+  StripePlacement placement(stripeDir(tmpDir.dir(), 0), options);
+  const string path = "a/b";
+  const int recordedStripe = (placement.getStripe(path) + 1) % kNumStripes;
+  placement.recordStripe(path, recordedStripe);
+  EXPECT_EQ(recordedStripe, placement.getStripe(path));
+  EXPECT_EQ(1, placement.getNumRecordedStripes());
+}
+
+TEST(StripePlacement, FilesAreStriped) {
+  TemporaryDirectory tmpDir;
+  const string baseDir = tmpDir.dir();
+  const string srcDir = baseDir + "/src";
+  ASSERT_EQ(0, mkdir(srcDir.c_str(), 0755));
+  ASSERT_EQ(0, mkdir((srcDir + "/sub").c_str(), 0755));
+  const int numFiles = 60;
+  vector<string> files;
+  for (int i = 0; i < numFiles; i++) {
+    files.push_back(folly::to<string>(i % 2 ? "sub/" : "", "file", i));
+    FILE *file = fopen((srcDir + "/" + files.back()).c_str(), "wb");
+    ASSERT_NE(nullptr, file);
+    const string content(100 + i, 'a' + i % 26);
+    ASSERT_EQ(content.size(), fwrite(content.data(), 1, content.size(), file));
+    fclose(file);
+  }
+
+  Wdt &wdt = Wdt::initializeWdt("unit test FilesAreStriped");
+  WdtOptions &options = wdt.getWdtOptions();
+  options.stripe_directories = stripeDirectories(baseDir);
+  WdtTransferRequest req(/* start port */ 0, /* num ports */ 3,
+                         stripeDir(baseDir, 0));
+  req.wdtNamespace = "stripes";
+  EXPECT_EQ(OK, wdt.wdtReceiveStart("stripes", req));
+  req.directory = srcDir;
+  EXPECT_EQ(OK, wdt.wdtSend(req));
+  EXPECT_EQ(OK, wdt.wdtReceiveFinish("stripes"));
+
+  StripePlacement placement(stripeDir(baseDir, 0), options);
+  vector<int> numFilesPerStripe(kNumStripes, 0);
+  for (int i = 0; i < numFiles; i++) {
+    const int expectedStripe = placement.getStripe(files[i]);
+    for (int stripe = 0; stripe < kNumStripes; stripe++) {
+      struct stat fileStat;
+      const string path = stripeDir(baseDir, stripe) + "/" + files[i];
+      const bool exists = (stat(path.c_str(), &fileStat) == 0);
+      EXPECT_EQ(stripe == expectedStripe, exists) << path;
+      if (exists) {
+        EXPECT_EQ(100 + i, fileStat.st_size) << path;
+        ++numFilesPerStripe[stripe];
+      }
+    }
+  }
+  for (int count : numFilesPerStripe) {
+    EXPECT_GT(count, 0);
+  }
+  options.stripe_directories.clear();
+}
+}
+}  // namespaces
+
+int main(int argc, char *argv[]) {
+  FLAGS_logtostderr = true;
+  testing::InitGoogleTest(&argc, argv);
+  GFLAGS_NAMESPACE::ParseCommandLineFlags(&argc, &argv, true);
+  google::InitGoogleLogging(argv[0]);
+  int ret = RUN_ALL_TESTS();
+  return ret;
+}
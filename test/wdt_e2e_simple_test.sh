@@ -75,6 +75,13 @@ mkdir -p $BASEDIR
 DIR=`mktemp -d $BASEDIR/XXXXXX`
 echo "Testing in $DIR"
 
+if [ -n "$WDT_TEST_DISCOVERY_CACHE" ]; then
+  # cache of this test only, removed with the test directory
+  mkdir $DIR/cache
+  WDTBIN="$WDTBIN -discovery_cache_dir=$DIR/cache"
+  echo "Discovery cache in $DIR/cache"
+fi
+
 #pkill -x wdt
 
 mkdir $DIR/src
@@ -3,13 +3,14 @@
 from common_utils import *
 
 
-def run_test(name, sender_extra_flags, fail_transfer=False):
+def run_test(name, sender_extra_flags, fail_transfer=False,
+             manifest="file_list"):
     start_test(name)
     connection_url = start_receiver(wdt_receiver_arg)
     if fail_transfer is True:
         connection_url += "&id=blah1234"
-    sender_arg = "{0} -manifest {1}/file_list {2}".format(
-        wdt_sender_arg, root_dir, sender_extra_flags
+    sender_arg = "{0} -manifest {1}/{2} {3}".format(
+        wdt_sender_arg, root_dir, manifest, sender_extra_flags
     )
     run_sender(sender_arg, connection_url)
     check_transfer_status(fail_transfer)
@@ -35,6 +36,12 @@ for root, dirs, files in os.walk(src_dir):
             file_list_in.write(file)
         file_list_in.write('\n')
 file_list_in.close()
+# and its binary version
+convert_cmd = "{0} -manifest {1}/file_list -convert_manifest {1}/file_list.bin"
+(out, err) = run_command(convert_cmd.format(get_wdt_binary(), root_dir))
+if not os.path.exists(os.path.join(root_dir, "file_list.bin")):
+    print("Manifest conversion failed " + err)
+    exit(1)
 print("Done with set-up")
 
 wdtbin_opts = " -full_reporting --enable_perf_stat_collection "
@@ -54,6 +61,19 @@ run_test(
     "failed transfer with open early and direct reads",
     "-open_files_during_discovery -1 -odirect_reads", True
 )
+run_test(
+    "file list with adaptive block sizes",
+    "-adaptive_block_size -adaptive_min_block_mbytes 0.01"
+)
+run_test(
+    "file list with stolen block tails",
+    "-steal_block_tails -steal_segment_mbytes 0.05"
+)
+run_test("binary file list", "", manifest="file_list.bin")
+run_test(
+    "binary file list with bounded discovery", "-max_queued_sources 2",
+    manifest="file_list.bin"
+)
 
 os.remove(os.path.join(src_dir, "file0"))
 open(os.path.join(src_dir, "file1"), 'a').truncate(1025)
@@ -0,0 +1,54 @@
+#! /usr/bin/env python
+
+# the test mirrors a directory with -incremental_sync, then changes the source
+# and checks that the next run only sends the files which changed, deletes
+# the extra ones and keeps the modification times
+
+from common_utils import *
+import os
+
+
+def sync():
+    start_receiver("-num_ports=2 -incremental_sync")
+    run_sender("-incremental_sync")
+    check_transfer_status()
+
+
+def check_mtimes():
+    src_dir = get_source_dir()
+    dst_dir = get_dest_dir()
+    for name in os.listdir(src_dir):
+        src_mtime = int(os.stat(os.path.join(src_dir, name)).st_mtime)
+        dst_mtime = int(os.stat(os.path.join(dst_dir, name)).st_mtime)
+        if src_mtime != dst_mtime:
+            error("mtime of {0} not kept {1} {2}".format(
+                name, src_mtime, dst_mtime))
+
+
+def rewrite_one_src_file():
+    # same size, only the mtime tells the file changed
+    file_name = os.path.join(get_source_dir(), "file1")
+    with open(file_name, "r+b") as f:
+        f.write(os.urandom(4096))
+    st = os.stat(file_name)
+    os.utime(file_name, (st.st_atime, st.st_mtime + 10))
+
+
+root_dir = create_test_directory("/tmp")
+generate_random_files(20 * 1024 * 1024)
+
+start_test("incremental sync")
+sync()
+check_mtimes()
+src_dir = get_source_dir()
+rewrite_one_src_file()
+os.rename(os.path.join(src_dir, "file0"), os.path.join(src_dir, "file55"))
+os.remove(os.path.join(src_dir, "file2"))
+sync()
+check_mtimes()
+# 20 files, one rewritten, one renamed and one deleted
+if not search_in_logs(get_test_count(),
+                      "17 files already on the receiver side"):
+    error("unchanged files were sent again")
+
+exit(verify_transfer_success())
@@ -0,0 +1,47 @@
+#! /usr/bin/env python
+
+# the sender replicates a directory to a receiver running forever: after the
+# initial transfer, files are appended to, created, renamed and deleted, and
+# only the changes are sent, without discovering the tree again
+
+from common_utils import *
+import os
+import threading
+import time
+
+
+def append_to(file_name, size):
+    with open(os.path.join(get_source_dir(), file_name), "ab") as f:
+        f.write(os.urandom(size))
+
+
+def change_src_files():
+    # leaves time for the initial transfer
+    time.sleep(3)
+    src_dir = get_source_dir()
+    append_to("file1", 1024 * 1024)
+    os.rename(os.path.join(src_dir, "file0"), os.path.join(src_dir, "file55"))
+    os.remove(os.path.join(src_dir, "file2"))
+    os.mkdir(os.path.join(src_dir, "newdir"))
+    append_to("newdir/new", 4096)
+    time.sleep(1)
+    append_to("file1", 4096)
+
+
+root_dir = create_test_directory("/tmp")
+generate_random_files(20 * 1024 * 1024)
+
+start_test("watch directory")
+start_receiver("-start_port 0 -run_as_daemon -overwrite -delete_extra_files")
+changer = threading.Thread(target=change_src_files)
+changer.start()
+# the sender stops once aborted between two transfers
+run_sender("-watch_directory -watch_interval_millis 200 "
+           "-abort_after_seconds 8")
+changer.join()
+get_receiver_process().kill()
+check_transfer_status(False, False)
+if not search_in_logs(get_test_count(), "Receiver known to have"):
+    error("changes were not sent incrementally")
+
+exit(verify_transfer_success())
@@ -0,0 +1,245 @@
+/**
+ * Copyright (c) 2014-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+#include <wdt/util/BinaryManifest.h>
+#include <wdt/ErrorCodes.h>
+#include <wdt/util/SerializationUtil.h>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cstring>
+
+namespace facebook {
+namespace wdt {
+
+const int64_t BinaryManifest::kVersion = 1;
+
+namespace {
+const char *const kMagic = "wdt_binary_manifest";
+/// entries are written out by chunks of about that many bytes
+const size_t kWriteBufferSize = 1024 * 1024;
+
+void appendString(std::string &buffer, const std::string &str) {
+  encodeVarU64(buffer, str.size());
+  buffer.append(str);
+}
+
+std::string encodeHeader() {
+  std::string header;
+  appendString(header, kMagic);
+  encodeVarI64(header, BinaryManifest::kVersion);
+  return header;
+}
+}
+
+bool BinaryManifest::isBinaryManifest(const std::string &path) {
+  const std::string header = encodeHeader();
+  const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return false;
+  }
+  std::string start(header.size(), '\0');
+  const ssize_t numRead = ::read(fd, &start[0], start.size());
+  ::close(fd);
+  // only the magic is compared, the version is checked when opened
+  const size_t magicEnd = header.size() - 1;
+  return numRead == (ssize_t)header.size() &&
+         start.compare(0, magicEnd, header, 0, magicEnd) == 0;
+}
+
+BinaryManifestWriter::BinaryManifestWriter(const std::string &path)
+    : path_(path), tmpPath_(path + ".tmp") {
+}
+
+BinaryManifestWriter::~BinaryManifestWriter() {
+  if (fd_ >= 0) {
+    ::close(fd_);
+    ::unlink(tmpPath_.c_str());
+  }
+}
+
+bool BinaryManifestWriter::open() {
+  WDT_CHECK(fd_ < 0) << "Manifest already opened " << path_;
+  fd_ =
+      ::open(tmpPath_.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd_ < 0) {
+    WPLOG(ERROR) << "Unable to create manifest " << tmpPath_;
+    return false;
+  }
+  buffer_ = encodeHeader();
+  return true;
+}
+
+bool BinaryManifestWriter::add(const std::string &fileName, int64_t fileSize,
+                               BinaryManifest::DirectReads directReads) {
+  WDT_CHECK(fd_ >= 0) << "Manifest not opened " << path_;
+  if (fileName.empty()) {
+    // reserved for the end of the list
+    WLOG(ERROR) << "Empty file name in manifest " << path_;
+    return false;
+  }
+  appendString(buffer_, fileName);
+  encodeVarI64(buffer_, fileSize);
+  encodeVarI64(buffer_, directReads);
+  ++numEntries_;
+  return buffer_.size() < kWriteBufferSize || flush();
+}
+
+bool BinaryManifestWriter::flush() {
+  int64_t off = 0;
+  while (off < (int64_t)buffer_.size()) {
+    const ssize_t written =
+        ::write(fd_, buffer_.data() + off, buffer_.size() - off);
+    if (written < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      WPLOG(ERROR) << "Failed to write manifest " << tmpPath_;
+      return false;
+    }
+    off += written;
+  }
+  buffer_.clear();
+  return true;
+}
+
+bool BinaryManifestWriter::close() {
+  WDT_CHECK(fd_ >= 0) << "Manifest not opened " << path_;
+  appendString(buffer_, "");
+  encodeVarI64(buffer_, numEntries_);
+  bool ok = flush();
+  if (::close(fd_) != 0) {
+    WPLOG(ERROR) << "Failed to close manifest " << tmpPath_;
+    ok = false;
+  }
+  fd_ = -1;
+  if (ok && ::rename(tmpPath_.c_str(), path_.c_str()) != 0) {
+    WPLOG(ERROR) << "Failed to rename manifest " << tmpPath_ << " to "
+                 << path_;
+    ok = false;
+  }
+  if (!ok) {
+    ::unlink(tmpPath_.c_str());
+    return false;
+  }
+  WLOG(INFO) << "Wrote manifest " << path_ << " with " << numEntries_
+             << " entries";
+  return true;
+}
+
+BinaryManifestReader::BinaryManifestReader(const std::string &path)
+    : path_(path) {
+}
+
+BinaryManifestReader::~BinaryManifestReader() {
+  if (data_ != nullptr) {
+    ::munmap(const_cast<char *>(data_), size_);
+  }
+}
+
+bool BinaryManifestReader::open() {
+  WDT_CHECK(data_ == nullptr) << "Manifest already opened " << path_;
+  const int fd = ::open(path_.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    WPLOG(ERROR) << "Unable to open manifest " << path_;
+    return false;
+  }
+  struct stat fileStat;
+  if (fstat(fd, &fileStat) != 0) {
+    WPLOG(ERROR) << "Unable to stat manifest " << path_;
+    ::close(fd);
+    return false;
+  }
+  size_ = fileStat.st_size;
+  if (size_ == 0) {
+    ::close(fd);
+    return invalid("empty");
+  }
+  void *mapping = ::mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd, 0);
+  // the mapping keeps the file
+  ::close(fd);
+  if (mapping == MAP_FAILED) {
+    WPLOG(ERROR) << "Unable to map manifest " << path_;
+    return false;
+  }
+  data_ = static_cast<const char *>(mapping);
+  // read once from start to end, the pages read can go
+  ::madvise(mapping, size_, MADV_SEQUENTIAL);
+  uint64_t magicLen;
+  int64_t version;
+  if (!decodeVarU64(data_, size_, pos_, magicLen) ||
+      magicLen != strlen(kMagic) || (int64_t)magicLen > size_ - pos_ ||
+      memcmp(data_ + pos_, kMagic, magicLen) != 0) {
+    return invalid("not a binary manifest");
+  }
+  pos_ += magicLen;
+  if (!decodeVarI64(data_, size_, pos_, version) ||
+      version != BinaryManifest::kVersion) {
+    return invalid("unknown version");
+  }
+  return true;
+}
+
+bool BinaryManifestReader::invalid(const char *what) {
+  WLOG(ERROR) << "Invalid manifest " << path_ << ": " << what << " at "
+              << pos_;
+  hasError_ = true;
+  ended_ = true;
+  return false;
+}
+
+bool BinaryManifestReader::next(bool dfltDirectReads, WdtFileInfo &fileInfo) {
+  WDT_CHECK(data_ != nullptr || hasError_) << "Manifest not opened " << path_;
+  if (ended_) {
+    return false;
+  }
+  uint64_t nameLen;
+  if (!decodeVarU64(data_, size_, pos_, nameLen) ||
+      (int64_t)nameLen > size_ - pos_) {
+    return invalid("truncated entry");
+  }
+  if (nameLen == 0) {
+    int64_t numEntries;
+    if (!decodeVarI64(data_, size_, pos_, numEntries)) {
+      return invalid("truncated end");
+    }
+    if (numEntries != numRead_) {
+      return invalid("wrong number of entries");
+    }
+    ended_ = true;
+    WVLOG(1) << "Read the " << numRead_ << " entries of manifest " << path_;
+    return false;
+  }
+  fileInfo.fileName.assign(data_ + pos_, nameLen);
+  pos_ += nameLen;
+  int64_t directReads;
+  if (!decodeVarI64(data_, size_, pos_, fileInfo.fileSize) ||
+      !decodeVarI64(data_, size_, pos_, directReads)) {
+    return invalid("truncated entry");
+  }
+  switch (directReads) {
+    case BinaryManifest::DIRECT_READS_DEFAULT:
+      fileInfo.directReads = dfltDirectReads;
+      break;
+    case BinaryManifest::DIRECT_READS_OFF:
+      fileInfo.directReads = false;
+      break;
+    case BinaryManifest::DIRECT_READS_ON:
+      fileInfo.directReads = true;
+      break;
+    default:
+      return invalid("unknown direct reads of entry");
+  }
+  fileInfo.fd = -1;
+  ++numRead_;
+  return true;
+}
+}
+}
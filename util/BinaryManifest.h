@@ -0,0 +1,157 @@
+/**
+ * Copyright (c) 2014-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+#pragma once
+
+#include <wdt/WdtTransferRequest.h>
+
+#include <string>
+
+namespace facebook {
+namespace wdt {
+
+/**
+ * Binary manifest: the list of files to send, for lists too large for the
+ * text manifest to be parsed up front. After a header (magic and version),
+ * every entry is a length prefixed path, its size (-1 if unknown, the file is
+ * then stat'ed when queued) and whether to read it with O_DIRECT. The list
+ * ends with an empty path followed by the number of entries, so that a
+ * truncated manifest is detected. Integers are varints (SerializationUtil).
+ *
+ * Manifests are written once, by converting a text manifest, and can be sent
+ * many times.
+ */
+class BinaryManifest {
+ public:
+  /// Version of the format
+  static const int64_t kVersion;
+
+  /// how an entry is to be read
+  enum DirectReads : int64_t {
+    DIRECT_READS_DEFAULT = 0,  // per the odirect_reads option of the sender
+    DIRECT_READS_OFF = 1,
+    DIRECT_READS_ON = 2,
+  };
+
+  /// @return   whether the file at path starts like a binary manifest
+  static bool isBinaryManifest(const std::string &path);
+};
+
+/**
+ * Writes a binary manifest. The manifest is written aside and renamed by
+ * close(), a failed conversion does not leave a partial manifest behind
+ */
+class BinaryManifestWriter {
+ public:
+  /// @param path   path of the manifest to write
+  explicit BinaryManifestWriter(const std::string &path);
+
+  /// Drops the manifest if not closed
+  ~BinaryManifestWriter();
+
+  /// @return   false if the manifest can not be created (logged)
+  bool open();
+
+  /**
+   * Adds an entry
+   *
+   * @param fileName      path of the file relative to the directory sent
+   * @param fileSize      size of the file, -1 if unknown
+   * @param directReads   how the file is to be read
+   *
+   * @return              false on write errors (logged)
+   */
+  bool add(const std::string &fileName, int64_t fileSize,
+           BinaryManifest::DirectReads directReads);
+
+  /// @return   false if the manifest could not be completed (logged)
+  bool close();
+
+  /// @return   number of entries added
+  int64_t getNumEntries() const {
+    return numEntries_;
+  }
+
+  /// Copy constructor deleted
+  BinaryManifestWriter(const BinaryManifestWriter &that) = delete;
+
+  /// Delete the assignment operatory by copy
+  BinaryManifestWriter &operator=(const BinaryManifestWriter &that) = delete;
+
+ private:
+  /// writes out the buffered entries
+  bool flush();
+
+  std::string path_;
+  std::string tmpPath_;
+  int fd_{-1};
+  /// entries not written yet
+  std::string buffer_;
+  int64_t numEntries_{0};
+};
+
+/**
+ * Reads a binary manifest through a read only mapping, one entry at a time,
+ * so that the files can be queued as the manifest is read instead of after
+ * parsing the whole list
+ */
+class BinaryManifestReader {
+ public:
+  /// @param path   path of the manifest
+  explicit BinaryManifestReader(const std::string &path);
+
+  /// Unmaps the manifest
+  ~BinaryManifestReader();
+
+  /// @return   false if the manifest can not be mapped or has an unknown
+  ///           header (logged)
+  bool open();
+
+  /**
+   * Reads the next entry
+   *
+   * @param dfltDirectReads   direct reads of the entries which have no
+   *                          preference
+   * @param fileInfo          set to the entry read
+   *
+   * @return                  false at the end of the list or if the manifest
+   *                          is invalid, see hasError()
+   */
+  bool next(bool dfltDirectReads, WdtFileInfo &fileInfo);
+
+  /// @return   whether the manifest turned out to be truncated or invalid
+  bool hasError() const {
+    return hasError_;
+  }
+
+  /// @return   number of entries read so far
+  int64_t getNumRead() const {
+    return numRead_;
+  }
+
+  /// Copy constructor deleted
+  BinaryManifestReader(const BinaryManifestReader &that) = delete;
+
+  /// Delete the assignment operatory by copy
+  BinaryManifestReader &operator=(const BinaryManifestReader &that) = delete;
+
+ private:
+  /// logs and records an invalid manifest
+  bool invalid(const char *what);
+
+  std::string path_;
+  const char *data_{nullptr};
+  int64_t size_{0};
+  /// offset of the next entry
+  int64_t pos_{0};
+  int64_t numRead_{0};
+  bool ended_{false};
+  bool hasError_{false};
+};
+}
+}
@@ -0,0 +1,149 @@
+/**
+ * Copyright (c) 2014-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+#include <wdt/util/ByteSourceQueue.h>
+#include <wdt/ErrorCodes.h>
+
+#include <algorithm>
+#include <limits>
+
+namespace facebook {
+namespace wdt {
+
+const int64_t ByteSourceQueue::kEmptyRank =
+    std::numeric_limits<int64_t>::min();
+
+bool ByteSourceQueue::EntryComparator::operator()(const Entry &entry1,
+                                                  const Entry &entry2) const {
+  if (entry1.failedAttempts != entry2.failedAttempts) {
+    return entry1.failedAttempts > entry2.failedAttempts;
+  }
+  if (order == BY_PHYSICAL_OFFSET) {
+    // inode numbers say nothing about the physical offsets, files located on
+    // the disk go first
+    if (entry1.offsetLocated != entry2.offsetLocated) {
+      return entry2.offsetLocated;
+    }
+    if (entry1.physicalOffset != entry2.physicalOffset) {
+      return entry1.physicalOffset > entry2.physicalOffset;
+    }
+    if (entry1.seqId != entry2.seqId) {
+      return entry1.seqId > entry2.seqId;
+    }
+    return entry1.offset > entry2.offset;
+  }
+  if (entry1.size != entry2.size) {
+    return entry1.size < entry2.size;
+  }
+  if (entry1.offset != entry2.offset) {
+    return entry1.offset > entry2.offset;
+  }
+  return entry1.seqId > entry2.seqId;
+}
+
+ByteSourceQueue::ByteSourceQueue(int numShards) {
+  setNumShards(numShards);
+}
+
+void ByteSourceQueue::setNumShards(int numShards) {
+  WDT_CHECK(empty()) << "Changing the shards of a non empty queue";
+  numShards = std::max(1, numShards);
+  shards_.clear();
+  for (int i = 0; i < numShards; i++) {
+    shards_.emplace_back(new Shard());
+  }
+}
+
+void ByteSourceQueue::setOrder(Order order) {
+  WDT_CHECK(empty()) << "Changing the order of a non empty queue";
+  comparator_.order = order;
+}
+
+int64_t ByteSourceQueue::getRank(const Entry &entry) const {
+  if (comparator_.order == BY_PHYSICAL_OFFSET) {
+    // located files in (-kRange, 0], the others in [-2 * kRange, -kRange]
+    const int64_t kRange = std::numeric_limits<int64_t>::max() / 2;
+    const int64_t key =
+        std::min(std::max<int64_t>(entry.physicalOffset, 0), kRange - 1);
+    return entry.offsetLocated ? -key : -kRange - key;
+  }
+  return entry.size;
+}
+
+void ByteSourceQueue::push(std::unique_ptr<ByteSource> source) {
+  Entry entry;
+  entry.failedAttempts = source->getTransferStats().getFailedAttempts();
+  entry.size = source->getSize();
+  entry.offset = source->getOffset();
+  entry.seqId = source->getMetaData().seqId;
+  entry.physicalOffset = source->getMetaData().physicalOffset;
+  entry.offsetLocated = source->getMetaData().physicalOffsetLocated;
+  entry.source = std::move(source);
+  Shard &shard = *shards_[nextShard_.fetch_add(1) % shards_.size()];
+  std::lock_guard<std::mutex> lock(shard.mutex);
+  shard.heap.push_back(std::move(entry));
+  std::push_heap(shard.heap.begin(), shard.heap.end(), comparator_);
+  shard.topRank = getRank(shard.heap.front());
+  ++size_;
+}
+
+bool ByteSourceQueue::pop(int threadIndex,
+                          std::unique_ptr<ByteSource> &source) {
+  const int ownShard = getOwnShard(threadIndex);
+  if (popShard(*shards_[ownShard], source)) {
+    return true;
+  }
+  // steal the best source on top of the other shards
+  while (true) {
+    int bestShard = -1;
+    int64_t bestRank = kEmptyRank;
+    for (size_t i = 0; i < shards_.size(); i++) {
+      const int64_t topRank = shards_[i]->topRank.load();
+      if (topRank > bestRank) {
+        bestRank = topRank;
+        bestShard = i;
+      }
+    }
+    if (bestShard < 0) {
+      break;
+    }
+    if (popShard(*shards_[bestShard], source)) {
+      return true;
+    }
+  }
+  // every shard looked empty, make sure of it under their locks
+  for (auto &shard : shards_) {
+    if (popShard(*shard, source)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool ByteSourceQueue::popShard(Shard &shard,
+                               std::unique_ptr<ByteSource> &source) {
+  std::lock_guard<std::mutex> lock(shard.mutex);
+  if (shard.heap.empty()) {
+    return false;
+  }
+  std::pop_heap(shard.heap.begin(), shard.heap.end(), comparator_);
+  source = std::move(shard.heap.back().source);
+  shard.heap.pop_back();
+  shard.topRank =
+      shard.heap.empty() ? kEmptyRank : getRank(shard.heap.front());
+  --size_;
+  return true;
+}
+
+int ByteSourceQueue::getOwnShard(int threadIndex) const {
+  // the indices of the threads of a transfer are dense, so each thread gets
+  // its own shard whatever the other transfers of the process do
+  return threadIndex < 0 ? 0 : threadIndex % shards_.size();
+}
+}
+}
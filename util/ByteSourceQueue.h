@@ -0,0 +1,147 @@
+/**
+ * Copyright (c) 2014-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+#pragma once
+
+#include <wdt/ByteSource.h>
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace facebook {
+namespace wdt {
+
+/**
+ * Concurrent priority queue of byte sources, split in shards so that sender
+ * threads do not all contend on a single lock. Each shard is a heap under its
+ * own mutex. Sources are pushed round robin on the shards, a thread pops from
+ * its own shard and steals the best source of the other shards when its shard
+ * is empty.
+ *
+ * Within a shard, sources are ordered by increasing failed attempts, then by
+ * decreasing size, then by increasing offset, then by seq-id. With the
+ * BY_PHYSICAL_OFFSET order, sources are instead ordered by the physical
+ * offset of their file on disk, so that a spinning disk reads sequentially.
+ * Files whose offset is unknown go after the others, by inode number.
+ * The order is global only approximately: since consecutive sources land on
+ * different shards, the top of every shard stays close to the global top. The
+ * sort key is computed once on push, the heap operations make no virtual
+ * call.
+ */
+class ByteSourceQueue {
+ public:
+  enum Order {
+    /// largest sources first
+    BY_SIZE,
+    /// sources of files closer to the start of the disk first, and the blocks
+    /// of a file by increasing offset
+    BY_PHYSICAL_OFFSET,
+  };
+
+  /// @param numShards    number of shards, usually the number of consumers
+  explicit ByteSourceQueue(int numShards = 1);
+
+  /// Changes the number of shards, the queue must be empty
+  void setNumShards(int numShards);
+
+  /// Changes the order of the sources, the queue must be empty
+  void setOrder(Order order);
+
+  /// adds a source, can be called by any thread
+  void push(std::unique_ptr<ByteSource> source);
+
+  /**
+   * Removes a source, from the shard of the calling thread if possible
+   *
+   * @param threadIndex   index of the calling thread among the consumers,
+   *                      which pops from shard threadIndex % numShards.
+   *                      Negative if the thread has no index, it then pops
+   *                      from the first shard
+   * @param source        set to the source removed
+   *
+   * @return              false if every shard was empty
+   */
+  bool pop(int threadIndex, std::unique_ptr<ByteSource> &source);
+
+  /// @return   number of sources queued
+  int64_t size() const {
+    return size_.load();
+  }
+
+  bool empty() const {
+    return size() == 0;
+  }
+
+  /// removes every source, calling fn(source) on each of them
+  template <typename Fn>
+  void drain(Fn fn) {
+    for (auto &shard : shards_) {
+      std::lock_guard<std::mutex> lock(shard->mutex);
+      for (auto &entry : shard->heap) {
+        fn(entry.source);
+      }
+      size_ -= shard->heap.size();
+      shard->heap.clear();
+      shard->topRank = kEmptyRank;
+    }
+  }
+
+  void clear() {
+    drain([](std::unique_ptr<ByteSource> &) {});
+  }
+
+ private:
+  /// rank of the top of an empty shard
+  static const int64_t kEmptyRank;
+
+  /// cached sort key of a source
+  struct Entry {
+    int64_t failedAttempts;
+    int64_t size;
+    int64_t offset;
+    int64_t seqId;
+    int64_t physicalOffset;
+    bool offsetLocated;
+    std::unique_ptr<ByteSource> source;
+  };
+
+  /// heap comparator, @return   whether entry1 goes after entry2
+  struct EntryComparator {
+    Order order;
+
+    bool operator()(const Entry &entry1, const Entry &entry2) const;
+  };
+
+  struct Shard {
+    std::mutex mutex;
+    std::vector<Entry> heap;
+    /// rank of the top source, the higher the sooner it should be sent,
+    /// kEmptyRank when empty. Read without the lock to pick the shard to steal
+    /// from
+    std::atomic<int64_t> topRank{kEmptyRank};
+  };
+
+  /// @return   rank of an entry, comparable across shards
+  int64_t getRank(const Entry &entry) const;
+
+  /// @return   whether a source could be popped from a shard
+  bool popShard(Shard &shard, std::unique_ptr<ByteSource> &source);
+
+  /// @return   shard a thread pops from, see pop()
+  int getOwnShard(int threadIndex) const;
+
+  std::vector<std::unique_ptr<Shard>> shards_;
+  EntryComparator comparator_{BY_SIZE};
+  /// shard of the next push
+  std::atomic<uint64_t> nextShard_{0};
+  std::atomic<int64_t> size_{0};
+};
+}
+}
@@ -83,6 +83,15 @@ const Buffer* ThreadCtx::getBuffer() const {
   return buffer_.get();
 }
 
+bool ThreadCtx::resizeBuffer(int64_t size) {
+  auto buffer = std::make_unique<Buffer>(size);
+  if (buffer->getData() == nullptr) {
+    return false;
+  }
+  buffer_ = std::move(buffer);
+  return true;
+}
+
 PerfStatReport& ThreadCtx::getPerfReport() {
   return perfReport_;
 }
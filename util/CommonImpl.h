@@ -64,9 +64,24 @@ class ThreadCtx {
   /// @param    thread index
   int getThreadIndex() const;
 
+  /// @return   whether the context was created with a thread index
+  bool hasThreadIndex() const {
+    return threadIndex_ >= 0;
+  }
+
   /// @return   buffer to use
   const Buffer *getBuffer() const;
 
+  /**
+   * Replaces the buffer with one of a different size, its content is lost
+   *
+   * @param size    size of the new buffer
+   *
+   * @return        whether the new buffer could be allocated, the old one is
+   *                kept otherwise
+   */
+  bool resizeBuffer(int64_t size);
+
   /// @return   perf stat reporter
   PerfStatReport &getPerfReport();
 
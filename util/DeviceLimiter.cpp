@@ -0,0 +1,50 @@
+/**
+ * Copyright (c) 2014-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+#include <wdt/util/DeviceLimiter.h>
+#include <wdt/ErrorCodes.h>
+
+namespace facebook {
+namespace wdt {
+
+DeviceLimiter &DeviceLimiter::get() {
+  static DeviceLimiter deviceLimiter;
+  return deviceLimiter;
+}
+
+void DeviceLimiter::acquire(int64_t deviceId, int32_t maxThreads) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  if (numHolders_[deviceId] >= maxThreads) {
+    WVLOG(2) << "Waiting for a slot on device " << deviceId;
+    // looked up again after each wake up, released entries are erased
+    slotReleased_.wait(
+        lock, [&] { return numHolders_[deviceId] < maxThreads; });
+  }
+  ++numHolders_[deviceId];
+}
+
+void DeviceLimiter::release(int64_t deviceId) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = numHolders_.find(deviceId);
+    WDT_CHECK(it != numHolders_.end() && it->second > 0) << deviceId;
+    if (--it->second == 0) {
+      numHolders_.erase(it);
+    }
+  }
+  // waiters of different devices share the condition variable
+  slotReleased_.notify_all();
+}
+
+int32_t DeviceLimiter::getNumHolders(int64_t deviceId) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = numHolders_.find(deviceId);
+  return it == numHolders_.end() ? 0 : it->second;
+}
+}
+}
@@ -0,0 +1,58 @@
+/**
+ * Copyright (c) 2014-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <unordered_map>
+
+namespace facebook {
+namespace wdt {
+
+/**
+ * Process wide limit of the number of threads writing to a device (st_dev) at
+ * once. Receiver threads hold a slot on the device of their file while they
+ * write a buffer to it, so that when the destination spans several disks the
+ * writes of the threads spread over them instead of piling up on one. The
+ * sender does the same by grouping its sources by device, see
+ * DirectorySourceQueue::setMaxThreadsPerDevice.
+ */
+class DeviceLimiter {
+ public:
+  /// @return     Singleton instance of the limiter
+  static DeviceLimiter &get();
+
+  /**
+   * Waits till fewer than maxThreads threads hold a slot on the device and
+   * takes one
+   *
+   * @param deviceId    device
+   * @param maxThreads  maximum number of slots on the device
+   */
+  void acquire(int64_t deviceId, int32_t maxThreads);
+
+  /// Gives back a slot taken with acquire()
+  void release(int64_t deviceId);
+
+  /// @return     number of slots held on the device
+  int32_t getNumHolders(int64_t deviceId);
+
+ private:
+  DeviceLimiter() {
+  }
+
+  std::mutex mutex_;
+  /// notified when a slot is released
+  std::condition_variable slotReleased_;
+  /// number of slots held on each device, devices without slot are removed
+  std::unordered_map<int64_t, int32_t> numHolders_;
+};
+}
+}
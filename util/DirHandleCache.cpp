@@ -0,0 +1,82 @@
+/**
+ * Copyright (c) 2014-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+#include <wdt/util/DirHandleCache.h>
+#include <wdt/ErrorCodes.h>
+
+#include <unistd.h>
+
+namespace facebook {
+namespace wdt {
+
+DirHandleCache::Handle::Handle(int fd) : fd_(fd) {
+}
+
+DirHandleCache::Handle::~Handle() {
+  if (::close(fd_) != 0) {
+    WPLOG(ERROR) << "Unable to close directory fd " << fd_;
+  }
+}
+
+DirHandleCache::DirHandleCache(int64_t capacity) : capacity_(capacity) {
+}
+
+DirHandleCache::HandlePtr DirHandleCache::get(const std::string &dir) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = handleMap_.find(dir);
+  if (it == handleMap_.end()) {
+    return nullptr;
+  }
+  lruList_.splice(lruList_.begin(), lruList_, it->second);
+  return it->second->second;
+}
+
+void DirHandleCache::put(const std::string &dir, HandlePtr handle) {
+  if (capacity_ <= 0) {
+    return;
+  }
+  // evicted handles are released outside the lock, closing them is a syscall
+  HandlePtr evicted;
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = handleMap_.find(dir);
+  if (it != handleMap_.end()) {
+    evicted = std::move(it->second->second);
+    it->second->second = std::move(handle);
+    lruList_.splice(lruList_.begin(), lruList_, it->second);
+    return;
+  }
+  if ((int64_t)handleMap_.size() >= capacity_) {
+    auto &last = lruList_.back();
+    evicted = std::move(last.second);
+    handleMap_.erase(last.first);
+    lruList_.pop_back();
+  }
+  lruList_.emplace_front(dir, std::move(handle));
+  handleMap_[dir] = lruList_.begin();
+}
+
+void DirHandleCache::remove(const std::string &dir) {
+  HandlePtr removed;
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = handleMap_.find(dir);
+  if (it == handleMap_.end()) {
+    return;
+  }
+  removed = std::move(it->second->second);
+  lruList_.erase(it->second);
+  handleMap_.erase(it);
+}
+
+void DirHandleCache::clear() {
+  LruList removed;
+  std::lock_guard<std::mutex> lock(mutex_);
+  handleMap_.clear();
+  removed.swap(lruList_);
+}
+}
+}
@@ -0,0 +1,93 @@
+/**
+ * Copyright (c) 2014-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+#pragma once
+
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+
+namespace facebook {
+namespace wdt {
+
+/**
+ * Bounded LRU cache of open directory descriptors, keyed by the directory
+ * path relative to the destination root. FileCreator uses it to create and
+ * open files with openat/mkdirat relative to their parent directory, so that
+ * the kernel does not resolve the whole path from the root for every file.
+ *
+ * Handles are reference counted, a handle evicted from the cache stays valid
+ * (and its descriptor open) until the last user releases it.
+ *
+ * This class is thread-safe.
+ */
+class DirHandleCache {
+ public:
+  /// Open directory, closes the descriptor on destruction
+  class Handle {
+   public:
+    /// @param fd   descriptor of the directory, ownership is taken
+    explicit Handle(int fd);
+
+    ~Handle();
+
+    /// @return     descriptor of the directory
+    int getFd() const {
+      return fd_;
+    }
+
+    /// Copy constructor deleted
+    Handle(const Handle &that) = delete;
+
+    /// Delete the assignment operatory by copy
+    Handle &operator=(const Handle &that) = delete;
+
+   private:
+    int fd_;
+  };
+
+  typedef std::shared_ptr<Handle> HandlePtr;
+
+  /// @param capacity   maximum number of directories kept open
+  explicit DirHandleCache(int64_t capacity);
+
+  /// @return     handle of the directory, null if not in the cache
+  HandlePtr get(const std::string &dir);
+
+  /**
+   * Adds a handle to the cache, evicting the least recently used one if the
+   * cache is full. If the directory is already cached, the handle is replaced.
+   *
+   * @param dir       directory relative to root
+   * @param handle    handle of the directory
+   */
+  void put(const std::string &dir, HandlePtr handle);
+
+  /// Removes a directory from the cache, used when its handle goes stale
+  void remove(const std::string &dir);
+
+  /// Drops all the cached handles
+  void clear();
+
+ private:
+  typedef std::list<std::pair<std::string, HandlePtr>> LruList;
+
+  /// maximum number of cached handles
+  const int64_t capacity_;
+  /// cached handles, most recently used first
+  LruList lruList_;
+  /// map from directory to its position in lruList_
+  std::unordered_map<std::string, LruList::iterator> handleMap_;
+  /// protects lruList_ and handleMap_
+  std::mutex mutex_;
+};
+}
+}
@@ -0,0 +1,167 @@
+/**
+ * Copyright (c) 2014-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+#include <wdt/util/DirectoryScanner.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#ifdef WDT_HAS_GETDENTS64
+#include <sys/syscall.h>
+#endif
+#ifdef WDT_HAS_STATX
+#include <sys/sysmacros.h>
+#endif
+
+namespace facebook {
+namespace wdt {
+
+namespace {
+#ifdef WDT_HAS_GETDENTS64
+/// record returned by getdents64, see getdents(2)
+struct LinuxDirent64 {
+  uint64_t d_ino;
+  int64_t d_off;
+  unsigned short d_reclen;
+  unsigned char d_type;
+  char d_name[1];
+};
+#endif
+
+const int64_t kNsPerSec = 1000000000;
+}
+
+void DirectoryScanner::fillEntryStat(const struct stat &fileStat,
+                                     EntryStat &entryStat) {
+  entryStat.mode = fileStat.st_mode;
+  entryStat.size = fileStat.st_size;
+  entryStat.device = fileStat.st_dev;
+  entryStat.inode = fileStat.st_ino;
+#ifdef __APPLE__
+  entryStat.mtimeNs = fileStat.st_mtimespec.tv_sec * kNsPerSec +
+                      fileStat.st_mtimespec.tv_nsec;
+#else
+  entryStat.mtimeNs =
+      fileStat.st_mtim.tv_sec * kNsPerSec + fileStat.st_mtim.tv_nsec;
+#endif
+}
+
+DirectoryScanner::~DirectoryScanner() {
+  close();
+}
+
+bool DirectoryScanner::open(const std::string &path) {
+  close();
+  error_ = false;
+  fd_ = ::open(path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (fd_ < 0) {
+    return false;
+  }
+#ifdef WDT_HAS_GETDENTS64
+  if (!buffer_) {
+    buffer_.reset(new char[kBufferSize]);
+  }
+  bufferOffset_ = bufferEnd_ = 0;
+#else
+  dir_ = ::fdopendir(fd_);
+  if (dir_ == nullptr) {
+    const int savedErrno = errno;
+    ::close(fd_);
+    fd_ = -1;
+    errno = savedErrno;
+    return false;
+  }
+#endif
+  return true;
+}
+
+bool DirectoryScanner::next(const char *&name, unsigned char &type) {
+#ifdef WDT_HAS_GETDENTS64
+  if (bufferOffset_ >= bufferEnd_) {
+    const int64_t numRead =
+        ::syscall(SYS_getdents64, fd_, buffer_.get(), kBufferSize);
+    if (numRead <= 0) {
+      error_ = (numRead < 0);
+      return false;
+    }
+    bufferOffset_ = 0;
+    bufferEnd_ = numRead;
+  }
+  const LinuxDirent64 *entry =
+      reinterpret_cast<const LinuxDirent64 *>(buffer_.get() + bufferOffset_);
+  bufferOffset_ += entry->d_reclen;
+  name = entry->d_name;
+  type = entry->d_type;
+  return true;
+#else
+  errno = 0;
+  const struct dirent *entry = ::readdir(dir_);
+  if (entry == nullptr) {
+    error_ = (errno != 0);
+    return false;
+  }
+  name = entry->d_name;
+  type = entry->d_type;
+  return true;
+#endif
+}
+
+bool DirectoryScanner::statEntry(const char *name, bool followSymlink,
+                                 EntryStat &entryStat) const {
+  const int flags = followSymlink ? 0 : AT_SYMLINK_NOFOLLOW;
+#ifdef WDT_HAS_STATX
+  struct statx entryStatx;
+  if (::statx(fd_, name, flags | AT_NO_AUTOMOUNT,
+              STATX_TYPE | STATX_SIZE | STATX_MTIME | STATX_INO,
+              &entryStatx) != 0) {
+    return false;
+  }
+  entryStat.mode = entryStatx.stx_mode;
+  entryStat.size = entryStatx.stx_size;
+  // the device is always filled, whatever the mask
+  entryStat.device =
+      makedev(entryStatx.stx_dev_major, entryStatx.stx_dev_minor);
+  entryStat.inode = entryStatx.stx_ino;
+  entryStat.mtimeNs =
+      entryStatx.stx_mtime.tv_sec * kNsPerSec + entryStatx.stx_mtime.tv_nsec;
+#else
+  struct stat fileStat;
+  if (::fstatat(fd_, name, &fileStat, flags) != 0) {
+    return false;
+  }
+  fillEntryStat(fileStat, entryStat);
+#endif
+  return true;
+}
+
+bool DirectoryScanner::statDirectory(EntryStat &entryStat) const {
+  struct stat dirStat;
+  if (::fstat(fd_, &dirStat) != 0) {
+    return false;
+  }
+  fillEntryStat(dirStat, entryStat);
+  return true;
+}
+
+void DirectoryScanner::close() {
+#ifndef WDT_HAS_GETDENTS64
+  if (dir_ != nullptr) {
+    // also closes fd_
+    ::closedir(dir_);
+    dir_ = nullptr;
+    fd_ = -1;
+  }
+#endif
+  if (fd_ >= 0) {
+    ::close(fd_);
+    fd_ = -1;
+  }
+}
+}
+}
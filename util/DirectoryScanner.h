@@ -0,0 +1,130 @@
+/**
+ * Copyright (c) 2014-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+#pragma once
+
+#include <wdt/WdtConfig.h>
+
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <memory>
+#include <string>
+
+namespace facebook {
+namespace wdt {
+
+/**
+ * Reads the entries of a directory and stats them relative to the directory
+ * descriptor, so that no full path is built or resolved per entry. Entries
+ * are read with getdents64 into a large buffer where available (readdir
+ * otherwise), and stat'ed with statx asking only for the fields of EntryStat
+ * (fstatat otherwise). A scanner is meant to be reused for many
+ * directories by a single thread.
+ */
+class DirectoryScanner {
+ public:
+  /// mode, size, device, modification time and inode of an entry
+  struct EntryStat {
+    /// st_mode of the entry, type and permissions
+    mode_t mode{0};
+    int64_t size{0};
+    /// st_dev of the entry
+    int64_t device{0};
+    /// modification time in ns since the epoch
+    int64_t mtimeNs{0};
+    /// inode number
+    int64_t inode{0};
+  };
+
+  DirectoryScanner() = default;
+
+  /// Closes the current directory
+  ~DirectoryScanner();
+
+  /**
+   * Opens a directory, closing the previous one
+   *
+   * @param path    path of the directory
+   *
+   * @return        whether the directory could be opened, errno is set
+   *                otherwise
+   */
+  bool open(const std::string &path);
+
+  /**
+   * Reads the next entry of the directory, '.' and '..' included
+   *
+   * @param name    set to the name of the entry, valid till the next call
+   * @param type    set to the d_type of the entry, DT_UNKNOWN on filesystems
+   *                which do not fill it
+   *
+   * @return        false at the end of the directory or on error, see
+   *                hasError()
+   */
+  bool next(const char *&name, unsigned char &type);
+
+  /// @return   whether reading the directory failed, errno is then set
+  bool hasError() const {
+    return error_;
+  }
+
+  /**
+   * Stats an entry of the directory
+   *
+   * @param name            name of the entry
+   * @param followSymlink   whether to stat the target of a symlink
+   * @param entryStat       set to the stat of the entry
+   *
+   * @return                whether the stat succeeded, errno is set otherwise
+   */
+  bool statEntry(const char *name, bool followSymlink,
+                 EntryStat &entryStat) const;
+
+  /**
+   * Stats the opened directory itself
+   *
+   * @param entryStat       set to the stat of the directory
+   *
+   * @return                whether the stat succeeded, errno is set otherwise
+   */
+  bool statDirectory(EntryStat &entryStat) const;
+
+  /// Closes the current directory
+  void close();
+
+  /// Fills an EntryStat from the result of a stat() done elsewhere
+  static void fillEntryStat(const struct stat &fileStat, EntryStat &entryStat);
+
+  /// Copy constructor deleted
+  DirectoryScanner(const DirectoryScanner &that) = delete;
+
+  /// Delete the assignment operatory by copy
+  DirectoryScanner &operator=(const DirectoryScanner &that) = delete;
+
+ private:
+  /// descriptor of the directory
+  int fd_{-1};
+  /// whether reading the directory failed
+  bool error_{false};
+#ifdef WDT_HAS_GETDENTS64
+  /// size of the getdents64 buffer, large to save calls on huge directories
+  static const int kBufferSize = 128 * 1024;
+  /// records returned by the last getdents64 call
+  std::unique_ptr<char[]> buffer_;
+  /// offset of the next record in buffer_
+  int64_t bufferOffset_{0};
+  /// end of the records in buffer_
+  int64_t bufferEnd_{0};
+#else
+  /// directory stream on fd_
+  DIR *dir_{nullptr};
+#endif
+};
+}
+}
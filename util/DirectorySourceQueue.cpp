@@ -12,12 +12,15 @@
 #include <sys/types.h>
 #include <unistd.h>
 #include <wdt/Protocol.h>
+#include <wdt/util/BinaryManifest.h>
+#include <wdt/util/PathMatcher.h>
+#include <wdt/util/WorkStealingQueue.h>
 #include <algorithm>
+#include <atomic>
 #include <set>
 #include <utility>
 
 #include <fcntl.h>
-#include <regex>
 
 // NOTE: this should remain standalone code and not use WdtOptions directly
 // also note this is used not just by the Sender but also by the receiver
@@ -56,6 +59,18 @@ void WdtFileInfo::verifyAndFixFlags() {
   }
 }
 
+namespace {
+/// blocks per thread of the bytes discovered, for every thread to get an
+/// even share of them
+const int64_t kBlocksPerThread = 4;
+/// blocks per thread of the bytes left at the end of the transfer
+const int64_t kTailBlocksPerThread = 2;
+
+int64_t roundToDiskBlocks(int64_t size) {
+  return (size + kDiskBlockSize - 1) / kDiskBlockSize * kDiskBlockSize;
+}
+}
+
 DirectorySourceQueue::DirectorySourceQueue(const WdtOptions &options,
                                            const string &rootDir,
                                            IAbortChecker const *abortChecker) {
@@ -77,16 +92,80 @@ void DirectorySourceQueue::setPruneDirPattern(const string &pruneDirPattern) {
   pruneDirPattern_ = pruneDirPattern;
 }
 
+void DirectorySourceQueue::setNumClientThreads(int64_t numClientThreads) {
+  numClientThreads_ = numClientThreads;
+  numBlockRests_.reset(new std::atomic<int32_t>[numClientThreads]());
+  for (int i = 0; i < numDeviceQueues_.load(); i++) {
+    deviceQueues_[i]->sources.setNumShards(numClientThreads);
+  }
+}
+
+void DirectorySourceQueue::setOrderByPhysicalOffset(
+    bool orderByPhysicalOffset) {
+  orderByPhysicalOffset_ = orderByPhysicalOffset;
+  for (int i = 0; i < numDeviceQueues_.load(); i++) {
+    deviceQueues_[i]->sources.setOrder(orderByPhysicalOffset
+                                           ? ByteSourceQueue::BY_PHYSICAL_OFFSET
+                                           : ByteSourceQueue::BY_SIZE);
+  }
+}
+
 void DirectorySourceQueue::setBlockSizeMbytes(int64_t blockSizeMbytes) {
   blockSizeMbytes_ = blockSizeMbytes;
 }
 
+void DirectorySourceQueue::setAdaptiveBlockSizes(int64_t minBlockSize,
+                                                 int64_t maxBlockSize) {
+  // whole disk blocks, for direct reads
+  minBlockSize_ = std::max(kDiskBlockSize, roundToDiskBlocks(minBlockSize));
+  maxBlockSize_ = 0;
+  if (maxBlockSize > 0) {
+    maxBlockSize_ = std::max(minBlockSize_, roundToDiskBlocks(maxBlockSize));
+  }
+  blockSizingStats_.adaptive = (maxBlockSize_ > 0);
+}
+
+void DirectorySourceQueue::setBlockSegmentSize(int64_t segmentSize) {
+  segmentSize_ = 0;
+  if (segmentSize > 0) {
+    // whole disk blocks, for direct reads
+    segmentSize_ = std::max(kDiskBlockSize, roundToDiskBlocks(segmentSize));
+  }
+  blockSizingStats_.segmented = (segmentSize_ > 0);
+}
+
+void DirectorySourceQueue::returnBlockRest(const ThreadCtx *callerThreadCtx) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  auto it = blockRests_.find(callerThreadCtx);
+  if (it == blockRests_.end()) {
+    return;
+  }
+  WVLOG(1) << "Returning the rest of " << it->second->getIdentifier()
+           << " at " << it->second->getOffset() << " to the queue";
+  // already counted in numBlocks_ when cut
+  enqueueSource(std::move(it->second));
+  blockRests_.erase(it);
+  countBlockRest(callerThreadCtx, -1);
+  lock.unlock();
+  conditionNotEmpty_.notify_one();
+}
+
+BlockSizingStats DirectorySourceQueue::getBlockSizingStats() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return blockSizingStats_;
+}
+
 void DirectorySourceQueue::setFileInfo(
     const std::vector<WdtFileInfo> &fileInfo) {
   fileInfo_ = fileInfo;
   exploreDirectory_ = false;
 }
 
+void DirectorySourceQueue::setBinaryManifest(const string &manifestPath) {
+  manifestPath_ = manifestPath;
+  exploreDirectory_ = false;
+}
+
 const std::vector<WdtFileInfo> &DirectorySourceQueue::getFileInfo() const {
   return fileInfo_;
 }
@@ -124,28 +203,177 @@ bool DirectorySourceQueue::setRootDir(const string &newRootDir) {
   }
   if (dir != rootDir_) {
     rootDir_.assign(dir);
+    pathTable_.setRootDir(rootDir_);
     WLOG(INFO) << "Root dir now " << rootDir_;
   }
   return true;
 }
 
 void DirectorySourceQueue::clearSourceQueue() {
-  // clear current content of the queue. For some reason, priority_queue does
-  // not have a clear method
-  while (!sourceQueue_.empty()) {
-    sourceQueue_.pop();
+  for (int i = 0; i < numDeviceQueues_.load(); i++) {
+    deviceQueues_[i]->sources.clear();
+  }
+  sourcesToDelete_.clear();
+  numSourcesToDelete_ = 0;
+  numQueuedBytes_ = 0;
+  blockRests_.clear();
+}
+
+void DirectorySourceQueue::enqueueSource(std::unique_ptr<ByteSource> source) {
+  if (source->getMetaData().allocationStatus == TO_BE_DELETED) {
+    sourcesToDelete_.push_back(std::move(source));
+    ++numSourcesToDelete_;
+  } else {
+    numQueuedBytes_ += source->getSize();
+    getDeviceQueue(source->getMetaData().deviceId)
+        .sources.push(std::move(source));
+  }
+}
+
+DirectorySourceQueue::DeviceQueue &DirectorySourceQueue::getDeviceQueue(
+    int64_t deviceId) {
+  if (maxThreadsPerDevice_ <= 0) {
+    // no limit, every source goes in the same queue
+    deviceId = -1;
+  }
+  auto it = deviceQueueIndex_.find(deviceId);
+  if (it != deviceQueueIndex_.end()) {
+    return *deviceQueues_[it->second];
+  }
+  const int numQueues = numDeviceQueues_.load();
+  if (numQueues == kMaxDeviceQueues) {
+    WLOG(WARNING) << "More than " << kMaxDeviceQueues << " devices, files of "
+                  << "device " << deviceId << " share the last queue";
+    deviceQueueIndex_[deviceId] = numQueues - 1;
+    return *deviceQueues_[numQueues - 1];
+  }
+  std::unique_ptr<DeviceQueue> deviceQueue(new DeviceQueue());
+  deviceQueue->deviceId = deviceId;
+  deviceQueue->sources.setNumShards(numClientThreads_);
+  deviceQueue->sources.setOrder(orderByPhysicalOffset_
+                                    ? ByteSourceQueue::BY_PHYSICAL_OFFSET
+                                    : ByteSourceQueue::BY_SIZE);
+  deviceQueues_[numQueues] = std::move(deviceQueue);
+  deviceQueueIndex_[deviceId] = numQueues;
+  // readers only look at the queues below the count
+  numDeviceQueues_.store(numQueues + 1);
+  if (deviceId >= 0) {
+    WVLOG(1) << "Sources of device " << deviceId << " in queue " << numQueues;
+  }
+  return *deviceQueues_[numQueues];
+}
+
+bool DirectorySourceQueue::popSource(const ThreadCtx *callerThreadCtx,
+                                     std::unique_ptr<ByteSource> &source) {
+  const int threadIndex =
+      (callerThreadCtx != nullptr && callerThreadCtx->hasThreadIndex())
+          ? callerThreadCtx->getThreadIndex()
+          : -1;
+  const int numQueues = numDeviceQueues_.load();
+  if (maxThreadsPerDevice_ <= 0) {
+    if (numQueues > 0 && deviceQueues_[0]->sources.pop(threadIndex, source)) {
+      numQueuedBytes_ -= source->getSize();
+      return true;
+    }
+    return false;
+  }
+  const int firstQueue = nextDeviceQueue_++ % std::max(numQueues, 1);
+  for (int i = 0; i < numQueues; i++) {
+    DeviceQueue &deviceQueue = *deviceQueues_[(firstQueue + i) % numQueues];
+    if (deviceQueue.sources.empty()) {
+      continue;
+    }
+    // take a slot on the device before popping
+    int32_t numInFlight = deviceQueue.numInFlight.load();
+    bool hasSlot = false;
+    while (numInFlight < maxThreadsPerDevice_ && !hasSlot) {
+      hasSlot = deviceQueue.numInFlight.compare_exchange_weak(numInFlight,
+                                                              numInFlight + 1);
+    }
+    if (!hasSlot) {
+      continue;
+    }
+    if (deviceQueue.sources.pop(threadIndex, source)) {
+      numQueuedBytes_ -= source->getSize();
+      return true;
+    }
+    --deviceQueue.numInFlight;
+  }
+  return false;
+}
+
+int64_t DirectorySourceQueue::getNumQueuedSources() const {
+  int64_t numQueuedSources = 0;
+  for (int i = 0; i < numDeviceQueues_.load(); i++) {
+    numQueuedSources += deviceQueues_[i]->sources.size();
+  }
+  return numQueuedSources;
+}
+
+void DirectorySourceQueue::waitForQueueToDrain(
+    std::unique_lock<std::mutex> &lock) {
+  if (maxQueuedSources_ <= 0 || getNumQueuedSources() < maxQueuedSources_) {
+    return;
+  }
+  WVLOG(1) << "Pausing discovery, " << getNumQueuedSources()
+           << " sources queued";
+  ++numPausedDiscoveryThreads_;
+  while (getNumQueuedSources() > maxQueuedSources_ / 2 &&
+         !threadCtx_->getAbortChecker()->shouldAbort()) {
+    // the timeout is only there to check for aborts
+    conditionQueueDrained_.wait_for(lock, std::chrono::milliseconds(100));
+  }
+  --numPausedDiscoveryThreads_;
+  WVLOG(1) << "Resuming discovery, " << getNumQueuedSources()
+           << " sources queued";
+}
+
+void DirectorySourceQueue::resumeDiscoveryIfDrained() {
+  if (numPausedDiscoveryThreads_.load() == 0 ||
+      getNumQueuedSources() > maxQueuedSources_ / 2) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  conditionQueueDrained_.notify_all();
+}
+
+bool DirectorySourceQueue::hasQueuedSources() const {
+  for (int i = 0; i < numDeviceQueues_.load(); i++) {
+    if (!deviceQueues_[i]->sources.empty()) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void DirectorySourceQueue::releaseSource(const ByteSource &source) {
+  const SourceMetaData &metadata = source.getMetaData();
+  if (maxThreadsPerDevice_ <= 0 || metadata.allocationStatus == TO_BE_DELETED) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = deviceQueueIndex_.find(metadata.deviceId);
+  WDT_CHECK(it != deviceQueueIndex_.end()) << metadata.getFullPath();
+  DeviceQueue &deviceQueue = *deviceQueues_[it->second];
+  WDT_CHECK_GT(deviceQueue.numInFlight.load(), 0);
+  --deviceQueue.numInFlight;
+  // a thread may be waiting for a slot on this device
+  if (!deviceQueue.sources.empty()) {
+    conditionNotEmpty_.notify_one();
   }
 }
 
 void DirectorySourceQueue::setPreviouslyReceivedChunks(
     std::vector<FileChunksInfo> &previouslyTransferredChunks) {
   std::unique_lock<std::mutex> lock(mutex_);
-  WDT_CHECK_EQ(0, numBlocksDequeued_);
+  WDT_CHECK_EQ(0, numBlocksDequeued_.load());
+  WDT_CHECK(!isBounded()) << "Download resumption needs all the metadata";
   // reset all the queue variables
   nextSeqId_ = 0;
   totalFileSize_ = 0;
   numEntries_ = 0;
   numBlocks_ = 0;
+  numUnchangedFiles_ = 0;
   for (auto &chunkInfo : previouslyTransferredChunks) {
     nextSeqId_ = std::max(nextSeqId_, chunkInfo.getSeqId() + 1);
     auto fileName = chunkInfo.getFileName();
@@ -157,8 +385,10 @@ void DirectorySourceQueue::setPreviouslyReceivedChunks(
   for (const auto metadata : sharedFileData_) {
     // TODO: do not notify inside createIntoQueueInternal. This method still
     // holds the lock, so no point in notifying
-    createIntoQueueInternal(metadata);
+    createIntoQueueInternal(metadata, metadata->getRelPath());
   }
+  WLOG(INFO) << numUnchangedFiles_ << " files already on the receiver side, "
+             << numEntries_ << " to send";
   enqueueFilesToBeDeleted();
 }
 
@@ -170,7 +400,7 @@ DirectorySourceQueue::~DirectorySourceQueue() {
     if (fileData->needToClose && fileData->fd >= 0) {
       int ret = ::close(fileData->fd);
       if (ret) {
-        WPLOG(ERROR) << "Failed to close file " << fileData->fullPath;
+        WPLOG(ERROR) << "Failed to close file " << fileData->getFullPath();
       }
     }
     delete fileData;
@@ -197,6 +427,9 @@ bool DirectorySourceQueue::buildQueueSynchronously() {
   // files
   if (exploreDirectory_) {
     res = explore();
+  } else if (!manifestPath_.empty()) {
+    WLOG(INFO) << "Using binary manifest " << manifestPath_;
+    res = enqueueManifestFiles();
   } else {
     WLOG(INFO) << "Using list of file info. Number of files "
                << fileInfo_.size();
@@ -207,7 +440,7 @@ bool DirectorySourceQueue::buildQueueSynchronously() {
     initFinished_ = true;
     enqueueFilesToBeDeleted();
     // TODO: comment why
-    if (sourceQueue_.empty()) {
+    if (!hasQueuedSources() && sourcesToDelete_.empty()) {
       conditionNotEmpty_.notify_all();
     }
   }
@@ -236,160 +469,381 @@ string DirectorySourceQueue::resolvePath(const string &path) {
   return result;
 }
 
+/// state shared by the threads exploring the tree
+struct DirectorySourceQueue::ExploreState {
+  ExploreState(const string &includePattern, const string &excludePattern,
+               const string &pruneDirPattern, int numWorkers)
+      : includeMatcher(includePattern),
+        excludeMatcher(excludePattern),
+        pruneDirMatcher(pruneDirPattern),
+        directories(numWorkers) {
+  }
+
+  const PathMatcher includeMatcher;
+  const PathMatcher excludeMatcher;
+  const PathMatcher pruneDirMatcher;
+  std::atomic<bool> hasError{false};
+  /// directories visited, when following symlinks
+  std::set<string> visited;
+  std::mutex visitedMutex;
+
+  /// following are only used by parallel exploration
+  /// directories left to explore
+  WorkStealingQueue<int32_t> directories;
+  /// directories queued or being explored
+  std::atomic<int64_t> numPendingDirectories{0};
+  /// number of times directories were queued, lets idle threads detect pushes
+  std::atomic<int64_t> numPushes{0};
+  /// number of threads waiting for a directory
+  std::atomic<int> numIdle{0};
+  std::mutex idleMutex;
+  /// signalled when directories are queued or everything is explored
+  std::condition_variable idleCondition;
+};
+
 bool DirectorySourceQueue::explore() {
   WLOG(INFO) << "Exploring root dir " << rootDir_
              << " include_pattern : " << includePattern_
              << " exclude_pattern : " << excludePattern_
-             << " prune_dir_pattern : " << pruneDirPattern_;
+             << " prune_dir_pattern : " << pruneDirPattern_
+             << " threads : " << numDiscoveryThreads_;
   WDT_CHECK(!rootDir_.empty());
-  bool hasError = false;
-  std::set<string> visited;
-  std::regex includeRegex(includePattern_);
-  std::regex excludeRegex(excludePattern_);
-  std::regex pruneDirRegex(pruneDirPattern_);
-  std::deque<string> todoList;
-  todoList.push_back("");
-  while (!todoList.empty()) {
+  const int numWorkers = std::max(1, numDiscoveryThreads_);
+  if (!discoveryCacheDir_.empty()) {
+    if (followSymlinks_) {
+      WLOG(WARNING) << "Not using the discovery cache, symlinks are followed";
+    } else {
+      string key = rootDir_;
+      for (const string *pattern :
+           {&includePattern_, &excludePattern_, &pruneDirPattern_}) {
+        key.push_back('\0');
+        key.append(*pattern);
+      }
+      discoveryCache_ =
+          std::make_unique<DiscoveryCache>(discoveryCacheDir_, key);
+      discoveryCache_->load();
+    }
+  }
+  ExploreState state(includePattern_, excludePattern_, pruneDirPattern_,
+                     numWorkers);
+  if (numWorkers == 1) {
+    std::deque<int32_t> todoList;
+    todoList.push_back(PathTable::kRootDirectory);
+    std::vector<int32_t> subDirs;
+    DirectoryScanner scanner;
+    while (!todoList.empty()) {
+      if (threadCtx_->getAbortChecker()->shouldAbort()) {
+        WLOG(ERROR) << "Directory transfer thread aborted";
+        state.hasError = true;
+        break;
+      }
+      const int32_t directory = todoList.front();
+      todoList.pop_front();
+      subDirs.clear();
+      exploreDirectory(state, scanner, directory, subDirs);
+      todoList.insert(todoList.end(), subDirs.begin(), subDirs.end());
+    }
+  } else {
+    state.numPendingDirectories = 1;
+    state.directories.push(0, PathTable::kRootDirectory);
+    std::vector<std::thread> exploreThreads;
+    for (int i = 1; i < numWorkers; i++) {
+      exploreThreads.emplace_back(&DirectorySourceQueue::exploreThread, this,
+                                  std::ref(state), i);
+    }
+    // the calling thread is worker 0
+    exploreThread(state, 0);
+    for (auto &thread : exploreThreads) {
+      thread.join();
+    }
+  }
+  const bool hasError = state.hasError;
+  if (discoveryCache_) {
+    WLOG(INFO) << "Discovery cache: " << discoveryCache_->getNumHits()
+               << " directories unchanged " << discoveryCache_->getNumMisses()
+               << " rescanned";
+    // a partial discovery would drop directories from the cache
+    if (!hasError && !threadCtx_->getAbortChecker()->shouldAbort()) {
+      discoveryCache_->save();
+    }
+    discoveryCache_.reset();
+  }
+  WLOG(INFO) << "Number of files explored: " << numEntries_ << " opened "
+             << numFilesOpened_ << " with direct " << numFilesOpenedWithDirect_
+             << " errors " << std::boolalpha << hasError;
+  WLOG(INFO) << "Path table: " << pathTable_.getNumDirectories()
+             << " directories " << pathTable_.getNumFiles() << " files "
+             << pathTable_.getNumBytes() << " bytes";
+  return !hasError;
+}
+
+void DirectorySourceQueue::exploreThread(ExploreState &state, int worker) {
+  int32_t directory;
+  std::vector<int32_t> subDirs;
+  DirectoryScanner scanner;
+  while (true) {
     if (threadCtx_->getAbortChecker()->shouldAbort()) {
       WLOG(ERROR) << "Directory transfer thread aborted";
-      hasError = true;
+      state.hasError = true;
+      // the other threads may be waiting for directories which this thread
+      // will never explore
+      std::lock_guard<std::mutex> lock(state.idleMutex);
+      state.idleCondition.notify_all();
       break;
     }
-    // would be nice to do those 2 in 1 call...
-    auto relativePath = todoList.front();
-    todoList.pop_front();
-    const string fullPath = rootDir_ + relativePath;
-    WVLOG(1) << "Processing directory " << fullPath;
-    DIR *dirPtr = opendir(fullPath.c_str());
-    if (!dirPtr) {
-      WPLOG(ERROR) << "Error opening dir " << fullPath;
-      failedDirectories_.emplace_back(fullPath);
-      hasError = true;
+    // read before the pop, a push after a failed pop changes it
+    const int64_t numPushes = state.numPushes.load();
+    if (!state.directories.tryPop(worker, directory)) {
+      if (state.numPendingDirectories.load() == 0) {
+        break;
+      }
+      // other threads are exploring, wait for their sub directories
+      std::unique_lock<std::mutex> lock(state.idleMutex);
+      ++state.numIdle;
+      state.idleCondition.wait(lock, [&] {
+        return state.numPushes.load() != numPushes ||
+               state.numPendingDirectories.load() == 0 ||
+               threadCtx_->getAbortChecker()->shouldAbort();
+      });
+      --state.numIdle;
       continue;
     }
-    // http://elliotth.blogspot.com/2012/10/how-not-to-use-readdirr3.html
-    // tl;dr readdir is actually better than readdir_r ! (because of the
-    // nastiness of calculating correctly buffer size and race conditions there)
-    struct dirent *dirEntryRes = nullptr;
-    while (true) {
-      if (threadCtx_->getAbortChecker()->shouldAbort()) {
-        break;
+    subDirs.clear();
+    exploreDirectory(state, scanner, directory, subDirs);
+    if (!subDirs.empty()) {
+      state.numPendingDirectories += subDirs.size();
+      for (int32_t subDir : subDirs) {
+        state.directories.push(worker, subDir);
       }
-      errno = 0;  // yes that's right
-      dirEntryRes = readdir(dirPtr);
-      if (!dirEntryRes) {
-        if (errno) {
-          WPLOG(ERROR) << "Error reading dir " << fullPath;
-          // closedir always called
-          hasError = true;
-        } else {
-          WVLOG(2) << "Done with " << fullPath;
-          // finished reading dir
-        }
-        break;
+      // a waiter increments numIdle before checking numPushes, so either it
+      // sees the push or it is notified
+      ++state.numPushes;
+      if (state.numIdle.load() > 0) {
+        std::lock_guard<std::mutex> lock(state.idleMutex);
+        state.idleCondition.notify_all();
       }
-      const auto dType = dirEntryRes->d_type;
-      WVLOG(2) << "Found entry " << dirEntryRes->d_name << " type "
-               << (int)dType;
-      if (dirEntryRes->d_name[0] == '.') {
-        if (dirEntryRes->d_name[1] == '\0' ||
-            (dirEntryRes->d_name[1] == '.' && dirEntryRes->d_name[2] == '\0')) {
-          WVLOG(3) << "Skipping entry : " << dirEntryRes->d_name;
-          continue;
-        }
+    }
+    if (--state.numPendingDirectories == 0) {
+      // everything is explored, wake up the waiting threads so they exit
+      std::lock_guard<std::mutex> lock(state.idleMutex);
+      state.idleCondition.notify_all();
+    }
+  }
+}
+
+void DirectorySourceQueue::exploreDirectory(ExploreState &state,
+                                            DirectoryScanner &scanner,
+                                            int32_t directory,
+                                            std::vector<int32_t> &subDirs) {
+  const string relativePath = pathTable_.getDirectoryPath(directory);
+  const string fullPath = rootDir_ + relativePath;
+  WVLOG(1) << "Processing directory " << fullPath;
+  if (!scanner.open(fullPath)) {
+    WPLOG(ERROR) << "Error opening dir " << fullPath;
+    state.hasError = true;
+    std::lock_guard<std::mutex> lock(mutex_);
+    failedDirectories_.emplace_back(fullPath);
+    hasSourceErrors_ = true;
+    return;
+  }
+  // entries of the directory for the next discovery
+  DiscoveryCache::Directory cachedDir;
+  if (discoveryCache_) {
+    DirectoryScanner::EntryStat dirStat;
+    if (!scanner.statDirectory(dirStat)) {
+      WPLOG(ERROR) << "fstat() failed on dir " << fullPath;
+      state.hasError = true;
+    } else if (discoveryCache_->take(relativePath, dirStat.mtimeNs,
+                                     cachedDir)) {
+      WVLOG(1) << "Unchanged directory " << fullPath;
+      enqueueCachedDirectory(state, scanner, directory, cachedDir, subDirs);
+      scanner.close();
+      discoveryCache_->record(relativePath, std::move(cachedDir));
+      return;
+    }
+    cachedDir.mtimeNs = dirStat.mtimeNs;
+  }
+  const char *name;
+  unsigned char dType;
+  while (true) {
+    if (threadCtx_->getAbortChecker()->shouldAbort()) {
+      break;
+    }
+    if (!scanner.next(name, dType)) {
+      if (scanner.hasError()) {
+        WPLOG(ERROR) << "Error reading dir " << fullPath;
+        state.hasError = true;
+      } else {
+        WVLOG(2) << "Done with " << fullPath;
+        // finished reading dir
       }
-      // Following code is a bit ugly trying to save stat() call for directories
-      // yet still work for xfs which returns DT_UNKNOWN for everything
-      // would be simpler to always stat()
-
-      // if we reach DT_DIR and DT_REG directly:
-      bool isDir = (dType == DT_DIR);
-      bool isLink = (dType == DT_LNK);
-      bool keepEntry = (isDir || dType == DT_REG || dType == DT_UNKNOWN);
-      if (followSymlinks_) {
-        keepEntry |= isLink;
+      break;
+    }
+    WVLOG(2) << "Found entry " << name << " type " << (int)dType;
+    if (name[0] == '.') {
+      if (name[1] == '\0' || (name[1] == '.' && name[2] == '\0')) {
+        WVLOG(3) << "Skipping entry : " << name;
+        continue;
       }
-      if (!keepEntry) {
-        WVLOG(3) << "Ignoring entry type " << (int)(dType);
+    }
+    // Following code is a bit ugly trying to save stat() call for directories
+    // yet still work for xfs which returns DT_UNKNOWN for everything
+    // would be simpler to always stat()
+
+    // if we reach DT_DIR and DT_REG directly:
+    bool isDir = (dType == DT_DIR);
+    bool isLink = (dType == DT_LNK);
+    bool keepEntry = (isDir || dType == DT_REG || dType == DT_UNKNOWN);
+    if (followSymlinks_) {
+      keepEntry |= isLink;
+    }
+    if (!keepEntry) {
+      WVLOG(3) << "Ignoring entry type " << (int)(dType);
+      continue;
+    }
+    string newRelativePath = relativePath + name;
+    // only built for the entries which are kept
+    string newFullPath;
+    if (!isDir) {
+      // DT_REG, DT_LNK or DT_UNKNOWN cases
+      const bool isKnownFile = (dType == DT_REG);
+      if (isKnownFile && !matchesFilePatterns(state, newRelativePath)) {
+        // filtered out without a stat
         continue;
       }
-      string newRelativePath = relativePath + string(dirEntryRes->d_name);
-      string newFullPath = rootDir_ + newRelativePath;
-      if (!isDir) {
-        // DT_REG, DT_LNK or DT_UNKNOWN cases
-        struct stat fileStat;
-        // On XFS we don't know yet if this is a symlink, so check
-        // if following symlinks is ok we will do stat() too
-        if (lstat(newFullPath.c_str(), &fileStat) != 0) {
-          WPLOG(ERROR) << "lstat() failed on path " << newFullPath;
-          hasError = true;
+      DirectoryScanner::EntryStat entryStat;
+      // On XFS we don't know yet if this is a symlink, so check
+      // if following symlinks is ok we will do stat() too
+      if (!scanner.statEntry(name, false, entryStat)) {
+        WPLOG(ERROR) << "lstat() failed on path " << fullPath << name;
+        state.hasError = true;
+        continue;
+      }
+      isLink = S_ISLNK(entryStat.mode);
+      WVLOG(2) << "lstat for " << fullPath << name << " is link ? " << isLink;
+      if (followSymlinks_ && isLink) {
+        // Use stat to see if the pointed file is of the right type
+        // (overrides previous stat call result)
+        if (!scanner.statEntry(name, true, entryStat)) {
+          WPLOG(ERROR) << "stat() failed on path " << fullPath << name;
+          state.hasError = true;
           continue;
         }
-        isLink = S_ISLNK(fileStat.st_mode);
-        WVLOG(2) << "lstat for " << newFullPath << " is link ? " << isLink;
-        if (followSymlinks_ && isLink) {
-          // Use stat to see if the pointed file is of the right type
-          // (overrides previous stat call result)
-          if (stat(newFullPath.c_str(), &fileStat) != 0) {
-            WPLOG(ERROR) << "stat() failed on path " << newFullPath;
-            hasError = true;
-            continue;
-          }
-          newFullPath = resolvePath(newFullPath);
-          if (newFullPath.empty()) {
-            // already logged error
-            hasError = true;
-            continue;
-          }
-          WVLOG(2) << "Resolved symlink " << dirEntryRes->d_name << " to "
-                   << newFullPath;
+        newFullPath = resolvePath(fullPath + name);
+        if (newFullPath.empty()) {
+          // already logged error
+          state.hasError = true;
+          continue;
         }
+        WVLOG(2) << "Resolved symlink " << name << " to " << newFullPath;
+      }
 
-        // could dcheck that if DT_REG we better be !isDir
-        isDir = S_ISDIR(fileStat.st_mode);
-        // if we were DT_UNKNOWN this could still be a symlink, block device
-        // etc... (xfs)
-        if (S_ISREG(fileStat.st_mode)) {
-          WVLOG(2) << "Found file " << newFullPath << " of size "
-                   << fileStat.st_size;
-          if (!excludePattern_.empty() &&
-              std::regex_match(newRelativePath, excludeRegex)) {
-            continue;
-          }
-          if (!includePattern_.empty() &&
-              !std::regex_match(newRelativePath, includeRegex)) {
-            continue;
-          }
-          WdtFileInfo fileInfo(newRelativePath, fileStat.st_size, directReads_);
-          createIntoQueue(newFullPath, fileInfo);
+      // could dcheck that if DT_REG we better be !isDir
+      isDir = S_ISDIR(entryStat.mode);
+      // if we were DT_UNKNOWN this could still be a symlink, block device
+      // etc... (xfs)
+      if (S_ISREG(entryStat.mode)) {
+        WVLOG(2) << "Found file " << fullPath << name << " of size "
+                 << entryStat.size;
+        if (!isKnownFile && !matchesFilePatterns(state, newRelativePath)) {
           continue;
         }
+        // resolved symlinks keep their own paths
+        int64_t pathIndex = -1;
+        if (newFullPath.empty()) {
+          newFullPath = fullPath + name;
+          pathIndex = pathTable_.addFile(directory, name);
+        }
+        WdtFileInfo fileInfo(newRelativePath, entryStat.size, directReads_);
+        createIntoQueue(newFullPath, fileInfo, entryStat.device, pathIndex,
+                        entryStat.mtimeNs);
+        if (discoveryCache_) {
+          DiscoveryCache::File cachedFile;
+          cachedFile.name = name;
+          cachedFile.size = entryStat.size;
+          cachedFile.mtimeNs = entryStat.mtimeNs;
+          cachedFile.inode = entryStat.inode;
+          cachedFile.device = entryStat.device;
+          cachedDir.files.push_back(std::move(cachedFile));
+        }
+        continue;
       }
-      if (isDir) {
-        if (followSymlinks_) {
-          if (visited.find(newFullPath) != visited.end()) {
-            WLOG(ERROR) << "Attempted to visit directory twice: "
-                        << newFullPath;
-            hasError = true;
-            continue;
-          }
-          // TODO: consider custom hashing ignoring common prefix
-          visited.insert(newFullPath);
+    }
+    if (isDir) {
+      if (followSymlinks_) {
+        if (newFullPath.empty()) {
+          newFullPath = fullPath + name;
         }
-        newRelativePath.push_back('/');
-        if (pruneDirPattern_.empty() ||
-            !std::regex_match(newRelativePath, pruneDirRegex)) {
-          WVLOG(2) << "Adding " << newRelativePath;
-          todoList.push_back(std::move(newRelativePath));
+        std::lock_guard<std::mutex> lock(state.visitedMutex);
+        // TODO: consider custom hashing ignoring common prefix
+        if (!state.visited.insert(newFullPath).second) {
+          WLOG(ERROR) << "Attempted to visit directory twice: "
+                      << newFullPath;
+          state.hasError = true;
+          continue;
+        }
+      }
+      newRelativePath.push_back('/');
+      if (!state.pruneDirMatcher.matches(newRelativePath)) {
+        WVLOG(2) << "Adding " << newRelativePath;
+        subDirs.push_back(pathTable_.addDirectory(directory, name));
+        if (discoveryCache_) {
+          cachedDir.subDirs.emplace_back(name);
         }
       }
     }
-    closedir(dirPtr);
   }
-  WLOG(INFO) << "Number of files explored: " << numEntries_ << " opened "
-             << numFilesOpened_ << " with direct " << numFilesOpenedWithDirect_
-             << " errors " << std::boolalpha << hasError;
-  return !hasError;
+  scanner.close();
+  if (discoveryCache_) {
+    discoveryCache_->record(relativePath, std::move(cachedDir));
+  }
+}
+
+void DirectorySourceQueue::enqueueCachedDirectory(
+    ExploreState &state, const DirectoryScanner &scanner, int32_t directory,
+    DiscoveryCache::Directory &cachedDir, std::vector<int32_t> &subDirs) {
+  const string relativePath = pathTable_.getDirectoryPath(directory);
+  const string fullPath = rootDir_ + relativePath;
+  std::vector<DiscoveryCache::File> files;
+  files.reserve(cachedDir.files.size());
+  for (DiscoveryCache::File &file : cachedDir.files) {
+    // a file rewritten in place does not change the mtime of its directory,
+    // only the read and the filtering of the entries are saved
+    DirectoryScanner::EntryStat entryStat;
+    if (!scanner.statEntry(file.name.c_str(), false, entryStat)) {
+      WPLOG(ERROR) << "lstat() failed on path " << fullPath << file.name;
+      state.hasError = true;
+      continue;
+    }
+    if (!S_ISREG(entryStat.mode)) {
+      WLOG(ERROR) << "Cached file " << fullPath << file.name
+                  << " is no longer a regular file";
+      state.hasError = true;
+      continue;
+    }
+    file.size = entryStat.size;
+    file.mtimeNs = entryStat.mtimeNs;
+    file.inode = entryStat.inode;
+    file.device = entryStat.device;
+    const int64_t pathIndex = pathTable_.addFile(directory, file.name);
+    WdtFileInfo fileInfo(relativePath + file.name, file.size, directReads_);
+    createIntoQueue(fullPath + file.name, fileInfo, file.device, pathIndex,
+                    file.mtimeNs);
+    files.push_back(std::move(file));
+  }
+  cachedDir.files = std::move(files);
+  for (const string &subDir : cachedDir.subDirs) {
+    subDirs.push_back(pathTable_.addDirectory(directory, subDir));
+  }
+}
+
+bool DirectorySourceQueue::matchesFilePatterns(const ExploreState &state,
+                                               const string &relPath) const {
+  if (state.excludeMatcher.matches(relPath)) {
+    return false;
+  }
+  return state.includeMatcher.empty() ||
+         state.includeMatcher.matches(relPath);
 }
 
 void DirectorySourceQueue::smartNotify(int32_t addedSource) {
@@ -407,9 +861,9 @@ void DirectorySourceQueue::returnToQueue(
   int returnedCount = 0;
   std::unique_lock<std::mutex> lock(mutex_);
   for (auto &source : sources) {
-    sourceQueue_.push(std::move(source));
+    enqueueSource(std::move(source));
     returnedCount++;
-    WDT_CHECK_GT(numBlocksDequeued_, 0);
+    WDT_CHECK_GT(numBlocksDequeued_.load(), 0);
     numBlocksDequeued_--;
   }
   lock.unlock();
@@ -423,7 +877,10 @@ void DirectorySourceQueue::returnToQueue(std::unique_ptr<ByteSource> &source) {
 }
 
 void DirectorySourceQueue::createIntoQueue(const string &fullPath,
-                                           WdtFileInfo &fileInfo) {
+                                           WdtFileInfo &fileInfo,
+                                           int64_t deviceId,
+                                           int64_t pathIndex,
+                                           int64_t mtimeNs) {
   // TODO: currently we are treating small files(size less than blocksize) as
   // blocks. Also, we transfer file name in the header for all the blocks for a
   // large file. This can be optimized as follows -
@@ -435,31 +892,71 @@ void DirectorySourceQueue::createIntoQueue(const string &fullPath,
   // block size once negotiated, since blocksize is sort of fixed.
   fileInfo.verifyAndFixFlags();
   SourceMetaData *metadata = new SourceMetaData();
-  metadata->fullPath = fullPath;
-  metadata->relPath = fileInfo.fileName;
+  if (pathIndex >= 0) {
+    metadata->pathTable = &pathTable_;
+    metadata->pathIndex = pathIndex;
+  } else {
+    metadata->fullPath = fullPath;
+    metadata->relPath = fileInfo.fileName;
+  }
   metadata->fd = fileInfo.fd;
   metadata->directReads = fileInfo.directReads;
   metadata->size = fileInfo.fileSize;
+  if ((maxThreadsPerDevice_ > 0 && deviceId < 0) ||
+      (incrementalSync_ && mtimeNs < 0)) {
+    // files of the file list are not stat'ed by discovery
+    struct stat fileStat;
+    const int ret = (metadata->fd >= 0) ? fstat(metadata->fd, &fileStat)
+                                        : stat(fullPath.c_str(), &fileStat);
+    if (ret == 0) {
+      DirectoryScanner::EntryStat entryStat;
+      DirectoryScanner::fillEntryStat(fileStat, entryStat);
+      deviceId = (deviceId < 0) ? entryStat.device : deviceId;
+      mtimeNs = (mtimeNs < 0) ? entryStat.mtimeNs : mtimeNs;
+    } else {
+      WPLOG(ERROR) << "stat failed on path " << fullPath;
+    }
+  }
+  metadata->deviceId = deviceId;
+  metadata->mtimeNs = mtimeNs;
+  if (orderByPhysicalOffset_) {
+    metadata->physicalOffset = FileUtil::getPhysicalOffset(
+        fullPath, metadata->fd, metadata->physicalOffsetLocated);
+  }
+  // counters are shared by the discovery threads
+  std::unique_lock<std::mutex> lock(mutex_);
+  waitForQueueToDrain(lock);
   if ((openFilesDuringDiscovery_ != 0) && (metadata->fd < 0)) {
-    metadata->fd =
-        FileUtil::openForRead(*threadCtx_, fullPath, metadata->directReads);
     ++numFilesOpened_;
     if (metadata->directReads) {
       ++numFilesOpenedWithDirect_;
     }
-    metadata->needToClose = (metadata->fd >= 0);
     // works for -1 up to 4B files
     if (--openFilesDuringDiscovery_ == 0) {
       WLOG(WARNING) << "Already opened " << numFilesOpened_
                     << " files, will open the reminder as they are sent";
     }
+    lock.unlock();
+    metadata->fd =
+        FileUtil::openForRead(*threadCtx_, fullPath, metadata->directReads);
+    metadata->needToClose = (metadata->fd >= 0);
+    lock.lock();
+  }
+  if (maxQueuedSources_ > 0) {
+    // the metadata goes away with the last source of the file, hold it while
+    // the sources are created
+    metadata->deleteWithLastSource = true;
+    ++metadata->numSources;
+    createIntoQueueInternal(metadata, fileInfo.fileName);
+    FileByteSource::releaseMetaData(metadata);
+    return;
   }
-  std::unique_lock<std::mutex> lock(mutex_);
   sharedFileData_.emplace_back(metadata);
-  createIntoQueueInternal(metadata);
+  createIntoQueueInternal(metadata, fileInfo.fileName);
 }
 
-void DirectorySourceQueue::createIntoQueueInternal(SourceMetaData *metadata) {
+void DirectorySourceQueue::createIntoQueueInternal(SourceMetaData *metadata,
+                                                   const string &relPath) {
   // TODO: currently we are treating small files(size less than blocksize) as
   // blocks. Also, we transfer file name in the header for all the blocks for a
   // large file. This can be optimized as follows -
@@ -470,7 +967,6 @@ void DirectorySourceQueue::createIntoQueueInternal(SourceMetaData *metadata) {
   // block and use a shorter header for subsequent blocks. Also, we can remove
   // block size once negotiated, since blocksize is sort of fixed.
   auto &fileSize = metadata->size;
-  auto &relPath = metadata->relPath;
   int64_t blockSizeBytes = blockSizeMbytes_ * 1024 * 1024;
   bool enableBlockTransfer = blockSizeBytes > 0;
   if (!enableBlockTransfer) {
@@ -498,6 +994,19 @@ void DirectorySourceQueue::createIntoQueueInternal(SourceMetaData *metadata) {
                << fileSize << " " << it->second.getFileSize();
     allocationStatus = EXISTS_TOO_LARGE;
     prevSeqId = it->second.getSeqId();
+  } else if (incrementalSync_ && it->second.getMtimeNs() >= 0 &&
+             it->second.getMtimeNs() != metadata->mtimeNs) {
+    // modified since the receiver got it, or not completely received (the
+    // mtime is only set once a file is complete). The whole file is sent
+    // again over the copy of the receiver. Receivers not reporting mtimes are
+    // compared by size
+    remainingChunks.emplace_back(0, fileSize);
+    seqId = it->second.getSeqId();
+    WVLOG(1) << "File changed since the previous transfer " << relPath << " "
+             << metadata->mtimeNs << " " << it->second.getMtimeNs();
+    allocationStatus = it->second.getFileSize() < fileSize
+                           ? EXISTS_TOO_SMALL
+                           : EXISTS_CORRECT_SIZE;
   } else {
     auto &fileChunksInfo = it->second;
     // Some portion of the file was sent in previous transfers. Receiver sends
@@ -506,7 +1015,8 @@ void DirectorySourceQueue::createIntoQueueInternal(SourceMetaData *metadata) {
     previouslySentBytes_ += fileChunksInfo.getTotalChunkSize();
     remainingChunks = fileChunksInfo.getRemainingChunks(fileSize);
     if (remainingChunks.empty()) {
-      WLOG(INFO) << relPath << " completely sent in previous transfer";
+      WVLOG(1) << relPath << " completely sent in previous transfer";
+      ++numUnchangedFiles_;
       return;
     }
     seqId = fileChunksInfo.getSeqId();
@@ -517,6 +1027,12 @@ void DirectorySourceQueue::createIntoQueueInternal(SourceMetaData *metadata) {
   metadata->seqId = seqId;
   metadata->prevSeqId = prevSeqId;
   metadata->allocationStatus = allocationStatus;
+  if (collectDirectories_) {
+    addParentDirectories(relPath);
+  }
+  if (enableBlockTransfer && maxBlockSize_ > 0) {
+    blockSize = pickBlockSize(fileSize);
+  }
 
   for (const auto &chunk : remainingChunks) {
     int64_t offset = chunk.start_;
@@ -525,7 +1041,7 @@ void DirectorySourceQueue::createIntoQueueInternal(SourceMetaData *metadata) {
       const int64_t size = std::min<int64_t>(remainingBytes, blockSize);
       std::unique_ptr<ByteSource> source =
           std::make_unique<FileByteSource>(metadata, size, offset);
-      sourceQueue_.push(std::move(source));
+      enqueueSource(std::move(source));
       remainingBytes -= size;
       offset += size;
       blockCount++;
@@ -537,50 +1053,402 @@ void DirectorySourceQueue::createIntoQueueInternal(SourceMetaData *metadata) {
   smartNotify(blockCount);
 }
 
+int64_t DirectorySourceQueue::pickBlockSize(int64_t fileSize) {
+  // the bytes discovered so far are a lower bound of the total. The blocks of
+  // the first files discovered are smaller, the largest first order of the
+  // queue sends them at the end
+  int64_t blockSize =
+      (totalFileSize_ + fileSize) / (numClientThreads_ * kBlocksPerThread);
+  blockSize = std::min(maxBlockSize_,
+                       std::max(minBlockSize_, roundToDiskBlocks(blockSize)));
+  if (fileSize > blockSize) {
+    // even blocks, rather than a small last one
+    const int64_t numBlocks = (fileSize + blockSize - 1) / blockSize;
+    blockSize = roundToDiskBlocks((fileSize + numBlocks - 1) / numBlocks);
+  }
+  BlockSizingStats &stats = blockSizingStats_;
+  if (stats.minBlockSize < 0 || blockSize < stats.minBlockSize) {
+    stats.minBlockSize = blockSize;
+  }
+  stats.maxBlockSize = std::max(stats.maxBlockSize, blockSize);
+  return blockSize;
+}
+
+void DirectorySourceQueue::splitForTail(ByteSource &source) {
+  if (!initFinished_ ||
+      source.getMetaData().allocationStatus == TO_BE_DELETED) {
+    // the bytes left are not known yet
+    return;
+  }
+  if (source.getTransferStats().getFailedAttempts() > 0) {
+    // other threads may already have sent the number of blocks
+    return;
+  }
+  const int64_t size = source.getSize();
+  const int64_t bytesLeft = numQueuedBytes_.load() + size;
+  const int64_t tailBlockSize =
+      std::max(minBlockSize_, roundToDiskBlocks(bytesLeft / numClientThreads_ /
+                                                kTailBlocksPerThread));
+  if (size < tailBlockSize + minBlockSize_) {
+    // the rest would not be worth a block
+    return;
+  }
+  WVLOG(1) << "Cutting " << source.getIdentifier() << " at "
+           << source.getOffset() << " down to " << tailBlockSize << " from "
+           << size << ", " << bytesLeft << " bytes left";
+  enqueueSource(source.splitAt(tailBlockSize));
+  ++numBlocks_;
+  BlockSizingStats &stats = blockSizingStats_;
+  ++stats.numTailSplits;
+  if (stats.minTailBlockSize < 0 || tailBlockSize < stats.minTailBlockSize) {
+    stats.minTailBlockSize = tailBlockSize;
+  }
+  conditionNotEmpty_.notify_one();
+}
+
+bool DirectorySourceQueue::isTailNear() const {
+  if (maxBlockSize_ <= 0 || !initFinished_.load()) {
+    return false;
+  }
+  // sources are at most maxBlockSize_ long, none is split while the tail
+  // blocks would be larger
+  const int64_t tailBlockSize =
+      numQueuedBytes_.load() / numClientThreads_ / kTailBlocksPerThread;
+  return tailBlockSize < maxBlockSize_;
+}
+
+bool DirectorySourceQueue::mayCutSource(const ByteSource &source) const {
+  return isTailNear() ||
+         (segmentSize_ > 0 && source.getSize() >= 2 * segmentSize_);
+}
+
+void DirectorySourceQueue::cutSource(const ThreadCtx *callerThreadCtx,
+                                     ByteSource &source, bool isRest) {
+  if (maxBlockSize_ > 0 && !isRest) {
+    splitForTail(source);
+  }
+  if (segmentSize_ > 0) {
+    cutIntoSegment(callerThreadCtx, source);
+  }
+}
+
+void DirectorySourceQueue::cutIntoSegment(const ThreadCtx *callerThreadCtx,
+                                          ByteSource &source) {
+  if (source.getMetaData().allocationStatus == TO_BE_DELETED ||
+      source.getSize() < 2 * segmentSize_) {
+    return;
+  }
+  if (source.getTransferStats().getFailedAttempts() > 0) {
+    // sent whole after a failure, other threads may already have sent the
+    // number of blocks
+    return;
+  }
+  WDT_CHECK(blockRests_.find(callerThreadCtx) == blockRests_.end())
+      << "Thread already has the rest of a block";
+  blockRests_[callerThreadCtx] = source.splitAt(segmentSize_);
+  countBlockRest(callerThreadCtx, 1);
+  ++numBlocks_;
+  ++blockSizingStats_.numSegments;
+}
+
+bool DirectorySourceQueue::takeBlockRest(const ThreadCtx *callerThreadCtx,
+                                         std::unique_ptr<ByteSource> &source) {
+  auto it = blockRests_.find(callerThreadCtx);
+  if (it == blockRests_.end()) {
+    return false;
+  }
+  source = std::move(it->second);
+  blockRests_.erase(it);
+  countBlockRest(callerThreadCtx, -1);
+  takeDeviceSlot(*source);
+  return true;
+}
+
+std::atomic<int32_t> *DirectorySourceQueue::getNumBlockRests(
+    const ThreadCtx *callerThreadCtx) const {
+  const int index = callerThreadCtx->getThreadIndex();
+  if (!numBlockRests_ || index < 0 || index >= numClientThreads_) {
+    return nullptr;
+  }
+  return &numBlockRests_[index];
+}
+
+void DirectorySourceQueue::countBlockRest(const ThreadCtx *callerThreadCtx,
+                                          int32_t delta) {
+  std::atomic<int32_t> *numBlockRests = getNumBlockRests(callerThreadCtx);
+  if (numBlockRests != nullptr) {
+    *numBlockRests += delta;
+  }
+}
+
+bool DirectorySourceQueue::mayOwnBlockRest(
+    const ThreadCtx *callerThreadCtx) const {
+  if (segmentSize_ <= 0) {
+    return false;
+  }
+  // threads without a known index always look for their rest under mutex_
+  const std::atomic<int32_t> *numBlockRests =
+      getNumBlockRests(callerThreadCtx);
+  return numBlockRests == nullptr || numBlockRests->load() > 0;
+}
+
+bool DirectorySourceQueue::stealBlockRest(std::unique_ptr<ByteSource> &source) {
+  auto largest = blockRests_.end();
+  for (auto it = blockRests_.begin(); it != blockRests_.end(); ++it) {
+    if (largest == blockRests_.end() ||
+        it->second->getSize() > largest->second->getSize()) {
+      largest = it;
+    }
+  }
+  if (largest == blockRests_.end()) {
+    return false;
+  }
+  ByteSource &rest = *largest->second;
+  const int64_t size = rest.getSize();
+  if (size < 2 * segmentSize_) {
+    // the thread sending the block gets another one instead
+    source = std::move(largest->second);
+    countBlockRest(largest->first, -1);
+    blockRests_.erase(largest);
+  } else {
+    // the first half stays with the thread sending the block
+    source = rest.splitAt(roundToDiskBlocks(size / 2));
+    ++numBlocks_;
+  }
+  WVLOG(1) << "Taking over " << source->getIdentifier() << " at "
+           << source->getOffset() << " of size " << source->getSize()
+           << " from the rest of size " << size;
+  ++blockSizingStats_.numStolenRests;
+  takeDeviceSlot(*source);
+  return true;
+}
+
+void DirectorySourceQueue::takeDeviceSlot(const ByteSource &source) {
+  if (maxThreadsPerDevice_ <= 0) {
+    return;
+  }
+  // over the limit if need be: the rest of a block continues a read of the
+  // device, or ends the transfer
+  ++getDeviceQueue(source.getMetaData().deviceId).numInFlight;
+}
+
+void DirectorySourceQueue::addParentDirectories(const string &relPath) {
+  size_t pos = relPath.rfind('/');
+  if (pos == string::npos) {
+    // file directly under the root
+    return;
+  }
+  string dir = relPath.substr(0, pos + 1);
+  if (dir == lastParentDirectory_) {
+    // files of a directory are usually discovered together
+    return;
+  }
+  lastParentDirectory_ = dir;
+  std::vector<string> missingDirs;
+  while (discoveredDirectories_.insert(dir).second) {
+    missingDirs.push_back(dir);
+    pos = (dir.size() < 2 ? string::npos : dir.rfind('/', dir.size() - 2));
+    if (pos == string::npos) {
+      break;
+    }
+    dir.resize(pos + 1);
+  }
+  // ancestors first
+  newDirectories_.insert(newDirectories_.end(), missingDirs.rbegin(),
+                         missingDirs.rend());
+}
+
+bool DirectorySourceQueue::hasNewDirectories() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return !newDirectories_.empty();
+}
+
+void DirectorySourceQueue::getNextDirectories(std::vector<string> &directories,
+                                              int64_t maxBytes) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  int64_t totalBytes = 0;
+  while (!newDirectories_.empty()) {
+    const int64_t dirBytes = newDirectories_.front().size();
+    if (!directories.empty() && totalBytes + dirBytes > maxBytes) {
+      break;
+    }
+    totalBytes += dirBytes;
+    directories.emplace_back(std::move(newDirectories_.front()));
+    newDirectories_.pop_front();
+  }
+}
+
 std::vector<TransferStats> &DirectorySourceQueue::getFailedSourceStats() {
-  while (!sourceQueue_.empty()) {
-    failedSourceStats_.emplace_back(
-        std::move(sourceQueue_.top()->getTransferStats()));
-    sourceQueue_.pop();
+  for (auto &source : sourcesToDelete_) {
+    addFailedSourceStats(*source);
+  }
+  sourcesToDelete_.clear();
+  numSourcesToDelete_ = 0;
+  for (int i = 0; i < numDeviceQueues_.load(); i++) {
+    deviceQueues_[i]->sources.drain(
+        [this](std::unique_ptr<ByteSource> &source) {
+          addFailedSourceStats(*source);
+        });
+  }
+  for (auto &rest : blockRests_) {
+    addFailedSourceStats(*rest.second);
   }
+  blockRests_.clear();
   return failedSourceStats_;
 }
 
+bool DirectorySourceQueue::compactSource(std::unique_ptr<ByteSource> &source,
+                                         bool keepStats,
+                                         CompactSource &compact) const {
+  const SourceMetaData &metadata = source->getMetaData();
+  // files with a descriptor of the caller could not be opened again, and the
+  // other fields of the metadata are only set with download resumption
+  if (!isBounded() || metadata.pathTable != &pathTable_ ||
+      (metadata.fd >= 0 && !metadata.needToClose) ||
+      metadata.allocationStatus != NOT_EXISTS || metadata.prevSeqId != 0) {
+    return false;
+  }
+  compact.seqId = metadata.seqId;
+  compact.offset = source->getOffset();
+  compact.size = source->getSize();
+  compact.pathIndex = metadata.pathIndex;
+  compact.fileSize = metadata.size;
+  compact.mtimeNs = metadata.mtimeNs;
+  compact.deviceId = metadata.deviceId;
+  compact.physicalOffset = metadata.physicalOffset;
+  compact.physicalOffsetLocated = metadata.physicalOffsetLocated;
+  compact.directReads = metadata.directReads;
+  TransferStats &stats = source->getTransferStats();
+  compact.errorCode = stats.getLocalErrorCode();
+  compact.failedAttempts = stats.getFailedAttempts();
+  compact.effectiveHeaderBytes = stats.getEffectiveHeaderBytes();
+  if (keepStats) {
+    compact.stats = std::make_unique<TransferStats>(std::move(stats));
+  }
+  source.reset();
+  return true;
+}
+
+std::unique_ptr<ByteSource> DirectorySourceQueue::rebuildSource(
+    CompactSource &compact) {
+  SourceMetaData *metadata = new SourceMetaData();
+  metadata->pathTable = &pathTable_;
+  metadata->pathIndex = compact.pathIndex;
+  metadata->seqId = compact.seqId;
+  metadata->size = compact.fileSize;
+  metadata->mtimeNs = compact.mtimeNs;
+  metadata->deviceId = compact.deviceId;
+  metadata->physicalOffset = compact.physicalOffset;
+  metadata->physicalOffsetLocated = compact.physicalOffsetLocated;
+  metadata->directReads = compact.directReads;
+  // the sources of the file still alive keep the metadata they had
+  metadata->deleteWithLastSource = true;
+  std::unique_ptr<ByteSource> source =
+      std::make_unique<FileByteSource>(metadata, compact.size, compact.offset);
+  TransferStats &stats = source->getTransferStats();
+  if (compact.stats) {
+    stats = std::move(*compact.stats);
+    compact.stats.reset();
+    return source;
+  }
+  // what the source stats were once sent, see SenderThread::sendBlocks()
+  stats.setId(metadata->getRelPath());
+  stats.setLocalErrorCode(compact.errorCode);
+  for (int64_t i = 0; i < compact.failedAttempts; i++) {
+    stats.incrFailedAttempts();
+  }
+  if (compact.errorCode == OK) {
+    stats.incrNumBlocks();
+    stats.addEffectiveBytes(compact.effectiveHeaderBytes, compact.size);
+  }
+  return source;
+}
+
+void DirectorySourceQueue::failSource(std::unique_ptr<ByteSource> source) {
+  source->close();
+  releaseSource(*source);
+  std::lock_guard<std::mutex> lock(mutex_);
+  addFailedSourceStats(*source);
+  hasSourceErrors_ = true;
+}
+
+void DirectorySourceQueue::addFailedSourceStats(ByteSource &source) {
+  TransferStats &stats = source.getTransferStats();
+  // never opened sources do not have their id yet
+  if (stats.getId().empty()) {
+    stats.setId(source.getIdentifier());
+  }
+  failedSourceStats_.emplace_back(std::move(stats));
+}
+
 std::vector<string> &DirectorySourceQueue::getFailedDirectories() {
   return failedDirectories_;
 }
 
 bool DirectorySourceQueue::enqueueFiles() {
   for (auto &info : fileInfo_) {
-    if (threadCtx_->getAbortChecker()->shouldAbort()) {
-      WLOG(ERROR) << "Directory transfer thread aborted";
+    if (!enqueueFile(info)) {
       return false;
     }
-    string fullPath = rootDir_ + info.fileName;
-    if (info.fileSize < 0) {
-      struct stat fileStat;
-      if (stat(fullPath.c_str(), &fileStat) != 0) {
-        WPLOG(ERROR) << "stat failed on path " << fullPath;
-
-        TransferStats failedSourceStat(info.fileName);
-        failedSourceStat.setLocalErrorCode(BYTE_SOURCE_READ_ERROR);
-        {
-          std::unique_lock<std::mutex> lock(mutex_);
-          failedSourceStats_.emplace_back(std::move(failedSourceStat));
-        }
+  }
+  return true;
+}
+
+bool DirectorySourceQueue::enqueueManifestFiles() {
+  BinaryManifestReader reader(manifestPath_);
+  const bool opened = reader.open();
+  // entries are queued as they are read, a bounded queue pauses the reading
+  WdtFileInfo info("", -1, directReads_);
+  while (opened && reader.next(directReads_, info)) {
+    if (!enqueueFile(info)) {
+      return false;
+    }
+  }
+  if (!opened || reader.hasError()) {
+    TransferStats failedSourceStat(manifestPath_);
+    failedSourceStat.setLocalErrorCode(BYTE_SOURCE_READ_ERROR);
+    std::unique_lock<std::mutex> lock(mutex_);
+    failedSourceStats_.emplace_back(std::move(failedSourceStat));
+    hasSourceErrors_ = true;
+    return false;
+  }
+  WLOG(INFO) << "Enqueued the " << reader.getNumRead()
+             << " files of manifest " << manifestPath_;
+  return true;
+}
 
-        return false;
+bool DirectorySourceQueue::enqueueFile(WdtFileInfo &info) {
+  if (threadCtx_->getAbortChecker()->shouldAbort()) {
+    WLOG(ERROR) << "Directory transfer thread aborted";
+    return false;
+  }
+  string fullPath = rootDir_ + info.fileName;
+  if (info.fileSize < 0) {
+    struct stat fileStat;
+    if (stat(fullPath.c_str(), &fileStat) != 0) {
+      WPLOG(ERROR) << "stat failed on path " << fullPath;
+
+      TransferStats failedSourceStat(info.fileName);
+      failedSourceStat.setLocalErrorCode(BYTE_SOURCE_READ_ERROR);
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        failedSourceStats_.emplace_back(std::move(failedSourceStat));
+        hasSourceErrors_ = true;
       }
-      info.fileSize = fileStat.st_size;
+
+      return false;
     }
-    createIntoQueue(fullPath, info);
+    info.fileSize = fileStat.st_size;
   }
+  const int64_t pathIndex = pathTable_.addFilePath(info.fileName);
+  createIntoQueue(fullPath, info, -1, pathIndex);
   return true;
 }
 
 bool DirectorySourceQueue::finished() const {
   std::lock_guard<std::mutex> lock(mutex_);
-  return initFinished_ && sourceQueue_.empty();
+  return initFinished_ && !hasQueuedSources() && sourcesToDelete_.empty() &&
+         blockRests_.empty() && numUnsettledPops_.load() == 0;
 }
 
 int64_t DirectorySourceQueue::getCount() const {
@@ -629,7 +1497,7 @@ void DirectorySourceQueue::enqueueFilesToBeDeleted() {
   }
   std::set<std::string> discoveredFiles;
   for (const SourceMetaData *metadata : sharedFileData_) {
-    discoveredFiles.insert(metadata->relPath);
+    discoveredFiles.insert(metadata->getRelPath());
   }
   int64_t numFilesToBeDeleted = 0;
   for (auto &it : previouslyTransferredChunks_) {
@@ -651,7 +1519,8 @@ void DirectorySourceQueue::enqueueFilesToBeDeleted() {
     // create a byte source with size and offset equal to 0
     std::unique_ptr<ByteSource> source =
         std::make_unique<FileByteSource>(metadata, 0, 0);
-    sourceQueue_.push(std::move(source));
+    sourcesToDelete_.push_back(std::move(source));
+    ++numSourcesToDelete_;
     numFilesToBeDeleted++;
   }
   numEntries_ += numFilesToBeDeleted;
@@ -659,43 +1528,122 @@ void DirectorySourceQueue::enqueueFilesToBeDeleted() {
   smartNotify(numFilesToBeDeleted);
 }
 
+bool DirectorySourceQueue::hasSourcesToDelete() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return !sourcesToDelete_.empty();
+}
+
+void DirectorySourceQueue::getNextSourcesToDelete(
+    ThreadCtx *callerThreadCtx,
+    std::vector<std::unique_ptr<ByteSource>> &sources, int64_t maxBytes,
+    int64_t perSourceBytes) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  int64_t numBytes = 0;
+  while (!sourcesToDelete_.empty()) {
+    const SourceMetaData &metadata = sourcesToDelete_.front()->getMetaData();
+    numBytes += metadata.getRelPath().size() + perSourceBytes;
+    if (!sources.empty() && numBytes > maxBytes) {
+      break;
+    }
+    std::unique_ptr<ByteSource> source = std::move(sourcesToDelete_.front());
+    sourcesToDelete_.pop_front();
+    --numSourcesToDelete_;
+    // no-op for files to be deleted, kept for symmetry with getNextSource
+    source->open(callerThreadCtx);
+    numBlocksDequeued_++;
+    sources.emplace_back(std::move(source));
+  }
+  if (sourcesToDelete_.empty() && !hasQueuedSources() && initFinished_) {
+    conditionNotEmpty_.notify_all();
+  }
+}
+
 std::unique_ptr<ByteSource> DirectorySourceQueue::getNextSource(
     ThreadCtx *callerThreadCtx, ErrorCode &status) {
   std::unique_ptr<ByteSource> source;
   while (true) {
-    std::unique_lock<std::mutex> lock(mutex_);
-    while (sourceQueue_.empty() && !initFinished_) {
-      conditionNotEmpty_.wait(lock);
+    // sources are popped without mutex_, which is only needed to wait for
+    // new sources, to send the files to delete first, to go on with the rest
+    // of a block or to cut a source
+    std::unique_lock<std::mutex> lock(mutex_, std::defer_lock);
+    bool popped = false;
+    if (numSourcesToDelete_.load() == 0 && !mayOwnBlockRest(callerThreadCtx)) {
+      // the cuts must be done before other threads see the end of the
+      // transfer, which waits for the pops counted here
+      const bool mayCut = (maxBlockSize_ > 0 || segmentSize_ > 0);
+      if (mayCut) {
+        ++numUnsettledPops_;
+      }
+      popped = popSource(callerThreadCtx, source);
+      if (popped && mayCut && mayCutSource(*source)) {
+        lock.lock();
+        cutSource(callerThreadCtx, *source, false);
+      }
+      if (mayCut) {
+        --numUnsettledPops_;
+      }
     }
-    if (!failedSourceStats_.empty() || !failedDirectories_.empty()) {
-      status = ERROR;
-    } else {
-      status = OK;
+    if (!popped) {
+      lock.lock();
+      bool isRest = false;
+      while (true) {
+        if (!sourcesToDelete_.empty()) {
+          source = std::move(sourcesToDelete_.front());
+          sourcesToDelete_.pop_front();
+          --numSourcesToDelete_;
+          break;
+        }
+        // the thread goes on with the block it is sending
+        if (takeBlockRest(callerThreadCtx, source)) {
+          isRest = true;
+          break;
+        }
+        // pushes and releases happen under mutex_, a source can not become
+        // available before the wait. The queues are checked before the pops
+        // which may still add sources
+        if (popSource(callerThreadCtx, source) ||
+            (initFinished_ && !hasQueuedSources() &&
+             numUnsettledPops_.load() == 0)) {
+          break;
+        }
+        conditionNotEmpty_.wait(lock);
+      }
+      if (!source && stealBlockRest(source)) {
+        // nothing left but the blocks being sent by the other threads
+        isRest = true;
+      }
+      if (source) {
+        cutSource(callerThreadCtx, *source, isRest);
+      }
+    } else if (!lock.owns_lock() && !hasQueuedSources()) {
+      lock.lock();
     }
-    if (sourceQueue_.empty()) {
-      return nullptr;
+    if (lock.owns_lock()) {
+      if (!hasQueuedSources() && sourcesToDelete_.empty() && initFinished_) {
+        conditionNotEmpty_.notify_all();
+      }
+      lock.unlock();
     }
-    // using const_cast since priority_queue returns a const reference
-    source = std::move(
-        const_cast<std::unique_ptr<ByteSource> &>(sourceQueue_.top()));
-    sourceQueue_.pop();
-    if (sourceQueue_.empty() && initFinished_) {
-      conditionNotEmpty_.notify_all();
+    status = hasSourceErrors_.load() ? ERROR : OK;
+    if (!source) {
+      return nullptr;
     }
-    lock.unlock();
+    resumeDiscoveryIfDrained();
     WVLOG(1) << "got next source " << rootDir_ + source->getIdentifier()
              << " size " << source->getSize();
     // try to open the source
     if (source->open(callerThreadCtx) == OK) {
-      lock.lock();
       numBlocksDequeued_++;
       return source;
     }
     source->close();
+    releaseSource(*source);
     // we need to lock again as we will be adding element to failedSourceStats
     // vector
     lock.lock();
-    failedSourceStats_.emplace_back(std::move(source->getTransferStats()));
+    addFailedSourceStats(*source);
+    hasSourceErrors_ = true;
+    source.reset();
   }
 }
 }
@@ -11,17 +11,23 @@
 #include <dirent.h>
 #include <glog/logging.h>
 #include <algorithm>
+#include <atomic>
 #include <condition_variable>
+#include <deque>
 #include <mutex>
-#include <queue>
 #include <string>
 #include <thread>
 #include <unordered_map>
+#include <unordered_set>
 #include <utility>
 
 #include <wdt/Protocol.h>
 #include <wdt/SourceQueue.h>
 #include <wdt/WdtTransferRequest.h>
+#include <wdt/util/ByteSourceQueue.h>
+#include <wdt/util/DirectoryScanner.h>
+#include <wdt/util/DiscoveryCache.h>
+#include <wdt/util/PathTable.h>
 #include <wdt/util/FileByteSource.h>
 
 namespace facebook {
@@ -83,7 +89,9 @@ class DirectorySourceQueue : public SourceQueue {
    * @param callerThreadCtx context of the calling thread
    * @param status          this variable is set to the status of the transfer
    *
-   * @return next FileByteSource to consume or nullptr when finished
+   * @return next FileByteSource to consume or nullptr when finished. With
+   *         a limit of threads per device, the source must be released with
+   *         releaseSource() once read
    */
   std::unique_ptr<ByteSource> getNextSource(ThreadCtx *callerThreadCtx,
                                             ErrorCode &status) override;
@@ -118,16 +126,17 @@ class DirectorySourceQueue : public SourceQueue {
    * Sets regex representing directories to exclude for transfer
    *
    * @param pruneDirPattern         directory exclusion regex
+   *
+   * Patterns can also be globs prefixed with "glob:", see PathMatcher
    */
   void setPruneDirPattern(const std::string &pruneDirPattern);
 
   /**
    * Sets the number of consumer threads for this queue. used as threshold
-   * between notify and notifyAll
+   * between notify and notifyAll. The rests of the blocks of the threads
+   * whose index is below it are tracked without the lock
    */
-  void setNumClientThreads(int64_t numClientThreads) {
-    numClientThreads_ = numClientThreads;
-  }
+  void setNumClientThreads(int64_t numClientThreads);
 
   /**
    * Sets the count and trigger for files to open during discovery
@@ -145,11 +154,160 @@ class DirectorySourceQueue : public SourceQueue {
     directReads_ = directReads;
   }
 
+  /**
+   * Hands out the sources in the order of their files on disk instead of
+   * largest first, to keep a spinning disk reading sequentially. Must be
+   * called before discovery starts
+   */
+  void setOrderByPhysicalOffset(bool orderByPhysicalOffset);
+
+  /**
+   * Limits the number of sources of a device (st_dev) handed out at once.
+   * Sources are grouped by device and a thread skips the devices already at
+   * their limit, so that each disk gets its own queue depth while the other
+   * threads keep reading from the other disks. Must be called before
+   * discovery starts
+   *
+   * @param maxThreadsPerDevice   limit, 0 for no limit
+   */
+  void setMaxThreadsPerDevice(int32_t maxThreadsPerDevice) {
+    maxThreadsPerDevice_ = maxThreadsPerDevice;
+  }
+
+  /**
+   * Bounds the number of queued sources: discovery pauses when that many
+   * sources are queued and resumes once the sender threads drained half of
+   * them. The metadata of a file is no longer kept for the whole transfer but
+   * deleted along with the last source of the file. The transfer histories
+   * compact the sources once sent (see compactSource()), so only the path
+   * table and a few fields per sent block are kept till the blocks are
+   * acknowledged, on checkpoints and at the end. Download resumption needs
+   * the metadata of all the files and can not be used in this mode. Must be
+   * called before discovery starts
+   *
+   * @param maxQueuedSources    high-water mark, 0 for no limit
+   */
+  void setMaxQueuedSources(int64_t maxQueuedSources) {
+    maxQueuedSources_ = maxQueuedSources;
+  }
+
+  /**
+   * Keeps the result of the discovery in a cache file of that directory,
+   * keyed by the root directory and the patterns. The next discovery of the
+   * same tree only rescans the directories whose mtime changed, see
+   * DiscoveryCache. Not used when following symlinks. Must be called before
+   * discovery starts
+   *
+   * @param discoveryCacheDir   directory of the cache files, empty to disable
+   */
+  void setDiscoveryCacheDir(const std::string &discoveryCacheDir) {
+    discoveryCacheDir_ = discoveryCacheDir;
+  }
+
+  /**
+   * Picks the block size of every file instead of using the one of
+   * setBlockSizeMbytes. A file is cut in even blocks of about the bytes
+   * discovered so far (a lower bound of the total) over a few blocks per
+   * thread. Once discovery finished, the blocks handed out are cut down to
+   * spread the bytes left over the threads. Must be called before discovery
+   * starts, only with block transfer enabled
+   *
+   * @param minBlockSize    smallest block size in bytes
+   * @param maxBlockSize    largest block size in bytes, 0 to disable
+   */
+  void setAdaptiveBlockSizes(int64_t minBlockSize, int64_t maxBlockSize);
+
+  /**
+   * Hands out the blocks in segments, each sent as a block of its own. The
+   * rest of a block is kept for the thread sending it, which gets the next
+   * segment from getNextSource, so that once nothing else is left the idle
+   * threads can take over half of the largest rest instead of a slow thread
+   * sending it alone. Only the rest can be moved, the receiver is told the
+   * size of a block before its data. Must be called before discovery starts
+   *
+   * @param segmentSize   size of the segments in bytes, 0 to disable
+   */
+  void setBlockSegmentSize(int64_t segmentSize);
+
+  /**
+   * Queues the rest of the block of a thread which stops sending, for the
+   * other threads to send it without waiting for the end of the transfer
+   *
+   * @param callerThreadCtx   context of the thread given to getNextSource
+   */
+  void returnBlockRest(const ThreadCtx *callerThreadCtx);
+
+  /// @return   block sizes picked, see setAdaptiveBlockSizes
+  BlockSizingStats getBlockSizingStats() const;
+
+  /// @return   whether discovery is bounded, see setMaxQueuedSources
+  bool isBounded() const {
+    return maxQueuedSources_ > 0;
+  }
+
+  /**
+   * Tells that a source returned by getNextSource is no longer being read,
+   * freeing its slot on its device. Must be called once for every source
+   * returned by getNextSource
+   *
+   * @param source    the source
+   */
+  void releaseSource(const ByteSource &source);
+
   /// enable extra file deletion in the receiver side
   void enableFileDeletion() {
     deleteFiles_ = true;
   }
 
+  /**
+   * Enables incremental sync: a file the receiver already has is only skipped
+   * if its modification time is also the same, otherwise it is sent again as
+   * a whole. The modification time of the files of the file list is looked up
+   *
+   * @param incrementalSync   whether to compare modification times
+   */
+  void setIncrementalSync(bool incrementalSync) {
+    incrementalSync_ = incrementalSync;
+  }
+
+  /// enable collection of the directories to be created on the receiver side
+  void enableDirectoryList() {
+    collectDirectories_ = true;
+  }
+
+  /// @return   whether there are discovered directories not yet handed out
+  bool hasNewDirectories() const;
+
+  /// @return   whether the next source is a file to be deleted on the
+  ///           receiver side
+  bool hasSourcesToDelete() const;
+
+  /**
+   * Hands out the next sources as long as they are files to be deleted on the
+   * receiver side. These are queued ahead of all the other sources.
+   *
+   * @param callerThreadCtx context of the calling thread
+   * @param sources         vector to fill
+   * @param maxBytes        maximum total size, at least one source is returned
+   *                        if the next one is to be deleted
+   * @param perSourceBytes  size of a source in addition to its name
+   */
+  void getNextSourcesToDelete(ThreadCtx *callerThreadCtx,
+                              std::vector<std::unique_ptr<ByteSource>> &sources,
+                              int64_t maxBytes, int64_t perSourceBytes);
+
+  /**
+   * Hands out discovered directories which were not handed out before. Parent
+   * directories always come before their children.
+   *
+   * @param directories   vector to fill, directories are relative to the root
+   *                      and end with '/'
+   * @param maxBytes      maximum total length of the names, at least one
+   *                      directory is returned if there is any
+   */
+  void getNextDirectories(std::vector<std::string> &directories,
+                          int64_t maxBytes);
+
   /**
    * Stat the FileInfo input files (if their size aren't already specified) and
    * insert them in the queue
@@ -158,12 +316,31 @@ class DirectorySourceQueue : public SourceQueue {
    */
   void setFileInfo(const std::vector<WdtFileInfo> &fileInfo);
 
+  /**
+   * Reads the files to transfer from a binary manifest instead of recursing
+   * over the root directory. The files are queued as the manifest is read,
+   * see BinaryManifest
+   *
+   * @param manifestPath          path of the binary manifest
+   */
+  void setBinaryManifest(const std::string &manifestPath);
+
   /// @param blockSizeMbytes    block size in Mbytes
   void setBlockSizeMbytes(int64_t blockSizeMbytes);
 
   /// Get the file info in this directory queue
   const std::vector<WdtFileInfo> &getFileInfo() const;
 
+  /**
+   * Sets the number of threads exploring the directory tree in parallel
+   *
+   * @param numDiscoveryThreads   number of threads, including the one
+   *                              building the queue
+   */
+  void setNumDiscoveryThreads(int numDiscoveryThreads) {
+    numDiscoveryThreads_ = numDiscoveryThreads;
+  }
+
   /**
    * Sets whether to follow symlink or not
    *
@@ -195,6 +372,66 @@ class DirectorySourceQueue : public SourceQueue {
    */
   void returnToQueue(std::unique_ptr<ByteSource> &source);
 
+  /// sent source reduced to what is needed to send it again, see
+  /// compactSource()
+  struct CompactSource {
+    int64_t seqId{0};
+    int64_t offset{0};
+    int64_t size{0};
+    /// index of the file in the path table of the queue
+    int64_t pathIndex{-1};
+    /// fields of the metadata of the file
+    int64_t fileSize{0};
+    int64_t mtimeNs{-1};
+    int64_t deviceId{-1};
+    int64_t physicalOffset{-1};
+    bool physicalOffsetLocated{false};
+    bool directReads{false};
+    /// stats needed to account for a failure of the source
+    ErrorCode errorCode{OK};
+    int64_t failedAttempts{0};
+    int64_t effectiveHeaderBytes{0};
+    /// all the stats of the source, only when asked to keep them
+    std::unique_ptr<TransferStats> stats;
+  };
+
+  /**
+   * Frees a sent source, and the metadata of its file along with its last
+   * source, keeping only what is needed to send it again. Only the sources
+   * of a bounded queue whose file is in the path table, and not from a
+   * previous transfer, can be compacted.
+   *
+   * @param source      source sent, reset if compacted
+   * @param keepStats   whether to keep all the stats of the source
+   * @param compact     set to the compacted source
+   *
+   * @return            whether the source was compacted
+   */
+  bool compactSource(std::unique_ptr<ByteSource> &source, bool keepStats,
+                     CompactSource &compact) const;
+
+  /**
+   * Rebuilds a compacted source which has to be sent again. Its file gets a
+   * metadata of its own, deleted with the source
+   *
+   * @param compact     compacted source, its stats are moved to the source
+   *
+   * @return            source to return to the queue
+   */
+  std::unique_ptr<ByteSource> rebuildSource(CompactSource &compact);
+
+  /// @return   relative path of the file of a compacted source
+  std::string getRelPath(const CompactSource &compact) const {
+    return pathTable_.getRelPath(compact.pathIndex);
+  }
+
+  /**
+   * Reports a source which can never be sent as failed, without retrying it
+   *
+   * @param source                source handed out by the queue
+   */
+  void failSource(std::unique_ptr<ByteSource> source);
+
   /**
    * Returns list of files which were not transferred. It empties the queue and
    * adds queue entries to the failed file list. This function should be called
@@ -212,7 +449,7 @@ class DirectorySourceQueue : public SourceQueue {
 
   ~DirectorySourceQueue() override;
 
-  /// @return   discovered files metadata
+  /// @return   discovered files metadata, not kept in bounded mode
   std::vector<SourceMetaData *> &getDiscoveredFilesMetaData();
 
   /// Returns the time it took to traverse the directory tree
@@ -244,28 +481,176 @@ class DirectorySourceQueue : public SourceQueue {
    */
   bool explore();
 
+  /// state shared by the threads exploring the tree
+  struct ExploreState;
+
+  /**
+   * Explores directories pulled from the work stealing queue of the state,
+   * till the whole tree is explored
+   *
+   * @param state           exploration state
+   * @param worker          index of the thread in the work stealing queue
+   */
+  void exploreThread(ExploreState &state, int worker);
+
+  /**
+   * Enqueues the files of a directory and returns its sub directories.
+   * Errors are recorded in the state.
+   *
+   * @param state           exploration state
+   * @param scanner         scanner of the calling thread
+   * @param directory       index in pathTable_ of the directory to explore
+   * @param subDirs         sub directories to explore, not pruned
+   */
+  void exploreDirectory(ExploreState &state, DirectoryScanner &scanner,
+                        int32_t directory, std::vector<int32_t> &subDirs);
+
+  /**
+   * Enqueues the files of a directory unchanged since it was cached and
+   * returns its sub directories. The files are stat'ed again, their cached
+   * entries are updated
+   *
+   * @param state           state of the exploration
+   * @param scanner         scanner opened on the directory
+   * @param directory       index in pathTable_ of the directory
+   * @param cachedDir       cached entries of the directory
+   * @param subDirs         sub directories to explore
+   */
+  void enqueueCachedDirectory(ExploreState &state,
+                              const DirectoryScanner &scanner,
+                              int32_t directory,
+                              DiscoveryCache::Directory &cachedDir,
+                              std::vector<int32_t> &subDirs);
+
+  /// @return   whether a file passes the include and exclude patterns
+  bool matchesFilePatterns(const ExploreState &state,
+                           const std::string &relPath) const;
+
   /**
    * Stat the input files and populate queue
    * @return                true on success, false on error
    */
   bool enqueueFiles();
 
+  /**
+   * Reads the binary manifest and populates the queue
+   * @return                true on success, false on error
+   */
+  bool enqueueManifestFiles();
+
+  /**
+   * Stat an input file if its size isn't specified, and queues it
+   * @return                true on success, false on error
+   */
+  bool enqueueFile(WdtFileInfo &info);
+
+  /**
+   * Picks the block size of a file, see setAdaptiveBlockSizes. Lock must be
+   * held
+   *
+   * @param fileSize      size of the file
+   *
+   * @return              block size in bytes
+   */
+  int64_t pickBlockSize(int64_t fileSize);
+
+  /**
+   * Cuts a source down to its share of the bytes left, once discovery
+   * finished, and queues the rest. Lock must be held
+   *
+   * @param source        source being handed out
+   */
+  void splitForTail(ByteSource &source);
+
+  /// @return   whether splitForTail may cut the next sources, read without
+  ///           mutex_
+  bool isTailNear() const;
+
+  /// @return   whether a source popped without mutex_ may have to be cut
+  bool mayCutSource(const ByteSource &source) const;
+
+  /**
+   * Cuts a source handed out for the tail and into a segment, as configured.
+   * Lock must be held
+   *
+   * @param callerThreadCtx   context of the calling thread
+   * @param source            source being handed out
+   * @param isRest            whether the source is the rest of a block
+   */
+  void cutSource(const ThreadCtx *callerThreadCtx, ByteSource &source,
+                 bool isRest);
+
+  /**
+   * Cuts a source down to a segment, see setBlockSegmentSize, and keeps the
+   * rest for the calling thread. Lock must be held
+   *
+   * @param callerThreadCtx   context of the calling thread
+   * @param source            source being handed out
+   */
+  void cutIntoSegment(const ThreadCtx *callerThreadCtx, ByteSource &source);
+
+  /**
+   * Takes the rest of the block of the calling thread. Lock must be held
+   *
+   * @param callerThreadCtx   context of the calling thread
+   * @param source            set to the rest
+   *
+   * @return                  false if the thread has no rest
+   */
+  bool takeBlockRest(const ThreadCtx *callerThreadCtx,
+                     std::unique_ptr<ByteSource> &source);
+
+  /**
+   * Takes over the second half of the largest rest of the other threads, or
+   * all of it if too small to be shared. Lock must be held
+   *
+   * @param source            set to the part taken over
+   *
+   * @return                  false if no thread has a rest
+   */
+  bool stealBlockRest(std::unique_ptr<ByteSource> &source);
+
+  /// @return   rest counter of the index of a thread, nullptr if the index is
+  ///           not the one of a client thread
+  std::atomic<int32_t> *getNumBlockRests(
+      const ThreadCtx *callerThreadCtx) const;
+
+  /// updates the rest counter of a thread, lock must be held
+  void countBlockRest(const ThreadCtx *callerThreadCtx, int32_t delta);
+
+  /**
+   * @return    whether the thread may own a rest in blockRests_, to look for
+   *            it under the lock. Read without mutex_
+   */
+  bool mayOwnBlockRest(const ThreadCtx *callerThreadCtx) const;
+
+  /// Counts a rest handed out in the slots of its device. Lock must be held
+  void takeDeviceSlot(const ByteSource &source);
+
   /**
    * initial creation from either explore or enqueue files, uses
    * createIntoQueueInternal to create blocks
    *
    * @param fullPath             full path of the file to be added
    * @param fileInfo             Information about file
+   * @param deviceId             device of the file, -1 if unknown
+   * @param pathIndex            index of the file in pathTable_, -1 to keep
+   *                             the paths in the metadata
+   * @param mtimeNs              modification time of the file, -1 if unknown
    */
-  void createIntoQueue(const std::string &fullPath, WdtFileInfo &fileInfo);
+  void createIntoQueue(const std::string &fullPath, WdtFileInfo &fileInfo,
+                       int64_t deviceId = -1, int64_t pathIndex = -1,
+                       int64_t mtimeNs = -1);
 
   /**
    * initial creation from either explore or enqueue files - always increment
    * numentries. Lock must be held before calling this.
    *
    * @param metadata             file meta-data
+   * @param relPath              relative path of the file
    */
-  void createIntoQueueInternal(SourceMetaData *metadata);
+  void createIntoQueueInternal(SourceMetaData *metadata,
+                               const std::string &relPath);
 
   /**
    * when adding multiple files, we have the option of using notify_one multiple
@@ -279,15 +664,72 @@ class DirectorySourceQueue : public SourceQueue {
   /// Removes all elements from the source queue
   void clearSourceQueue();
 
+  /// Adds a source to the queue it belongs to, mutex_ must be held
+  void enqueueSource(std::unique_ptr<ByteSource> source);
+
+  /// Moves the stats of a source to failedSourceStats_, mutex_ must be held
+  void addFailedSourceStats(ByteSource &source);
+
+  /// sources of the files of a device
+  struct DeviceQueue {
+    /// device of the files, -1 for the single queue used without limits
+    int64_t deviceId{-1};
+    ByteSourceQueue sources;
+    /// number of sources handed out and not yet released
+    std::atomic<int32_t> numInFlight{0};
+  };
+
+  /// @return   queue of the files of a device, created if needed. mutex_ must
+  ///           be held
+  DeviceQueue &getDeviceQueue(int64_t deviceId);
+
+  /**
+   * Pops the best source of a device below its limit, trying the devices
+   * round robin
+   *
+   * @param callerThreadCtx context of the calling thread, its index picks the
+   *                        shard of the queues it pops from
+   * @param source          set to the source popped
+   *
+   * @return                false if every queue was empty or at its limit
+   */
+  bool popSource(const ThreadCtx *callerThreadCtx,
+                 std::unique_ptr<ByteSource> &source);
+
+  /// @return   whether any source other than files to delete is queued
+  bool hasQueuedSources() const;
+
+  /// @return   number of sources queued, files to delete excluded
+  int64_t getNumQueuedSources() const;
+
+  /**
+   * In bounded mode, waits while the queue is above the high-water mark,
+   * till it is drained to half of it or the transfer is aborted
+   *
+   * @param lock    lock on mutex_
+   */
+  void waitForQueueToDrain(std::unique_lock<std::mutex> &lock);
+
+  /// wakes up the paused discovery threads if the queue is drained enough
+  void resumeDiscoveryIfDrained();
+
   /// if file deletion is enabled, extra files to be deleted are enqueued. This
   /// method should be called while holding the lock
   void enqueueFilesToBeDeleted();
 
+  /// records the parent directories of a file not seen before. This method
+  /// should be called while holding the lock
+  void addParentDirectories(const std::string &relPath);
+
   std::unique_ptr<ThreadCtx> threadCtx_{nullptr};
 
   /// root directory to recurse on if fileInfo_ is empty
   std::string rootDir_;
 
+  /// interned paths of the directories and files discovered, referred to by
+  /// their metadata
+  PathTable pathTable_;
+
   /// regex representing directories to prune
   std::string pruneDirPattern_;
 
@@ -303,56 +745,62 @@ class DirectorySourceQueue : public SourceQueue {
   /// List of files to enqueue instead of recursing over rootDir_.
   std::vector<WdtFileInfo> fileInfo_;
 
-  /// protects initCalled_/initFinished_/sourceQueue_/failedSourceStats_
+  /// binary manifest to read the files to enqueue from, instead of fileInfo_
+  std::string manifestPath_;
+
+  /// protects initCalled_/initFinished_/sourcesToDelete_/failedSourceStats_
+  /// and the pushes to deviceQueues_
   mutable std::mutex mutex_;
 
-  /// condition variable indicating sourceQueue_ is not empty
+  /// condition variable indicating a source can be popped
   mutable std::condition_variable conditionNotEmpty_;
 
+  /// condition variable indicating the queue is below the low-water mark
+  std::condition_variable conditionQueueDrained_;
+
+  /// number of discovery threads waiting on conditionQueueDrained_
+  std::atomic<int> numPausedDiscoveryThreads_{0};
+
   /// Indicates whether init() has been called to prevent multiple calls
   bool initCalled_{false};
 
-  /// Indicates whether call to init() has finished
-  bool initFinished_{false};
-
-  struct SourceComparator {
-    bool operator()(const std::unique_ptr<ByteSource> &source1,
-                    const std::unique_ptr<ByteSource> &source2) {
-      bool toBeDeleted1 =
-          (source1->getMetaData().allocationStatus == TO_BE_DELETED);
-      bool toBeDeleted2 =
-          (source2->getMetaData().allocationStatus == TO_BE_DELETED);
-      if (toBeDeleted1 != toBeDeleted2) {
-        // always send files to be deleted first
-        return toBeDeleted2;
-      }
-
-      auto retryCount1 = source1->getTransferStats().getFailedAttempts();
-      auto retryCount2 = source2->getTransferStats().getFailedAttempts();
-      if (retryCount1 != retryCount2) {
-        return retryCount1 > retryCount2;
-      }
-      if (source1->getSize() != source2->getSize()) {
-        return source1->getSize() < source2->getSize();
-      }
-      if (source1->getOffset() != source2->getOffset()) {
-        return source1->getOffset() > source2->getOffset();
-      }
-      return source1->getIdentifier() > source2->getIdentifier();
-    }
-  };
+  /// Indicates whether call to init() has finished, read without mutex_
+  std::atomic<bool> initFinished_{false};
+
+  /// capacity of deviceQueues_, the files of any further device share the
+  /// last queue
+  static const int kMaxDeviceQueues = 64;
 
   /**
-   * priority queue of sources. Sources are first ordered by increasing
-   * failedAttempts, then by decreasing size. If sizes are equal(always for
-   * blocks), sources are ordered by offset. This way, we ensure that all the
-   * threads in the receiver side are not writing to the same file at the same
-   * time.
+   * queues of sources to send, one per device when the threads per device
+   * are limited, a single one otherwise. Sources are first ordered by
+   * increasing failedAttempts, then by decreasing size. If sizes are
+   * equal(always for blocks), sources are ordered by offset. This way, we
+   * ensure that all the threads in the receiver side are not writing to the
+   * same file at the same time. The order is approximate, see
+   * ByteSourceQueue. Queues are only added and sources only pushed under
+   * mutex_, but sources can be popped without it.
    */
-  std::priority_queue<std::unique_ptr<ByteSource>,
-                      std::vector<std::unique_ptr<ByteSource>>,
-                      SourceComparator>
-      sourceQueue_;
+  std::unique_ptr<DeviceQueue> deviceQueues_[kMaxDeviceQueues];
+
+  /// number of queues in deviceQueues_, published after the queue is created
+  std::atomic<int> numDeviceQueues_{0};
+
+  /// index in deviceQueues_ of each device
+  std::unordered_map<int64_t, int> deviceQueueIndex_;
+
+  /// queue a pop starts from, to spread the threads over the devices
+  std::atomic<uint32_t> nextDeviceQueue_{0};
+
+  /// files to delete on the receiver side, always sent first
+  std::deque<std::unique_ptr<ByteSource>> sourcesToDelete_;
+
+  /// size of sourcesToDelete_, read without mutex_
+  std::atomic<int64_t> numSourcesToDelete_{0};
+
+  /// whether failedSourceStats_ or failedDirectories_ is not empty, read
+  /// without mutex_
+  std::atomic<bool> hasSourceErrors_{false};
 
   /// Transfer stats for sources which are not transferred
   std::vector<TransferStats> failedSourceStats_;
@@ -376,13 +824,50 @@ class DirectorySourceQueue : public SourceQueue {
   int64_t totalFileSize_{0};
 
   /// Number of blocks dequeued
-  int64_t numBlocksDequeued_{0};
+  std::atomic<int64_t> numBlocksDequeued_{0};
+
+  /// bytes of the sources in the device queues, read without mutex_
+  std::atomic<int64_t> numQueuedBytes_{0};
+
+  /// smallest block size picked, see setAdaptiveBlockSizes
+  int64_t minBlockSize_{0};
+
+  /// largest block size picked, 0 when block sizes are not adaptive
+  int64_t maxBlockSize_{0};
+
+  /// block sizes picked so far
+  BlockSizingStats blockSizingStats_;
+
+  /// sources popped without mutex_ which may still be cut, the end of the
+  /// transfer waits for them as they may add blocks
+  std::atomic<int64_t> numUnsettledPops_{0};
+
+  /// size of the segments of the blocks, 0 to hand out whole blocks
+  int64_t segmentSize_{0};
+
+  /// rests of the blocks being sent, by thread context of their sender
+  std::unordered_map<const ThreadCtx *, std::unique_ptr<ByteSource>>
+      blockRests_;
+
+  /// number of rests in blockRests_ by thread index, updated under mutex_
+  /// and read without it by the threads to skip the lock when they own none
+  std::unique_ptr<std::atomic<int32_t>[]> numBlockRests_;
 
   /// Whether to follow symlinks or not
   bool followSymlinks_{false};
 
+  /// Number of threads exploring the directory tree
+  int numDiscoveryThreads_{1};
+
+  /// directory of the discovery cache files, empty if disabled
+  std::string discoveryCacheDir_;
+
+  /// cache of the discovery, only set while exploring
+  std::unique_ptr<DiscoveryCache> discoveryCache_;
+
   /// shared file data. This are used during transfer to add blocks
-  /// contribution
+  /// contribution. Empty in bounded mode, where the metadata is owned by the
+  /// sources of the file
   std::vector<SourceMetaData *> sharedFileData_;
 
   /// A map from relative file name to previously received chunks
@@ -395,6 +880,9 @@ class DirectorySourceQueue : public SourceQueue {
   /// Number of bytes previously sent
   int64_t previouslySentBytes_{0};
 
+  /// Number of files found unchanged on the receiver side
+  int64_t numUnchangedFiles_{0};
+
   /**
    * Count and trigger of files to open (negative is keep opening until we run
    * out of fd, positive is how many files we can still open, 0 is stop opening
@@ -405,6 +893,12 @@ class DirectorySourceQueue : public SourceQueue {
   int32_t openFilesDuringDiscovery_{0};
   /// Should the WdtFileInfo created during discovery have direct read mode set
   bool directReads_{false};
+  /// whether the physical offset of the files is looked up during discovery
+  bool orderByPhysicalOffset_{false};
+  /// maximum number of sources of a device handed out at once, 0 for no limit
+  int32_t maxThreadsPerDevice_{0};
+  /// high-water mark of the queue in bounded mode, 0 for unbounded
+  int64_t maxQueuedSources_{0};
 
   // Number of files opened
   int64_t numFilesOpened_{0};
@@ -416,6 +910,16 @@ class DirectorySourceQueue : public SourceQueue {
   bool exploreDirectory_{true};
   /// delete extra files in the receiver side
   bool deleteFiles_{false};
+  /// compare modification times with the files of the receiver
+  bool incrementalSync_{false};
+  /// collect directories to be created in the receiver side
+  bool collectDirectories_{false};
+  /// all the directories recorded so far
+  std::unordered_set<std::string> discoveredDirectories_;
+  /// directories not yet handed out to the sender threads
+  std::deque<std::string> newDirectories_;
+  /// parent directory of the last enqueued file
+  std::string lastParentDirectory_;
 };
 }
 }
@@ -0,0 +1,393 @@
+/**
+ * Copyright (c) 2014-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+#include <wdt/util/DirectoryWatcher.h>
+#include <wdt/ErrorCodes.h>
+#include <wdt/util/DirectoryScanner.h>
+
+#include <folly/Checksum.h>
+
+#ifdef WDT_HAS_INOTIFY
+#include <sys/inotify.h>
+#endif
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+
+namespace facebook {
+namespace wdt {
+
+namespace {
+#ifdef WDT_HAS_INOTIFY
+const uint32_t kWatchMask = IN_MODIFY | IN_CLOSE_WRITE | IN_CREATE |
+                            IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO |
+                            IN_MOVE_SELF | IN_ONLYDIR | IN_DONT_FOLLOW |
+                            IN_EXCL_UNLINK;
+#endif
+}
+
+DirectoryWatcher::DirectoryWatcher(const std::string &rootDir,
+                                   const WdtOptions &options)
+    : rootDir_(rootDir),
+      includeMatcher_(options.include_regex),
+      excludeMatcher_(options.exclude_regex),
+      pruneDirMatcher_(options.prune_dir_regex),
+      directReads_(options.odirect_reads) {
+  if (!rootDir_.empty() && rootDir_.back() != '/') {
+    rootDir_.push_back('/');
+  }
+}
+
+DirectoryWatcher::~DirectoryWatcher() {
+  if (fd_ >= 0) {
+    ::close(fd_);
+  }
+}
+
+bool DirectoryWatcher::start() {
+#ifdef WDT_HAS_INOTIFY
+  WDT_CHECK(fd_ < 0) << "Watcher already started";
+  fd_ = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (fd_ < 0) {
+    WPLOG(ERROR) << "Unable to initialize inotify";
+    return false;
+  }
+  if (!watchTree("", false)) {
+    return false;
+  }
+  WLOG(INFO) << "Watching " << rootDir_ << " with " << watches_.size()
+             << " watches, " << changed_.size() << " files";
+  return true;
+#else
+  WLOG(ERROR) << "Unable to watch " << rootDir_ << ", no inotify support";
+  return false;
+#endif
+}
+
+bool DirectoryWatcher::watchTree(const std::string &relDir, bool rescan) {
+#ifdef WDT_HAS_INOTIFY
+  std::vector<std::string> dirs{relDir};
+  DirectoryScanner scanner;
+  while (!dirs.empty()) {
+    const std::string dir = std::move(dirs.back());
+    dirs.pop_back();
+    const std::string fullPath = rootDir_ + dir;
+    // the watch is added first, changes made while the directory is read are
+    // reported by events
+    const int wd = inotify_add_watch(fd_, fullPath.c_str(), kWatchMask);
+    if (wd < 0) {
+      if (errno == ENOENT || errno == ENOTDIR) {
+        // already gone, the parent got an event
+        WVLOG(1) << "Directory " << fullPath << " gone before being watched";
+        continue;
+      }
+      WPLOG(ERROR) << "Unable to watch " << fullPath
+                   << (errno == ENOSPC
+                           ? ", fs.inotify.max_user_watches may be too low"
+                           : "");
+      return false;
+    }
+    watches_[wd] = dir;
+    if (!scanner.open(fullPath)) {
+      WPLOG(ERROR) << "Unable to open directory " << fullPath;
+      if (dir.empty()) {
+        return false;
+      }
+      continue;
+    }
+    const char *name;
+    unsigned char type;
+    while (scanner.next(name, type)) {
+      if (name[0] == '.' &&
+          (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'))) {
+        continue;
+      }
+      if (type != DT_DIR && type != DT_REG && type != DT_UNKNOWN) {
+        continue;
+      }
+      DirectoryScanner::EntryStat entryStat;
+      if (!scanner.statEntry(name, false, entryStat)) {
+        // deleted since read, reported by an event
+        continue;
+      }
+      std::string relPath = dir + name;
+      if (S_ISDIR(entryStat.mode)) {
+        relPath.push_back('/');
+        if (!pruneDirMatcher_.matches(relPath)) {
+          dirs.emplace_back(std::move(relPath));
+        }
+        continue;
+      }
+      if (!S_ISREG(entryStat.mode) || !matchesFilePatterns(relPath)) {
+        continue;
+      }
+      if (!rescan) {
+        markChanged(relPath, true);
+        continue;
+      }
+      auto it = files_.find(relPath);
+      if (it == files_.end() || it->second.inode != entryStat.inode) {
+        markChanged(relPath, true);
+      } else if (it->second.size != entryStat.size ||
+                 it->second.mtimeNs != entryStat.mtimeNs) {
+        markChanged(relPath, false);
+      }
+      rescannedFiles_.insert(std::move(relPath));
+    }
+    if (scanner.hasError()) {
+      WPLOG(ERROR) << "Failed to read directory " << fullPath;
+    }
+    scanner.close();
+  }
+  return true;
+#else
+  return false;
+#endif
+}
+
+bool DirectoryWatcher::rescan() {
+#ifdef WDT_HAS_INOTIFY
+  WLOG(WARNING) << "Rescanning " << rootDir_ << ", events were lost";
+  // a fresh descriptor drops the watches of directories moved away
+  ::close(fd_);
+  watches_.clear();
+  fd_ = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (fd_ < 0) {
+    WPLOG(ERROR) << "Unable to initialize inotify";
+    return false;
+  }
+  rescannedFiles_.clear();
+  if (!watchTree("", true)) {
+    return false;
+  }
+  for (const auto &it : files_) {
+    if (rescannedFiles_.find(it.first) == rescannedFiles_.end()) {
+      markChanged(it.first, true);
+    }
+  }
+  rescannedFiles_.clear();
+  WLOG(INFO) << "Rescanned " << rootDir_ << ", " << changed_.size()
+             << " changed files";
+  return true;
+#else
+  return false;
+#endif
+}
+
+bool DirectoryWatcher::waitForChanges(int timeoutMillis) {
+#ifdef WDT_HAS_INOTIFY
+  struct pollfd pollFd;
+  pollFd.fd = fd_;
+  pollFd.events = POLLIN;
+  const int numReady = poll(&pollFd, 1, timeoutMillis);
+  if (numReady < 0) {
+    if (errno == EINTR) {
+      return true;
+    }
+    WPLOG(ERROR) << "Failed to wait for inotify events";
+    return false;
+  }
+  if (numReady == 0) {
+    return true;
+  }
+  bool needsRescan = false;
+  alignas(struct inotify_event) char buf[64 * 1024];
+  while (true) {
+    const ssize_t numRead = ::read(fd_, buf, sizeof(buf));
+    if (numRead < 0) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        break;
+      }
+      if (errno == EINTR) {
+        continue;
+      }
+      WPLOG(ERROR) << "Failed to read inotify events";
+      return false;
+    }
+    for (ssize_t off = 0; off < numRead;) {
+      const struct inotify_event *event =
+          reinterpret_cast<const struct inotify_event *>(buf + off);
+      if (!processEvent(event->wd, event->mask,
+                        event->len > 0 ? event->name : "")) {
+        needsRescan = true;
+      }
+      off += sizeof(struct inotify_event) + event->len;
+    }
+  }
+  return needsRescan ? rescan() : true;
+#else
+  return false;
+#endif
+}
+
+bool DirectoryWatcher::processEvent(int wd, uint32_t mask, const char *name) {
+#ifdef WDT_HAS_INOTIFY
+  if (mask & IN_Q_OVERFLOW) {
+    WLOG(WARNING) << "inotify queue overflow";
+    return false;
+  }
+  auto it = watches_.find(wd);
+  if (it == watches_.end()) {
+    // dropped by a rescan
+    return true;
+  }
+  if (mask & IN_IGNORED) {
+    watches_.erase(it);
+    return true;
+  }
+  if (name[0] == '\0') {
+    // the watched directory itself was moved, its paths are stale
+    return !(mask & IN_MOVE_SELF);
+  }
+  std::string relPath = it->second + name;
+  if (mask & IN_ISDIR) {
+    relPath.push_back('/');
+    if (mask & IN_MOVED_FROM) {
+      // the files of the directory left the tree without events
+      return false;
+    }
+    if ((mask & (IN_CREATE | IN_MOVED_TO)) &&
+        !pruneDirMatcher_.matches(relPath)) {
+      WVLOG(1) << "New directory " << relPath;
+      return watchTree(relPath, false);
+    }
+    return true;
+  }
+  if (!matchesFilePatterns(relPath)) {
+    return true;
+  }
+  const bool replaced =
+      (mask & (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO)) != 0;
+  markChanged(relPath, replaced);
+  return true;
+#else
+  return false;
+#endif
+}
+
+void DirectoryWatcher::markChanged(const std::string &relPath,
+                                   bool replaced) {
+  auto res = changed_.emplace(relPath, replaced);
+  if (!res.second && replaced) {
+    res.first->second = true;
+  }
+}
+
+bool DirectoryWatcher::checksumTail(int fd, int64_t end,
+                                    uint32_t &checksum) {
+  char buf[kTailBytes];
+  const int64_t start = std::max<int64_t>(0, end - kTailBytes);
+  for (int64_t off = start; off < end;) {
+    const ssize_t numRead = ::pread(fd, buf + (off - start), end - off, off);
+    if (numRead < 0 && errno == EINTR) {
+      continue;
+    }
+    if (numRead < 0) {
+      WPLOG(WARNING) << "Failed to read the end of a file";
+    }
+    if (numRead <= 0) {
+      return false;
+    }
+    off += numRead;
+  }
+  checksum = folly::crc32c((const uint8_t *)buf, end - start, 0);
+  return true;
+}
+
+bool DirectoryWatcher::matchesFilePatterns(const std::string &relPath) const {
+  if (excludeMatcher_.matches(relPath)) {
+    return false;
+  }
+  return includeMatcher_.empty() || includeMatcher_.matches(relPath);
+}
+
+void DirectoryWatcher::takeChanges(
+    std::vector<WdtFileInfo> &fileInfo,
+    std::vector<FileChunksInfo> &receivedChunks) {
+  WDT_CHECK(inFlight_.empty()) << "Previous transfer not ended";
+  // seq-ids only need to be unique within a transfer
+  int64_t seqId = 0;
+  for (const auto &it : changed_) {
+    std::string relPath = it.first;
+    SentChange change;
+    change.replaced = it.second;
+    const std::string fullPath = rootDir_ + relPath;
+    int fd = -1;
+    struct stat fileStat;
+    if (lstat(fullPath.c_str(), &fileStat) == 0 &&
+        S_ISREG(fileStat.st_mode)) {
+      DirectoryScanner::EntryStat entryStat;
+      DirectoryScanner::fillEntryStat(fileStat, entryStat);
+      change.exists = true;
+      change.state.size = entryStat.size;
+      change.state.mtimeNs = entryStat.mtimeNs;
+      change.state.inode = entryStat.inode;
+      fileInfo.emplace_back(relPath, change.state.size, directReads_);
+      // without the checksum of what is sent, the next change is sent whole
+      fd = ::open(fullPath.c_str(), O_RDONLY | O_CLOEXEC);
+      if (fd < 0 ||
+          !checksumTail(fd, change.state.size, change.state.tailChecksum)) {
+        change.replaced = true;
+      }
+    }
+    auto recorded = files_.find(relPath);
+    if (recorded != files_.end()) {
+      const FileState &prev = recorded->second;
+      FileChunksInfo chunksInfo(seqId++, relPath, prev.size);
+      // the bytes the receiver has must still be the start of the file: a
+      // truncated and rewritten file may have grown, an unchanged size with
+      // another mtime is a rewrite in place
+      bool appended = change.exists && !change.replaced &&
+                      change.state.inode == prev.inode;
+      if (appended && change.state.size == prev.size) {
+        appended = change.state.mtimeNs == prev.mtimeNs &&
+                   change.state.tailChecksum == prev.tailChecksum;
+      } else if (appended) {
+        uint32_t prevTailChecksum = 0;
+        appended = change.state.size > prev.size &&
+                   checksumTail(fd, prev.size, prevTailChecksum) &&
+                   prevTailChecksum == prev.tailChecksum;
+      }
+      if (appended && prev.size > 0) {
+        chunksInfo.addChunk(Interval(0, prev.size));
+      }
+      receivedChunks.emplace_back(std::move(chunksInfo));
+    } else if (!change.exists) {
+      // created and deleted between two transfers
+      continue;
+    }
+    if (fd >= 0) {
+      ::close(fd);
+    }
+    inFlight_.emplace(std::move(relPath), change);
+  }
+  changed_.clear();
+  WVLOG(1) << "Took " << inFlight_.size() << " changes, " << fileInfo.size()
+           << " files to send";
+}
+
+void DirectoryWatcher::endTransfer(bool success) {
+  for (const auto &it : inFlight_) {
+    const SentChange &change = it.second;
+    if (!success) {
+      markChanged(it.first, change.replaced);
+    } else if (change.exists) {
+      files_[it.first] = change.state;
+    } else {
+      files_.erase(it.first);
+    }
+  }
+  WLOG_IF(WARNING, !success) << inFlight_.size()
+                             << " changes to be sent again";
+  inFlight_.clear();
+}
+}
+}
@@ -0,0 +1,204 @@
+/**
+ * Copyright (c) 2014-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+#pragma once
+
+#include <wdt/Protocol.h>
+#include <wdt/WdtOptions.h>
+#include <wdt/WdtTransferRequest.h>
+#include <wdt/util/PathMatcher.h>
+
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace facebook {
+namespace wdt {
+
+/**
+ * Watches a directory tree with inotify to replicate it continuously: instead
+ * of discovering the whole tree for every transfer, the files changed since
+ * the previous transfer are sent, along with what the receiver already has of
+ * them. inotify is not recursive, every directory of the tree gets its own
+ * watch, so the tree must fit in fs.inotify.max_user_watches.
+ *
+ * The watcher keeps the size, mtime, inode and a checksum of the last bytes of
+ * every file the receiver got. A file which grew with the same inode and the
+ * same bytes before its old end is taken as appended to and only its new
+ * bytes are sent, a file which was created, deleted, renamed, truncated and
+ * rewritten or changed without growing is sent whole (or deleted). Symlinks are not followed. If the inotify queue
+ * overflows or a directory is moved, the tree is rescanned and compared with
+ * what the receiver has.
+ *
+ * Not thread safe, meant to be driven by the thread running the transfers.
+ */
+class DirectoryWatcher {
+ public:
+  /**
+   * @param rootDir   directory to watch
+   * @param options   include, exclude and prune patterns and direct reads
+   */
+  DirectoryWatcher(const std::string &rootDir, const WdtOptions &options);
+
+  /// Stops watching
+  ~DirectoryWatcher();
+
+  /**
+   * Starts watching the tree. All its files are marked as changed, so that
+   * the first transfer sends the whole tree
+   *
+   * @return    false if the tree can not be watched (logged)
+   */
+  bool start();
+
+  /**
+   * Waits for changes and records them
+   *
+   * @param timeoutMillis   maximum time to wait for the first change
+   *
+   * @return                false if watching failed (logged)
+   */
+  bool waitForChanges(int timeoutMillis);
+
+  /// @return   whether there are changes not taken by a transfer yet
+  bool hasChanges() const {
+    return !changed_.empty();
+  }
+
+  /**
+   * Takes the changes recorded so far for the next transfer. Must be
+   * followed by endTransfer()
+   *
+   * @param fileInfo        set to the files to send, with their current size
+   * @param receivedChunks  set to what the receiver has of the files to send
+   *                        or to delete, to be passed to the sender
+   */
+  void takeChanges(std::vector<WdtFileInfo> &fileInfo,
+                   std::vector<FileChunksInfo> &receivedChunks);
+
+  /**
+   * Ends the transfer of the changes taken. If it failed, they are taken
+   * again by the next transfer
+   *
+   * @param success   whether the receiver got all the changes
+   */
+  void endTransfer(bool success);
+
+  /// @return   number of files the receiver is known to have
+  int64_t getNumFiles() const {
+    return files_.size();
+  }
+
+  /// @return   number of directories watched
+  int64_t getNumWatches() const {
+    return watches_.size();
+  }
+
+  /// Copy constructor deleted
+  DirectoryWatcher(const DirectoryWatcher &that) = delete;
+
+  /// Delete the assignment operatory by copy
+  DirectoryWatcher &operator=(const DirectoryWatcher &that) = delete;
+
+ private:
+  /// size, mtime and inode of a file, and checksum of its last bytes
+  struct FileState {
+    int64_t size{0};
+    int64_t mtimeNs{0};
+    int64_t inode{0};
+    /// crc32c of the last kTailBytes bytes before size
+    uint32_t tailChecksum{0};
+  };
+
+  /// number of bytes before the end sent checked to detect rewrites
+  static const int64_t kTailBytes = 4096;
+
+  /// a change taken by the ongoing transfer
+  struct SentChange {
+    /// whether the file was replaced rather than appended to
+    bool replaced{false};
+    /// whether the file exists, or is to be deleted
+    bool exists{false};
+    /// state of the file when taken
+    FileState state;
+  };
+
+  /**
+   * Watches a directory and its sub directories and records their files as
+   * changed, or in a rescan, the ones which differ from what the receiver has
+   *
+   * @param relDir    directory relative to the root, ending with '/' except
+   *                  for the root
+   * @param rescan    whether this is a rescan of the tree
+   *
+   * @return          false if a watch could not be added (logged)
+   */
+  bool watchTree(const std::string &relDir, bool rescan);
+
+  /**
+   * Replaces all the watches and compares the whole tree with what the
+   * receiver has, when events were lost
+   *
+   * @return    false if the tree can not be watched anymore (logged)
+   */
+  bool rescan();
+
+  /**
+   * Records the change of an inotify event
+   *
+   * @return    false if the tree needs to be rescanned
+   */
+  bool processEvent(int wd, uint32_t mask, const char *name);
+
+  /**
+   * Marks a file as changed
+   *
+   * @param relPath   path of the file relative to the root
+   * @param replaced  whether the file may have been replaced rather than
+   *                  appended to
+   */
+  void markChanged(const std::string &relPath, bool replaced);
+
+  /**
+   * Computes the checksum of the kTailBytes bytes of a file before an offset
+   *
+   * @param fd        descriptor of the file
+   * @param end       offset after the bytes to checksum
+   * @param checksum  set to the checksum
+   *
+   * @return          false if the bytes could not be read, the file may
+   *                  have been truncated
+   */
+  static bool checksumTail(int fd, int64_t end, uint32_t &checksum);
+
+  /// @return   whether a file passes the include and exclude patterns
+  bool matchesFilePatterns(const std::string &relPath) const;
+
+  /// root directory, ending with '/'
+  std::string rootDir_;
+  PathMatcher includeMatcher_;
+  PathMatcher excludeMatcher_;
+  PathMatcher pruneDirMatcher_;
+  /// whether the files are read with O_DIRECT
+  bool directReads_{false};
+  /// inotify descriptor
+  int fd_{-1};
+  /// directory of each watch, relative to the root
+  std::unordered_map<int, std::string> watches_;
+  /// files the receiver has, as last sent
+  std::unordered_map<std::string, FileState> files_;
+  /// files changed since taken by a transfer, and whether they were replaced
+  std::unordered_map<std::string, bool> changed_;
+  /// changes taken by the ongoing transfer
+  std::unordered_map<std::string, SentChange> inFlight_;
+  /// files found by the ongoing rescan
+  std::unordered_set<std::string> rescannedFiles_;
+};
+}
+}
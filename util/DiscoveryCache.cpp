@@ -0,0 +1,213 @@
+/**
+ * Copyright (c) 2014-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+#include <wdt/util/DiscoveryCache.h>
+#include <wdt/ErrorCodes.h>
+#include <wdt/util/SerializationUtil.h>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <chrono>
+#include <cstdio>
+#include <functional>
+
+namespace facebook {
+namespace wdt {
+
+const int64_t DiscoveryCache::kVersion = 1;
+
+namespace {
+const char *const kMagic = "wdt_discovery_cache";
+/// directories modified less than that before the discovery are not cached
+const int64_t kRacyMtimeNs = 1000000000;
+
+void appendString(std::string &buffer, const std::string &str) {
+  encodeVarU64(buffer, str.size());
+  buffer.append(str);
+}
+}
+
+DiscoveryCache::DiscoveryCache(const std::string &cacheDir,
+                               const std::string &key)
+    : key_(key) {
+  char name[64];
+  snprintf(name, sizeof(name), "wdt_discovery_%016zx.cache",
+           std::hash<std::string>()(key));
+  path_ = cacheDir;
+  if (!path_.empty() && path_.back() != '/') {
+    path_.push_back('/');
+  }
+  path_.append(name);
+  startTimeNs_ = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                     std::chrono::system_clock::now().time_since_epoch())
+                     .count();
+}
+
+bool DiscoveryCache::load() {
+  const int fd = ::open(path_.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    if (errno == ENOENT) {
+      WLOG(INFO) << "No discovery cache " << path_ << ", full discovery";
+    } else {
+      WPLOG(ERROR) << "Unable to open discovery cache " << path_;
+    }
+    return false;
+  }
+  std::string data;
+  char buf[64 * 1024];
+  while (true) {
+    const ssize_t numRead = ::read(fd, buf, sizeof(buf));
+    if (numRead < 0) {
+      WPLOG(ERROR) << "Failed to read discovery cache " << path_;
+      ::close(fd);
+      return false;
+    }
+    if (numRead == 0) {
+      break;
+    }
+    data.append(buf, numRead);
+  }
+  ::close(fd);
+  folly::ByteRange br = makeByteRange(&data[0], data.size());
+  std::string magic;
+  std::string key;
+  int64_t version;
+  int64_t numDirectories;
+  if (!decodeString(br, magic) || magic != kMagic ||
+      !decodeInt64(br, version) || version != kVersion ||
+      !decodeString(br, key) || !decodeInt64(br, numDirectories)) {
+    WLOG(WARNING) << "Ignoring discovery cache " << path_
+                  << " with an unknown header";
+    return false;
+  }
+  if (key != key_) {
+    WLOG(WARNING) << "Ignoring discovery cache " << path_
+                  << " of another tree";
+    return false;
+  }
+  std::unordered_map<std::string, Directory> cached;
+  for (int64_t i = 0; i < numDirectories; i++) {
+    std::string relPath;
+    Directory directory;
+    int64_t numFiles;
+    bool ok = decodeString(br, relPath) &&
+              decodeInt64(br, directory.mtimeNs) &&
+              decodeInt64(br, numFiles) && numFiles >= 0;
+    for (int64_t j = 0; ok && j < numFiles; j++) {
+      File file;
+      ok = decodeString(br, file.name) && decodeInt64(br, file.size) &&
+           decodeInt64(br, file.mtimeNs) && decodeInt64(br, file.inode) &&
+           decodeInt64(br, file.device);
+      directory.files.push_back(std::move(file));
+    }
+    int64_t numSubDirs;
+    ok = ok && decodeInt64(br, numSubDirs) && numSubDirs >= 0;
+    for (int64_t j = 0; ok && j < numSubDirs; j++) {
+      std::string subDir;
+      ok = decodeString(br, subDir);
+      directory.subDirs.push_back(std::move(subDir));
+    }
+    if (!ok) {
+      WLOG(WARNING) << "Ignoring truncated discovery cache " << path_;
+      return false;
+    }
+    cached.emplace(std::move(relPath), std::move(directory));
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  cached_ = std::move(cached);
+  WLOG(INFO) << "Loaded discovery cache " << path_ << " with "
+             << cached_.size() << " directories";
+  return true;
+}
+
+bool DiscoveryCache::take(const std::string &relPath, int64_t mtimeNs,
+                          Directory &directory) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = cached_.find(relPath);
+    if (it != cached_.end() && it->second.mtimeNs == mtimeNs) {
+      directory = std::move(it->second);
+      cached_.erase(it);
+      ++numHits_;
+      return true;
+    }
+  }
+  ++numMisses_;
+  return false;
+}
+
+void DiscoveryCache::record(const std::string &relPath, Directory directory) {
+  if (directory.mtimeNs >= startTimeNs_ - kRacyMtimeNs) {
+    WVLOG(2) << "Not caching recently modified directory " << relPath;
+    return;
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  recorded_[relPath] = std::move(directory);
+}
+
+bool DiscoveryCache::save() const {
+  std::string buffer;
+  int64_t numDirectories;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    numDirectories = recorded_.size();
+    appendString(buffer, kMagic);
+    encodeVarI64(buffer, kVersion);
+    appendString(buffer, key_);
+    encodeVarI64(buffer, recorded_.size());
+    for (const auto &it : recorded_) {
+      const Directory &directory = it.second;
+      appendString(buffer, it.first);
+      encodeVarI64(buffer, directory.mtimeNs);
+      encodeVarI64(buffer, directory.files.size());
+      for (const File &file : directory.files) {
+        appendString(buffer, file.name);
+        encodeVarI64(buffer, file.size);
+        encodeVarI64(buffer, file.mtimeNs);
+        encodeVarI64(buffer, file.inode);
+        encodeVarI64(buffer, file.device);
+      }
+      encodeVarI64(buffer, directory.subDirs.size());
+      for (const std::string &subDir : directory.subDirs) {
+        appendString(buffer, subDir);
+      }
+    }
+  }
+  // written aside and renamed, a failed write keeps the previous cache
+  const std::string tmpPath = path_ + ".tmp";
+  const int fd =
+      ::open(tmpPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd < 0) {
+    WPLOG(ERROR) << "Unable to create discovery cache " << tmpPath;
+    return false;
+  }
+  int64_t off = 0;
+  while (off < (int64_t)buffer.size()) {
+    const ssize_t written =
+        ::write(fd, buffer.data() + off, buffer.size() - off);
+    if (written < 0) {
+      WPLOG(ERROR) << "Failed to write discovery cache " << tmpPath;
+      ::close(fd);
+      ::unlink(tmpPath.c_str());
+      return false;
+    }
+    off += written;
+  }
+  if (::close(fd) != 0 || ::rename(tmpPath.c_str(), path_.c_str()) != 0) {
+    WPLOG(ERROR) << "Failed to save discovery cache " << path_;
+    ::unlink(tmpPath.c_str());
+    return false;
+  }
+  WLOG(INFO) << "Saved discovery cache " << path_ << " with "
+             << numDirectories << " directories, " << buffer.size()
+             << " bytes";
+  return true;
+}
+}
+}
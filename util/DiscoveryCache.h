@@ -0,0 +1,136 @@
+/**
+ * Copyright (c) 2014-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+#pragma once
+
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace facebook {
+namespace wdt {
+
+/**
+ * On-disk cache of the result of the discovery of a tree, for trees sent
+ * again and again. For every directory it keeps the files which passed the
+ * patterns, with their size, mtime and inode, and the sub directories which
+ * were not pruned. A directory whose mtime did not change since it was cached
+ * has the same entries, so the next discovery skips reading it and filtering
+ * its entries, and only rescans the directories which changed. Sub
+ * directories are still visited, a change deep in the tree does not change
+ * the mtime of its ancestors.
+ *
+ * The mtime of a directory does not change when one of its files is
+ * rewritten in place, so the cached files are still stat'ed for their size.
+ *
+ * A cache file is keyed by the root directory and the patterns, and lives in
+ * the cache directory. It is replaced atomically at the end of a successful
+ * discovery. The methods used during the discovery are thread safe.
+ */
+class DiscoveryCache {
+ public:
+  struct File {
+    std::string name;
+    int64_t size{0};
+    /// modification time in ns since the epoch
+    int64_t mtimeNs{0};
+    int64_t inode{0};
+    /// st_dev of the file
+    int64_t device{-1};
+  };
+
+  struct Directory {
+    /// modification time of the directory in ns since the epoch
+    int64_t mtimeNs{0};
+    std::vector<File> files;
+    /// names of the sub directories to explore
+    std::vector<std::string> subDirs;
+  };
+
+  /**
+   * @param cacheDir    directory holding the cache files
+   * @param key         identifies the tree and the way it is explored, e.g.
+   *                    the root directory and the patterns
+   */
+  DiscoveryCache(const std::string &cacheDir, const std::string &key);
+
+  /**
+   * Loads the cache written by the previous discovery of the same key
+   *
+   * @return    false if there is none or it can not be used (logged)
+   */
+  bool load();
+
+  /**
+   * Takes the cached entries of a directory out of the cache, each directory
+   * is only explored once
+   *
+   * @param relPath     path of the directory relative to the root, ending
+   *                    with '/' except for the root
+   * @param mtimeNs     current mtime of the directory
+   * @param directory   set to the cached entries
+   *
+   * @return            false if the directory is not cached or changed
+   */
+  bool take(const std::string &relPath, int64_t mtimeNs, Directory &directory);
+
+  /**
+   * Records the entries of a directory for the next discovery. Directories
+   * modified right before or during this discovery are not recorded, as
+   * changes made within the same mtime tick would go unnoticed
+   *
+   * @param relPath     path of the directory relative to the root
+   * @param directory   entries found
+   */
+  void record(const std::string &relPath, Directory directory);
+
+  /**
+   * Writes the directories recorded, replacing the previous cache
+   *
+   * @return    whether the cache could be written (logged otherwise)
+   */
+  bool save() const;
+
+  /// @return   path of the cache file
+  const std::string &getPath() const {
+    return path_;
+  }
+
+  /// @return   number of directories found unchanged in the cache
+  int64_t getNumHits() const {
+    return numHits_;
+  }
+
+  /// @return   number of directories rescanned
+  int64_t getNumMisses() const {
+    return numMisses_;
+  }
+
+ private:
+  /// version of the cache file format
+  static const int64_t kVersion;
+
+  /// path of the cache file
+  std::string path_;
+  /// key of the tree, checked on load against hash collisions
+  std::string key_;
+  /// time this discovery started, in ns since the epoch
+  int64_t startTimeNs_{0};
+
+  mutable std::mutex mutex_;
+  /// directories of the previous discovery
+  std::unordered_map<std::string, Directory> cached_;
+  /// directories of this discovery
+  std::unordered_map<std::string, Directory> recorded_;
+  std::atomic<int64_t> numHits_{0};
+  std::atomic<int64_t> numMisses_{0};
+};
+}
+}
@@ -0,0 +1,192 @@
+/**
+ * Copyright (c) 2014-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+#include <wdt/util/DiskFlusher.h>
+#include <wdt/WdtConfig.h>
+#include <wdt/util/CommonImpl.h>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <map>
+#include <set>
+
+namespace facebook {
+namespace wdt {
+
+DiskFlusher::DiskFlusher(const WdtOptions &options) : options_(options) {
+}
+
+DiskFlusher::~DiskFlusher() {
+  shutdownThread();
+}
+
+void DiskFlusher::startThread() {
+  WDT_CHECK(!flusherThread_.joinable()) << "Flusher thread already started";
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    finished_ = false;
+  }
+  flusherThread_ = std::thread(&DiskFlusher::threadProcFlush, this);
+}
+
+void DiskFlusher::shutdownThread() {
+  if (!flusherThread_.joinable()) {
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    finished_ = true;
+  }
+  conditionPending_.notify_one();
+  flusherThread_.join();
+  WLOG(INFO) << "Disk flusher synced " << numFilesSynced_ << " files in "
+             << numBatches_ << " batches";
+}
+
+int64_t DiskFlusher::addFd(int fd) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  const int64_t ticket = ++lastTicket_;
+  pendingFds_.push_back(fd);
+  if (finished_ || !flusherThread_.joinable()) {
+    // no flusher thread to batch with, flush inline
+    std::vector<int> fds;
+    fds.swap(pendingFds_);
+    if (!flushFds(fds)) {
+      status_ = FILE_WRITE_ERROR;
+    }
+    flushedTicket_ = std::max(flushedTicket_, ticket);
+  }
+  return ticket;
+}
+
+ErrorCode DiskFlusher::getFlushStatus(int64_t &flushedTicket) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  flushedTicket = flushedTicket_;
+  return status_;
+}
+
+ErrorCode DiskFlusher::waitForFlush(int64_t ticket) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  if (flushedTicket_ < ticket) {
+    ++numWaiters_;
+    conditionPending_.notify_one();
+    conditionFlushed_.wait(lock, [&] { return flushedTicket_ >= ticket; });
+    --numWaiters_;
+  }
+  return status_;
+}
+
+void DiskFlusher::clearError() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  status_ = OK;
+}
+
+bool DiskFlusher::flushFds(const std::vector<int> &fds) {
+  if (fds.empty()) {
+    return true;
+  }
+  // Several blocks of the same file are usually queued together, sync every
+  // file only once
+  std::set<std::pair<dev_t, ino_t>> seenFiles;
+  // a descriptor per filesystem (the files may be striped across several),
+  // syncfs works with any descriptor of the filesystem
+  std::map<dev_t, int> filesystemFds;
+  bool allFilesStated = true;
+  std::vector<int> fdsToSync;
+  bool success = true;
+  for (int fd : fds) {
+    struct stat fileStat;
+    if (fstat(fd, &fileStat) != 0) {
+      WPLOG(ERROR) << "fstat failed for fd " << fd;
+      fdsToSync.push_back(fd);
+      allFilesStated = false;
+      continue;
+    }
+    if (seenFiles.emplace(fileStat.st_dev, fileStat.st_ino).second) {
+      fdsToSync.push_back(fd);
+      filesystemFds.emplace(fileStat.st_dev, fd);
+    }
+  }
+  const int64_t numFiles = fdsToSync.size();
+  bool synced = false;
+#ifdef HAS_SYNCFS
+  const int64_t syncfsThreshold = options_.group_commit_syncfs_threshold;
+  if (syncfsThreshold > 0 && numFiles >= syncfsThreshold && allFilesStated) {
+    synced = true;
+    for (const auto &filesystemFd : filesystemFds) {
+      if (::syncfs(filesystemFd.second) != 0) {
+        WPLOG(ERROR) << "syncfs failed for device " << filesystemFd.first;
+        synced = false;
+        break;
+      }
+    }
+  }
+#endif
+  if (!synced) {
+    for (int fd : fdsToSync) {
+#ifdef HAS_FDATASYNC
+      const int ret = ::fdatasync(fd);
+#else
+      const int ret = ::fsync(fd);
+#endif
+      if (ret != 0) {
+        WPLOG(ERROR) << "Unable to sync fd " << fd;
+        success = false;
+      }
+    }
+  }
+  for (int fd : fds) {
+    if (::close(fd) != 0) {
+      WPLOG(ERROR) << "Unable to close fd " << fd;
+      success = false;
+    }
+  }
+  numFilesSynced_ += numFiles;
+  ++numBatches_;
+  WVLOG(1) << "Flushed " << numFiles << " files for " << fds.size()
+           << " blocks, syncfs " << synced;
+  return success;
+}
+
+void DiskFlusher::threadProcFlush() {
+  WLOG(INFO) << "Disk flusher thread started";
+  auto waitingTime =
+      std::chrono::milliseconds(options_.group_commit_interval_millis);
+  bool finished = false;
+  while (!finished) {
+    std::vector<int> fds;
+    int64_t ticket;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      // Wake up every waitingTime to flush, or right away if some thread is
+      // blocked on pending writes
+      conditionPending_.wait_for(lock, waitingTime, [this] {
+        return finished_ || (numWaiters_ > 0 && !pendingFds_.empty());
+      });
+      finished = finished_;
+      fds.swap(pendingFds_);
+      ticket = lastTicket_;
+    }
+    // no lock held while syncing, receiver threads keep queueing
+    const bool success = flushFds(fds);
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (!success) {
+        status_ = FILE_WRITE_ERROR;
+      }
+      // an inline flush of addFd may have completed a later ticket
+      flushedTicket_ = std::max(flushedTicket_, ticket);
+    }
+    conditionFlushed_.notify_all();
+  }
+  WLOG(INFO) << "Disk flusher thread finished";
+}
+}
+}
@@ -0,0 +1,121 @@
+/**
+ * Copyright (c) 2014-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+#pragma once
+
+#include <wdt/ErrorCodes.h>
+#include <wdt/WdtOptions.h>
+
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace facebook {
+namespace wdt {
+
+/**
+ * Background flusher used by the receiver in group commit mode. Instead of
+ * calling fsync after every block, receiver threads hand a duplicate of the
+ * file descriptor to this class and get back a ticket. The flusher thread
+ * periodically takes all the pending descriptors and syncs every distinct file
+ * once (or calls syncfs on the destination filesystems if the batch is large).
+ * A block must only be acknowledged to the sender (checkpoint or transfer log
+ * entry) once the ticket it was written under is flushed.
+ */
+class DiskFlusher {
+ public:
+  /// @param options     wdt options
+  explicit DiskFlusher(const WdtOptions &options);
+
+  /// Flushes pending descriptors and stops the flusher thread
+  ~DiskFlusher();
+
+  /// Starts the flusher thread
+  void startThread();
+
+  /// Flushes whatever is pending and joins the flusher thread
+  void shutdownThread();
+
+  /**
+   * Queues a descriptor to be flushed. The flusher takes ownership of the
+   * descriptor and closes it once it is synced.
+   *
+   * @param fd      descriptor of the file to flush
+   * @return        ticket of this request, the write is durable once this
+   *                ticket is flushed
+   */
+  int64_t addFd(int fd);
+
+  /**
+   * @param flushedTicket   set to the highest ticket for which the flush is
+   *                        complete
+   * @return                OK if all the flushes so far succeeded,
+   *                        FILE_WRITE_ERROR otherwise
+   */
+  ErrorCode getFlushStatus(int64_t &flushedTicket);
+
+  /**
+   * Blocks till all the requests up to and including ticket are flushed. Also
+   * wakes the flusher thread up instead of letting it wait for the interval.
+   *
+   * @param ticket    ticket to wait for
+   * @return          OK if the flush succeeded, FILE_WRITE_ERROR otherwise
+   */
+  ErrorCode waitForFlush(int64_t ticket);
+
+  /// Clears the error of a previous failed flush, called between sessions
+  void clearError();
+
+  /// Copy constructor deleted
+  DiskFlusher(const DiskFlusher &that) = delete;
+
+  /// Delete the assignment operatory by copy
+  DiskFlusher &operator=(const DiskFlusher &that) = delete;
+
+ private:
+  /// entry point of the flusher thread
+  void threadProcFlush();
+
+  /**
+   * Syncs and closes the descriptors
+   *
+   * @param fds     descriptors to flush
+   * @return        whether all the syncs succeeded
+   */
+  bool flushFds(const std::vector<int> &fds);
+
+  /// wdt options
+  const WdtOptions &options_;
+  /// descriptors waiting to be flushed
+  std::vector<int> pendingFds_;
+  /// ticket handed out to the last request
+  int64_t lastTicket_{0};
+  /// every request with ticket <= flushedTicket_ is durable
+  int64_t flushedTicket_{0};
+  /// number of threads blocked in waitForFlush
+  int numWaiters_{0};
+  /// status of the flushes since the last clearError
+  ErrorCode status_{OK};
+  /// Flag to signal end to the flusher thread
+  bool finished_{false};
+  /// number of batches flushed
+  int64_t numBatches_{0};
+  /// number of files synced
+  int64_t numFilesSynced_{0};
+  /// flusher thread
+  std::thread flusherThread_;
+  std::mutex mutex_;
+  /// signalled when there is new work or a thread starts waiting
+  std::condition_variable conditionPending_;
+  /// signalled when a batch is flushed
+  std::condition_variable conditionFlushed_;
+};
+}
+}
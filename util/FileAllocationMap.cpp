@@ -0,0 +1,70 @@
+/**
+ * Copyright (c) 2014-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+#include <wdt/util/FileAllocationMap.h>
+#include <wdt/ErrorCodes.h>
+
+#include <tuple>
+
+namespace facebook {
+namespace wdt {
+
+const int FileAllocationMap::ALLOCATED;
+const int FileAllocationMap::FAILED;
+
+FileAllocationMap::Entry *FileAllocationMap::findOrInsert(int64_t seqId,
+                                                          int initialStatus,
+                                                          bool &inserted) {
+  Shard &shard = getShard(seqId);
+  folly::SpinLockGuard guard(shard.lock);
+  auto res = shard.statusMap.emplace(std::piecewise_construct,
+                                     std::forward_as_tuple(seqId),
+                                     std::forward_as_tuple(initialStatus));
+  inserted = res.second;
+  return &res.first->second;
+}
+
+void FileAllocationMap::finishAllocation(int64_t seqId, Entry *entry,
+                                         int status) {
+  WDT_CHECK(status == ALLOCATED || status == FAILED) << status;
+  Shard &shard = getShard(seqId);
+  entry->store(status);
+  // Waiters register before checking their entry, so either they see the new
+  // status or we see them
+  if (shard.numWaiters.load() > 0) {
+    {
+      std::lock_guard<std::mutex> lock(shard.waitMutex);
+    }
+    shard.waitCondition.notify_all();
+  }
+}
+
+int FileAllocationMap::waitForAllocation(int64_t seqId, Entry *entry) {
+  int status = entry->load();
+  if (status < 0) {
+    return status;
+  }
+  Shard &shard = getShard(seqId);
+  std::unique_lock<std::mutex> lock(shard.waitMutex);
+  ++shard.numWaiters;
+  while ((status = entry->load()) >= 0) {
+    // still in progress, value is the index of the allocating thread
+    shard.waitCondition.wait(lock);
+  }
+  --shard.numWaiters;
+  return status;
+}
+
+void FileAllocationMap::clear() {
+  for (Shard &shard : shards_) {
+    folly::SpinLockGuard guard(shard.lock);
+    shard.statusMap.clear();
+  }
+}
+}
+}
@@ -0,0 +1,114 @@
+/**
+ * Copyright (c) 2014-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+#pragma once
+
+#include <folly/SpinLock.h>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <unordered_map>
+
+namespace facebook {
+namespace wdt {
+
+/**
+ * Map from file sequence id to allocation status, used by FileCreator to
+ * coordinate the allocation of a file among the receiver threads getting its
+ * blocks. There are four possible allocation status: NOT STARTED (no entry in
+ * the map), ALLOCATED, FAILED and IN_PROGRESS (value is the index of the
+ * allocating thread).
+ *
+ * The map is split in shards by seq-id, each with its own spin lock, so
+ * threads opening different files do not contend. Statuses are atomics with
+ * stable addresses: once a thread has the entry of a file, reading its status
+ * needs no lock. Waiting for an allocation in progress works like a futex on
+ * the entry: waiters block on the condition of the shard till the value of
+ * their entry changes, and the allocating thread wakes them up when it sets
+ * the final status.
+ *
+ * This class is thread-safe.
+ */
+class FileAllocationMap {
+ public:
+  /// allocation finished successfully
+  static const int ALLOCATED = -1;
+  /// allocation failed
+  static const int FAILED = -2;
+
+  typedef std::atomic<int> Entry;
+
+  FileAllocationMap() {
+  }
+
+  /**
+   * Finds the entry of a file, inserting it if absent
+   *
+   * @param seqId           seq-id of the file
+   * @param initialStatus   status of the entry if inserted
+   * @param inserted        set to whether the entry was inserted
+   *
+   * @return                entry of the file, valid till clear() is called
+   */
+  Entry *findOrInsert(int64_t seqId, int initialStatus, bool &inserted);
+
+  /**
+   * Sets the final status of an allocation and wakes up the threads waiting
+   * for it
+   *
+   * @param seqId     seq-id of the file
+   * @param entry     entry of the file
+   * @param status    ALLOCATED or FAILED
+   */
+  void finishAllocation(int64_t seqId, Entry *entry, int status);
+
+  /**
+   * Waits for the allocation of a file to finish
+   *
+   * @param seqId     seq-id of the file
+   * @param entry     entry of the file
+   *
+   * @return          ALLOCATED or FAILED
+   */
+  int waitForAllocation(int64_t seqId, Entry *entry);
+
+  /// Removes all the entries, no thread must be using the map
+  void clear();
+
+  /// Copy constructor deleted
+  FileAllocationMap(const FileAllocationMap &that) = delete;
+
+  /// Delete the assignment operatory by copy
+  FileAllocationMap &operator=(const FileAllocationMap &that) = delete;
+
+ private:
+  /// number of shards, seq-ids are sequential so the low bits spread them
+  static const int kNumShards = 64;
+
+  struct Shard {
+    /// protects statusMap
+    folly::SpinLock lock;
+    /// map from seq-id to allocation status, values never move
+    std::unordered_map<int64_t, Entry> statusMap;
+    /// mutex and condition used to wait for entries of this shard
+    std::mutex waitMutex;
+    std::condition_variable waitCondition;
+    /// number of threads waiting on waitCondition, lets the allocating thread
+    /// skip waitMutex when nobody waits
+    std::atomic<int> numWaiters{0};
+  };
+
+  /// @return     shard of a seq-id
+  Shard &getShard(int64_t seqId) {
+    return shards_[static_cast<uint64_t>(seqId) % kNumShards];
+  }
+
+  Shard shards_[kNumShards];
+};
+}
+}
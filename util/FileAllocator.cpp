@@ -0,0 +1,124 @@
+/**
+ * Copyright (c) 2014-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+#include <wdt/util/FileAllocator.h>
+#include <wdt/WdtConfig.h>
+#include <wdt/util/CommonImpl.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace facebook {
+namespace wdt {
+
+FileAllocator::FileAllocator(const WdtOptions &options) : options_(options) {
+}
+
+FileAllocator::~FileAllocator() {
+  shutdownThreads();
+}
+
+void FileAllocator::startThreads() {
+  WDT_CHECK(allocatorThreads_.empty()) << "Allocator threads already started";
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    finished_ = false;
+  }
+  for (int i = 0; i < options_.preallocation_threads; i++) {
+    allocatorThreads_.emplace_back(&FileAllocator::threadProcAllocate, this);
+  }
+}
+
+void FileAllocator::shutdownThreads() {
+  if (allocatorThreads_.empty()) {
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    finished_ = true;
+  }
+  conditionPending_.notify_all();
+  for (auto &allocatorThread : allocatorThreads_) {
+    allocatorThread.join();
+  }
+  allocatorThreads_.clear();
+  WLOG(INFO) << "File allocator allocated " << numFilesAllocated_
+             << " files, failures " << numFailures_;
+}
+
+void FileAllocator::allocate(int fd, int64_t fileSize) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!finished_ && !allocatorThreads_.empty()) {
+      pendingFiles_.emplace_back(fd, fileSize);
+      conditionPending_.notify_one();
+      return;
+    }
+  }
+  // no allocator thread running, allocate inline
+  const bool success = allocateFile(fd, fileSize);
+  std::lock_guard<std::mutex> lock(mutex_);
+  ++numFilesAllocated_;
+  if (!success) {
+    ++numFailures_;
+  }
+}
+
+bool FileAllocator::allocateFile(int fd, int64_t fileSize) {
+  bool success = true;
+#ifdef HAS_FALLOCATE
+  // not posix_fallocate: without support of the file system, glibc emulates it
+  // by writing zeros, over the blocks the receiver threads wrote meanwhile.
+  // fallocate only allocates the holes
+  if (fallocate(fd, 0, 0, fileSize) != 0) {
+    if (errno == EOPNOTSUPP) {
+      WVLOG(1) << "fallocate() not supported, not allocating " << fileSize
+               << " bytes";
+    } else {
+      // writes to the unallocated part will report the error, if any
+      WPLOG(ERROR) << "background fallocate() failed for " << fileSize
+                   << " bytes";
+      success = false;
+    }
+  }
+#else
+  WDT_CHECK(false) << "Should never reach here";
+#endif
+  if (::close(fd) != 0) {
+    WPLOG(ERROR) << "Unable to close fd " << fd;
+  }
+  return success;
+}
+
+void FileAllocator::threadProcAllocate() {
+  WVLOG(1) << "File allocator thread started";
+  while (true) {
+    std::pair<int, int64_t> file;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      conditionPending_.wait(
+          lock, [this] { return finished_ || !pendingFiles_.empty(); });
+      if (pendingFiles_.empty()) {
+        // finished and nothing left to allocate
+        break;
+      }
+      file = pendingFiles_.front();
+      pendingFiles_.pop_front();
+    }
+    const bool success = allocateFile(file.first, file.second);
+    std::lock_guard<std::mutex> lock(mutex_);
+    ++numFilesAllocated_;
+    if (!success) {
+      ++numFailures_;
+    }
+  }
+  WVLOG(1) << "File allocator thread finished";
+}
+}
+}
@@ -0,0 +1,92 @@
+/**
+ * Copyright (c) 2014-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+#pragma once
+
+#include <wdt/WdtOptions.h>
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace facebook {
+namespace wdt {
+
+/**
+ * Pool of background threads which pre-allocate space for destination files.
+ * Allocating a large file can take seconds (especially on XFS), and
+ * done inline it blocks the receiver thread which got the first block of the
+ * file as well as every other thread waiting to write to that file. Instead,
+ * FileCreator only sets the file size and hands a duplicate of the descriptor
+ * to this class, receiver threads start writing right away while the space is
+ * allocated in the background. Needs fallocate(2), which unlike
+ * posix_fallocate never writes over the blocks already received.
+ */
+class FileAllocator {
+ public:
+  /// @param options    wdt options
+  explicit FileAllocator(const WdtOptions &options);
+
+  /// Stops the allocator threads
+  ~FileAllocator();
+
+  /// Starts preallocation_threads allocator threads
+  void startThreads();
+
+  /// Allocates whatever is pending and joins the allocator threads
+  void shutdownThreads();
+
+  /**
+   * Queues a file for allocation. The allocator takes ownership of the
+   * descriptor and closes it once the space is allocated.
+   *
+   * @param fd        descriptor of the file
+   * @param fileSize  size to allocate
+   */
+  void allocate(int fd, int64_t fileSize);
+
+  /// Copy constructor deleted
+  FileAllocator(const FileAllocator &that) = delete;
+
+  /// Delete the assignment operatory by copy
+  FileAllocator &operator=(const FileAllocator &that) = delete;
+
+ private:
+  /// entry point of the allocator threads
+  void threadProcAllocate();
+
+  /**
+   * Allocates space for the file and closes the descriptor
+   *
+   * @param fd        descriptor of the file
+   * @param fileSize  size to allocate
+   *
+   * @return          whether the allocation succeeded
+   */
+  bool allocateFile(int fd, int64_t fileSize);
+
+  /// wdt options
+  const WdtOptions &options_;
+  /// files waiting to be allocated
+  std::deque<std::pair<int, int64_t>> pendingFiles_;
+  /// Flag to signal end to the allocator threads
+  bool finished_{false};
+  /// number of files allocated
+  int64_t numFilesAllocated_{0};
+  /// number of failed allocations
+  int64_t numFailures_{0};
+  /// allocator threads
+  std::vector<std::thread> allocatorThreads_;
+  std::mutex mutex_;
+  /// signalled when there is new work or the threads need to finish
+  std::condition_variable conditionPending_;
+};
+}
+}
@@ -7,12 +7,20 @@
  * of patent rights can be found in the PATENTS file in the same directory.
  */
 #include <wdt/util/FileByteSource.h>
+#include <wdt/WdtConfig.h>
 
 #include <fcntl.h>
 #include <glog/logging.h>
+#include <string.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <unistd.h>
 #include <algorithm>
+#ifdef WDT_HAS_FIEMAP
+#include <linux/fiemap.h>
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#endif
 namespace facebook {
 namespace wdt {
 
@@ -53,6 +61,63 @@ int FileUtil::openForRead(ThreadCtx &threadCtx, const std::string &filename,
   return fd;
 }
 
+int64_t FileUtil::getPhysicalOffset(const std::string &filename, int fd,
+                                    bool &located) {
+  located = false;
+  bool needToClose = false;
+  if (fd < 0) {
+    fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+      WPLOG(ERROR) << "Error opening file " << filename;
+      return -1;
+    }
+    needToClose = true;
+  }
+  int64_t physicalOffset = -1;
+#ifdef WDT_HAS_FIEMAP
+  {
+    // room for the header and a single extent
+    union {
+      struct fiemap fiemap;
+      char buf[sizeof(struct fiemap) + sizeof(struct fiemap_extent)];
+    } request;
+    memset(&request, 0, sizeof(request));
+    request.fiemap.fm_start = 0;
+    request.fiemap.fm_length = FIEMAP_MAX_OFFSET;
+    request.fiemap.fm_extent_count = 1;
+    if (ioctl(fd, FS_IOC_FIEMAP, &request.fiemap) == 0) {
+      if (request.fiemap.fm_mapped_extents > 0) {
+        const struct fiemap_extent &extent = request.fiemap.fm_extents[0];
+        // extents not yet allocated or packed with metadata have no
+        // meaningful location
+        const uint32_t unknownFlags = FIEMAP_EXTENT_UNKNOWN |
+                                      FIEMAP_EXTENT_DELALLOC |
+                                      FIEMAP_EXTENT_DATA_INLINE;
+        if (!(extent.fe_flags & unknownFlags)) {
+          physicalOffset = extent.fe_physical;
+          located = true;
+        }
+      }
+    } else {
+      WVLOG(2) << "FIEMAP not supported for " << filename << ", "
+               << strerrorStr(errno);
+    }
+  }
+#endif
+  if (physicalOffset < 0) {
+    struct stat fileStat;
+    if (fstat(fd, &fileStat) == 0) {
+      physicalOffset = fileStat.st_ino;
+    } else {
+      WPLOG(ERROR) << "fstat failed for " << filename;
+    }
+  }
+  if (needToClose) {
+    ::close(fd);
+  }
+  return physicalOffset;
+}
+
 FileByteSource::FileByteSource(SourceMetaData *metadata, int64_t size,
                                int64_t offset)
     : metadata_(metadata),
@@ -60,10 +125,31 @@ FileByteSource::FileByteSource(SourceMetaData *metadata, int64_t size,
       offset_(offset),
       bytesRead_(0),
       alignedReadNeeded_(false) {
-  transferStats_.setId(getIdentifier());
+  // the id of the stats is only set on open, to not keep a copy of the path
+  // per queued block
+  ++metadata_->numSources;
+}
+
+FileByteSource::~FileByteSource() {
+  this->close();
+  releaseMetaData(metadata_);
+}
+
+void FileByteSource::releaseMetaData(SourceMetaData *metadata) {
+  if (--metadata->numSources > 0 || !metadata->deleteWithLastSource) {
+    return;
+  }
+  if (metadata->needToClose && metadata->fd >= 0 &&
+      ::close(metadata->fd) != 0) {
+    WPLOG(ERROR) << "Failed to close file " << metadata->getFullPath();
+  }
+  delete metadata;
 }
 
 ErrorCode FileByteSource::open(ThreadCtx *threadCtx) {
+  if (transferStats_.getId().empty()) {
+    transferStats_.setId(getIdentifier());
+  }
   if (metadata_->allocationStatus == TO_BE_DELETED) {
     return OK;
   }
@@ -83,8 +169,9 @@ ErrorCode FileByteSource::open(ThreadCtx *threadCtx) {
     WVLOG(1) << "metadata already has fd, no need to open " << getIdentifier();
     fd_ = metadata_->fd;
   } else {
-    fd_ =
-        FileUtil::openForRead(*threadCtx_, metadata_->fullPath, isDirectReads);
+    // the only place the full path of a source is materialized
+    fd_ = FileUtil::openForRead(*threadCtx_, metadata_->getFullPath(),
+                                isDirectReads);
     if (fd_ < 0) {
       errCode = BYTE_SOURCE_READ_ERROR;
     }
@@ -99,6 +186,16 @@ void FileByteSource::advanceOffset(int64_t numBytes) {
   size_ -= numBytes;
 }
 
+std::unique_ptr<ByteSource> FileByteSource::splitAt(int64_t size) {
+  WDT_CHECK(size > 0 && size < size_) << "Can not split " << getIdentifier()
+                                      << " of size " << size_ << " at "
+                                      << size;
+  std::unique_ptr<ByteSource> rest =
+      std::make_unique<FileByteSource>(metadata_, size_ - size, offset_ + size);
+  size_ = size;
+  return rest;
+}
+
 char *FileByteSource::read(int64_t &size) {
   size = 0;
   if (hasError() || finished()) {
@@ -124,7 +221,7 @@ char *FileByteSource::read(int64_t &size) {
     numRead = ::pread(fd_, buffer->getData(), physicalRead, seekPos);
   }
   if (numRead < 0) {
-    WPLOG(ERROR) << "Failure while reading file " << metadata_->fullPath
+    WPLOG(ERROR) << "Failure while reading file " << metadata_->getFullPath()
                  << " need align " << alignedReadNeeded_ << " physicalRead "
                  << physicalRead << " offset " << offset_ << " seepPos "
                  << seekPos << " offsetRemainder " << offsetRemainder
@@ -134,11 +231,11 @@ char *FileByteSource::read(int64_t &size) {
     return nullptr;
   }
   if (numRead == 0) {
-    WLOG(ERROR) << "Unexpected EOF on " << metadata_->fullPath << " need align "
-                << alignedReadNeeded_ << " physicalRead " << physicalRead
-                << " offset " << offset_ << " seepPos " << seekPos
-                << " offsetRemainder " << offsetRemainder << " bytesRead "
-                << bytesRead_;
+    WLOG(ERROR) << "Unexpected EOF on " << metadata_->getFullPath()
+                << " need align " << alignedReadNeeded_ << " physicalRead "
+                << physicalRead << " offset " << offset_ << " seepPos "
+                << seekPos << " offsetRemainder " << offsetRemainder
+                << " bytesRead " << bytesRead_;
     this->close();
     return nullptr;
   }
@@ -30,6 +30,23 @@ class FileUtil {
    */
   static int openForRead(ThreadCtx &threadCtx, const std::string &filename,
                          bool isDirectReads);
+
+  /**
+   * Finds where a file starts on its disk, to read files in on-disk order.
+   * Uses the physical offset of the first extent of the file (FIEMAP), and
+   * falls back to the inode number, which on most file systems correlates
+   * with the location of the data. The two are not comparable, so the caller
+   * is told which one is returned.
+   *
+   * @param filename        name of the file
+   * @param fd              descriptor of the file, -1 to open it here
+   * @param located         set to whether the physical offset is returned,
+   *                        as opposed to the inode number
+   *
+   * @return    physical offset or inode number, -1 in case of error
+   */
+  static int64_t getPhysicalOffset(const std::string &filename, int fd,
+                                   bool &located);
   // TODO: create a separate file for this class and move other file related
   // code here
 };
@@ -49,14 +66,21 @@ class FileByteSource : public ByteSource {
    */
   FileByteSource(SourceMetaData *metadata, int64_t size, int64_t offset);
 
-  /// close file descriptor if still open
-  ~FileByteSource() override {
-    this->close();
-  }
+  /// close file descriptor if still open, releases the metadata
+  ~FileByteSource() override;
 
-  /// @return filepath
-  const std::string &getIdentifier() const override {
-    return metadata_->relPath;
+  /**
+   * Drops a reference to a file metadata, taken by each source of the file.
+   * If deleteWithLastSource is set, the metadata is deleted with the last
+   * reference and the file closed if wdt opened it.
+   *
+   * @param metadata    metadata of the file
+   */
+  static void releaseMetaData(SourceMetaData *metadata);
+
+  /// @return relative path of the file
+  std::string getIdentifier() const override {
+    return metadata_->getRelPath();
   }
 
   /// @return size of file in bytes
@@ -90,6 +114,9 @@ class FileByteSource : public ByteSource {
   /// @see ByteSource.h
   void advanceOffset(int64_t numBytes) override;
 
+  /// @see ByteSource.h
+  std::unique_ptr<ByteSource> splitAt(int64_t size) override;
+
   /// @see ByteSource.h
   ErrorCode open(ThreadCtx *threadCtx) override;
 
@@ -14,11 +14,34 @@
 #include <string.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <unistd.h>
 
 namespace facebook {
 namespace wdt {
 
-bool FileCreator::setFileSize(ThreadCtx &threadCtx, int fd, int64_t fileSize) {
+/// mode of the directories created by the receiver
+const mode_t kDirMode = S_IRWXU | S_IRWXG | S_IROTH | S_IXOTH;
+
+bool FileCreator::setModificationTime(int fd, const std::string &relPath,
+                                      int64_t mtimeNs) {
+  const int64_t kNsPerSec = 1000000000;
+  struct timespec times[2];
+  // access time left unchanged
+  times[0].tv_sec = 0;
+  times[0].tv_nsec = UTIME_OMIT;
+  times[1].tv_sec = mtimeNs / kNsPerSec;
+  times[1].tv_nsec = mtimeNs % kNsPerSec;
+  const int ret = relPath.empty() ? ::futimens(fd, times)
+                                  : ::utimensat(fd, relPath.c_str(), times, 0);
+  if (ret != 0) {
+    WPLOG(ERROR) << "Unable to set the mtime of " << relPath << " fd " << fd;
+    return false;
+  }
+  return true;
+}
+
+bool FileCreator::setFileSize(ThreadCtx &threadCtx, int fd, int64_t fileSize,
+                              bool isMultiBlock) {
   struct stat fileStat;
   if (fstat(fd, &fileStat) != 0) {
     WPLOG(ERROR) << "fstat() failed for " << fd;
@@ -41,6 +64,24 @@ bool FileCreator::setFileSize(ThreadCtx &threadCtx, int fd, int64_t fileSize) {
     return true;
   }
 #ifdef HAS_POSIX_FALLOCATE
+#ifdef HAS_FALLOCATE
+  if (fileAllocator_ != nullptr && isMultiBlock) {
+    // The size is set right away (this is what the transfer log verification
+    // relies on) and the blocks are allocated in the background, so that
+    // neither this thread nor the ones waiting for this file block on it
+    if (fileStat.st_size < fileSize && ftruncate(fd, fileSize) != 0) {
+      WPLOG(ERROR) << "ftruncate() failed for " << fd << " " << fileSize;
+      return false;
+    }
+    int allocationFd = dup(fd);
+    if (allocationFd < 0) {
+      WPLOG(ERROR) << "Unable to dup fd " << fd;
+      return false;
+    }
+    fileAllocator_->allocate(allocationFd, fileSize);
+    return true;
+  }
+#endif
   int status = posix_fallocate(fd, 0, fileSize);
   if (status != 0) {
     WLOG(ERROR) << "fallocate() failed " << strerrorStr(status);
@@ -68,7 +109,8 @@ int FileCreator::openAndSetSize(ThreadCtx &threadCtx,
   if (blockDetails->allocationStatus == EXISTS_CORRECT_SIZE) {
     return fd;
   }
-  if (!setFileSize(threadCtx, fd, blockDetails->fileSize)) {
+  const bool isMultiBlock = (blockDetails->dataSize < blockDetails->fileSize);
+  if (!setFileSize(threadCtx, fd, blockDetails->fileSize, isMultiBlock)) {
     close(fd);
     return -1;
   }
@@ -80,8 +122,9 @@ int FileCreator::openAndSetSize(ThreadCtx &threadCtx,
       transferLogManager_.addFileInvalidationEntry(blockDetails->prevSeqId);
     }
     if (isTooLarge || doCreate) {
-      transferLogManager_.addFileCreationEntry(
-          blockDetails->fileName, blockDetails->seqId, blockDetails->fileSize);
+      transferLogManager_.addFileCreationEntry(blockDetails->fileName,
+                                               blockDetails->seqId,
+                                               blockDetails->fileSize, stripe_);
     } else {
       WDT_CHECK_EQ(EXISTS_TOO_SMALL, blockDetails->allocationStatus);
       transferLogManager_.addFileResizeEntry(blockDetails->seqId,
@@ -92,81 +135,89 @@ int FileCreator::openAndSetSize(ThreadCtx &threadCtx,
 }
 
 int FileCreator::openForFirstBlock(ThreadCtx &threadCtx,
-                                   BlockDetails const *blockDetails) {
+                                   BlockDetails const *blockDetails,
+                                   FileAllocationMap::Entry *entry) {
   int fd = openAndSetSize(threadCtx, blockDetails);
-  {
-    folly::SpinLockGuard guard(lock_);
-    auto it = fileStatusMap_.find(blockDetails->seqId);
-    WDT_CHECK(it != fileStatusMap_.end());
-    it->second = fd >= 0 ? ALLOCATED : FAILED;
-  }
-  std::unique_lock<std::mutex> waitLock(allocationMutex_);
-  threadConditionVariables_[threadCtx.getThreadIndex()].notify_all();
+  allocationMap_.finishAllocation(
+      blockDetails->seqId, entry,
+      fd >= 0 ? FileAllocationMap::ALLOCATED : FileAllocationMap::FAILED);
   return fd;
 }
 
-bool FileCreator::waitForAllocationFinish(int allocatingThreadIndex,
-                                          int64_t seqId) {
-  std::unique_lock<std::mutex> waitLock(allocationMutex_);
-  while (true) {
-    {
-      folly::SpinLockGuard guard(lock_);
-      auto it = fileStatusMap_.find(seqId);
-      WDT_CHECK(it != fileStatusMap_.end());
-      if (it->second == ALLOCATED) {
-        return true;
-      }
-      if (it->second == FAILED) {
-        return false;
-      }
-    }
-    threadConditionVariables_[allocatingThreadIndex].wait(waitLock);
+void FileCreator::setStripePlacement(StripePlacement *stripePlacement) {
+  WDT_CHECK(stripeCreators_.empty()) << "Stripes already set";
+  stripePlacement_ = stripePlacement;
+  stripe_ = 0;
+  for (int i = 1; i < stripePlacement_->getNumStripes(); i++) {
+    auto stripeCreator = std::make_unique<FileCreator>(
+        stripePlacement_->getStripeDir(i), transferLogManager_, skipWrites_,
+        fileAllocator_);
+    stripeCreator->stripe_ = i;
+    stripeCreators_.emplace_back(std::move(stripeCreator));
+  }
+}
+
+FileCreator &FileCreator::getStripeCreator(const std::string &relPath) {
+  if (stripePlacement_ == nullptr) {
+    return *this;
+  }
+  const int stripe = stripePlacement_->getStripe(relPath);
+  return stripe == 0 ? *this : *stripeCreators_[stripe - 1];
+}
+
+bool FileCreator::deleteFile(const std::string &relPathStr) {
+  FileCreator &stripeCreator = getStripeCreator(relPathStr);
+  if (&stripeCreator != this) {
+    return stripeCreator.deleteFile(relPathStr);
+  }
+  const std::string path = getFullPath(relPathStr);
+  int status;
+  if (dirHandleCache_) {
+    std::string dir, name;
+    splitPath(relPathStr, dir, name);
+    auto dirHandle = openDir(dir, false);
+    status = dirHandle ? ::unlinkat(dirHandle->getFd(), name.c_str(), 0) : -1;
+  } else {
+    status = ::unlink(path.c_str());
+  }
+  if (status != 0) {
+    WPLOG(ERROR) << "Failed to delete file " << path;
+    return false;
   }
+  WLOG(INFO) << "Successfully deleted file " << path;
+  return true;
 }
 
 int FileCreator::openForBlocks(ThreadCtx &threadCtx,
                                BlockDetails const *blockDetails) {
+  FileCreator &stripeCreator = getStripeCreator(blockDetails->fileName);
+  if (&stripeCreator != this) {
+    return stripeCreator.openForBlocks(threadCtx, blockDetails);
+  }
   if (blockDetails->allocationStatus == TO_BE_DELETED) {
-    const std::string path = getFullPath(blockDetails->fileName);
-    int status;
-    {
-      PerfStatCollector statCollector(threadCtx, PerfStatReport::UNLINK);
-      status = ::unlink(path.c_str());
-    }
-    if (status != 0) {
-      WPLOG(ERROR) << "Failed to delete file " << path;
-    } else {
-      WLOG(INFO) << "Successfully deleted file " << path;
-    }
+    PerfStatCollector statCollector(threadCtx, PerfStatReport::UNLINK);
+    deleteFile(blockDetails->fileName);
     return -1;
   }
-  lock_.lock();
-  auto it = fileStatusMap_.find(blockDetails->seqId);
-  if (blockDetails->allocationStatus == EXISTS_CORRECT_SIZE &&
-      it == fileStatusMap_.end()) {
-    it =
-        fileStatusMap_
-            .insert(std::make_pair(blockDetails->seqId, FileCreator::ALLOCATED))
-            .first;
-  }
-  if (it == fileStatusMap_.end()) {
+  const int initialStatus =
+      blockDetails->allocationStatus == EXISTS_CORRECT_SIZE
+          ? FileAllocationMap::ALLOCATED
+          : threadCtx.getThreadIndex();
+  bool inserted;
+  FileAllocationMap::Entry *entry = allocationMap_.findOrInsert(
+      blockDetails->seqId, initialStatus, inserted);
+  if (inserted && initialStatus != FileAllocationMap::ALLOCATED) {
     // allocation has not started for this file
-    fileStatusMap_.insert(
-        std::make_pair(blockDetails->seqId, threadCtx.getThreadIndex()));
-    lock_.unlock();
-    return openForFirstBlock(threadCtx, blockDetails);
-  }
-  auto statusOrThreadIdx = it->second;
-  lock_.unlock();
-  if (statusOrThreadIdx == FAILED) {
-    // allocation failed previously
-    return -1;
+    return openForFirstBlock(threadCtx, blockDetails, entry);
   }
-  if (statusOrThreadIdx != ALLOCATED) {
+  int status = entry->load(std::memory_order_acquire);
+  if (status >= 0) {
     // allocation in progress
-    if (!waitForAllocationFinish(statusOrThreadIdx, blockDetails->seqId)) {
-      return -1;
-    }
+    status = allocationMap_.waitForAllocation(blockDetails->seqId, entry);
+  }
+  if (status == FileAllocationMap::FAILED) {
+    // allocation failed previously
+    return -1;
   }
   return openExistingFile(threadCtx, blockDetails->fileName);
 }
@@ -181,22 +232,153 @@ int FileCreator::openExistingFile(ThreadCtx &threadCtx,
   WDT_CHECK(relPathStr[0] != '/');
   WDT_CHECK(relPathStr.back() != '/');
 
-  const string path = getFullPath(relPathStr);
-
   int openFlags = O_WRONLY;
   int res;
   {
     PerfStatCollector statCollector(threadCtx, PerfStatReport::FILE_OPEN);
-    res = open(path.c_str(), openFlags, 0644);
+    if (dirHandleCache_) {
+      string dir, name;
+      splitPath(relPathStr, dir, name);
+      auto dirHandle = openDir(dir, false);
+      res = dirHandle ? openat(dirHandle->getFd(), name.c_str(), openFlags)
+                      : -1;
+    } else {
+      res = open(getFullPath(relPathStr).c_str(), openFlags, 0644);
+    }
   }
   if (res < 0) {
-    WPLOG(ERROR) << "failed opening file " << path;
+    WPLOG(ERROR) << "failed opening file " << getFullPath(relPathStr);
     return -1;
   }
-  WVLOG(1) << "successfully opened file " << path;
+  WVLOG(1) << "successfully opened file " << getFullPath(relPathStr);
   return res;
 }
 
+int FileCreator::getCreateFlags(ThreadCtx &threadCtx) const {
+  int openFlags = O_CREAT | O_WRONLY;
+  // When doing download resumption we sometime open files that do already
+  // exist and we need to overwrite them anyway (files which have been
+  // discarded from the log for some reason)
+  if (threadCtx.getOptions().overwrite ||
+      threadCtx.getOptions().enable_download_resumption) {
+    // Make sure file size resumption will not get messed up if we
+    // expect to create this file
+    openFlags |= O_TRUNC;
+  } else {
+    // Make sure open will fail if we don't allow overwriting and
+    // the file happens to already exist
+    openFlags |= O_EXCL;
+  }
+  return openFlags;
+}
+
+int FileCreator::createFileInDir(ThreadCtx &threadCtx, const string &relPathStr,
+                                 int openFlags) {
+  string dir, name;
+  splitPath(relPathStr, dir, name);
+  int openErrno = 0;
+  // a cached handle may point to a directory removed since, in which case
+  // the handles are dropped and the creation retried once
+  for (int attempt = 0; attempt < 2; attempt++) {
+    DirHandleCache::HandlePtr dirHandle;
+    {
+      PerfStatCollector statCollector(threadCtx,
+                                      PerfStatReport::DIRECTORY_CREATE);
+      dirHandle = openDir(dir, true);
+    }
+    if (!dirHandle) {
+      WLOG(ERROR) << "failed to create dir " << dir;
+      return -1;
+    }
+    int res;
+    {
+      PerfStatCollector statCollector(threadCtx, PerfStatReport::FILE_OPEN);
+      res = openat(dirHandle->getFd(), name.c_str(), openFlags, 0644);
+      openErrno = errno;
+    }
+    if (res >= 0) {
+      WVLOG(1) << "successfully created file " << getFullPath(relPathStr);
+      return res;
+    }
+    if (openErrno != ENOENT || dir.empty()) {
+      break;
+    }
+    WLOG(WARNING) << "failed creating file " << getFullPath(relPathStr)
+                  << ", retrying with fresh directory handles";
+    dirHandleCache_->clear();
+  }
+  errno = openErrno;
+  WPLOG(ERROR) << "failed creating file " << getFullPath(relPathStr);
+  return -1;
+}
+
+DirHandleCache::HandlePtr FileCreator::openDir(const string &dir,
+                                               bool create) {
+  if (dir.empty()) {
+    return rootDirHandle_;
+  }
+  auto handle = dirHandleCache_->get(dir);
+  if (handle) {
+    return handle;
+  }
+  string parentDir, name;
+  splitPath(dir, parentDir, name);
+  auto parentHandle = openDir(parentDir, create);
+  if (!parentHandle) {
+    return nullptr;
+  }
+  const int dirFlags = O_RDONLY | O_DIRECTORY | O_CLOEXEC;
+  int fd = openat(parentHandle->getFd(), name.c_str(), dirFlags);
+  if (fd < 0 && errno == ENOENT && create) {
+    if (mkdirat(parentHandle->getFd(), name.c_str(), kDirMode) == 0) {
+      WLOG(INFO) << "made dir " << getFullPath(dir);
+    } else if (errno != EEXIST) {
+      WPLOG(ERROR) << "failed to make directory " << getFullPath(dir);
+      return nullptr;
+    }
+    fd = openat(parentHandle->getFd(), name.c_str(), dirFlags);
+  }
+  if (fd < 0) {
+    WPLOG(ERROR) << "failed to open directory " << getFullPath(dir);
+    return nullptr;
+  }
+  handle = std::make_shared<DirHandleCache::Handle>(fd);
+  dirHandleCache_->put(dir, handle);
+  return handle;
+}
+
+int FileCreator::makeDir(const string &dir) {
+  if (dirHandleCache_) {
+    string parentDir, name;
+    splitPath(dir, parentDir, name);
+    auto parentHandle = openDir(parentDir, false);
+    if (!parentHandle) {
+      errno = ENOENT;
+      return -1;
+    }
+    return mkdirat(parentHandle->getFd(), name.c_str(), kDirMode);
+  }
+  if (rootDirFd_ >= 0) {
+    return mkdirat(rootDirFd_, dir.c_str(), kDirMode);
+  }
+  return mkdir(getFullPath(dir).c_str(), kDirMode);
+}
+
+/* static */
+void FileCreator::splitPath(const string &relPath, string &parentDir,
+                            string &name) {
+  int64_t end = relPath.size();
+  if (end > 0 && relPath[end - 1] == '/') {
+    --end;
+  }
+  int64_t p = end;
+  while (p > 0 && relPath[p - 1] != '/') {
+    --p;
+  }
+  parentDir.assign(relPath.data(), p);
+  name.assign(relPath.data() + p, end - p);
+}
+
 int FileCreator::createFile(ThreadCtx &threadCtx, const string &relPathStr) {
   CHECK(!relPathStr.empty());
   CHECK(relPathStr[0] != '/');
@@ -207,6 +389,11 @@ int FileCreator::createFile(ThreadCtx &threadCtx, const string &relPathStr) {
     return -1;
   }
 
+  const int openFlags = getCreateFlags(threadCtx);
+  if (dirHandleCache_) {
+    return createFileInDir(threadCtx, relPathStr, openFlags);
+  }
+
   const string path = getFullPath(relPathStr);
 
   int p = relPathStr.size();
@@ -238,20 +425,6 @@ int FileCreator::createFile(ThreadCtx &threadCtx, const string &relPathStr) {
       }
     }
   }
-  int openFlags = O_CREAT | O_WRONLY;
-  // When doing download resumption we sometime open files that do already
-  // exist and we need to overwrite them anyway (files which have been
-  // discarded from the log for some reason)
-  if (threadCtx.getOptions().overwrite ||
-      threadCtx.getOptions().enable_download_resumption) {
-    // Make sure file size resumption will not get messed up if we
-    // expect to create this file
-    openFlags |= O_TRUNC;
-  } else {
-    // Make sure open will fail if we don't allow overwriting and
-    // the file happens to already exist
-    openFlags |= O_EXCL;
-  }
   int res;
   {
     PerfStatCollector statCollector(threadCtx, PerfStatReport::FILE_OPEN);
@@ -287,6 +460,90 @@ int FileCreator::createFile(ThreadCtx &threadCtx, const string &relPathStr) {
   return res;
 }
 
+bool FileCreator::createParentDirectory(ThreadCtx &threadCtx,
+                                        const string &relPathStr) {
+  FileCreator &stripeCreator = getStripeCreator(relPathStr);
+  if (&stripeCreator != this) {
+    return stripeCreator.createParentDirectory(threadCtx, relPathStr);
+  }
+  string dir, name;
+  splitPath(relPathStr, dir, name);
+  if (dir.empty()) {
+    return true;
+  }
+  PerfStatCollector statCollector(threadCtx, PerfStatReport::DIRECTORY_CREATE);
+  if (dirHandleCache_) {
+    return openDir(dir, true) != nullptr;
+  }
+  if (createDirRecursively(dir)) {
+    return true;
+  }
+  WLOG(ERROR) << "failed to create dir " << dir << " recursively, "
+              << "trying to force directory creation";
+  return createDirRecursively(dir, true /* force */);
+}
+
+void FileCreator::logFileCreation(ThreadCtx &threadCtx,
+                                  BlockDetails const *blockDetails) {
+  if (threadCtx.getOptions().isLogBasedResumption()) {
+    const int stripe = getStripeCreator(blockDetails->fileName).stripe_;
+    transferLogManager_.addFileCreationEntry(blockDetails->fileName,
+                                             blockDetails->seqId,
+                                             blockDetails->fileSize, stripe);
+  }
+}
+
+bool FileCreator::createDirectories(ThreadCtx &threadCtx,
+                                    const std::vector<string> &directories) {
+  for (const string &dir : directories) {
+    if (dir.empty() || dir[0] == '/' || dir.back() != '/') {
+      WLOG(ERROR) << "Invalid directory name received " << dir;
+      return false;
+    }
+  }
+  if (skipWrites_) {
+    return true;
+  }
+  // only the tree of the destination directory is created ahead, files are
+  // placed one by one and the other stripes get their directories when a
+  // file is created on them
+  PerfStatCollector statCollector(threadCtx, PerfStatReport::DIRECTORY_CREATE);
+  std::vector<const string *> dirsToCreate;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (const string &dir : directories) {
+      if (createdDirs_.find(dir) == createdDirs_.end()) {
+        dirsToCreate.push_back(&dir);
+      }
+    }
+  }
+  std::vector<string> createdDirs;
+  createdDirs.reserve(dirsToCreate.size());
+  for (const string *dir : dirsToCreate) {
+    if (makeDir(*dir) == 0 || errno == EEXIST) {
+      WVLOG(1) << "made dir " << *dir;
+      createdDirs.push_back(*dir);
+      continue;
+    }
+    if (errno == ENOENT) {
+      // parent is in a batch processed by another thread, or failed earlier
+      if (dirHandleCache_ ? openDir(*dir, true) != nullptr
+                          : createDirRecursively(*dir)) {
+        continue;
+      }
+    } else {
+      WPLOG(ERROR) << "failed to make directory " << getFullPath(*dir);
+    }
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    createdDirs_.insert(createdDirs.begin(), createdDirs.end());
+  }
+  WVLOG(1) << "Created " << createdDirs.size() << " of " << directories.size()
+           << " directories";
+  return true;
+}
+
 bool FileCreator::createDirRecursively(const std::string dir, bool force) {
   // Skip writes is turned on. We shouldn't be creating files
   if (skipWrites_) {
@@ -311,7 +568,7 @@ bool FileCreator::createDirRecursively(const std::string dir, bool force) {
   }
 
   std::string fullDirPath = getFullPath(dir);
-  int code = mkdir(fullDirPath.c_str(), S_IRWXU | S_IRWXG | S_IROTH | S_IXOTH);
+  int code = mkdir(fullDirPath.c_str(), kDirMode);
   if (code != 0 && errno != EEXIST && errno != EISDIR) {
     WPLOG(ERROR) << "failed to make directory " << fullDirPath;
     return false;
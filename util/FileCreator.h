@@ -11,15 +11,20 @@
 #include <wdt/Protocol.h>
 #include <wdt/WdtConfig.h>
 #include <wdt/util/CommonImpl.h>
+#include <wdt/util/DirHandleCache.h>
+#include <wdt/util/FileAllocationMap.h>
+#include <wdt/util/FileAllocator.h>
+#include <wdt/util/StripePlacement.h>
 #include <wdt/util/TransferLogManager.h>
 
-#include <folly/SpinLock.h>
 #include <glog/logging.h>
-#include <condition_variable>
-#include <map>
+#include <fcntl.h>
+#include <unistd.h>
+#include <memory>
 #include <mutex>
 #include <string>
 #include <unordered_set>
+#include <vector>
 
 namespace facebook {
 namespace wdt {
@@ -36,9 +41,12 @@ namespace wdt {
  */
 class FileCreator {
  public:
-  FileCreator(const std::string &rootDir, int numThreads,
-              TransferLogManager &transferLogManager, bool skipWrites)
-      : transferLogManager_(transferLogManager), skipWrites_(skipWrites) {
+  FileCreator(const std::string &rootDir,
+              TransferLogManager &transferLogManager, bool skipWrites,
+              FileAllocator *fileAllocator = nullptr)
+      : transferLogManager_(transferLogManager),
+        skipWrites_(skipWrites),
+        fileAllocator_(fileAllocator) {
     CHECK(!rootDir.empty());
 
     // For creating root directory, we are using createDirRecursively.
@@ -50,13 +58,56 @@ class FileCreator {
     createDirRecursively(rootDirPath, false);
     resetDirCache();
     rootDir_ = rootDirPath;
-    threadConditionVariables_ = new std::condition_variable[numThreads];
+    rootDirFd_ = open(rootDir_.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (rootDirFd_ >= 0) {
+      rootDirHandle_ = std::make_shared<DirHandleCache::Handle>(rootDirFd_);
+    } else if (!skipWrites_) {
+      WPLOG(ERROR) << "Unable to open root dir " << rootDir_;
+    }
   }
 
   virtual ~FileCreator() {
-    delete[] threadConditionVariables_;
   }
 
+  /**
+   * Enables creating and opening files relative to cached descriptors of their
+   * parent directory. Must be called before the creator is used.
+   *
+   * @param cacheSize   maximum number of directories kept open, 0 to open
+   *                    files using their full path
+   */
+  void setDirHandleCacheSize(int64_t cacheSize) {
+    if (cacheSize > 0 && rootDirHandle_) {
+      dirHandleCache_ = std::make_unique<DirHandleCache>(cacheSize);
+    }
+    for (auto &stripeCreator : stripeCreators_) {
+      stripeCreator->setDirHandleCacheSize(cacheSize);
+    }
+  }
+
+  /// drops cached directory handles, called after end of each session
+  void clearDirHandleCache() {
+    if (dirHandleCache_) {
+      dirHandleCache_->clear();
+    }
+    for (auto &stripeCreator : stripeCreators_) {
+      stripeCreator->clearDirHandleCache();
+    }
+  }
+
+  /**
+   * Spreads the files across stripe directories. The root dir is stripe 0,
+   * the other stripes get a creator of their own, to which the per file
+   * operations of this creator are forwarded. Must be called before the
+   * creator is used.
+   *
+   * @param stripePlacement   placement of the files, must outlive the creator
+   */
+  void setStripePlacement(StripePlacement *stripePlacement);
+
+  /// @return   creator of the stripe of a file, this one if not striping
+  FileCreator &getStripeCreator(const std::string &relPath);
+
   /**
    * This is used to open the file in block mode. If the current thread is the
    * first one to try to open the file, then it allocates space using
@@ -70,23 +121,99 @@ class FileCreator {
    */
   int openForBlocks(ThreadCtx &threadCtx, BlockDetails const *blockDetails);
 
+  /**
+   * Creates the directories sent ahead of the files by the sender. Directories
+   * already in the cache are skipped, the others are created with mkdirat
+   * relative to the root dir. Parents are expected to come before their
+   * children, but since batches are received on different connections, a
+   * missing parent is created recursively. With striping, directories are
+   * only created under the destination directory, the other stripes create
+   * the parents of the files placed on them.
+   *
+   * @param threadCtx     context of the calling thread
+   * @param directories   directories relative to root, ending with '/'
+   *
+   * @return              false if some directory name is invalid, failures
+   *                      to create directories are only logged, creation is
+   *                      retried when files are created in them
+   */
+  bool createDirectories(ThreadCtx &threadCtx,
+                         const std::vector<std::string> &directories);
+
   /// reset internal directory cache
   void resetDirCache() {
-    std::lock_guard<std::mutex> lock(mutex_);
-    createdDirs_.clear();
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      createdDirs_.clear();
+    }
+    for (auto &stripeCreator : stripeCreators_) {
+      stripeCreator->resetDirCache();
+    }
   }
 
   /// clears allocation status map, called after end of each session
   void clearAllocationMap() {
-    folly::SpinLockGuard guard(lock_);
-    fileStatusMap_.clear();
+    allocationMap_.clear();
+    for (auto &stripeCreator : stripeCreators_) {
+      stripeCreator->clearAllocationMap();
+    }
+  }
+
+  /**
+   * Deletes a file, relative to the cached handle of its parent directory if
+   * the cache is enabled. Thread-safe, used by the file deleter threads.
+   *
+   * @param relPath       path of the file relative to root dir
+   *
+   * @return              whether the file was deleted
+   */
+  bool deleteFile(const std::string &relPath);
+
+  /**
+   * Creates the parent directory of a file created by the caller itself
+   * (relative to getRootDirFd()), used by the small file batches
+   *
+   * @param threadCtx     context of the calling thread
+   * @param relPath       path of the file relative to root dir
+   *
+   * @return              whether the parent directory exists
+   */
+  bool createParentDirectory(ThreadCtx &threadCtx, const std::string &relPath);
+
+  /// adds the creation of a file created by the caller to the transfer log
+  void logFileCreation(ThreadCtx &threadCtx, BlockDetails const *blockDetails);
+
+  /**
+   * @return   descriptor of the root dir, -1 if it could not be opened. When
+   *           striping, only valid for files of this creator's stripe, see
+   *           getStripeCreator().
+   */
+  int getRootDirFd() const {
+    return rootDirFd_;
   }
 
+  /// @return   flags used to open files being created
+  int getCreateFlags(ThreadCtx &threadCtx) const;
+
+  /**
+   * Sets the modification time of a received file, for incremental sync
+   *
+   * @param fd        descriptor of the file, or of a directory if relPath is
+   *                  not empty
+   * @param relPath   path of the file relative to fd, empty if fd is the file
+   * @param mtimeNs   modification time in ns since the epoch
+   *
+   * @return          whether the time was set (logged otherwise)
+   */
+  static bool setModificationTime(int fd, const std::string &relPath,
+                                  int64_t mtimeNs);
+
  private:
   /**
    * Opens the file and sets its size. If the existing file size is greater than
    * required size, the file is truncated using ftruncate. Space is
-   * allocated using posix_fallocate.
+   * allocated using posix_fallocate, in the background for multi-block files
+   * if there is a file allocator.
    *
    * @param threadCtx     context of the calling thread
    * @param blockDetails  block-details
@@ -109,26 +236,74 @@ class FileCreator {
    * @return          file descriptor or -1 on error
    */
   int createFile(ThreadCtx &threadCtx, const std::string &relPath);
+  /**
+   * Create a file and open for writing relative to the handle of its parent
+   * directory, creating the parent if needed. Used instead of the path based
+   * creation if the directory handle cache is enabled.
+   *
+   * @param threadCtx     context of the calling thread
+   * @param relPath       path relative to root dir
+   * @param openFlags     flags to open the file with
+   *
+   * @return          file descriptor or -1 on error
+   */
+  int createFileInDir(ThreadCtx &threadCtx, const std::string &relPath,
+                      int openFlags);
+
   /**
    * Open existing file
    */
   int openExistingFile(ThreadCtx &threadCtx, const std::string &relPath);
 
+  /**
+   * Returns the handle of a directory, using the cache or opening it relative
+   * to the handle of its parent. Only used if the cache is enabled.
+   *
+   * @param dir       directory relative to root ending with '/', empty for
+   *                  root
+   * @param create    whether to create missing directories
+   *
+   * @return          handle of the directory, null on error
+   */
+  DirHandleCache::HandlePtr openDir(const std::string &dir, bool create);
+
+  /**
+   * Creates a single directory whose parent is expected to exist, relative to
+   * the handle of the parent if the cache is enabled, otherwise relative to
+   * the root
+   *
+   * @param dir       directory relative to root ending with '/'
+   *
+   * @return          0 on success, -1 with errno set otherwise
+   */
+  int makeDir(const std::string &dir);
+
+  /**
+   * splits a path relative to root into its parent directory (with trailing
+   * '/', empty for root) and its last component (without trailing '/')
+   */
+  static void splitPath(const std::string &relPath, std::string &parentDir,
+                        std::string &name);
+
   /**
    * sets the size of the file. If the size is greater then the
    * file is truncated using ftruncate. Space is allocated using fallocate.
    *
-   * @param threadCtx context of the calling thread
-   * @param fd        file descriptor
-   * @param fileSize  size of the file
+   * @param threadCtx     context of the calling thread
+   * @param fd            file descriptor
+   * @param fileSize      size of the file
+   * @param isMultiBlock  whether more blocks of the file are still to come, in
+   *                      which case the allocation is left to fileAllocator_
+   *                      and the size is only extended with ftruncate
    *
-   * @return          true for success, false otherwise
+   * @return              true for success, false otherwise
    */
-  bool setFileSize(ThreadCtx &threadCtx, int fd, int64_t fileSize);
+  bool setFileSize(ThreadCtx &threadCtx, int fd, int64_t fileSize,
+                   bool isMultiBlock);
 
   /**
    * opens the file and sets it size. Called only for the first block to request
-   * opening a multi-block file. Sets the allocation status in fileStatusMap_
+   * opening a multi-block file. Sets the allocation status in allocationMap_
    * and notifies other waiting thread.
    *
    * @param threadCtx     context of the calling thread
@@ -136,10 +311,8 @@ class FileCreator {
    *
    * @return          file descriptor or -1 on error
    */
-  int openForFirstBlock(ThreadCtx &threadCtx, BlockDetails const *blockDetails);
-
-  /// waits for allocation of a file to finish
-  bool waitForAllocationFinish(int allocatingThreadIndex, int64_t seqId);
+  int openForFirstBlock(ThreadCtx &threadCtx, BlockDetails const *blockDetails,
+                        FileAllocationMap::Entry *entry);
 
   /// appends a trailing / if not already there to path
   static void addTrailingSlash(std::string &path);
@@ -169,31 +342,40 @@ class FileCreator {
   /// root directory
   std::string rootDir_;
 
+  /// placement of the files across stripes, null if not striping
+  StripePlacement *stripePlacement_{nullptr};
+
+  /// stripe of this creator, -1 if not striping
+  int stripe_{-1};
+
+  /// creators of the other stripes, stripe i is at index i - 1
+  std::vector<std::unique_ptr<FileCreator>> stripeCreators_;
+
+  /// descriptor of the root directory, -1 if it could not be opened
+  int rootDirFd_{-1};
+
+  /// handle owning rootDirFd_
+  DirHandleCache::HandlePtr rootDirHandle_;
+
+  /// cache of open directories, null if disabled
+  std::unique_ptr<DirHandleCache> dirHandleCache_;
+
   /// directories created so far, relative to root
   std::unordered_set<std::string> createdDirs_;
 
   /// protects createdDirs_
   std::mutex mutex_;
 
-  const int ALLOCATED{-1};
-  const int FAILED{-2};
-
-  /// map from file sequence id to allocation status. There are four possible
-  /// allocation status. NOT STARTED(no entry in the map), ALLOCATED(-1),
-  /// FAILED(-2) and IN_PROGRESS(map value is the index of the allocating
-  /// thread)
-  std::map<int64_t, int> fileStatusMap_;
+  /// allocation status of the multi-block files
+  FileAllocationMap allocationMap_;
   /// transfer log manger used by receiver
   TransferLogManager &transferLogManager_;
-  /// mutex to coordinate waiting among threads
-  std::mutex allocationMutex_;
-  /// array of condition_variables for different threads
-  std::condition_variable *threadConditionVariables_;
-  /// lock protecting fileStatusMap_
-  folly::SpinLock lock_;
 
   // Set to prevent creating files
   bool skipWrites_;
+
+  /// background allocator for multi-block files, can be null
+  FileAllocator *fileAllocator_;
 };
 }
 }
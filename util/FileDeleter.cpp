@@ -0,0 +1,121 @@
+/**
+ * Copyright (c) 2014-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+#include <wdt/util/FileDeleter.h>
+
+#include <algorithm>
+
+namespace facebook {
+namespace wdt {
+
+FileDeleter::FileDeleter(const WdtOptions &options) : options_(options) {
+}
+
+FileDeleter::~FileDeleter() {
+  shutdownThreads();
+}
+
+void FileDeleter::startThreads() {
+  WDT_CHECK(deleterThreads_.empty()) << "Deleter threads already started";
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    finished_ = false;
+  }
+  for (int i = 0; i < options_.deletion_threads; i++) {
+    deleterThreads_.emplace_back(&FileDeleter::threadProcDelete, this);
+  }
+}
+
+void FileDeleter::shutdownThreads() {
+  if (deleterThreads_.empty()) {
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    finished_ = true;
+  }
+  conditionPending_.notify_all();
+  for (auto &deleterThread : deleterThreads_) {
+    deleterThread.join();
+  }
+  deleterThreads_.clear();
+}
+
+int64_t FileDeleter::deleteFiles(FileCreator &fileCreator,
+                                 const std::vector<BlockDetails> &files) {
+  Batch batch(fileCreator, files);
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!finished_ && !deleterThreads_.empty()) {
+      batches_.push_back(&batch);
+      conditionPending_.notify_all();
+    }
+  }
+  // the calling thread deletes files as well
+  processBatch(batch);
+  std::unique_lock<std::mutex> lock(mutex_);
+  conditionDone_.wait(lock, [&batch] {
+    return batch.numProcessed == (int64_t)batch.files.size() &&
+           batch.numWorkers == 0;
+  });
+  auto it = std::find(batches_.begin(), batches_.end(), &batch);
+  if (it != batches_.end()) {
+    batches_.erase(it);
+  }
+  return batch.numDeleted;
+}
+
+void FileDeleter::processBatch(Batch &batch) {
+  const int64_t numFiles = batch.files.size();
+  while (true) {
+    const int64_t index = batch.nextIndex.fetch_add(1);
+    if (index >= numFiles) {
+      break;
+    }
+    const bool deleted =
+        batch.fileCreator.deleteFile(batch.files[index].fileName);
+    std::lock_guard<std::mutex> lock(mutex_);
+    ++batch.numProcessed;
+    if (deleted) {
+      ++batch.numDeleted;
+    }
+    if (batch.numProcessed == numFiles) {
+      conditionDone_.notify_all();
+    }
+  }
+}
+
+void FileDeleter::threadProcDelete() {
+  WVLOG(1) << "File deleter thread started";
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (true) {
+    conditionPending_.wait(lock,
+                           [this] { return finished_ || !batches_.empty(); });
+    if (batches_.empty()) {
+      // finished, callers delete whatever is left of their batches
+      break;
+    }
+    Batch *batch = batches_.front();
+    if (batch->nextIndex.load() >= (int64_t)batch->files.size()) {
+      // every file of the batch is claimed
+      batches_.pop_front();
+      continue;
+    }
+    // the caller waits for the workers before its batch goes away
+    ++batch->numWorkers;
+    lock.unlock();
+    processBatch(*batch);
+    lock.lock();
+    if (--batch->numWorkers == 0) {
+      conditionDone_.notify_all();
+    }
+  }
+  WVLOG(1) << "File deleter thread finished";
+}
+}
+}
@@ -0,0 +1,104 @@
+/**
+ * Copyright (c) 2014-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+#pragma once
+
+#include <wdt/Protocol.h>
+#include <wdt/WdtOptions.h>
+#include <wdt/util/FileCreator.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace facebook {
+namespace wdt {
+
+/**
+ * Small pool of threads deleting the extra files of the receiver side.
+ * With delete_extra_files, the sender sends the files to be deleted in
+ * batches, and the unlinks of a batch run in parallel on the pool and on the
+ * receiver thread which got the batch, instead of one at a time on that
+ * thread.
+ */
+class FileDeleter {
+ public:
+  /// @param options    wdt options
+  explicit FileDeleter(const WdtOptions &options);
+
+  /// Stops the deleter threads
+  ~FileDeleter();
+
+  /// Starts deletion_threads deleter threads
+  void startThreads();
+
+  /// Joins the deleter threads
+  void shutdownThreads();
+
+  /**
+   * Deletes files, on the deleter threads and on the calling thread. Returns
+   * once every file was processed.
+   *
+   * @param fileCreator   file creator of the transfer
+   * @param files         files to delete
+   *
+   * @return              number of files deleted, failures are logged
+   */
+  int64_t deleteFiles(FileCreator &fileCreator,
+                      const std::vector<BlockDetails> &files);
+
+  /// Copy constructor deleted
+  FileDeleter(const FileDeleter &that) = delete;
+
+  /// Delete the assignment operatory by copy
+  FileDeleter &operator=(const FileDeleter &that) = delete;
+
+ private:
+  /// files of a deleteFiles() call, owned by the caller
+  struct Batch {
+    Batch(FileCreator &creator, const std::vector<BlockDetails> &batchFiles)
+        : fileCreator(creator), files(batchFiles) {
+    }
+    FileCreator &fileCreator;
+    const std::vector<BlockDetails> &files;
+    /// index of the next file to claim
+    std::atomic<int64_t> nextIndex{0};
+    /// following are protected by mutex_
+    /// number of files processed
+    int64_t numProcessed{0};
+    /// number of files deleted
+    int64_t numDeleted{0};
+    /// number of deleter threads working on the batch
+    int numWorkers{0};
+  };
+
+  /// entry point of the deleter threads
+  void threadProcDelete();
+
+  /// deletes files of the batch till there is none left to claim
+  void processBatch(Batch &batch);
+
+  /// wdt options
+  const WdtOptions &options_;
+  /// batches which may have files left to claim
+  std::deque<Batch *> batches_;
+  /// Flag to signal end to the deleter threads
+  bool finished_{false};
+  /// deleter threads
+  std::vector<std::thread> deleterThreads_;
+  std::mutex mutex_;
+  /// signalled when there is a new batch or the threads need to finish
+  std::condition_variable conditionPending_;
+  /// signalled when a batch may be complete
+  std::condition_variable conditionDone_;
+};
+}
+}
@@ -8,11 +8,15 @@
  */
 #include <wdt/util/FileWriter.h>
 #include <wdt/util/CommonImpl.h>
+#include <wdt/util/DeviceLimiter.h>
+#include <wdt/util/WritebackController.h>
 
 #include <fcntl.h>
 #include <gflags/gflags.h>
 #include <glog/logging.h>
+#include <sys/stat.h>
 #include <sys/types.h>
+#include <unistd.h>
 
 namespace facebook {
 namespace wdt {
@@ -55,6 +59,15 @@ ErrorCode FileWriter::open() {
     WLOG(ERROR) << "File open/seek failed for " << blockDetails_->fileName;
     return FILE_WRITE_ERROR;
   }
+  if (threadCtx_.getOptions().max_threads_per_device > 0) {
+    struct stat fileStat;
+    if (fstat(fd_, &fileStat) != 0) {
+      WPLOG(ERROR) << "fstat() failed for " << blockDetails_->fileName;
+      close();
+      return FILE_WRITE_ERROR;
+    }
+    deviceId_ = fileStat.st_dev;
+  }
   return OK;
 }
 
@@ -63,13 +76,29 @@ ErrorCode FileWriter::sync() {
     // File was either never opened or already closed
     return OK;
   }
+  if (blockDetails_->mtimeNs >= 0 &&
+      totalWritten_ == blockDetails_->dataSize) {
+    // after the last write, and before the sync which persists it
+    if (!FileCreator::setModificationTime(fd_, "", blockDetails_->mtimeNs)) {
+      return FILE_WRITE_ERROR;
+    }
+  }
   const auto &options = threadCtx_.getOptions();
-  if (options.fsync || options.isLogBasedResumption()) {
+  if (diskFlusher_ != nullptr) {
+    // group commit: the flusher owns the duplicate and syncs it in a batch
+    const int flushFd = ::dup(fd_);
+    if (flushFd < 0) {
+      WPLOG(ERROR) << "Unable to dup() fd " << fd_ << " for flushing";
+      return FILE_WRITE_ERROR;
+    }
+    flushTicket_ = diskFlusher_->addFd(flushFd);
+  } else if (options.fsync || options.isLogBasedResumption()) {
     PerfStatCollector statCollector(threadCtx_, PerfStatReport::FSYNC_STATS);
     if (::fsync(fd_) < 0) {
       WPLOG(ERROR) << "Unable to fsync() fd " << fd_;
       return FILE_WRITE_ERROR;
    }
+    releaseDirtyBytes(true);
   }
 #ifdef HAS_POSIX_FADVISE
   if (!options.skip_fadvise) {
@@ -87,6 +116,7 @@ ErrorCode FileWriter::sync() {
 }
 
 ErrorCode FileWriter::close() {
+  const bool released = releaseDirtyBytes(false);
   if (fd_ >= 0) {
     PerfStatCollector statCollector(threadCtx_, PerfStatReport::FILE_CLOSE);
     if (::close(fd_) != 0) {
@@ -96,7 +126,7 @@ ErrorCode FileWriter::close() {
     }
     fd_ = -1;
   }
-  return OK;
+  return released ? OK : FILE_WRITE_ERROR;
 }
 
 bool FileWriter::isClosed() {
@@ -107,30 +137,20 @@ ErrorCode FileWriter::write(char *buf, int64_t size) {
   WDT_CHECK_NE(TO_BE_DELETED, blockDetails_->allocationStatus);
   auto &options = threadCtx_.getOptions();
   if (!options.skip_writes) {
-    int64_t count = 0;
-    while (count < size) {
-      int64_t written;
-      {
-        PerfStatCollector statCollector(threadCtx_, PerfStatReport::FILE_WRITE);
-        written = ::write(fd_, buf + count, size - count);
-      }
-      if (written == -1) {
-        if (errno == EINTR) {
-          WVLOG(1) << "Disk write interrupted, retrying "
-                   << blockDetails_->fileName;
-          continue;
-        }
-        WPLOG(ERROR) << "File write failed for " << blockDetails_->fileName
-                     << "fd : " << fd_ << " " << written << " " << count << " "
-                     << size;
-        return FILE_WRITE_ERROR;
-      }
-      count += written;
+    if (deviceId_ >= 0) {
+      DeviceLimiter::get().acquire(deviceId_, options.max_threads_per_device);
+    }
+    const ErrorCode code = writeToDevice(buf, size);
+    // the slot only covers the write, a thread waiting for writeback below
+    // must not keep the other threads off the device
+    if (deviceId_ >= 0) {
+      DeviceLimiter::get().release(deviceId_);
+    }
+    if (code != OK) {
+      return code;
     }
-    WVLOG(1) << "Successfully written " << count << " bytes to fd " << fd_
-             << " for file " << blockDetails_->fileName;
     const bool finished = ((totalWritten_ + size) == blockDetails_->dataSize);
-    if (!syncFileRange(count, finished /*forced*/)) {
+    if (!syncFileRange(size, finished /*forced*/)) {
       return FILE_WRITE_ERROR;
     }
   }
@@ -138,13 +158,47 @@ ErrorCode FileWriter::write(char *buf, int64_t size) {
   return OK;
 }
 
+ErrorCode FileWriter::writeToDevice(char *buf, int64_t size) {
+  int64_t count = 0;
+  while (count < size) {
+    int64_t written;
+    {
+      PerfStatCollector statCollector(threadCtx_, PerfStatReport::FILE_WRITE);
+      written = ::write(fd_, buf + count, size - count);
+    }
+    if (written == -1) {
+      if (errno == EINTR) {
+        WVLOG(1) << "Disk write interrupted, retrying "
+                 << blockDetails_->fileName;
+        continue;
+      }
+      WPLOG(ERROR) << "File write failed for " << blockDetails_->fileName
+                   << "fd : " << fd_ << " " << written << " " << count << " "
+                   << size;
+      return FILE_WRITE_ERROR;
+    }
+    count += written;
+  }
+  WVLOG(1) << "Successfully written " << count << " bytes to fd " << fd_
+           << " for file " << blockDetails_->fileName;
+  return OK;
+}
+
 bool FileWriter::syncFileRange(int64_t written, bool forced) {
 #ifdef HAS_SYNC_FILE_RANGE
   const WdtOptions &options = threadCtx_.getOptions();
   if (options.disk_sync_interval_mb < 0) {
     return true;
   }
-  const int64_t syncIntervalBytes = options.disk_sync_interval_mb * 1024 * 1024;
+  WritebackController &writebackController = WritebackController::get();
+  const bool controllerEnabled = WritebackController::isEnabled(options);
+  if (syncIntervalBytes_ < 0) {
+    syncIntervalBytes_ = writebackController.getSyncIntervalBytes(options);
+  }
+  if (controllerEnabled) {
+    writebackController.addDirtyBytes(written);
+    dirtyBytes_ += written;
+  }
   writtenSinceLastSync_ += written;
   if (writtenSinceLastSync_ == 0) {
     // no need to sync
@@ -153,7 +207,7 @@ bool FileWriter::syncFileRange(int64_t written, bool forced) {
              << " sync forced = " << std::boolalpha << forced;
     return true;
   }
-  if (forced || writtenSinceLastSync_ > syncIntervalBytes) {
+  if (forced || writtenSinceLastSync_ > syncIntervalBytes_) {
     // sync_file_range with flag SYNC_FILE_RANGE_WRITE is an asynchronous
     // operation. So, this is not that costly. Source :
     // http://yoshinorimatsunobu.blogspot.com/2014/03/how-syncfilerange-really-works.html
@@ -174,11 +228,86 @@ bool FileWriter::syncFileRange(int64_t written, bool forced) {
     WVLOG(1) << "file range [" << nextSyncOffset_ << " "
              << writtenSinceLastSync_ << "] synced for file "
              << blockDetails_->fileName;
+    const int64_t rangeStart = nextSyncOffset_;
     nextSyncOffset_ += writtenSinceLastSync_;
     writtenSinceLastSync_ = 0;
+    if (controllerEnabled && writebackController.isOverLimit(options)) {
+      // Too many dirty pages in the process, wait for the ranges of the
+      // closed files, then for the ranges started before the one we just
+      // started. They have had time to be written, so this mostly waits on
+      // the device and not on our own writes
+      if (!writebackController.waitForClosedRanges(threadCtx_)) {
+        return false;
+      }
+      if (rangeStart > writebackOffset_ &&
+          writebackController.isOverLimit(options) &&
+          !waitForWriteback(rangeStart)) {
+        return false;
+      }
+    }
+  }
+#endif
+  return true;
+}
+
+bool FileWriter::waitForWriteback(int64_t endOffset) {
+#ifdef HAS_SYNC_FILE_RANGE
+  const int64_t length = endOffset - writebackOffset_;
+  if (length <= 0) {
+    return true;
+  }
+  int status;
+  {
+    PerfStatCollector statCollector(threadCtx_, PerfStatReport::WRITEBACK_WAIT);
+    status = sync_file_range(fd_, writebackOffset_, length,
+                             SYNC_FILE_RANGE_WAIT_BEFORE |
+                                 SYNC_FILE_RANGE_WRITE |
+                                 SYNC_FILE_RANGE_WAIT_AFTER);
   }
+  if (status != 0) {
+    WPLOG(ERROR) << "sync_file_range() wait failed for "
+                 << blockDetails_->fileName << " fd " << fd_;
+    return false;
+  }
+  WVLOG(1) << "file range [" << writebackOffset_ << " " << length
+           << "] written back for file " << blockDetails_->fileName;
+  const int64_t cleanBytes = std::min(length, dirtyBytes_);
+  WritebackController::get().removeDirtyBytes(cleanBytes, true);
+  dirtyBytes_ -= cleanBytes;
+  writebackOffset_ = endOffset;
 #endif
   return true;
 }
+
+bool FileWriter::releaseDirtyBytes(bool writtenBack) {
+#ifdef HAS_SYNC_FILE_RANGE
+  if (dirtyBytes_ == 0) {
+    return true;
+  }
+  WritebackController &writebackController = WritebackController::get();
+  if (writtenBack || fd_ < 0) {
+    writebackController.removeDirtyBytes(dirtyBytes_, writtenBack);
+    dirtyBytes_ = 0;
+    return true;
+  }
+  // the pages this block leaves behind stay counted till waited for
+  const int64_t endOffset = nextSyncOffset_ + writtenSinceLastSync_;
+  const int rangeFd = ::dup(fd_);
+  if (rangeFd < 0) {
+    WPLOG(ERROR) << "Unable to dup() fd " << fd_ << ", waiting for writeback";
+    const bool success = waitForWriteback(endOffset);
+    writebackController.removeDirtyBytes(dirtyBytes_, false);
+    dirtyBytes_ = 0;
+    return success;
+  }
+  writebackController.addClosedRange(rangeFd, writebackOffset_,
+                                     endOffset - writebackOffset_,
+                                     dirtyBytes_);
+  dirtyBytes_ = 0;
+  return true;
+#else
+  return true;
+#endif
+}
 }
 }
@@ -11,6 +11,7 @@
 #include <wdt/Protocol.h>
 #include <wdt/WdtConfig.h>
 #include <wdt/Writer.h>
+#include <wdt/util/DiskFlusher.h>
 #include <wdt/util/FileCreator.h>
 
 namespace facebook {
@@ -19,13 +20,15 @@ namespace wdt {
 class FileWriter : public Writer {
  public:
   FileWriter(ThreadCtx &threadCtx, BlockDetails const *blockDetails,
-             FileCreator *fileCreator)
+             FileCreator *fileCreator, DiskFlusher *diskFlusher = nullptr)
       : threadCtx_(threadCtx),
         blockDetails_(blockDetails),
 #ifdef HAS_SYNC_FILE_RANGE
         nextSyncOffset_(blockDetails->offset),
+        writebackOffset_(blockDetails->offset),
 #endif
-        fileCreator_(fileCreator) {
+        fileCreator_(fileCreator),
+        diskFlusher_(diskFlusher) {
   }
 
   ~FileWriter() override;
@@ -43,13 +46,22 @@ class FileWriter : public Writer {
 
   /// @see Writer.h
   /// This method calls fsync() and posix_fadvise, except if options are set
-  /// to disable it.
+  /// to disable it. If a disk flusher is set, the fsync is deferred to it and
+  /// the data is only durable once getFlushTicket() is flushed.
   ErrorCode sync() override;
 
+  /// @return   ticket of the deferred flush, 0 if nothing was deferred
+  int64_t getFlushTicket() const {
+    return flushTicket_;
+  }
+
   /// @see Writer.h
   ErrorCode close() override;
 
  private:
+  /// writes the whole buffer to the file
+  ErrorCode writeToDevice(char *buf, int64_t size);
+
   /**
    * calls sync_file_range at disk_sync_interval_mb intervals.
    *
@@ -58,6 +70,27 @@ class FileWriter : public Writer {
    */
   bool syncFileRange(int64_t written, bool forced);
 
+  /**
+   * Waits for the range from the last waited offset till endOffset to be
+   * written back and removes it from the dirty bytes of the writeback
+   * controller.
+   *
+   * @param endOffset   end of the range to wait for
+   * @return            whether the wait succeeded
+   */
+  bool waitForWriteback(int64_t endOffset);
+
+  /**
+   * Removes the bytes still accounted to this writer from the writeback
+   * controller. Bytes not known to be on disk are handed to the controller
+   * with a duplicate of the descriptor, and stay counted till their writeback
+   * is waited for or the controller drops them.
+   *
+   * @param writtenBack   whether the bytes are known to be on disk already
+   * @return              false if waiting for a writeback failed
+   */
+  bool releaseDirtyBytes(bool writtenBack);
+
   /**
    * Return true if the file is already closed.
    */
@@ -74,14 +107,29 @@ class FileWriter : public Writer {
   /// number of bytes written
   int64_t totalWritten_{0};
 
+  /// device of the file when max_threads_per_device is set, -1 otherwise
+  int64_t deviceId_{-1};
+
 #ifdef HAS_SYNC_FILE_RANGE
   /// offset to use for next sync
   int64_t nextSyncOffset_;
   /// number of bytes written since last sync
   int64_t writtenSinceLastSync_{0};
+  /// offset till which the writeback was waited for
+  int64_t writebackOffset_;
+  /// bytes added to the writeback controller and not yet removed
+  int64_t dirtyBytes_{0};
+  /// number of bytes to write before starting writeback, -1 if not computed
+  int64_t syncIntervalBytes_{-1};
 #endif
   /// reference to file creator
   FileCreator *fileCreator_;
+
+  /// group commit flusher, nullptr if blocks are fsync'ed inline
+  DiskFlusher *diskFlusher_;
+
+  /// ticket returned by the flusher for this block
+  int64_t flushTicket_{0};
 };
 }
 }
@@ -0,0 +1,187 @@
+/**
+ * Copyright (c) 2014-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+#include <wdt/util/IoUring.h>
+
+#ifdef WDT_HAS_IO_URING
+
+#include <wdt/ErrorCodes.h>
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+namespace facebook {
+namespace wdt {
+
+IoUring::~IoUring() {
+  if (sqes_ != nullptr) {
+    munmap(sqes_, sqesSize_);
+  }
+  if (cqRing_ != nullptr && cqRing_ != sqRing_) {
+    munmap(cqRing_, cqRingSize_);
+  }
+  if (sqRing_ != nullptr) {
+    munmap(sqRing_, sqRingSize_);
+  }
+  if (ringFd_ >= 0) {
+    ::close(ringFd_);
+  }
+}
+
+bool IoUring::init(int numEntries, int numFiles) {
+  WDT_CHECK(ringFd_ < 0) << "io_uring already initialized";
+  struct io_uring_params params;
+  memset(&params, 0, sizeof(params));
+  params.flags = IORING_SETUP_CLAMP;
+  ringFd_ = syscall(__NR_io_uring_setup, numEntries, &params);
+  if (ringFd_ < 0) {
+    WPLOG(WARNING) << "io_uring_setup failed for " << numEntries
+                   << " entries";
+    return false;
+  }
+  sqRingSize_ = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+  cqRingSize_ =
+      params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+  const bool singleMmap = (params.features & IORING_FEAT_SINGLE_MMAP);
+  if (singleMmap) {
+    sqRingSize_ = cqRingSize_ = std::max(sqRingSize_, cqRingSize_);
+  }
+  sqRing_ = mmap(nullptr, sqRingSize_, PROT_READ | PROT_WRITE,
+                 MAP_SHARED | MAP_POPULATE, ringFd_, IORING_OFF_SQ_RING);
+  if (sqRing_ == MAP_FAILED) {
+    sqRing_ = nullptr;
+    WPLOG(ERROR) << "Unable to map io_uring submission ring";
+    return false;
+  }
+  if (singleMmap) {
+    cqRing_ = sqRing_;
+  } else {
+    cqRing_ = mmap(nullptr, cqRingSize_, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_POPULATE, ringFd_, IORING_OFF_CQ_RING);
+    if (cqRing_ == MAP_FAILED) {
+      cqRing_ = nullptr;
+      WPLOG(ERROR) << "Unable to map io_uring completion ring";
+      return false;
+    }
+  }
+  sqesSize_ = params.sq_entries * sizeof(struct io_uring_sqe);
+  void *sqes = mmap(nullptr, sqesSize_, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, ringFd_, IORING_OFF_SQES);
+  if (sqes == MAP_FAILED) {
+    WPLOG(ERROR) << "Unable to map io_uring submission entries";
+    return false;
+  }
+  sqes_ = static_cast<struct io_uring_sqe *>(sqes);
+  char *sq = static_cast<char *>(sqRing_);
+  sqHead_ = reinterpret_cast<std::atomic<uint32_t> *>(sq + params.sq_off.head);
+  sqTail_ = reinterpret_cast<std::atomic<uint32_t> *>(sq + params.sq_off.tail);
+  sqMask_ = *reinterpret_cast<uint32_t *>(sq + params.sq_off.ring_mask);
+  sqArray_ = reinterpret_cast<uint32_t *>(sq + params.sq_off.array);
+  char *cq = static_cast<char *>(cqRing_);
+  cqHead_ = reinterpret_cast<std::atomic<uint32_t> *>(cq + params.cq_off.head);
+  cqTail_ = reinterpret_cast<std::atomic<uint32_t> *>(cq + params.cq_off.tail);
+  cqMask_ = *reinterpret_cast<uint32_t *>(cq + params.cq_off.ring_mask);
+  cqes_ = reinterpret_cast<struct io_uring_cqe *>(cq + params.cq_off.cqes);
+  sqEntries_ = params.sq_entries;
+  localSqTail_ = sqTail_->load(std::memory_order_relaxed);
+
+  // sparse table of direct descriptors, openat installs the files in it
+  std::vector<int32_t> files(numFiles, -1);
+  if (syscall(__NR_io_uring_register, ringFd_, IORING_REGISTER_FILES,
+              files.data(), numFiles) < 0) {
+    WPLOG(WARNING) << "Unable to register " << numFiles
+                   << " io_uring file slots";
+    return false;
+  }
+  numFiles_ = numFiles;
+  return true;
+}
+
+struct io_uring_sqe *IoUring::getSqe() {
+  const uint32_t head = sqHead_->load(std::memory_order_acquire);
+  if (localSqTail_ - head >= (uint32_t)sqEntries_) {
+    return nullptr;
+  }
+  const uint32_t index = localSqTail_ & sqMask_;
+  struct io_uring_sqe *sqe = &sqes_[index];
+  memset(sqe, 0, sizeof(*sqe));
+  sqArray_[index] = index;
+  ++localSqTail_;
+  ++numToSubmit_;
+  return sqe;
+}
+
+int IoUring::enter(int toSubmit, int minComplete, unsigned flags) {
+  while (true) {
+    int ret = syscall(__NR_io_uring_enter, ringFd_, toSubmit, minComplete,
+                      flags, nullptr, 0);
+    if (ret >= 0 || errno != EINTR) {
+      return ret;
+    }
+  }
+}
+
+int IoUring::submitAndWait(int numCompletions) {
+  // publish the queued entries to the kernel
+  sqTail_->store(localSqTail_, std::memory_order_release);
+  if (numToSubmit_ > 0) {
+    int ret = enter(numToSubmit_, 0, 0);
+    if (ret < 0) {
+      if ((errno != EAGAIN && errno != EBUSY) || numInFlight_ == 0) {
+        WPLOG(ERROR) << "io_uring_enter failed to submit " << numToSubmit_
+                     << " entries";
+        return -errno;
+      }
+      // out of resources, the completions reaped make room for the rest
+      ret = 0;
+    }
+    if (ret == 0 && numInFlight_ == 0) {
+      WLOG(ERROR) << "io_uring_enter did not submit any of " << numToSubmit_
+                  << " entries";
+      return -EAGAIN;
+    }
+    numToSubmit_ -= ret;
+    numInFlight_ += ret;
+    WLOG_IF(WARNING, numToSubmit_ > 0)
+        << "io_uring_enter only submitted " << ret << " entries, "
+        << numToSubmit_ << " left for the next call";
+  }
+  return waitForCompletions(numCompletions);
+}
+
+int IoUring::waitForCompletions(int numCompletions) {
+  // only the entries submitted can complete
+  const int minComplete = std::min(numCompletions, numInFlight_);
+  if (minComplete > 0 && enter(0, minComplete, IORING_ENTER_GETEVENTS) < 0) {
+    WPLOG(ERROR) << "io_uring_enter failed waiting for " << minComplete
+                 << " completions";
+    return -errno;
+  }
+  return 0;
+}
+
+bool IoUring::popCompletion(uint64_t &userData, int32_t &res) {
+  const uint32_t head = cqHead_->load(std::memory_order_relaxed);
+  if (head == cqTail_->load(std::memory_order_acquire)) {
+    return false;
+  }
+  const struct io_uring_cqe &cqe = cqes_[head & cqMask_];
+  userData = cqe.user_data;
+  res = cqe.res;
+  cqHead_->store(head + 1, std::memory_order_release);
+  --numInFlight_;
+  return true;
+}
+}
+}
+
+#endif
@@ -0,0 +1,141 @@
+/**
+ * Copyright (c) 2014-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+#pragma once
+
+#include <wdt/WdtConfig.h>
+
+#ifdef WDT_HAS_IO_URING
+
+#include <linux/io_uring.h>
+#include <atomic>
+#include <cstdint>
+
+namespace facebook {
+namespace wdt {
+
+/**
+ * Minimal io_uring wrapper on top of the raw system calls, so that wdt does
+ * not depend on liburing. Supports a single submitting thread, and a table of
+ * registered (direct) file descriptors so that openat/write/close of a file
+ * can be linked in a single submission.
+ */
+class IoUring {
+ public:
+  IoUring() {
+  }
+
+  /// Unmaps the rings and closes the ring descriptor
+  ~IoUring();
+
+  /**
+   * Sets up the ring
+   *
+   * @param numEntries    number of submission entries, the kernel may clamp it
+   * @param numFiles      number of direct descriptor slots to register
+   *
+   * @return              whether io_uring is usable
+   */
+  bool init(int numEntries, int numFiles);
+
+  /// @return   number of submission entries of the ring
+  int getNumEntries() const {
+    return sqEntries_;
+  }
+
+  /// @return   number of registered direct descriptor slots
+  int getNumFiles() const {
+    return numFiles_;
+  }
+
+  /**
+   * Returns the next submission entry, zeroed. The entry is queued and
+   * submitted by the next call to submitAndWait.
+   *
+   * @return    submission entry, nullptr if the submission queue is full
+   */
+  struct io_uring_sqe *getSqe();
+
+  /**
+   * Submits the queued entries and waits till at least numCompletions
+   * completions are ready, or all the completions of the entries submitted.
+   * The entries the kernel could not take yet are submitted by the next call
+   *
+   * @return    0 on success, -errno otherwise
+   */
+  int submitAndWait(int numCompletions);
+
+  /**
+   * Pops a ready completion
+   *
+   * @param userData    set to the user data of the entry
+   * @param res         set to the result of the entry
+   *
+   * @return            false if no completion is ready
+   */
+  bool popCompletion(uint64_t &userData, int32_t &res);
+
+  /// @return   number of entries submitted whose completion was not popped
+  int getNumInFlight() const {
+    return numInFlight_;
+  }
+
+  /**
+   * Waits for completions of the entries already submitted, without
+   * submitting the queued ones
+   *
+   * @param numCompletions  number of completions to wait for, capped to the
+   *                        number of entries in flight
+   *
+   * @return                0 on success, -errno otherwise
+   */
+  int waitForCompletions(int numCompletions);
+
+  /// Copy constructor deleted
+  IoUring(const IoUring &that) = delete;
+
+  /// Delete the assignment operatory by copy
+  IoUring &operator=(const IoUring &that) = delete;
+
+ private:
+  /// io_uring_enter, retried on EINTR
+  int enter(int toSubmit, int minComplete, unsigned flags);
+
+  /// descriptor of the ring
+  int ringFd_{-1};
+  /// mappings of the rings and of the submission entries
+  void *sqRing_{nullptr};
+  size_t sqRingSize_{0};
+  void *cqRing_{nullptr};
+  size_t cqRingSize_{0};
+  struct io_uring_sqe *sqes_{nullptr};
+  size_t sqesSize_{0};
+  /// pointers into the shared rings
+  std::atomic<uint32_t> *sqHead_{nullptr};
+  std::atomic<uint32_t> *sqTail_{nullptr};
+  uint32_t sqMask_{0};
+  uint32_t *sqArray_{nullptr};
+  std::atomic<uint32_t> *cqHead_{nullptr};
+  std::atomic<uint32_t> *cqTail_{nullptr};
+  uint32_t cqMask_{0};
+  struct io_uring_cqe *cqes_{nullptr};
+  /// number of submission entries of the ring
+  int sqEntries_{0};
+  /// tail of the submission queue, including entries not yet published
+  uint32_t localSqTail_{0};
+  /// number of entries queued and not yet submitted
+  int numToSubmit_{0};
+  /// number of entries submitted whose completion was not popped yet
+  int numInFlight_{0};
+  /// number of registered direct descriptor slots
+  int numFiles_{0};
+};
+}
+}
+
+#endif
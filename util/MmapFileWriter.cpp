@@ -0,0 +1,374 @@
+/**
+ * Copyright (c) 2014-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+#include <wdt/util/MmapFileWriter.h>
+#include <wdt/util/CommonImpl.h>
+#include <wdt/util/WritebackController.h>
+
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+
+namespace facebook {
+namespace wdt {
+
+MmapFileWriter::~MmapFileWriter() {
+  if (fd_ >= 0 || mapping_ != nullptr) {
+    WLOG(ERROR) << "File " << blockDetails_->fileName
+                << " was not closed and needed to be closed in the dtor";
+    close();
+  }
+}
+
+bool MmapFileWriter::canMap(const WdtOptions &options,
+                            const BlockDetails &blockDetails) {
+  // space allocated in the background may still be a hole, and a page fault
+  // on a full disk kills the process with SIGBUS instead of failing a write.
+  // Files which already existed or are resumed are not allocated by the
+  // file creator, open() checks their range, see allocateRange().
+  // The modification time of a mapped file may also be updated as late as
+  // its pages are synced, overriding the one set for incremental sync
+  return options.mmap_writes && !options.skip_writes &&
+         options.shouldPreallocateFiles() &&
+         options.preallocation_threads == 0 && blockDetails.dataSize > 0 &&
+         blockDetails.allocationStatus != TO_BE_DELETED &&
+         blockDetails.mtimeNs < 0;
+}
+
+ErrorCode MmapFileWriter::open() {
+  fd_ = fileCreator_->openForBlocks(threadCtx_, blockDetails_);
+  if (fd_ < 0) {
+    WLOG(ERROR) << "File open failed for " << blockDetails_->fileName;
+    return FILE_WRITE_ERROR;
+  }
+  const int64_t endOffset = blockDetails_->offset + blockDetails_->dataSize;
+  struct stat fileStat;
+  if (::fstat(fd_, &fileStat) != 0) {
+    WPLOG(ERROR) << "fstat failed for " << blockDetails_->fileName;
+    close();
+    return FILE_WRITE_ERROR;
+  }
+  if (fileStat.st_size < endOffset) {
+    // other blocks of the file may be written concurrently, so the file is
+    // never extended here
+    WLOG(WARNING) << "File " << blockDetails_->fileName << " of size "
+                  << fileStat.st_size << " does not cover block ending at "
+                  << endOffset << ", not mapping it";
+    return OK;
+  }
+  if (!allocateRange()) {
+    WLOG(WARNING) << "Block " << blockDetails_->offset << " of "
+                  << blockDetails_->fileName
+                  << " is not allocated, not mapping it";
+    return OK;
+  }
+  static const int64_t kPageSize = ::sysconf(_SC_PAGESIZE);
+  const int64_t mappingOffset = blockDetails_->offset & ~(kPageSize - 1);
+  mappingDelta_ = blockDetails_->offset - mappingOffset;
+  mappingLength_ = mappingDelta_ + blockDetails_->dataSize;
+  void *mapping;
+  {
+    PerfStatCollector statCollector(threadCtx_, PerfStatReport::MMAP);
+    mapping = ::mmap(nullptr, mappingLength_, PROT_READ | PROT_WRITE,
+                     MAP_SHARED, fd_, mappingOffset);
+  }
+  if (mapping == MAP_FAILED) {
+    WPLOG(WARNING) << "mmap failed for " << blockDetails_->fileName << " "
+                   << mappingOffset << " " << mappingLength_
+                   << ", using pwrite";
+    mappingLength_ = 0;
+    return OK;
+  }
+  mapping_ = (char *)mapping;
+  ::madvise(mapping_, mappingLength_, MADV_SEQUENTIAL);
+  return OK;
+}
+
+ErrorCode MmapFileWriter::write(char *buf, int64_t size) {
+  WDT_CHECK_LE(totalWritten_ + size, blockDetails_->dataSize);
+  if (mapping_ == nullptr) {
+    const ErrorCode code = pwriteFully(buf, size);
+    if (code != OK) {
+      return code;
+    }
+  } else {
+    PerfStatCollector statCollector(threadCtx_, PerfStatReport::FILE_WRITE);
+    memcpy(getWritePosition(), buf, size);
+  }
+  totalWritten_ += size;
+  if (!startWriteback(size, totalWritten_ == blockDetails_->dataSize)) {
+    return FILE_WRITE_ERROR;
+  }
+  return OK;
+}
+
+char *MmapFileWriter::getWriteBuffer(int64_t &size) {
+  if (mapping_ == nullptr || !threadCtx_.getOptions().mmap_direct_receive) {
+    return nullptr;
+  }
+  size = blockDetails_->dataSize - totalWritten_;
+  return getWritePosition();
+}
+
+ErrorCode MmapFileWriter::commitWriteBuffer(int64_t size) {
+  WDT_CHECK(mapping_ != nullptr);
+  WDT_CHECK_LE(totalWritten_ + size, blockDetails_->dataSize);
+  totalWritten_ += size;
+  if (!startWriteback(size, totalWritten_ == blockDetails_->dataSize)) {
+    return FILE_WRITE_ERROR;
+  }
+  return OK;
+}
+
+ErrorCode MmapFileWriter::pwriteFully(char *buf, int64_t size) {
+  int64_t count = 0;
+  while (count < size) {
+    int64_t written;
+    {
+      PerfStatCollector statCollector(threadCtx_, PerfStatReport::FILE_WRITE);
+      written = ::pwrite(fd_, buf + count, size - count,
+                         blockDetails_->offset + totalWritten_ + count);
+    }
+    if (written == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      WPLOG(ERROR) << "File write failed for " << blockDetails_->fileName
+                   << " fd : " << fd_ << " " << count << " " << size;
+      return FILE_WRITE_ERROR;
+    }
+    count += written;
+  }
+  return OK;
+}
+
+bool MmapFileWriter::allocateRange() {
+  PerfStatCollector statCollector(threadCtx_, PerfStatReport::MMAP);
+  const int64_t offset = blockDetails_->offset;
+#ifdef SEEK_HOLE
+  // most files were allocated when created, this avoids the allocation call
+  const off_t hole = ::lseek(fd_, offset, SEEK_HOLE);
+  if (hole >= offset + blockDetails_->dataSize) {
+    return true;
+  }
+#endif
+#ifdef HAS_POSIX_FALLOCATE
+  const int status = posix_fallocate(fd_, offset, blockDetails_->dataSize);
+  if (status == 0) {
+    return true;
+  }
+  WLOG(WARNING) << "posix_fallocate failed for " << blockDetails_->fileName
+                << " " << offset << " " << blockDetails_->dataSize << " "
+                << strerrorStr(status);
+#endif
+  return false;
+}
+
+bool MmapFileWriter::startWriteback(int64_t written, bool forced) {
+  const WdtOptions &options = threadCtx_.getOptions();
+  if (options.disk_sync_interval_mb < 0) {
+    return true;
+  }
+  WritebackController &writebackController = WritebackController::get();
+#ifdef HAS_SYNC_FILE_RANGE
+  // pages dirtied through the mapping count against the limit just as those
+  // written with write(2)
+  const bool controllerEnabled = WritebackController::isEnabled(options);
+  if (controllerEnabled) {
+    writebackController.addDirtyBytes(written);
+    dirtyBytes_ += written;
+  }
+#endif
+  const int64_t length = totalWritten_ - writebackStarted_;
+  if (length == 0 ||
+      (!forced &&
+       length <= writebackController.getSyncIntervalBytes(options))) {
+    return true;
+  }
+  const int64_t offset = blockDetails_->offset + writebackStarted_;
+  int status;
+  {
+    PerfStatCollector statCollector(threadCtx_,
+                                    PerfStatReport::SYNC_FILE_RANGE);
+#ifdef HAS_SYNC_FILE_RANGE
+    // pages dirtied through the mapping are in the page cache of the file, so
+    // this starts their writeback just as for write(2). msync(MS_ASYNC) is a
+    // no-op on linux
+    status = sync_file_range(fd_, offset, length, SYNC_FILE_RANGE_WRITE);
+#else
+    // the mapping is page aligned, msync() needs a page aligned start
+    const int64_t start = mappingDelta_ + writebackStarted_;
+    const int64_t alignedStart = start & ~(::sysconf(_SC_PAGESIZE) - 1);
+    status = 0;
+    if (mapping_ != nullptr) {
+      status = ::msync(mapping_ + alignedStart, start + length - alignedStart,
+                       MS_ASYNC);
+    }
+#endif
+  }
+  if (status != 0) {
+    WPLOG(ERROR) << "Unable to start writeback of " << blockDetails_->fileName
+                 << " " << offset << " " << length;
+    return false;
+  }
+  const int64_t rangeStart = writebackStarted_;
+  writebackStarted_ = totalWritten_;
+#ifdef HAS_SYNC_FILE_RANGE
+  if (controllerEnabled && writebackController.isOverLimit(options)) {
+    // same as FileWriter::syncFileRange(), the ranges of the closed files
+    // first, then the older ranges of this block
+    if (!writebackController.waitForClosedRanges(threadCtx_)) {
+      return false;
+    }
+    if (rangeStart > writebackDone_ &&
+        writebackController.isOverLimit(options) &&
+        !waitForWriteback(rangeStart)) {
+      return false;
+    }
+  }
+#endif
+  return true;
+}
+
+bool MmapFileWriter::waitForWriteback(int64_t endOffset) {
+#ifdef HAS_SYNC_FILE_RANGE
+  const int64_t length = endOffset - writebackDone_;
+  if (length <= 0) {
+    return true;
+  }
+  const int64_t offset = blockDetails_->offset + writebackDone_;
+  int status;
+  {
+    PerfStatCollector statCollector(threadCtx_, PerfStatReport::WRITEBACK_WAIT);
+    status = sync_file_range(fd_, offset, length,
+                             SYNC_FILE_RANGE_WAIT_BEFORE |
+                                 SYNC_FILE_RANGE_WRITE |
+                                 SYNC_FILE_RANGE_WAIT_AFTER);
+  }
+  if (status != 0) {
+    WPLOG(ERROR) << "sync_file_range() wait failed for "
+                 << blockDetails_->fileName << " fd " << fd_;
+    return false;
+  }
+  const int64_t cleanBytes = std::min(length, dirtyBytes_);
+  WritebackController::get().removeDirtyBytes(cleanBytes, true);
+  dirtyBytes_ -= cleanBytes;
+  writebackDone_ = endOffset;
+#endif
+  return true;
+}
+
+bool MmapFileWriter::releaseDirtyBytes(bool writtenBack) {
+#ifdef HAS_SYNC_FILE_RANGE
+  if (dirtyBytes_ == 0) {
+    return true;
+  }
+  WritebackController &writebackController = WritebackController::get();
+  if (writtenBack || fd_ < 0) {
+    writebackController.removeDirtyBytes(dirtyBytes_, writtenBack);
+    dirtyBytes_ = 0;
+    return true;
+  }
+  // the pages this block leaves behind stay counted till waited for
+  const int rangeFd = ::dup(fd_);
+  if (rangeFd < 0) {
+    WPLOG(ERROR) << "Unable to dup() fd " << fd_ << ", waiting for writeback";
+    const bool success = waitForWriteback(totalWritten_);
+    writebackController.removeDirtyBytes(dirtyBytes_, false);
+    dirtyBytes_ = 0;
+    return success;
+  }
+  writebackController.addClosedRange(
+      rangeFd, blockDetails_->offset + writebackDone_,
+      totalWritten_ - writebackDone_, dirtyBytes_);
+  dirtyBytes_ = 0;
+#endif
+  return true;
+}
+
+ErrorCode MmapFileWriter::sync() {
+  if (fd_ < 0) {
+    return OK;
+  }
+  const auto &options = threadCtx_.getOptions();
+  if (diskFlusher_ != nullptr) {
+    // fdatasync of the file covers the pages dirtied through the mapping
+    const int flushFd = ::dup(fd_);
+    if (flushFd < 0) {
+      WPLOG(ERROR) << "Unable to dup() fd " << fd_ << " for flushing";
+      return FILE_WRITE_ERROR;
+    }
+    flushTicket_ = diskFlusher_->addFd(flushFd);
+  } else if (options.fsync || options.isLogBasedResumption()) {
+    int status;
+    if (mapping_ != nullptr) {
+      PerfStatCollector statCollector(threadCtx_, PerfStatReport::MSYNC);
+      status = ::msync(mapping_, mappingLength_, MS_SYNC);
+    } else {
+      PerfStatCollector statCollector(threadCtx_, PerfStatReport::FSYNC_STATS);
+      status = ::fsync(fd_);
+    }
+    if (status != 0) {
+      WPLOG(ERROR) << "Unable to sync " << blockDetails_->fileName;
+      return FILE_WRITE_ERROR;
+    }
+    releaseDirtyBytes(true);
+  }
+  // pages still mapped are not dropped by fadvise
+  const ErrorCode code = unmap();
+  if (code != OK) {
+    return code;
+  }
+#ifdef HAS_POSIX_FADVISE
+  if (!options.skip_fadvise) {
+    PerfStatCollector statCollector(threadCtx_, PerfStatReport::FADVISE);
+    if (posix_fadvise(fd_, blockDetails_->offset, blockDetails_->dataSize,
+                      POSIX_FADV_DONTNEED) != 0) {
+      WPLOG(ERROR) << "posix_fadvise failed for " << blockDetails_->fileName
+                   << " " << blockDetails_->offset << " "
+                   << blockDetails_->dataSize;
+      return FILE_WRITE_ERROR;
+    }
+  }
+#endif
+  return OK;
+}
+
+ErrorCode MmapFileWriter::unmap() {
+  if (mapping_ == nullptr) {
+    return OK;
+  }
+  const int status = ::munmap(mapping_, mappingLength_);
+  mapping_ = nullptr;
+  if (status != 0) {
+    WPLOG(ERROR) << "munmap failed for " << blockDetails_->fileName;
+    return FILE_WRITE_ERROR;
+  }
+  return OK;
+}
+
+ErrorCode MmapFileWriter::close() {
+  ErrorCode code = releaseDirtyBytes(false) ? OK : FILE_WRITE_ERROR;
+  if (unmap() != OK) {
+    code = FILE_WRITE_ERROR;
+  }
+  if (fd_ >= 0) {
+    PerfStatCollector statCollector(threadCtx_, PerfStatReport::FILE_CLOSE);
+    if (::close(fd_) != 0) {
+      WPLOG(ERROR) << "Unable to close fd " << fd_;
+      code = FILE_WRITE_ERROR;
+    }
+    fd_ = -1;
+  }
+  return code;
+}
+}
+}
@@ -0,0 +1,170 @@
+/**
+ * Copyright (c) 2014-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+#pragma once
+
+#include <wdt/Protocol.h>
+#include <wdt/WdtConfig.h>
+#include <wdt/Writer.h>
+#include <wdt/util/DiskFlusher.h>
+#include <wdt/util/FileCreator.h>
+
+namespace facebook {
+namespace wdt {
+
+/**
+ * Writer copying the received data into a shared mapping of the block range
+ * instead of calling write(2). The file must already have its final size,
+ * so this is only used for preallocated files (see canMap()), and only once
+ * the block range is known to be allocated (see allocateRange()). With
+ * mmap_direct_receive, the receiver thread reads from the socket straight
+ * into the mapping through getWriteBuffer(), saving the copy out of the
+ * receive buffer. If the file turns out to be too small for the range, or the
+ * range can not be allocated, the writer falls back to pwrite.
+ */
+class MmapFileWriter : public Writer {
+ public:
+  MmapFileWriter(ThreadCtx &threadCtx, BlockDetails const *blockDetails,
+                 FileCreator *fileCreator, DiskFlusher *diskFlusher = nullptr)
+      : threadCtx_(threadCtx),
+        blockDetails_(blockDetails),
+        fileCreator_(fileCreator),
+        diskFlusher_(diskFlusher) {
+  }
+
+  ~MmapFileWriter() override;
+
+  /**
+   * @param options       wdt options
+   * @param blockDetails  block to write
+   *
+   * @return              whether the block should be written through a
+   *                      mapping
+   */
+  static bool canMap(const WdtOptions &options,
+                     const BlockDetails &blockDetails);
+
+  /// @see Writer.h
+  ErrorCode open() override;
+
+  /// @see Writer.h
+  ErrorCode write(char *buf, int64_t size) override;
+
+  /// @see Writer.h
+  int64_t getTotalWritten() override {
+    return totalWritten_;
+  }
+
+  /// @see Writer.h
+  /// Returns the unwritten part of the mapping with mmap_direct_receive
+  char *getWriteBuffer(int64_t &size) override;
+
+  /// @see Writer.h
+  ErrorCode commitWriteBuffer(int64_t size) override;
+
+  /// @see Writer.h
+  /// Same as FileWriter::sync(), with msync() instead of fsync(). The mapping
+  /// is removed before the pages are dropped from the page cache.
+  ErrorCode sync() override;
+
+  /// @return   ticket of the deferred flush, 0 if nothing was deferred
+  int64_t getFlushTicket() const {
+    return flushTicket_;
+  }
+
+  /// @see Writer.h
+  ErrorCode close() override;
+
+ private:
+  /// @return   the mapped address of the next byte of the block to write
+  char *getWritePosition() const {
+    return mapping_ + mappingDelta_ + totalWritten_;
+  }
+
+  /// writes with pwrite, when the range could not be mapped
+  ErrorCode pwriteFully(char *buf, int64_t size);
+
+  /**
+   * Makes sure the block range has no hole, allocating it if needed. A page
+   * fault on a hole of a full disk raises SIGBUS instead of failing a write,
+   * so only allocated ranges are mapped.
+   *
+   * @return    whether the range is allocated
+   */
+  bool allocateRange();
+
+  /**
+   * Accounts the bytes just written with the WritebackController and starts
+   * writeback of the range written since the last one, at
+   * disk_sync_interval_mb intervals. Like FileWriter, waits for older ranges
+   * when too many bytes are dirty.
+   *
+   * @param written   number of bytes just written
+   * @param forced    whether to start writeback regardless of the interval
+   */
+  bool startWriteback(int64_t written, bool forced);
+
+  /**
+   * Waits for the writeback of the block up to an offset and removes the
+   * bytes from the WritebackController
+   *
+   * @param endOffset   offset within the block
+   */
+  bool waitForWriteback(int64_t endOffset);
+
+  /**
+   * Removes the dirty bytes of this block from the WritebackController, see
+   * FileWriter::releaseDirtyBytes()
+   *
+   * @param writtenBack   whether the block was synced
+   */
+  bool releaseDirtyBytes(bool writtenBack);
+
+  /// removes the mapping, if any
+  ErrorCode unmap();
+
+  ThreadCtx &threadCtx_;
+
+  /// details of the block
+  BlockDetails const *blockDetails_;
+
+  /// reference to file creator
+  FileCreator *fileCreator_;
+
+  /// group commit flusher, nullptr if blocks are synced inline
+  DiskFlusher *diskFlusher_;
+
+  /// file handler
+  int fd_{-1};
+
+  /// page aligned mapping of the block, nullptr if not mapped
+  char *mapping_{nullptr};
+
+  /// length of the mapping
+  int64_t mappingLength_{0};
+
+  /// offset of the block within the mapping
+  int64_t mappingDelta_{0};
+
+  /// number of bytes written
+  int64_t totalWritten_{0};
+
+  /// number of bytes of the block whose writeback was started
+  int64_t writebackStarted_{0};
+
+  /// number of bytes of the block whose writeback was waited for
+  int64_t writebackDone_{0};
+
+  /// bytes added to the writeback controller and not yet removed
+  int64_t dirtyBytes_{0};
+
+  /// ticket returned by the flusher for this block
+  int64_t flushTicket_{0};
+};
+}
+}
@@ -0,0 +1,877 @@
+/**
+ * Copyright (c) 2014-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+#include <wdt/util/PathMatcher.h>
+#include <wdt/ErrorCodes.h>
+
+#include <string.h>
+#include <algorithm>
+#include <bitset>
+#include <map>
+
+namespace facebook {
+namespace wdt {
+
+const std::string PathMatcher::kGlobPrefix = "glob:";
+const int PathMatcher::kMaxDfaStates = 10000;
+
+namespace {
+typedef std::bitset<256> ByteSet;
+
+/// bounds the size of the syntax tree and of the NFA, {n,m} copies nodes
+const int kMaxNodes = 100000;
+/// largest count of a {n,m} repetition handled by the DFA
+const int kMaxRepeat = 1000;
+
+ByteSet rangeSet(unsigned char low, unsigned char high) {
+  ByteSet set;
+  for (int c = low; c <= high; c++) {
+    set.set(c);
+  }
+  return set;
+}
+
+ByteSet byteSet(unsigned char c) {
+  ByteSet set;
+  set.set(c);
+  return set;
+}
+
+/// '.' of ECMAScript, anything but line terminators
+ByteSet dotSet() {
+  ByteSet set;
+  set.set();
+  set.reset('\n');
+  set.reset('\r');
+  return set;
+}
+
+/// @return   regex matching exactly the byte c
+std::string quoteByte(unsigned char c) {
+  if (isalnum(c)) {
+    return std::string(1, c);
+  }
+  const char *hex = "0123456789abcdef";
+  return std::string("\\x") + hex[c >> 4] + hex[c & 0xf];
+}
+
+int hexValue(char c) {
+  if (c >= '0' && c <= '9') {
+    return c - '0';
+  }
+  if (c >= 'a' && c <= 'f') {
+    return c - 'a' + 10;
+  }
+  if (c >= 'A' && c <= 'F') {
+    return c - 'A' + 10;
+  }
+  return -1;
+}
+
+/// Thompson NFA built from the syntax tree
+struct Nfa {
+  struct State {
+    /// index in byteSets, -1 for epsilon and match states
+    int byteSetIndex{-1};
+    /// next state after a byte of the set
+    int out{-1};
+    /// epsilon transitions
+    std::vector<int> epsilons;
+  };
+
+  std::vector<State> states;
+  std::vector<ByteSet> byteSets;
+  int matchState{-1};
+
+  int addState() {
+    states.emplace_back();
+    return states.size() - 1;
+  }
+
+  int addByteSet(const ByteSet &bytes) {
+    for (size_t i = 0; i < byteSets.size(); i++) {
+      if (byteSets[i] == bytes) {
+        return i;
+      }
+    }
+    byteSets.push_back(bytes);
+    return byteSets.size() - 1;
+  }
+
+  bool tooLarge() const {
+    return states.size() > (size_t)kMaxNodes;
+  }
+
+  /// @return   sorted non epsilon states reachable from seeds
+  std::vector<int> closure(std::vector<int> &seeds, std::vector<int> &marks,
+                           int &generation) const {
+    ++generation;
+    std::vector<int> result;
+    while (!seeds.empty()) {
+      const int state = seeds.back();
+      seeds.pop_back();
+      if (marks[state] == generation) {
+        continue;
+      }
+      marks[state] = generation;
+      const State &nfaState = states[state];
+      if (nfaState.byteSetIndex >= 0 || state == matchState) {
+        result.push_back(state);
+      }
+      for (int next : nfaState.epsilons) {
+        seeds.push_back(next);
+      }
+    }
+    std::sort(result.begin(), result.end());
+    return result;
+  }
+};
+}
+
+/// syntax tree of a pattern
+struct PathMatcher::Node {
+  enum Type { EMPTY, BYTES, CONCAT, ALTERNATION, REPEAT };
+
+  explicit Node(Type nodeType) : type(nodeType) {
+  }
+
+  Type type;
+  /// bytes matched by a BYTES node
+  ByteSet bytes;
+  std::vector<std::unique_ptr<Node>> children;
+  /// bounds of a REPEAT node, max is -1 when unbounded
+  int min{0};
+  int max{-1};
+
+  /// @return   start state of the node, continuing to next. -1 if too large
+  int emitNfa(int next, Nfa &nfa) const;
+};
+
+int PathMatcher::Node::emitNfa(int next, Nfa &nfa) const {
+  if (next < 0 || nfa.tooLarge()) {
+    return -1;
+  }
+  switch (type) {
+    case EMPTY:
+      return next;
+    case BYTES: {
+      const int state = nfa.addState();
+      nfa.states[state].byteSetIndex = nfa.addByteSet(bytes);
+      nfa.states[state].out = next;
+      return state;
+    }
+    case CONCAT:
+      for (auto it = children.rbegin(); it != children.rend(); ++it) {
+        next = (*it)->emitNfa(next, nfa);
+      }
+      return next;
+    case ALTERNATION: {
+      std::vector<int> starts;
+      for (const auto &child : children) {
+        starts.push_back(child->emitNfa(next, nfa));
+        if (starts.back() < 0) {
+          return -1;
+        }
+      }
+      const int state = nfa.addState();
+      nfa.states[state].epsilons = starts;
+      return state;
+    }
+    case REPEAT: {
+      const Node &child = *children[0];
+      int start = next;
+      if (max < 0) {
+        // loop, the child goes back to the split state
+        const int loop = nfa.addState();
+        const int childStart = child.emitNfa(loop, nfa);
+        if (childStart < 0) {
+          return -1;
+        }
+        nfa.states[loop].epsilons = {childStart, next};
+        start = loop;
+      } else {
+        // nested optional copies
+        for (int i = min; i < max; i++) {
+          const int childStart = child.emitNfa(start, nfa);
+          if (childStart < 0) {
+            return -1;
+          }
+          const int optional = nfa.addState();
+          nfa.states[optional].epsilons = {childStart, next};
+          start = optional;
+        }
+      }
+      for (int i = 0; i < min; i++) {
+        start = child.emitNfa(start, nfa);
+      }
+      return start;
+    }
+  }
+  return -1;
+}
+
+/**
+ * Parses regular expressions and globs into a syntax tree. Regex constructs
+ * the DFA can not express make the parse fail, the caller then falls back to
+ * std::regex which also reports syntax errors.
+ */
+class PathMatcher::Parser {
+ public:
+  typedef std::unique_ptr<Node> NodePtr;
+
+  explicit Parser(const std::string &pattern) : pattern_(pattern) {
+  }
+
+  /// @return   syntax tree of the regex, nullptr if not supported
+  NodePtr parseRegex() {
+    pos_ = 0;
+    // anchors are implied by the whole path match
+    if (peek() == '^') {
+      ++pos_;
+    }
+    NodePtr root = parseAlternation();
+    if (!root || !atEnd()) {
+      return nullptr;
+    }
+    return root;
+  }
+
+  /**
+   * @param regex   set to an equivalent std::regex pattern
+   *
+   * @return        syntax tree of the glob, nullptr if too large
+   */
+  NodePtr parseGlob(std::string &regex) {
+    NodePtr root = newNode(Node::CONCAT);
+    ByteSet all;
+    all.set();
+    for (pos_ = 0; !atEnd() && root; ++pos_) {
+      const unsigned char c = pattern_[pos_];
+      NodePtr child;
+      if (c == '*') {
+        child = newBytes(all);
+        if (child) {
+          NodePtr bytes = std::move(child);
+          child = newNode(Node::REPEAT);
+          if (child) {
+            child->children.push_back(std::move(bytes));
+          }
+        }
+        regex += "[\\s\\S]*";
+      } else if (c == '?') {
+        child = newBytes(all);
+        regex += "[\\s\\S]";
+      } else if (c == '[' && parseGlobClass(regex, child)) {
+        // parsed the whole class
+      } else {
+        // also an unterminated '['
+        unsigned char literal = c;
+        if (c == '\\' && pos_ + 1 < pattern_.size()) {
+          literal = pattern_[++pos_];
+        }
+        child = newBytes(byteSet(literal));
+        regex += quoteByte(literal);
+      }
+      if (!child) {
+        return nullptr;
+      }
+      root->children.push_back(std::move(child));
+    }
+    return root;
+  }
+
+ private:
+  bool atEnd() const {
+    return pos_ >= pattern_.size();
+  }
+
+  unsigned char peek() const {
+    return atEnd() ? '\0' : pattern_[pos_];
+  }
+
+  NodePtr newNode(Node::Type type) {
+    if (++numNodes_ > kMaxNodes) {
+      return nullptr;
+    }
+    return NodePtr(new Node(type));
+  }
+
+  NodePtr newBytes(const ByteSet &bytes) {
+    NodePtr node = newNode(Node::BYTES);
+    if (node) {
+      node->bytes = bytes;
+    }
+    return node;
+  }
+
+  NodePtr parseAlternation() {
+    NodePtr first = parseConcatenation();
+    if (!first || peek() != '|') {
+      return first;
+    }
+    NodePtr node = newNode(Node::ALTERNATION);
+    if (!node) {
+      return nullptr;
+    }
+    node->children.push_back(std::move(first));
+    while (peek() == '|') {
+      ++pos_;
+      NodePtr child = parseConcatenation();
+      if (!child) {
+        return nullptr;
+      }
+      node->children.push_back(std::move(child));
+    }
+    return node;
+  }
+
+  NodePtr parseConcatenation() {
+    NodePtr node = newNode(Node::CONCAT);
+    if (!node) {
+      return nullptr;
+    }
+    while (!atEnd() && peek() != '|' && peek() != ')') {
+      NodePtr child = parseRepetition();
+      if (!child) {
+        return nullptr;
+      }
+      node->children.push_back(std::move(child));
+    }
+    return node;
+  }
+
+  NodePtr parseRepetition() {
+    NodePtr atom = parseAtom();
+    if (!atom) {
+      return nullptr;
+    }
+    int min = 0;
+    int max = -1;
+    switch (peek()) {
+      case '*':
+        break;
+      case '+':
+        min = 1;
+        break;
+      case '?':
+        max = 1;
+        break;
+      case '{':
+        ++pos_;
+        if (!parseCount(min)) {
+          return nullptr;
+        }
+        max = min;
+        if (peek() == ',') {
+          ++pos_;
+          max = -1;
+          if (peek() != '}' && (!parseCount(max) || max < min)) {
+            return nullptr;
+          }
+        }
+        if (peek() != '}') {
+          return nullptr;
+        }
+        break;
+      default:
+        return atom;
+    }
+    ++pos_;
+    if (peek() == '?') {
+      // lazy quantifiers match the same paths in a whole path match
+      ++pos_;
+    }
+    NodePtr node = newNode(Node::REPEAT);
+    if (!node) {
+      return nullptr;
+    }
+    node->min = min;
+    node->max = max;
+    node->children.push_back(std::move(atom));
+    return node;
+  }
+
+  bool parseCount(int &count) {
+    if (!isdigit(peek())) {
+      return false;
+    }
+    count = 0;
+    while (isdigit(peek())) {
+      count = count * 10 + (pattern_[pos_++] - '0');
+      if (count > kMaxRepeat) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  NodePtr parseAtom() {
+    const char c = pattern_[pos_++];
+    ByteSet bytes;
+    switch (c) {
+      case '(': {
+        if (peek() == '?') {
+          // only non capturing groups, no assertions
+          if (pos_ + 1 >= pattern_.size() || pattern_[pos_ + 1] != ':') {
+            return nullptr;
+          }
+          pos_ += 2;
+        }
+        NodePtr group = parseAlternation();
+        if (!group || peek() != ')') {
+          return nullptr;
+        }
+        ++pos_;
+        return group;
+      }
+      case '[':
+        if (!parseClass(bytes)) {
+          return nullptr;
+        }
+        return newBytes(bytes);
+      case '.':
+        return newBytes(dotSet());
+      case '\\': {
+        bool isSet;
+        if (!parseEscape(bytes, isSet)) {
+          return nullptr;
+        }
+        return newBytes(bytes);
+      }
+      case '$':
+        if (!atEnd()) {
+          return nullptr;
+        }
+        return newNode(Node::EMPTY);
+      case '^':
+      case '*':
+      case '+':
+      case '?':
+      case '{':
+      case '}':
+      case ']':
+      case ')':
+      case '|':
+        return nullptr;
+      default:
+        return newBytes(byteSet(c));
+    }
+  }
+
+  /**
+   * Parses an escape sequence, after the '\'
+   *
+   * @param bytes   set to the bytes matched
+   * @param isSet   set to whether it is a class like \d, which can not be
+   *                the bound of a range
+   *
+   * @return        whether the escape is supported
+   */
+  bool parseEscape(ByteSet &bytes, bool &isSet) {
+    if (atEnd()) {
+      return false;
+    }
+    const unsigned char c = pattern_[pos_++];
+    isSet = true;
+    switch (c) {
+      case 'd':
+      case 'D':
+        bytes = rangeSet('0', '9');
+        break;
+      case 'w':
+      case 'W':
+        bytes = rangeSet('a', 'z') | rangeSet('A', 'Z') | rangeSet('0', '9') |
+                byteSet('_');
+        break;
+      case 's':
+      case 'S':
+        bytes = rangeSet('\t', '\r') | byteSet(' ');
+        break;
+      default:
+        isSet = false;
+    }
+    if (isSet) {
+      if (isupper(c)) {
+        bytes.flip();
+      }
+      return true;
+    }
+    unsigned char literal = c;
+    switch (c) {
+      case 't':
+        literal = '\t';
+        break;
+      case 'n':
+        literal = '\n';
+        break;
+      case 'r':
+        literal = '\r';
+        break;
+      case 'f':
+        literal = '\f';
+        break;
+      case 'v':
+        literal = '\v';
+        break;
+      case '0':
+        if (isdigit(peek())) {
+          return false;
+        }
+        literal = '\0';
+        break;
+      case 'x': {
+        if (pos_ + 2 > pattern_.size()) {
+          return false;
+        }
+        const int high = hexValue(pattern_[pos_]);
+        const int low = hexValue(pattern_[pos_ + 1]);
+        if (high < 0 || low < 0) {
+          return false;
+        }
+        pos_ += 2;
+        literal = high * 16 + low;
+        break;
+      }
+      default:
+        // \b, back references, \c, \u... are left to std::regex
+        if (isalnum(c)) {
+          return false;
+        }
+    }
+    bytes = byteSet(literal);
+    return true;
+  }
+
+  /// parses a [...] class, after the '['
+  bool parseClass(ByteSet &bytes) {
+    const bool negate = (peek() == '^');
+    if (negate) {
+      ++pos_;
+    }
+    if (peek() == ']') {
+      // empty class, not worth the special case
+      return false;
+    }
+    bytes.reset();
+    while (!atEnd() && peek() != ']') {
+      ByteSet low;
+      bool isSet = false;
+      if (!parseClassAtom(low, isSet)) {
+        return false;
+      }
+      if (!isSet && peek() == '-' && pos_ + 1 < pattern_.size() &&
+          pattern_[pos_ + 1] != ']') {
+        ++pos_;
+        ByteSet high;
+        bool isHighSet = false;
+        if (!parseClassAtom(high, isHighSet) || isHighSet) {
+          return false;
+        }
+        const int lowByte = firstByte(low);
+        const int highByte = firstByte(high);
+        // ranges over non ascii bytes depend on the char signedness
+        if (lowByte > highByte || highByte >= 0x80) {
+          return false;
+        }
+        bytes |= rangeSet(lowByte, highByte);
+      } else {
+        bytes |= low;
+      }
+    }
+    if (atEnd()) {
+      return false;
+    }
+    ++pos_;
+    if (negate) {
+      bytes.flip();
+    }
+    return true;
+  }
+
+  bool parseClassAtom(ByteSet &bytes, bool &isSet) {
+    const char c = pattern_[pos_++];
+    if (c == '\\') {
+      if (peek() == 'b') {
+        // backspace in a class
+        return false;
+      }
+      return parseEscape(bytes, isSet);
+    }
+    if (c == '[' && (peek() == ':' || peek() == '.' || peek() == '=')) {
+      // posix classes
+      return false;
+    }
+    isSet = false;
+    bytes = byteSet(c);
+    return true;
+  }
+
+  static int firstByte(const ByteSet &bytes) {
+    for (int c = 0; c < 256; c++) {
+      if (bytes.test(c)) {
+        return c;
+      }
+    }
+    return -1;
+  }
+
+  /**
+   * Parses a glob [...] class, at the '['
+   *
+   * @return    false if the class is unterminated, the '[' is then a literal
+   */
+  bool parseGlobClass(std::string &regex, NodePtr &node) {
+    size_t pos = pos_ + 1;
+    const bool negate =
+        pos < pattern_.size() && (pattern_[pos] == '!' || pattern_[pos] == '^');
+    if (negate) {
+      ++pos;
+    }
+    ByteSet bytes;
+    std::string classRegex;
+    bool first = true;
+    while (pos < pattern_.size() && (first || pattern_[pos] != ']')) {
+      first = false;
+      unsigned char low = pattern_[pos++];
+      if (low == '\\' && pos < pattern_.size()) {
+        low = pattern_[pos++];
+      }
+      unsigned char high = low;
+      if (pos + 1 < pattern_.size() && pattern_[pos] == '-' &&
+          pattern_[pos + 1] != ']') {
+        high = pattern_[pos + 1];
+        pos += 2;
+        if (high == '\\' && pos < pattern_.size()) {
+          high = pattern_[pos++];
+        }
+      }
+      if (low > high) {
+        // matches nothing in fnmatch, skipped
+        continue;
+      }
+      bytes |= rangeSet(low, high);
+      classRegex += quoteByte(low);
+      if (high != low) {
+        classRegex += '-';
+        classRegex += quoteByte(high);
+      }
+    }
+    if (pos >= pattern_.size()) {
+      return false;
+    }
+    pos_ = pos;
+    if (negate) {
+      bytes.flip();
+    }
+    node = newBytes(bytes);
+    if (bytes.none()) {
+      // [\s\S] with nothing allowed
+      regex += "[^\\s\\S]";
+    } else if (negate) {
+      regex += classRegex.empty() ? "[\\s\\S]" : "[^" + classRegex + "]";
+    } else {
+      regex += "[" + classRegex + "]";
+    }
+    return true;
+  }
+
+  const std::string &pattern_;
+  size_t pos_{0};
+  int numNodes_{0};
+};
+
+PathMatcher::PathMatcher(const std::string &pattern) {
+  if (pattern.empty()) {
+    return;
+  }
+  if (pattern.compare(0, kGlobPrefix.size(), kGlobPrefix) == 0) {
+    const std::string glob = pattern.substr(kGlobPrefix.size());
+    if (!compileLiteralGlob(glob)) {
+      std::string regex;
+      Parser parser(glob);
+      auto root = parser.parseGlob(regex);
+      if (!root || !compileDfa(*root)) {
+        mode_ = REGEX;
+        regex_.reset(new std::regex(regex));
+      }
+    }
+  } else {
+    Parser parser(pattern);
+    auto root = parser.parseRegex();
+    if (!root || !compileDfa(*root)) {
+      mode_ = REGEX;
+      regex_.reset(new std::regex(pattern));
+    }
+  }
+  WVLOG(1) << "Pattern " << pattern << " matched in " << getModeName()
+           << " mode, dfa states " << getNumDfaStates();
+}
+
+bool PathMatcher::compileLiteralGlob(const std::string &glob) {
+  size_t pos = 0;
+  bool leadingStar = false;
+  while (pos < glob.size() && glob[pos] == '*') {
+    leadingStar = true;
+    ++pos;
+  }
+  bool trailingStar = false;
+  std::string literal;
+  while (pos < glob.size()) {
+    char c = glob[pos++];
+    if (c == '*') {
+      trailingStar = true;
+      break;
+    }
+    if (c == '?' || c == '[') {
+      return false;
+    }
+    if (c == '\\' && pos < glob.size()) {
+      c = glob[pos++];
+    }
+    literal.push_back(c);
+  }
+  // anything after the trailing star must be a star too
+  for (; pos < glob.size(); pos++) {
+    if (glob[pos] != '*') {
+      return false;
+    }
+  }
+  if (leadingStar) {
+    mode_ = trailingStar || literal.empty() ? CONTAINS : SUFFIX;
+  } else {
+    mode_ = trailingStar ? PREFIX : EXACT;
+  }
+  literal_ = std::move(literal);
+  return true;
+}
+
+bool PathMatcher::compileDfa(const Node &root) {
+  Nfa nfa;
+  nfa.matchState = nfa.addState();
+  const int nfaStart = root.emitNfa(nfa.matchState, nfa);
+  if (nfaStart < 0) {
+    WVLOG(1) << "NFA too large";
+    return false;
+  }
+
+  // bytes belonging to the same byte sets share their transitions
+  std::map<std::vector<bool>, int> classIds;
+  std::vector<int> classBytes;
+  for (int c = 0; c < 256; c++) {
+    std::vector<bool> signature(nfa.byteSets.size());
+    for (size_t i = 0; i < nfa.byteSets.size(); i++) {
+      signature[i] = nfa.byteSets[i].test(c);
+    }
+    auto inserted = classIds.emplace(std::move(signature), classIds.size());
+    if (inserted.second) {
+      classBytes.push_back(c);
+    }
+    byteClass_[c] = inserted.first->second;
+  }
+  numClasses_ = classBytes.size();
+
+  // subset construction, state 0 is the dead state (empty set)
+  std::map<std::vector<int>, int32_t> stateIds;
+  std::vector<const std::vector<int> *> stateSets;
+  auto addDfaState = [&](std::vector<int> set) {
+    auto inserted = stateIds.emplace(std::move(set), stateSets.size());
+    if (inserted.second) {
+      stateSets.push_back(&inserted.first->first);
+      const auto &nfaStates = inserted.first->first;
+      accepting_.push_back(std::binary_search(
+          nfaStates.begin(), nfaStates.end(), nfa.matchState));
+      transitions_.resize(transitions_.size() + numClasses_, 0);
+    }
+    return inserted.first->second;
+  };
+  std::vector<int> marks(nfa.states.size(), 0);
+  int generation = 0;
+  std::vector<int> seeds;
+  addDfaState({});
+  seeds.push_back(nfaStart);
+  startState_ = addDfaState(nfa.closure(seeds, marks, generation));
+  for (size_t state = 1; state < stateSets.size(); state++) {
+    if ((int)stateSets.size() > kMaxDfaStates) {
+      WVLOG(1) << "DFA too large";
+      transitions_.clear();
+      accepting_.clear();
+      return false;
+    }
+    for (int cls = 0; cls < numClasses_; cls++) {
+      const int c = classBytes[cls];
+      for (int nfaState : *stateSets[state]) {
+        const Nfa::State &s = nfa.states[nfaState];
+        if (s.byteSetIndex >= 0 && nfa.byteSets[s.byteSetIndex].test(c)) {
+          seeds.push_back(s.out);
+        }
+      }
+      const int32_t next = addDfaState(nfa.closure(seeds, marks, generation));
+      transitions_[state * numClasses_ + cls] = next;
+    }
+  }
+  mode_ = DFA;
+  return true;
+}
+
+bool PathMatcher::matches(const char *path, int64_t size) const {
+  const int64_t literalSize = literal_.size();
+  switch (mode_) {
+    case EMPTY:
+      return false;
+    case EXACT:
+      return size == literalSize &&
+             memcmp(path, literal_.data(), literalSize) == 0;
+    case PREFIX:
+      return size >= literalSize &&
+             memcmp(path, literal_.data(), literalSize) == 0;
+    case SUFFIX:
+      return size >= literalSize &&
+             memcmp(path + size - literalSize, literal_.data(),
+                    literalSize) == 0;
+    case CONTAINS:
+      return literalSize == 0 ||
+             memmem(path, size, literal_.data(), literalSize) != nullptr;
+    case DFA: {
+      const int32_t *transitions = transitions_.data();
+      int32_t state = startState_;
+      for (int64_t i = 0; i < size; i++) {
+        state = transitions[state * numClasses_ +
+                            byteClass_[(unsigned char)path[i]]];
+        if (state == 0) {
+          return false;
+        }
+      }
+      return accepting_[state];
+    }
+    case REGEX:
+      return std::regex_match(path, path + size, *regex_);
+  }
+  return false;
+}
+
+const char *PathMatcher::getModeName() const {
+  switch (mode_) {
+    case EMPTY:
+      return "empty";
+    case EXACT:
+      return "exact";
+    case PREFIX:
+      return "prefix";
+    case SUFFIX:
+      return "suffix";
+    case CONTAINS:
+      return "contains";
+    case DFA:
+      return "dfa";
+    case REGEX:
+      return "regex";
+  }
+  return "unknown";
+}
+}
+}
@@ -0,0 +1,118 @@
+/**
+ * Copyright (c) 2014-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+#pragma once
+
+#include <stdint.h>
+#include <memory>
+#include <regex>
+#include <string>
+#include <vector>
+
+namespace facebook {
+namespace wdt {
+
+/**
+ * Matches relative paths against an include/exclude/prune pattern, the whole
+ * path has to match (like std::regex_match).
+ *
+ * Patterns are ECMAScript regular expressions, or globs when prefixed with
+ * "glob:". In a glob, '*' matches any sequence of characters including '/',
+ * '?' any single character, [abc] / [!abc] a character class, and '\' quotes
+ * the next character, so "glob:*.sst" matches every sst file of the tree.
+ *
+ * The pattern is compiled once into a DFA over byte classes, matching is then
+ * a table lookup per byte and never allocates. Globs of the form "lit",
+ * "*lit", "lit*" and "*lit*" are matched with a plain string comparison.
+ * Regular expressions using constructs a DFA can not express (back
+ * references, assertions...) or whose DFA would be too large fall back to
+ * std::regex.
+ *
+ * A compiled matcher is immutable and can be used by several threads.
+ */
+class PathMatcher {
+ public:
+  /// how paths are matched
+  enum Mode {
+    EMPTY,     // no pattern, matches nothing
+    EXACT,     // glob without wildcard
+    PREFIX,    // "lit*" glob
+    SUFFIX,    // "*lit" glob
+    CONTAINS,  // "*lit*" glob
+    DFA,       // compiled automaton
+    REGEX,     // std::regex fallback
+  };
+
+  /// prefix of glob patterns
+  static const std::string kGlobPrefix;
+
+  /// maximum number of DFA states before falling back to std::regex
+  static const int kMaxDfaStates;
+
+  /// matcher matching nothing
+  PathMatcher() {
+  }
+
+  /**
+   * @param pattern   regular expression, or glob prefixed with "glob:".
+   *                  An invalid regular expression throws std::regex_error
+   *                  like std::regex does.
+   */
+  explicit PathMatcher(const std::string &pattern);
+
+  /// @return   whether the whole path matches the pattern
+  bool matches(const char *path, int64_t size) const;
+
+  bool matches(const std::string &path) const {
+    return matches(path.data(), path.size());
+  }
+
+  /// @return   whether there is no pattern
+  bool empty() const {
+    return mode_ == EMPTY;
+  }
+
+  Mode getMode() const {
+    return mode_;
+  }
+
+  /// @return   name of the mode, for logging
+  const char *getModeName() const;
+
+  /// @return   number of DFA states, 0 when not in DFA mode
+  int getNumDfaStates() const {
+    return accepting_.size();
+  }
+
+ private:
+  struct Node;
+  class Parser;
+
+  /// @return   whether the glob is a literal with an optional leading and
+  ///           trailing '*', in which case mode_ and literal_ are set
+  bool compileLiteralGlob(const std::string &glob);
+
+  /// @return   whether the syntax tree could be compiled into a small DFA
+  bool compileDfa(const Node &root);
+
+  Mode mode_{EMPTY};
+  /// literal of the EXACT, PREFIX, SUFFIX and CONTAINS modes
+  std::string literal_;
+  /// class of each byte, bytes of a class have the same transitions
+  uint8_t byteClass_[256];
+  int numClasses_{0};
+  /// transitions, numClasses_ entries per state. State 0 is the dead state
+  std::vector<int32_t> transitions_;
+  /// whether each state is accepting
+  std::vector<bool> accepting_;
+  int32_t startState_{0};
+  /// fallback for the REGEX mode
+  std::unique_ptr<std::regex> regex_;
+};
+}
+}
@@ -0,0 +1,164 @@
+/**
+ * Copyright (c) 2014-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+#include <wdt/util/PathTable.h>
+
+#include <algorithm>
+#include <cstring>
+#include <functional>
+
+namespace facebook {
+namespace wdt {
+
+const int32_t PathTable::kRootDirectory;
+const size_t PathTable::kChunkSize;
+
+PathTable::PathTable() {
+  Directory root;
+  root.name.data = "";
+  root.name.size = 0;
+  root.parent = -1;
+  directories_.pushBack(root);
+}
+
+void PathTable::setRootDir(const std::string &rootDir) {
+  rootDir_ = rootDir;
+}
+
+int32_t PathTable::addDirectory(int32_t parent, const std::string &name) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return addDirectoryLocked(parent, name.data(), name.size());
+}
+
+int64_t PathTable::addFile(int32_t directory, const std::string &name) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  WDT_CHECK(directory >= 0 && directory < (int64_t)directories_.size());
+  File file;
+  file.name = intern(name.data(), name.size());
+  file.directory = directory;
+  return files_.pushBack(file);
+}
+
+int64_t PathTable::addFilePath(const std::string &relPath) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  int32_t directory = kRootDirectory;
+  size_t start = 0;
+  size_t pos;
+  while ((pos = relPath.find('/', start)) != std::string::npos) {
+    directory =
+        addDirectoryLocked(directory, relPath.data() + start, pos - start);
+    start = pos + 1;
+  }
+  File file;
+  file.name = intern(relPath.data() + start, relPath.size() - start);
+  file.directory = directory;
+  return files_.pushBack(file);
+}
+
+std::string PathTable::getDirectoryPath(int32_t directory) const {
+  std::string path;
+  appendDirectoryPath(directory, path);
+  return path;
+}
+
+std::string PathTable::getRelPath(int64_t index) const {
+  std::string path;
+  const File &file = files_[index];
+  appendDirectoryPath(file.directory, path);
+  path.append(file.name.data, file.name.size);
+  return path;
+}
+
+std::string PathTable::getFullPath(int64_t index) const {
+  std::string path = rootDir_;
+  const File &file = files_[index];
+  appendDirectoryPath(file.directory, path);
+  path.append(file.name.data, file.name.size);
+  return path;
+}
+
+int64_t PathTable::getNumFiles() const {
+  return files_.size();
+}
+
+int32_t PathTable::getNumDirectories() const {
+  return directories_.size();
+}
+
+int64_t PathTable::getNumBytes() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return arenaBytes_ + directories_.size() * sizeof(Directory) +
+         files_.size() * sizeof(File) +
+         directoryIndex_.size() * (sizeof(size_t) + sizeof(int32_t));
+}
+
+PathTable::Name PathTable::intern(const char *data, size_t size) {
+  Name name;
+  name.data = "";
+  name.size = 0;
+  if (size == 0) {
+    return name;
+  }
+  if (size > chunkLeft_) {
+    const size_t chunkSize = std::max(size, kChunkSize);
+    chunks_.emplace_back(new char[chunkSize]);
+    chunkPos_ = chunks_.back().get();
+    chunkLeft_ = chunkSize;
+    arenaBytes_ += chunkSize;
+  }
+  name.data = chunkPos_;
+  name.size = static_cast<uint32_t>(size);
+  memcpy(chunkPos_, data, size);
+  chunkPos_ += size;
+  chunkLeft_ -= size;
+  return name;
+}
+
+int32_t PathTable::addDirectoryLocked(int32_t parent, const char *data,
+                                      size_t size) {
+  WDT_CHECK(parent >= 0 && parent < (int64_t)directories_.size());
+  const size_t hash = hashDirectory(parent, data, size);
+  auto range = directoryIndex_.equal_range(hash);
+  for (auto it = range.first; it != range.second; ++it) {
+    const Directory &directory = directories_[it->second];
+    if (directory.parent == parent && directory.name.size == size &&
+        memcmp(directory.name.data, data, size) == 0) {
+      return it->second;
+    }
+  }
+  Directory directory;
+  directory.name = intern(data, size);
+  directory.parent = parent;
+  const int32_t index = directories_.pushBack(directory);
+  directoryIndex_.emplace(hash, index);
+  return index;
+}
+
+void PathTable::appendDirectoryPath(int32_t directory,
+                                    std::string &path) const {
+  if (directory == kRootDirectory) {
+    return;
+  }
+  const Directory &node = directories_[directory];
+  appendDirectoryPath(node.parent, path);
+  path.append(node.name.data, node.name.size);
+  path.push_back('/');
+}
+
+size_t PathTable::hashDirectory(int32_t parent, const char *data,
+                                size_t size) {
+  // FNV-1a of the name, seeded with the parent
+  size_t hash = 14695981039346656037ULL ^ std::hash<int32_t>()(parent);
+  for (size_t i = 0; i < size; i++) {
+    hash ^= (unsigned char)data[i];
+    hash *= 1099511628211ULL;
+  }
+  return hash;
+}
+}
+}
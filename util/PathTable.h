@@ -0,0 +1,212 @@
+/**
+ * Copyright (c) 2014-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+#pragma once
+
+#include <wdt/ErrorCodes.h>
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace facebook {
+namespace wdt {
+
+/**
+ * Interned storage of the paths of the files of a transfer. Directories form
+ * a trie, each one only storing its name and the index of its parent, and
+ * files are leaves storing their name and the index of their directory. Names
+ * are copied once in an arena of large chunks, so a file costs its name and a
+ * few bytes instead of two heap allocated copies of its full and relative
+ * paths. Paths are materialized on demand, when a file is opened or sent.
+ *
+ * Nodes are never removed, indices stay valid for the life of the table. All
+ * the methods are thread safe. Adds are serialized by a mutex, while paths are
+ * materialized without locking: nodes never move once added and are published
+ * by the size of their array.
+ */
+class PathTable {
+ public:
+  /// index of the root directory
+  static const int32_t kRootDirectory = 0;
+
+  PathTable();
+
+  /**
+   * @param rootDir    prefix of the full paths, ending with '/'. Not
+   *                   synchronized with getFullPath, must be set before paths
+   *                   are materialized
+   */
+  void setRootDir(const std::string &rootDir);
+
+  /**
+   * Adds a directory, or finds it if it already exists
+   *
+   * @param parent    index of the parent directory
+   * @param name      name of the directory, without '/'
+   *
+   * @return          index of the directory
+   */
+  int32_t addDirectory(int32_t parent, const std::string &name);
+
+  /**
+   * Adds a file. Adding a name twice adds two files
+   *
+   * @param directory   index of the directory of the file
+   * @param name        name of the file
+   *
+   * @return            index of the file
+   */
+  int64_t addFile(int32_t directory, const std::string &name);
+
+  /**
+   * Adds a file by its relative path, adding its missing directories. The
+   * relative path materialized later is identical to the one added
+   *
+   * @param relPath     path relative to the root directory
+   *
+   * @return            index of the file
+   */
+  int64_t addFilePath(const std::string &relPath);
+
+  /// @return   path of a directory relative to the root directory, ending
+  ///           with '/' except for the root directory itself which is ""
+  std::string getDirectoryPath(int32_t directory) const;
+
+  /// @return   path of a file relative to the root directory
+  std::string getRelPath(int64_t file) const;
+
+  /// @return   path of a file, prefixed by the root directory
+  std::string getFullPath(int64_t file) const;
+
+  /// @return   number of files added
+  int64_t getNumFiles() const;
+
+  /// @return   number of directories, the root directory included
+  int32_t getNumDirectories() const;
+
+  /// @return   approximate number of bytes used by the table
+  int64_t getNumBytes() const;
+
+ private:
+  /// size of the chunks of the arena, longer names get their own chunk
+  static const size_t kChunkSize = 64 * 1024;
+
+  struct Name {
+    const char *data;
+    uint32_t size;
+  };
+
+  struct Directory {
+    Name name;
+    int32_t parent;
+  };
+
+  struct File {
+    Name name;
+    int32_t directory;
+  };
+
+  /**
+   * Append-only array of nodes, read without locking. Nodes are stored in
+   * buckets of doubling sizes which are never reallocated, and the size is
+   * published after the node is written
+   */
+  template <typename T>
+  class NodeArray {
+   public:
+    NodeArray() = default;
+
+    ~NodeArray() {
+      for (auto &bucket : buckets_) {
+        delete[] bucket.load();
+      }
+    }
+
+    /// appends a node, @return its index. Calls must be serialized
+    int64_t pushBack(const T &node) {
+      const int64_t index = size_.load(std::memory_order_relaxed);
+      int bucket;
+      int64_t offset;
+      locate(index, bucket, offset);
+      T *nodes = buckets_[bucket].load(std::memory_order_relaxed);
+      if (nodes == nullptr) {
+        nodes = new T[kFirstBucketSize << bucket];
+        buckets_[bucket].store(nodes, std::memory_order_relaxed);
+      }
+      nodes[offset] = node;
+      size_.store(index + 1, std::memory_order_release);
+      return index;
+    }
+
+    /// @return   node at an index returned by pushBack
+    const T &operator[](int64_t index) const {
+      WDT_CHECK(index >= 0 && index < size()) << index;
+      int bucket;
+      int64_t offset;
+      locate(index, bucket, offset);
+      return buckets_[bucket].load(std::memory_order_relaxed)[offset];
+    }
+
+    /// @return   number of nodes
+    int64_t size() const {
+      return size_.load(std::memory_order_acquire);
+    }
+
+   private:
+    static const int64_t kFirstBucketSize = 1024;
+    /// enough for kFirstBucketSize << kNumBuckets nodes
+    static const int kNumBuckets = 40;
+
+    static void locate(int64_t index, int &bucket, int64_t &offset) {
+      bucket = 0;
+      int64_t bucketSize = kFirstBucketSize;
+      while (index >= bucketSize) {
+        index -= bucketSize;
+        bucketSize <<= 1;
+        ++bucket;
+      }
+      WDT_CHECK(bucket < kNumBuckets) << index;
+      offset = index;
+    }
+
+    std::atomic<T *> buckets_[kNumBuckets]{};
+    std::atomic<int64_t> size_{0};
+  };
+
+  /// copies a name in the arena, mutex_ must be held
+  Name intern(const char *data, size_t size);
+
+  /// adds or finds a directory, mutex_ must be held
+  int32_t addDirectoryLocked(int32_t parent, const char *data, size_t size);
+
+  /// appends the relative path of a directory
+  void appendDirectoryPath(int32_t directory, std::string &path) const;
+
+  /// @return   hash of a directory name under its parent
+  static size_t hashDirectory(int32_t parent, const char *data, size_t size);
+
+  /// serializes the adds
+  mutable std::mutex mutex_;
+  std::string rootDir_;
+  /// chunks of the arena, names are stored contiguously
+  std::vector<std::unique_ptr<char[]>> chunks_;
+  /// free space left in the last chunk
+  char *chunkPos_{nullptr};
+  size_t chunkLeft_{0};
+  int64_t arenaBytes_{0};
+  NodeArray<Directory> directories_;
+  NodeArray<File> files_;
+  /// directories by hash of (parent, name), to find existing ones
+  std::unordered_multimap<size_t, int32_t> directoryIndex_;
+};
+}
+}
@@ -0,0 +1,104 @@
+/**
+ * Copyright (c) 2014-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+#include <wdt/util/ReceiveBufferSizer.h>
+#include <wdt/Protocol.h>
+#include <wdt/util/CommonImpl.h>
+
+#include <algorithm>
+
+namespace facebook {
+namespace wdt {
+
+std::atomic<int64_t> ReceiveBufferSizer::totalBufferBytes_{0};
+
+namespace {
+/// @return   size rounded down to a whole number of disk blocks, at least one
+int64_t roundToDiskBlocks(int64_t size) {
+  return std::max(kDiskBlockSize, size / kDiskBlockSize * kDiskBlockSize);
+}
+}
+
+ReceiveBufferSizer::ReceiveBufferSizer(const WdtOptions &options,
+                                       int64_t initialSize)
+    : baseSize_(initialSize),
+      reportReads_(options.enable_perf_stat_collection),
+      size_(initialSize) {
+  totalBufferBytes_ += size_;
+  if (options.adaptive_buffer_max_size <= 0) {
+    return;
+  }
+  maxSize_ = std::max(baseSize_,
+                      roundToDiskBlocks(options.adaptive_buffer_max_size));
+  // a whole header must fit in the buffer
+  const int64_t headerSize =
+      roundToDiskBlocks(Protocol::kMaxHeader + kDiskBlockSize - 1);
+  minSize_ = std::min(
+      baseSize_, std::max(headerSize,
+                          roundToDiskBlocks(options.adaptive_buffer_min_size)));
+  memoryLimit_ = (int64_t)(options.adaptive_buffer_memory_limit_mb * kMbToB);
+}
+
+ReceiveBufferSizer::~ReceiveBufferSizer() {
+  totalBufferBytes_ -= size_;
+}
+
+int64_t ReceiveBufferSizer::onRead(int64_t target, int64_t numRead) {
+  ++numReads_;
+  if (!isEnabled()) {
+    return size_;
+  }
+  const bool overLimit =
+      memoryLimit_ > 0 && totalBufferBytes_.load() > memoryLimit_;
+  if (overLimit && size_ > minSize_) {
+    return std::max(minSize_, roundToDiskBlocks(size_ / 2));
+  }
+  if (target < size_) {
+    // limited by the end of the block, says nothing about the connection
+    return size_;
+  }
+  if (numRead == target) {
+    smallReads_ = 0;
+    ++fullReads_;
+  } else if (numRead < size_ / 4) {
+    fullReads_ = 0;
+    ++smallReads_;
+  } else {
+    fullReads_ = 0;
+    smallReads_ = 0;
+  }
+  if (fullReads_ >= kReadsBeforeResize && size_ < maxSize_) {
+    const int64_t newSize = std::min(maxSize_, size_ * 2);
+    if (memoryLimit_ > 0 &&
+        totalBufferBytes_.load() + newSize - size_ > memoryLimit_) {
+      return size_;
+    }
+    return newSize;
+  }
+  if (smallReads_ >= kReadsBeforeResize && size_ > baseSize_) {
+    return std::max(baseSize_, roundToDiskBlocks(size_ / 2));
+  }
+  return size_;
+}
+
+void ReceiveBufferSizer::setSize(int64_t size, PerfStatReport &perfReport) {
+  reportStats(perfReport);
+  totalBufferBytes_ += size - size_;
+  size_ = size;
+  fullReads_ = 0;
+  smallReads_ = 0;
+}
+
+void ReceiveBufferSizer::reportStats(PerfStatReport &perfReport) {
+  if (reportReads_ && numReads_ > 0) {
+    perfReport.addBufferSizeReads(size_, numReads_);
+    numReads_ = 0;
+  }
+}
+}
+}
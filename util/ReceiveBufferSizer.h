@@ -0,0 +1,112 @@
+/**
+ * Copyright (c) 2014-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+#pragma once
+
+#include <wdt/Reporting.h>
+#include <wdt/WdtOptions.h>
+
+#include <atomic>
+
+namespace facebook {
+namespace wdt {
+
+/**
+ * Chooses the size of the receive buffer of a connection, which is also the
+ * size of its disk writes. A connection whose socket reads keep filling the
+ * buffer gets a buffer twice as large, up to adaptive_buffer_max_size. One
+ * whose reads stay small goes back to buffer_size. When the buffers of all
+ * the connections of the process exceed adaptive_buffer_memory_limit_mb,
+ * they shrink down to adaptive_buffer_min_size.
+ *
+ * The sizer only decides, the receiver thread swaps the buffer when it holds
+ * no unprocessed data and then calls setSize().
+ */
+class ReceiveBufferSizer {
+ public:
+  /**
+   * @param options       wdt options
+   * @param initialSize   size of the buffer the connection starts with
+   */
+  ReceiveBufferSizer(const WdtOptions &options, int64_t initialSize);
+
+  /// Releases the buffer from the memory used by all connections
+  ~ReceiveBufferSizer();
+
+  /// @return   whether adaptive buffer sizing is enabled
+  bool isEnabled() const {
+    return maxSize_ > 0;
+  }
+
+  /// @return   current size of the buffer
+  int64_t getSize() const {
+    return size_;
+  }
+
+  /**
+   * Records a socket read into the buffer
+   *
+   * @param target    number of bytes asked for
+   * @param numRead   number of bytes read
+   *
+   * @return          size the buffer should be resized to, or the current
+   *                  size
+   */
+  int64_t onRead(int64_t target, int64_t numRead);
+
+  /**
+   * Records a resize of the buffer
+   *
+   * @param size          new size of the buffer
+   * @param perfReport    where the number of reads done at the previous size
+   *                      is reported
+   */
+  void setSize(int64_t size, PerfStatReport &perfReport);
+
+  /// Reports the number of reads done at the current size, if perf stats
+  /// are collected
+  void reportStats(PerfStatReport &perfReport);
+
+  /// @return   bytes used by the receive buffers of all the connections
+  static int64_t getTotalBufferBytes() {
+    return totalBufferBytes_.load();
+  }
+
+  /// Copy constructor deleted
+  ReceiveBufferSizer(const ReceiveBufferSizer &that) = delete;
+
+  /// Delete the assignment operatory by copy
+  ReceiveBufferSizer &operator=(const ReceiveBufferSizer &that) = delete;
+
+ private:
+  /// number of consecutive reads to see before changing the size
+  static const int kReadsBeforeResize = 16;
+
+  /// initial size, which small reads shrink back to
+  const int64_t baseSize_;
+  /// whether reads are reported, with enable_perf_stat_collection
+  const bool reportReads_;
+  /// bounds of the size
+  int64_t minSize_{0};
+  int64_t maxSize_{0};
+  /// memory limit of all connections in bytes, 0 for no limit
+  int64_t memoryLimit_{0};
+  /// current size
+  int64_t size_;
+  /// number of consecutive reads which filled the buffer
+  int fullReads_{0};
+  /// number of consecutive reads below a quarter of the buffer
+  int smallReads_{0};
+  /// number of reads done at the current size and not yet reported
+  int64_t numReads_{0};
+
+  /// sum of the sizes of all the sizers
+  static std::atomic<int64_t> totalBufferBytes_;
+};
+}
+}
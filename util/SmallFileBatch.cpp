@@ -0,0 +1,431 @@
+/**
+ * Copyright (c) 2014-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+#include <wdt/util/SmallFileBatch.h>
+#include <wdt/util/CommonImpl.h>
+#include <wdt/util/WritebackController.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <climits>
+
+namespace facebook {
+namespace wdt {
+
+#ifdef WDT_HAS_IO_URING
+/// operations of the io_uring chain of a file
+enum SmallFileOp {
+  OP_OPEN,
+  OP_WRITE,
+  OP_SYNC,
+  OP_FADVISE,
+  OP_CLOSE,
+  OP_END
+};
+
+/// result of an operation submitted but not completed
+const int32_t kPendingResult = INT32_MIN;
+#endif
+
+SmallFileBatch::SmallFileBatch(ThreadCtx &threadCtx, DiskFlusher *diskFlusher)
+    : threadCtx_(threadCtx), diskFlusher_(diskFlusher), writer_(*this) {
+  const auto &options = threadCtx_.getOptions();
+  const int batchSize = std::max(options.small_file_batch_size, 1);
+  files_.reserve(batchSize);
+  data_.reserve((int64_t)batchSize * options.small_file_max_size_kb * 1024);
+#ifdef WDT_HAS_IO_URING
+  ring_ = std::make_unique<IoUring>();
+  if (!ring_->init(batchSize * OP_END, batchSize)) {
+    WLOG(WARNING) << "io_uring not usable, writing small files with regular "
+                     "system calls";
+    ring_.reset();
+  }
+#endif
+}
+
+SmallFileBatch::~SmallFileBatch() {
+  if (!files_.empty()) {
+    WLOG(WARNING) << "Dropping " << files_.size() << " small files not written";
+  }
+}
+
+bool SmallFileBatch::canBatch(const BlockDetails &blockDetails) const {
+  const auto &options = threadCtx_.getOptions();
+  return !options.skip_writes && blockDetails.allocationStatus == NOT_EXISTS &&
+         blockDetails.offset == 0 &&
+         blockDetails.dataSize == blockDetails.fileSize &&
+         blockDetails.fileSize <= options.small_file_max_size_kb * 1024LL;
+}
+
+bool SmallFileBatch::isFull() const {
+  return (int64_t)files_.size() >=
+         threadCtx_.getOptions().small_file_batch_size;
+}
+
+void SmallFileBatch::startFile(const BlockDetails &blockDetails) {
+  WDT_CHECK(!receivingFile_) << "Previous small file not committed";
+  files_.emplace_back(blockDetails);
+  files_.back().dataOffset = data_.size();
+  receivingFile_ = true;
+}
+
+Writer &SmallFileBatch::getWriter() {
+  WDT_CHECK(receivingFile_);
+  return writer_;
+}
+
+void SmallFileBatch::commitFile() {
+  WDT_CHECK(receivingFile_);
+  receivingFile_ = false;
+}
+
+void SmallFileBatch::abortFile() {
+  if (!receivingFile_) {
+    return;
+  }
+  data_.resize(files_.back().dataOffset);
+  files_.pop_back();
+  receivingFile_ = false;
+}
+
+ErrorCode SmallFileBatch::BatchWriter::write(char *buf, int64_t size) {
+  batch_.data_.insert(batch_.data_.end(), buf, buf + size);
+  return OK;
+}
+
+int64_t SmallFileBatch::BatchWriter::getTotalWritten() {
+  return batch_.data_.size() - batch_.files_.back().dataOffset;
+}
+
+bool SmallFileBatch::shouldSync() const {
+  const auto &options = threadCtx_.getOptions();
+  return diskFlusher_ == nullptr &&
+         (options.fsync || options.isLogBasedResumption());
+}
+
+bool SmallFileBatch::countsDirtyBytes() const {
+#ifdef HAS_SYNC_FILE_RANGE
+  return WritebackController::isEnabled(threadCtx_.getOptions());
+#else
+  return false;
+#endif
+}
+
+bool SmallFileBatch::needsDescriptor() const {
+  return diskFlusher_ != nullptr || (countsDirtyBytes() && !shouldSync());
+}
+
+bool SmallFileBatch::releaseFile(File &file, int fd) {
+  const int64_t size = file.blockDetails.dataSize;
+  if (countsDirtyBytes() && size > 0) {
+    WritebackController &writebackController = WritebackController::get();
+    writebackController.addDirtyBytes(size);
+    const int rangeFd = shouldSync() ? -1 : ::dup(fd);
+    if (rangeFd >= 0) {
+      // the pages stay counted till waited for, like those of a FileWriter
+      writebackController.addClosedRange(rangeFd, 0, size, size);
+    } else {
+      if (!shouldSync()) {
+        WPLOG(ERROR) << "Unable to dup() fd " << fd
+                     << " for writeback accounting";
+      }
+      writebackController.removeDirtyBytes(size, shouldSync());
+    }
+  }
+  if (fd < 0) {
+    return true;
+  }
+  if (diskFlusher_ != nullptr) {
+    // group commit: the flusher owns the descriptor and syncs it in a batch
+    file.flushTicket = diskFlusher_->addFd(fd);
+    return true;
+  }
+  PerfStatCollector statCollector(threadCtx_, PerfStatReport::FILE_CLOSE);
+  if (::close(fd) != 0) {
+    WPLOG(ERROR) << "Unable to close " << file.blockDetails.fileName;
+    return false;
+  }
+  return true;
+}
+
+ErrorCode SmallFileBatch::flush(FileCreator &fileCreator,
+                                const WrittenCallback &onWritten) {
+  WDT_CHECK(!receivingFile_) << "Flushing while receiving a small file";
+  if (files_.empty()) {
+    return OK;
+  }
+  WVLOG(1) << "Writing a batch of " << files_.size() << " small files";
+  const int openFlags = fileCreator.getCreateFlags(threadCtx_);
+  // like FileWriters, wait for the writeback of closed files before dirtying
+  // more pages when too many are dirty
+  WritebackController &writebackController = WritebackController::get();
+  const bool writebackWaitFailed =
+      countsDirtyBytes() &&
+      writebackController.isOverLimit(threadCtx_.getOptions()) &&
+      !writebackController.waitForClosedRanges(threadCtx_);
+  for (File &file : files_) {
+    FileCreator &stripeCreator =
+        fileCreator.getStripeCreator(file.blockDetails.fileName);
+    file.rootDirFd = stripeCreator.getRootDirFd();
+    if (writebackWaitFailed || file.rootDirFd < 0 ||
+        !stripeCreator.createParentDirectory(threadCtx_,
+                                             file.blockDetails.fileName)) {
+      file.failed = true;
+    }
+  }
+#ifdef WDT_HAS_IO_URING
+  const int64_t numFiles = files_.size();
+  for (int64_t begin = 0; begin < numFiles && ring_;) {
+    const int64_t chunkSize = std::min<int64_t>(
+        ring_->getNumFiles(), ring_->getNumEntries() / OP_END);
+    const int64_t end = std::min(numFiles, begin + chunkSize);
+    writeWithIoUring(openFlags, begin, end);
+    begin = end;
+  }
+#endif
+  for (File &file : files_) {
+    if (!file.written && !file.failed) {
+      file.written = writeFile(openFlags, file);
+      file.failed = !file.written;
+    }
+  }
+  ErrorCode code = OK;
+  for (File &file : files_) {
+    if (!file.written) {
+      WLOG(ERROR) << "Unable to write small file "
+                  << file.blockDetails.fileName << ", dropping the rest of "
+                  << "the batch";
+      code = FILE_WRITE_ERROR;
+      break;
+    }
+    if (file.blockDetails.mtimeNs >= 0 &&
+        !FileCreator::setModificationTime(file.rootDirFd,
+                                          file.blockDetails.fileName,
+                                          file.blockDetails.mtimeNs)) {
+      code = FILE_WRITE_ERROR;
+      break;
+    }
+    fileCreator.logFileCreation(threadCtx_, &file.blockDetails);
+    onWritten(file.blockDetails, file.flushTicket);
+  }
+#ifdef WDT_HAS_IO_URING
+  if (ringAbandoned_ && abandonedFiles_.empty()) {
+    // the kernel may still read them, keep them for the life of the batch
+    abandonedFiles_.swap(files_);
+    abandonedData_.swap(data_);
+  }
+#endif
+  files_.clear();
+  data_.clear();
+  return code;
+}
+
+#ifdef WDT_HAS_IO_URING
+void SmallFileBatch::writeWithIoUring(int openFlags, int64_t begin,
+                                      int64_t end) {
+  PerfStatCollector statCollector(threadCtx_, PerfStatReport::SMALL_FILE_BATCH);
+  const auto &options = threadCtx_.getOptions();
+  const bool doSync = shouldSync();
+#ifdef HAS_POSIX_FADVISE
+  const bool doFadvise = !options.skip_fadvise;
+#else
+  const bool doFadvise = false;
+#endif
+  std::vector<int32_t> results((end - begin) * OP_END, 0);
+  int numOps = 0;
+  auto addOp = [&](int64_t slot, SmallFileOp op, uint8_t opcode, int fd,
+                   uint8_t flags) {
+    struct io_uring_sqe *sqe = ring_->getSqe();
+    WDT_CHECK(sqe != nullptr) << "io_uring too small for the batch";
+    sqe->opcode = opcode;
+    sqe->fd = fd;
+    sqe->flags = flags;
+    sqe->user_data = slot * OP_END + op;
+    results[slot * OP_END + op] = kPendingResult;
+    ++numOps;
+    return sqe;
+  };
+  for (int64_t i = begin; i < end; i++) {
+    const File &file = files_[i];
+    if (file.failed) {
+      continue;
+    }
+    const int64_t slot = i - begin;
+    const int64_t size = file.blockDetails.dataSize;
+    // the file is opened in the direct descriptor slot, the other operations
+    // of the chain use the slot as a fixed file
+    auto sqe =
+        addOp(slot, OP_OPEN, IORING_OP_OPENAT, file.rootDirFd, IOSQE_IO_LINK);
+    sqe->addr = (uint64_t)file.blockDetails.fileName.c_str();
+    sqe->len = 0644;
+    sqe->open_flags = openFlags;
+    sqe->file_index = slot + 1;
+    // a failed write must still close the slot, hence the hard links
+    if (size > 0) {
+      sqe = addOp(slot, OP_WRITE, IORING_OP_WRITE, slot,
+                  IOSQE_FIXED_FILE | IOSQE_IO_HARDLINK);
+      sqe->addr = (uint64_t)getData(file);
+      sqe->len = size;
+      sqe->off = 0;
+    }
+    if (doSync) {
+      addOp(slot, OP_SYNC, IORING_OP_FSYNC, slot,
+            IOSQE_FIXED_FILE | IOSQE_IO_HARDLINK);
+    }
+    if (doFadvise && size > 0) {
+      sqe = addOp(slot, OP_FADVISE, IORING_OP_FADVISE, slot,
+                  IOSQE_FIXED_FILE | IOSQE_IO_HARDLINK);
+      sqe->off = 0;
+      sqe->len = size;
+      sqe->fadvise_advice = POSIX_FADV_DONTNEED;
+    }
+    sqe = addOp(slot, OP_CLOSE, IORING_OP_CLOSE, 0, 0);
+    sqe->file_index = slot + 1;
+  }
+  bool ringError = false;
+  uint64_t userData;
+  int32_t res;
+  for (int numReaped = 0; numReaped < numOps;) {
+    if (!ring_->popCompletion(userData, res)) {
+      if (ring_->submitAndWait(numOps - numReaped) != 0) {
+        ringError = true;
+        break;
+      }
+      continue;
+    }
+    results[userData] = res;
+    ++numReaped;
+  }
+  // the entries already submitted use the names and the contents of the
+  // files, wait for them before the batch is reused
+  while (ringError && ring_->getNumInFlight() > 0) {
+    if (ring_->popCompletion(userData, res)) {
+      results[userData] = res;
+    } else if (ring_->waitForCompletions(ring_->getNumInFlight()) != 0) {
+      WLOG(ERROR) << "Unable to reap " << ring_->getNumInFlight()
+                  << " io_uring entries, keeping their buffers";
+      ringAbandoned_ = true;
+      break;
+    }
+  }
+  bool directFilesUnsupported = false;
+  for (int64_t i = begin; i < end; i++) {
+    File &file = files_[i];
+    if (file.failed) {
+      continue;
+    }
+    const int32_t *fileResults = &results[(i - begin) * OP_END];
+    const std::string &fileName = file.blockDetails.fileName;
+    if (fileResults[OP_OPEN] == -EINVAL) {
+      // kernel older than 5.15, the file is written with system calls
+      directFilesUnsupported = true;
+      continue;
+    }
+    file.failed = true;
+    if (fileResults[OP_OPEN] < 0) {
+      if (fileResults[OP_OPEN] != kPendingResult) {
+        WLOG(ERROR) << "failed creating file " << fileName << " "
+                    << strerrorStr(-fileResults[OP_OPEN]);
+      }
+      continue;
+    }
+    if (fileResults[OP_WRITE] != file.blockDetails.dataSize) {
+      WLOG(ERROR) << "Write of " << file.blockDetails.dataSize << " bytes to "
+                  << fileName << " returned " << fileResults[OP_WRITE];
+      continue;
+    }
+    bool success = true;
+    for (int op = OP_SYNC; op < OP_END; op++) {
+      if (fileResults[op] < 0) {
+        WLOG(ERROR) << "io_uring operation " << op << " failed for "
+                    << fileName << " "
+                    << (fileResults[op] == kPendingResult
+                            ? std::string("not completed")
+                            : strerrorStr(-fileResults[op]));
+        success = false;
+      }
+    }
+    if (success) {
+      int fd = -1;
+      if (needsDescriptor()) {
+        // the ring closed its direct descriptor, the flusher and the
+        // writeback accounting need a regular one
+        fd = ::openat(file.rootDirFd, fileName.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+          WPLOG(ERROR) << "failed reopening written file " << fileName;
+          success = false;
+        }
+      }
+      success = success && releaseFile(file, fd);
+    }
+    file.failed = !success;
+    file.written = success;
+  }
+  if (ringError || directFilesUnsupported) {
+    WLOG(WARNING) << "io_uring not usable for small files, falling back to "
+                     "regular system calls";
+    ring_.reset();
+  }
+}
+#endif
+
+bool SmallFileBatch::writeFile(int openFlags, File &file) {
+  const std::string &fileName = file.blockDetails.fileName;
+  const int64_t size = file.blockDetails.dataSize;
+  int fd;
+  {
+    PerfStatCollector statCollector(threadCtx_, PerfStatReport::FILE_OPEN);
+    fd = ::openat(file.rootDirFd, fileName.c_str(), openFlags, 0644);
+  }
+  if (fd < 0) {
+    WPLOG(ERROR) << "failed creating file " << fileName;
+    return false;
+  }
+  bool success = true;
+  {
+    PerfStatCollector statCollector(threadCtx_, PerfStatReport::FILE_WRITE);
+    const char *data = getData(file);
+    int64_t written = 0;
+    while (written < size) {
+      const ssize_t ret = ::write(fd, data + written, size - written);
+      if (ret < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        WPLOG(ERROR) << "Write error for " << fileName;
+        success = false;
+        break;
+      }
+      written += ret;
+    }
+  }
+  if (success && shouldSync()) {
+    PerfStatCollector statCollector(threadCtx_, PerfStatReport::FSYNC_STATS);
+    if (::fsync(fd) < 0) {
+      WPLOG(ERROR) << "Unable to fsync() " << fileName;
+      success = false;
+    }
+  }
+#ifdef HAS_POSIX_FADVISE
+  if (success && size > 0 && !threadCtx_.getOptions().skip_fadvise) {
+    PerfStatCollector statCollector(threadCtx_, PerfStatReport::FADVISE);
+    if (posix_fadvise(fd, 0, size, POSIX_FADV_DONTNEED) != 0) {
+      WPLOG(ERROR) << "posix_fadvise failed for " << fileName;
+      success = false;
+    }
+  }
+#endif
+  if (!success) {
+    ::close(fd);
+    return false;
+  }
+  return releaseFile(file, fd);
+}
+}
+}
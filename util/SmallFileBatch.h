@@ -0,0 +1,224 @@
+/**
+ * Copyright (c) 2014-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+#pragma once
+
+#include <wdt/Protocol.h>
+#include <wdt/Writer.h>
+#include <wdt/util/DiskFlusher.h>
+#include <wdt/util/FileCreator.h>
+#include <wdt/util/IoUring.h>
+
+#include <functional>
+#include <memory>
+#include <vector>
+
+namespace facebook {
+namespace wdt {
+
+/**
+ * Per receiver thread batch of small files. Receiving a tiny file costs an
+ * open, a write, a sync, a fadvise and a close, each a synchronous system
+ * call on the receiver thread, so millions of tiny files are bound by the
+ * latency of the disk rather than by its bandwidth. Instead, the content of
+ * complete single block files up to small_file_max_size_kb is kept in memory
+ * and small_file_batch_size of them are written at once: with io_uring, each
+ * file is a linked openat/write/(fsync)/(fadvise)/close chain using a direct
+ * descriptor, and the whole batch is a single submission. Without io_uring,
+ * the files are written one after the other. With group commit, the files are
+ * not synced by the batch but handed to the DiskFlusher, and their dirty
+ * bytes are accounted by the WritebackController like those of a FileWriter.
+ *
+ * Files are only acknowledged once written, the owner must flush the batch
+ * before acknowledging any later block.
+ *
+ * This class is not thread-safe, each receiver thread has its own batch.
+ */
+class SmallFileBatch {
+ public:
+  /// called for each file written, in the order the files were added, with
+  /// the ticket of the group commit flush of the file, 0 without group commit
+  typedef std::function<void(const BlockDetails &blockDetails,
+                             int64_t flushTicket)>
+      WrittenCallback;
+
+  /**
+   * @param threadCtx     context of the owner thread
+   * @param diskFlusher   group commit flusher syncing the files, null if the
+   *                      files are synced by the batch
+   */
+  SmallFileBatch(ThreadCtx &threadCtx, DiskFlusher *diskFlusher);
+
+  ~SmallFileBatch();
+
+  /// @return   whether the block is a whole new file small enough to batch
+  bool canBatch(const BlockDetails &blockDetails) const;
+
+  /// @return   whether the batch has no file
+  bool isEmpty() const {
+    return files_.empty();
+  }
+
+  /// @return   whether the batch reached small_file_batch_size files
+  bool isFull() const;
+
+  /**
+   * Starts a file, its content is then appended by the writer returned by
+   * getWriter(). The file is only part of the batch once committed.
+   *
+   * @param blockDetails  details of the block, which is the whole file
+   */
+  void startFile(const BlockDetails &blockDetails);
+
+  /// @return   writer appending to the file being received
+  Writer &getWriter();
+
+  /// Adds the file being received to the batch
+  void commitFile();
+
+  /// Drops the file being received, if any
+  void abortFile();
+
+  /**
+   * Writes the files of the batch and empties it
+   *
+   * @param fileCreator   file creator of the transfer
+   * @param onWritten     called for each file written, in order
+   *
+   * @return              OK, or FILE_WRITE_ERROR if some file could not be
+   *                      written. onWritten is not called for the files
+   *                      after the first failed one.
+   */
+  ErrorCode flush(FileCreator &fileCreator, const WrittenCallback &onWritten);
+
+  /// Copy constructor deleted
+  SmallFileBatch(const SmallFileBatch &that) = delete;
+
+  /// Delete the assignment operatory by copy
+  SmallFileBatch &operator=(const SmallFileBatch &that) = delete;
+
+ private:
+  /// file of the batch
+  struct File {
+    explicit File(const BlockDetails &details) : blockDetails(details) {
+    }
+    BlockDetails blockDetails;
+    /// offset of the content of the file in data_
+    int64_t dataOffset{0};
+    /// descriptor of the root dir of the stripe of the file
+    int rootDirFd{-1};
+    /// ticket of the group commit flush of the file
+    int64_t flushTicket{0};
+    /// whether the file was written successfully
+    bool written{false};
+    /// whether writing the file failed
+    bool failed{false};
+  };
+
+  /// writer appending to the last file of files_
+  class BatchWriter : public Writer {
+   public:
+    explicit BatchWriter(SmallFileBatch &batch) : batch_(batch) {
+    }
+    /// @see Writer.h
+    ErrorCode open() override {
+      return OK;
+    }
+    /// @see Writer.h
+    ErrorCode write(char *buf, int64_t size) override;
+    /// @see Writer.h
+    int64_t getTotalWritten() override;
+    /// @see Writer.h
+    ErrorCode sync() override {
+      return OK;
+    }
+    /// @see Writer.h
+    ErrorCode close() override {
+      return OK;
+    }
+
+   private:
+    SmallFileBatch &batch_;
+  };
+
+  /// @return   content of a file
+  const char *getData(const File &file) const {
+    return data_.data() + file.dataOffset;
+  }
+
+  /// @return   whether the file is synced by the batch after it is written,
+  ///           with group commit it is synced by the flusher instead
+  bool shouldSync() const;
+
+  /// @return   whether the dirty bytes of the files are accounted by the
+  ///           WritebackController
+  bool countsDirtyBytes() const;
+
+  /// @return   whether a regular descriptor of a written file is needed,
+  ///           to hand it to the flusher or to the WritebackController
+  bool needsDescriptor() const;
+
+  /**
+   * Accounts the dirty bytes of a written file and hands its descriptor to
+   * the flusher, or closes it
+   *
+   * @param file          file written, and synced if shouldSync()
+   * @param fd            descriptor of the file, owned by this call. -1 if
+   *                      already closed, only when !needsDescriptor()
+   *
+   * @return              whether the descriptor was closed successfully
+   */
+  bool releaseFile(File &file, int fd);
+
+  /**
+   * Writes files with io_uring. Files which could not be submitted, because
+   * the kernel does not support direct descriptors, are left not written.
+   *
+   * @param openFlags     flags to create the files with
+   * @param begin         index of the first file to write
+   * @param end           index after the last file to write
+   *
+   * The completions of all the entries submitted are reaped before
+   * returning, even on error, as the kernel reads the names and the contents
+   * of the files from the batch.
+   */
+  void writeWithIoUring(int openFlags, int64_t begin, int64_t end);
+
+  /**
+   * Writes a file with regular system calls
+   *
+   * @param openFlags     flags to create the file with
+   * @param file          file to write
+   *
+   * @return              whether the file was written
+   */
+  bool writeFile(int openFlags, File &file);
+
+  ThreadCtx &threadCtx_;
+  /// group commit flusher, null if the batch syncs the files
+  DiskFlusher *const diskFlusher_;
+  /// files of the batch, the last one may be being received
+  std::vector<File> files_;
+  /// whether the last file of files_ is still being received
+  bool receivingFile_{false};
+  /// contents of the files, back to back
+  std::vector<char> data_;
+  BatchWriter writer_;
+#ifdef WDT_HAS_IO_URING
+  /// ring used to write the batches, null if io_uring is not usable
+  std::unique_ptr<IoUring> ring_;
+  /// whether entries of the ring could not be reaped, their buffers must
+  /// then outlive the batch
+  bool ringAbandoned_{false};
+  /// files and contents of the batch the abandoned entries refer to
+  std::vector<File> abandonedFiles_;
+  std::vector<char> abandonedData_;
+#endif
+};
+}
+}
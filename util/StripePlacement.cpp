@@ -0,0 +1,151 @@
+/**
+ * Copyright (c) 2014-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+#include <wdt/util/StripePlacement.h>
+#include <wdt/ErrorCodes.h>
+
+#include <folly/String.h>
+#include <errno.h>
+#include <sys/statvfs.h>
+#include <cmath>
+
+namespace facebook {
+namespace wdt {
+
+namespace {
+/// 64 bit FNV-1a, stable across platforms and releases unlike std::hash
+uint64_t hashPath(const std::string &path) {
+  uint64_t hash = 14695981039346656037ULL;
+  for (unsigned char c : path) {
+    hash ^= c;
+    hash *= 1099511628211ULL;
+  }
+  return hash;
+}
+
+/// splitmix64 finalizer, mixes the path hash with the stripe index
+uint64_t mix(uint64_t x) {
+  x += 0x9e3779b97f4a7c15ULL;
+  x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+  return x ^ (x >> 31);
+}
+
+void addTrailingSlash(std::string &dir) {
+  if (dir.empty() || dir.back() != '/') {
+    dir.push_back('/');
+  }
+}
+
+/**
+ * @return    bytes available on the filesystem of a directory, or of its
+ *            closest existing ancestor since stripe directories are created
+ *            along with the files. -1 on error.
+ */
+double getFreeSpace(std::string dir) {
+  while (true) {
+    struct statvfs fsStat;
+    if (::statvfs(dir.c_str(), &fsStat) == 0) {
+      return (double)fsStat.f_bavail * fsStat.f_frsize;
+    }
+    if (errno != ENOENT || dir == ".") {
+      break;
+    }
+    while (!dir.empty() && dir.back() == '/') {
+      dir.pop_back();
+    }
+    const size_t pos = dir.rfind('/');
+    if (pos == std::string::npos) {
+      dir = ".";
+    } else {
+      dir.resize(pos + 1);
+    }
+  }
+  WPLOG(WARNING) << "statvfs failed for " << dir;
+  return -1;
+}
+}
+
+StripePlacement::StripePlacement(const std::string &rootDir,
+                                 const WdtOptions &options) {
+  stripeDirs_.push_back(rootDir);
+  folly::split(',', options.stripe_directories, stripeDirs_, true);
+  const bool byFreeSpace = (options.stripe_placement == "free_space");
+  if (!byFreeSpace && options.stripe_placement != "hash") {
+    WLOG(WARNING) << "Unknown stripe placement " << options.stripe_placement
+                  << ", using hash";
+  }
+  for (auto &dir : stripeDirs_) {
+    addTrailingSlash(dir);
+    // unknown free space gets the average weight below
+    weights_.push_back(byFreeSpace ? getFreeSpace(dir) : 1);
+  }
+  double totalWeight = 0;
+  int numWeighted = 0;
+  for (double weight : weights_) {
+    if (weight > 0) {
+      totalWeight += weight;
+      ++numWeighted;
+    }
+  }
+  for (int i = 0; i < getNumStripes(); i++) {
+    double &weight = weights_[i];
+    if (weight < 0) {
+      weight = numWeighted > 0 ? totalWeight / numWeighted : 1;
+    }
+    if (weight == 0) {
+      // full disk, only gets the files recorded there
+      WLOG(WARNING) << "No free space on " << stripeDirs_[i]
+                    << ", no new file placed on it";
+    }
+    WLOG(INFO) << "Stripe " << i << " " << stripeDirs_[i] << " weight "
+               << weight;
+  }
+}
+
+int StripePlacement::getStripe(const std::string &relPath) const {
+  if (!recordedStripes_.empty()) {
+    auto it = recordedStripes_.find(relPath);
+    if (it != recordedStripes_.end()) {
+      return it->second;
+    }
+  }
+  return hashStripe(relPath);
+}
+
+void StripePlacement::recordStripe(const std::string &relPath, int stripe) {
+  WDT_CHECK(stripe >= 0 && stripe < getNumStripes()) << stripe;
+  recordedStripes_[relPath] = stripe;
+}
+
+int StripePlacement::hashStripe(const std::string &relPath) const {
+  const int numStripes = getNumStripes();
+  if (numStripes == 1) {
+    return 0;
+  }
+  const uint64_t pathHash = hashPath(relPath);
+  int bestStripe = 0;
+  double bestScore = -1;
+  for (int i = 0; i < numStripes; i++) {
+    if (weights_[i] <= 0) {
+      continue;
+    }
+    // uniform in (0, 1), the stripe with the highest weight / -ln(u) wins,
+    // which picks each stripe with a probability proportional to its weight
+    const uint64_t hash = mix(pathHash ^ mix(i));
+    const double u = ((hash >> 11) + 0.5) / 9007199254740992.0;
+    const double score = weights_[i] / -std::log(u);
+    if (score > bestScore) {
+      bestScore = score;
+      bestStripe = i;
+    }
+  }
+  return bestStripe;
+}
+}
+}
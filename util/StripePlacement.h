@@ -0,0 +1,84 @@
+/**
+ * Copyright (c) 2014-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+#pragma once
+
+#include <wdt/WdtOptions.h>
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace facebook {
+namespace wdt {
+
+/**
+ * Placement of the received files across several destination directories,
+ * usually on independent disks (JBOD mode). Stripe 0 is the destination
+ * directory of the transfer, which also holds the transfer log, the others
+ * come from the stripe_directories option. Every file goes whole to a single
+ * stripe.
+ *
+ * A file is placed by weighted rendezvous hashing of its path, so that the
+ * placement does not depend on the order in which files are received and
+ * only the files of a removed stripe move. With stripe_placement=free_space,
+ * stripes are weighted by their free space when the receiver starts. Since
+ * that changes from one transfer to the next, the placement of the files
+ * created by a previous transfer is recorded in the transfer log (or found by
+ * traversing the stripes) and takes precedence over the hash.
+ *
+ * Stripes must only be recorded before the transfer starts, getStripe() is
+ * then safe to call from any thread.
+ */
+class StripePlacement {
+ public:
+  /**
+   * @param rootDir     destination directory, stripe 0
+   * @param options     wdt options
+   */
+  StripePlacement(const std::string &rootDir, const WdtOptions &options);
+
+  /// @return   number of stripes, including the destination directory
+  int getNumStripes() const {
+    return stripeDirs_.size();
+  }
+
+  /// @return   directory of a stripe, with a trailing '/'
+  const std::string &getStripeDir(int stripe) const {
+    return stripeDirs_[stripe];
+  }
+
+  /// @return   stripe of a file, recorded or hashed
+  int getStripe(const std::string &relPath) const;
+
+  /**
+   * Records the stripe a file was created on by a previous transfer
+   *
+   * @param relPath   path of the file relative to the stripe directory
+   * @param stripe    stripe the file is on
+   */
+  void recordStripe(const std::string &relPath, int stripe);
+
+  /// @return   number of files whose stripe is recorded
+  int64_t getNumRecordedStripes() const {
+    return recordedStripes_.size();
+  }
+
+ private:
+  /// @return   stripe of a file according to the hash of its path
+  int hashStripe(const std::string &relPath) const;
+
+  /// stripe directories, destination directory first
+  std::vector<std::string> stripeDirs_;
+  /// relative weight of each stripe
+  std::vector<double> weights_;
+  /// stripes of the files created by previous transfers
+  std::unordered_map<std::string, int> recordedStripes_;
+};
+}
+}
@@ -14,20 +14,26 @@ namespace wdt {
 
 ThreadTransferHistory::ThreadTransferHistory(DirectorySourceQueue &queue,
                                              TransferStats &threadStats,
-                                             int32_t port)
-    : queue_(queue), threadStats_(threadStats), port_(port) {
+                                             int32_t port,
+                                             bool keepAckedSourceStats)
+    : queue_(queue),
+      threadStats_(threadStats),
+      keepAckedSourceStats_(keepAckedSourceStats),
+      port_(port) {
   WVLOG(1) << "Making thread history for port " << port_;
 }
 
 std::string ThreadTransferHistory::getSourceId(int64_t index) {
   std::lock_guard<std::mutex> lock(mutex_);
   std::string sourceId;
-  const int64_t historySize = history_.size();
-  if (index >= 0 && index < historySize) {
-    sourceId = history_[index]->getIdentifier();
+  const int64_t historySize = numReleased_ + history_.size();
+  if (index >= numReleased_ && index < historySize) {
+    const Entry &entry = history_[index - numReleased_];
+    sourceId = entry.source ? entry.source->getIdentifier()
+                            : queue_.getRelPath(*entry.compact);
   } else {
-    WLOG(WARNING) << "Trying to read out of bounds data " << index << " "
-                  << history_.size();
+    WLOG(WARNING) << "Trying to read out of bounds or released data " << index
+                  << " " << numReleased_ << " " << historySize;
   }
   return sourceId;
 }
@@ -43,10 +49,36 @@ bool ThreadTransferHistory::addSource(std::unique_ptr<ByteSource> &source) {
     queue_.returnToQueue(source);
     return false;
   }
-  history_.emplace_back(std::move(source));
+  Entry entry;
+  if (queue_.isBounded()) {
+    entry.compact = std::make_unique<DirectorySourceQueue::CompactSource>();
+    if (!queue_.compactSource(source, keepAckedSourceStats_,
+                              *entry.compact)) {
+      entry.compact.reset();
+    }
+  }
+  if (!entry.compact) {
+    entry.source = std::move(source);
+  }
+  history_.push_back(std::move(entry));
   return true;
 }
 
+std::unique_ptr<ByteSource> ThreadTransferHistory::takeSource(Entry &entry) {
+  if (entry.source) {
+    return std::move(entry.source);
+  }
+  return queue_.rebuildSource(*entry.compact);
+}
+
+TransferStats ThreadTransferHistory::takeStats(Entry &entry) {
+  if (entry.compact && entry.compact->stats) {
+    return std::move(*entry.compact->stats);
+  }
+  // without the kept stats, the rebuilt source has their id and counts
+  return std::move(takeSource(entry)->getTransferStats());
+}
+
 ErrorCode ThreadTransferHistory::setLocalCheckpoint(
     const Checkpoint &checkpoint) {
   std::lock_guard<std::mutex> lock(mutex_);
@@ -67,13 +99,19 @@ ErrorCode ThreadTransferHistory::setGlobalCheckpoint(
 }
 ErrorCode ThreadTransferHistory::setCheckpointAndReturnToQueue(
     const Checkpoint &checkpoint, bool globalCheckpoint) {
-  const int64_t historySize = history_.size();
+  const int64_t historySize = numReleased_ + history_.size();
   int64_t numReceivedSources = checkpoint.numBlocks;
   int64_t lastBlockReceivedBytes = checkpoint.lastBlockReceivedBytes;
   if (numReceivedSources > historySize) {
     WLOG(ERROR)
         << "checkpoint is greater than total number of sources transferred "
-        << history_.size() << " " << numReceivedSources;
+        << historySize << " " << numReceivedSources;
+    return INVALID_CHECKPOINT;
+  }
+  if (numReceivedSources < numReleased_) {
+    WLOG(ERROR) << "checkpoint is lower than the number of sources already "
+                   "acked and released "
+                << numReleased_ << " " << numReceivedSources;
     return INVALID_CHECKPOINT;
   }
   ErrorCode errCode = validateCheckpoint(checkpoint, globalCheckpoint);
@@ -95,7 +133,7 @@ ErrorCode ThreadTransferHistory::setCheckpointAndReturnToQueue(
   numAcknowledged_ = numReceivedSources;
   std::vector<std::unique_ptr<ByteSource>> sourcesToReturn;
   for (int64_t i = 0; i < numFailedSources; i++) {
-    std::unique_ptr<ByteSource> source = std::move(history_.back());
+    std::unique_ptr<ByteSource> source = takeSource(history_.back());
     history_.pop_back();
     const Checkpoint *checkpointPtr =
         (i == numFailedSources - 1 ? &checkpoint : nullptr);
@@ -106,17 +144,32 @@ ErrorCode ThreadTransferHistory::setCheckpointAndReturnToQueue(
   WLOG(INFO) << numFailedSources
              << " number of sources returned to queue, checkpoint: "
              << checkpoint;
+  releaseAckedSources();
   return errCode;
 }
 
+void ThreadTransferHistory::releaseAckedSources() {
+  if (!queue_.isBounded()) {
+    return;
+  }
+  while (numReleased_ < numAcknowledged_ && !history_.empty()) {
+    if (keepAckedSourceStats_) {
+      releasedSourceStats_.emplace_back(takeStats(history_.front()));
+    }
+    history_.pop_front();
+    ++numReleased_;
+  }
+}
+
 std::vector<TransferStats> ThreadTransferHistory::popAckedSourceStats() {
   std::unique_lock<std::mutex> lock(mutex_);
-  const int64_t historySize = history_.size();
+  const int64_t historySize = numReleased_ + history_.size();
   WDT_CHECK(numAcknowledged_ == historySize);
   // no locking needed, as this should be called after transfer has finished
-  std::vector<TransferStats> sourceStats;
+  std::vector<TransferStats> sourceStats = std::move(releasedSourceStats_);
+  releasedSourceStats_.clear();
   while (!history_.empty()) {
-    sourceStats.emplace_back(std::move(history_.back()->getTransferStats()));
+    sourceStats.emplace_back(takeStats(history_.back()));
     history_.pop_back();
   }
   return sourceStats;
@@ -124,7 +177,8 @@ std::vector<TransferStats> ThreadTransferHistory::popAckedSourceStats() {
 
 void ThreadTransferHistory::markAllAcknowledged() {
   std::unique_lock<std::mutex> lock(mutex_);
-  numAcknowledged_ = history_.size();
+  numAcknowledged_ = numReleased_ + history_.size();
+  releaseAckedSources();
 }
 
 void ThreadTransferHistory::returnUnackedSourcesToQueue() {
@@ -238,8 +292,8 @@ void ThreadTransferHistory::markNotInUse() {
 }
 
 TransferHistoryController::TransferHistoryController(
-    DirectorySourceQueue &dirQueue)
-    : dirQueue_(dirQueue) {
+    DirectorySourceQueue &dirQueue, bool keepAckedSourceStats)
+    : dirQueue_(dirQueue), keepAckedSourceStats_(keepAckedSourceStats) {
 }
 
 ThreadTransferHistory &TransferHistoryController::getTransferHistory(
@@ -252,8 +306,9 @@ ThreadTransferHistory &TransferHistoryController::getTransferHistory(
 void TransferHistoryController::addThreadHistory(int32_t port,
                                                  TransferStats &threadStats) {
   WVLOG(1) << "Adding the history for " << port;
-  threadHistoriesMap_.emplace(port, std::make_unique<ThreadTransferHistory>(
-                                        dirQueue_, threadStats, port));
+  threadHistoriesMap_.emplace(
+      port, std::make_unique<ThreadTransferHistory>(
+                dirQueue_, threadStats, port, keepAckedSourceStats_));
 }
 
 ErrorCode TransferHistoryController::handleVersionMismatch() {
@@ -11,20 +11,31 @@
 #include <wdt/Protocol.h>
 #include <wdt/Reporting.h>
 #include <wdt/util/DirectorySourceQueue.h>
+#include <deque>
 #include <vector>
 
 namespace facebook {
 namespace wdt {
 
-/// Transfer history of a sender thread
+/**
+ * Transfer history of a sender thread. With a bounded queue, the sources are
+ * compacted as they are added (see DirectorySourceQueue::compactSource()),
+ * which frees them and the metadata of their files while they wait for an
+ * acknowledgment. Those which turn out to be unacked are rebuilt to be sent
+ * again.
+ */
 class ThreadTransferHistory {
  public:
   /**
-   * @param queue        directory queue
-   * @param threadStats  stat object of the thread
+   * @param queue                 directory queue
+   * @param threadStats           stat object of the thread
+   * @param port                  port of the thread
+   * @param keepAckedSourceStats  whether to keep the stats of the acked
+   *                              sources released in bounded mode, for
+   *                              popAckedSourceStats()
    */
   ThreadTransferHistory(DirectorySourceQueue &queue, TransferStats &threadStats,
-                        int32_t port);
+                        int32_t port, bool keepAckedSourceStats);
 
   /**
    * @param             index of the source
@@ -101,6 +112,27 @@ class ThreadTransferHistory {
 
   void markSourceAsFailed(std::unique_ptr<ByteSource> &source,
                           const Checkpoint *checkpoint);
+
+  /**
+   * If the queue is bounded, drops the acked sources from the history, which
+   * releases the metadata of the files whose sources were all acked
+   */
+  void releaseAckedSources();
+
+  /// source of the history
+  struct Entry {
+    /// source, null if compacted
+    std::unique_ptr<ByteSource> source;
+    /// compacted source, null if kept whole
+    std::unique_ptr<DirectorySourceQueue::CompactSource> compact;
+  };
+
+  /// @return   source of an entry, rebuilt if it was compacted
+  std::unique_ptr<ByteSource> takeSource(Entry &entry);
+
+  /// @return   stats of the source of an entry
+  TransferStats takeStats(Entry &entry);
+
   /**
    * Sets checkpoint. Also, returns unacked sources to queue
    *
@@ -115,8 +147,14 @@ class ThreadTransferHistory {
   DirectorySourceQueue &queue_;
   /// reference to thread stats
   TransferStats &threadStats_;
-  /// history of the thread
-  std::vector<std::unique_ptr<ByteSource>> history_;
+  /// history of the thread, without the first numReleased_ sources
+  std::deque<Entry> history_;
+  /// number of acked sources dropped from the front of the history
+  int64_t numReleased_{0};
+  /// whether to keep the stats of the released sources
+  const bool keepAckedSourceStats_;
+  /// stats of the released sources
+  std::vector<TransferStats> releasedSourceStats_;
   /// whether a global error checkpoint has been received or not
   bool globalCheckpoint_{false};
   /// number of sources acked by the receiver thread
@@ -138,9 +176,12 @@ class TransferHistoryController {
  public:
   /**
    * Constructor for the history controller
-   * @param dirQueue      Directory queue used by the sender
+   * @param dirQueue              Directory queue used by the sender
+   * @param keepAckedSourceStats  whether the histories keep the stats of the
+   *                              acked sources they release
    */
-  explicit TransferHistoryController(DirectorySourceQueue &dirQueue);
+  TransferHistoryController(DirectorySourceQueue &dirQueue,
+                            bool keepAckedSourceStats);
 
   /**
    * Add transfer history for a thread
@@ -162,6 +203,9 @@ class TransferHistoryController {
   /// Reference to the directory queue being used by the sender
   DirectorySourceQueue &dirQueue_;
 
+  /// passed to the thread histories
+  const bool keepAckedSourceStats_;
+
   /// Map of port (used by sender threads) and transfer history
   std::unordered_map<int32_t, std::unique_ptr<ThreadTransferHistory>>
       threadHistoriesMap_;
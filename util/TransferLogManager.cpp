@@ -81,15 +81,20 @@ bool LogEncoderDecoder::decodeLogHeader(char *buf, int16_t size,
 int64_t LogEncoderDecoder::encodeFileCreationEntry(char *dest, int64_t max,
                                                    const string &fileName,
                                                    const int64_t seqId,
-                                                   const int64_t fileSize) {
+                                                   const int64_t fileSize,
+                                                   const int64_t stripe) {
   // increment by 2 bytes to later store the total length
   int64_t size = sizeof(int16_t);
   WDT_CHECK_GE(max, size + 1);
-  dest[size++] = TransferLogManager::FILE_CREATION;
+  dest[size++] = (stripe < 0 ? TransferLogManager::FILE_CREATION
+                             : TransferLogManager::STRIPED_FILE_CREATION);
   bool ok = encodeVarI64C(dest, max, size, timestampInMicroseconds()) &&
             encodeString(dest, max, size, fileName) &&
             encodeVarI64C(dest, max, size, seqId) &&
             encodeVarI64C(dest, max, size, fileSize);
+  if (ok && stripe >= 0) {
+    ok = encodeVarI64C(dest, max, size, stripe);
+  }
   if (!ok) {
     WLOG(ERROR) << "Log header buffer too small " << max << " for file c entry "
                 << fileName;
@@ -103,10 +108,14 @@ bool LogEncoderDecoder::decodeFileCreationEntry(char *buf, int16_t size,
                                                 int64_t &timestamp,
                                                 string &fileName,
                                                 int64_t &seqId,
-                                                int64_t &fileSize) {
+                                                int64_t &fileSize,
+                                                int64_t *stripe) {
   ByteRange br = makeByteRange(buf, size);
   bool ok = decodeInt64C(br, timestamp) && decodeString(br, fileName) &&
             decodeInt64C(br, seqId) && decodeInt64C(br, fileSize);
+  if (ok && stripe != nullptr) {
+    ok = decodeInt64C(br, *stripe);
+  }
   if (!ok || (br.size() != 0)) {
     WLOG(ERROR) << "Did not decode properly file creat entry " << size << " ok "
                 << ok << " left over " << br.size();
@@ -494,15 +503,16 @@ void TransferLogManager::writeLogHeader() {
 }
 
 void TransferLogManager::addFileCreationEntry(const string &fileName,
-                                              int64_t seqId, int64_t fileSize) {
+                                              int64_t seqId, int64_t fileSize,
+                                              int64_t stripe) {
   if (fd_ < 0 || !headerWritten_) {
     return;
   }
   WVLOG(1) << "Adding file entry to log " << fileName << " " << seqId << " "
-           << fileSize;
+           << fileSize << " " << stripe;
   char buf[kMaxEntryLength];
   int64_t size = encoderDecoder_.encodeFileCreationEntry(
-      buf, sizeof(buf), fileName, seqId, fileSize);
+      buf, sizeof(buf), fileName, seqId, fileSize, stripe);
 
   std::lock_guard<std::mutex> lock(mutex_);
   entries_.emplace_back(buf, size);
@@ -592,7 +602,7 @@ ErrorCode TransferLogManager::parseVerifyAndFix(
     return INVALID_LOG;
   }
   LogParser parser(options_, encoderDecoder_, rootDir_, recoveryId, config,
-                   parseOnly);
+                   parseOnly, stripePlacement_);
   resumptionStatus_ = parser.parseLog(fd_, senderIp_, parsedInfo);
   if (resumptionStatus_ == INVALID_LOG) {
     // leave the log, but close it. Keeping the invalid log ensures that the
@@ -670,9 +680,13 @@ void TransferLogManager::compactLog() {
   writeLogHeader();
 
   for (const auto &fileChunksInfo : fileChunksInfoVec) {
+    const int64_t stripe =
+        stripePlacement_
+            ? stripePlacement_->getStripe(fileChunksInfo.getFileName())
+            : -1;
     addFileCreationEntry(fileChunksInfo.getFileName(),
                          fileChunksInfo.getSeqId(),
-                         fileChunksInfo.getFileSize());
+                         fileChunksInfo.getFileSize(), stripe);
     addBlockWriteEntry(fileChunksInfo.getSeqId(), 0,
                        fileChunksInfo.getFileSize());
   }
@@ -695,13 +709,15 @@ void TransferLogManager::compactLog() {
 
 LogParser::LogParser(const WdtOptions &options,
                      LogEncoderDecoder &encoderDecoder, const string &rootDir,
-                     const string &recoveryId, int64_t config, bool parseOnly)
+                     const string &recoveryId, int64_t config, bool parseOnly,
+                     StripePlacement *stripePlacement)
     : options_(options),
       encoderDecoder_(encoderDecoder),
       rootDir_(rootDir),
       recoveryId_(recoveryId),
       config_(config),
-      parseOnly_(parseOnly) {
+      parseOnly_(parseOnly),
+      stripePlacement_(stripePlacement) {
 }
 
 bool LogParser::writeFileInvalidationEntries(int fd,
@@ -746,6 +762,7 @@ bool LogParser::truncateExtraBytesAtEnd(int fd, int64_t extraBytes) {
 void LogParser::clearParsedData() {
   fileInfoMap_.clear();
   seqIdToSizeMap_.clear();
+  seqIdToStripeMap_.clear();
   invalidSeqIds_.clear();
 }
 
@@ -812,22 +829,29 @@ ErrorCode LogParser::processHeaderEntry(char *buf, int64_t max, int64_t size,
   return OK;
 }
 
-ErrorCode LogParser::processFileCreationEntry(char *buf, int64_t size) {
+ErrorCode LogParser::processFileCreationEntry(char *buf, int64_t size,
+                                             bool striped) {
   if (!headerParsed_) {
     WLOG(ERROR)
         << "Invalid log: File creation entry found before transfer log header";
     return INVALID_LOG;
   }
   int64_t timestamp, seqId, fileSize;
+  // files created without striping are in the destination directory
+  int64_t stripe = 0;
   string fileName;
   if (!encoderDecoder_.decodeFileCreationEntry(buf, size, timestamp, fileName,
-                                               seqId, fileSize)) {
+                                               seqId, fileSize,
+                                               striped ? &stripe : nullptr)) {
     return INVALID_LOG;
   }
   if (parseOnly_) {
     std::cout << getFormattedTimestamp(timestamp) << " File created "
-              << fileName << " seq-id " << seqId << " file-size " << fileSize
-              << std::endl;
+              << fileName << " seq-id " << seqId << " file-size " << fileSize;
+    if (striped) {
+      std::cout << " stripe " << stripe;
+    }
+    std::cout << std::endl;
     return OK;
   }
   if (options_.resume_using_dir_tree) {
@@ -845,9 +869,19 @@ ErrorCode LogParser::processFileCreationEntry(char *buf, int64_t size) {
   // verify size
   bool sizeVerificationSuccess = false;
   struct stat buffer;
+  const int64_t numStripes =
+      stripePlacement_ ? stripePlacement_->getNumStripes() : 1;
   string fullPath;
-  folly::toAppend(rootDir_, fileName, &fullPath);
-  if (stat(fullPath.c_str(), &buffer) != 0) {
+  if (stripe > 0 && stripe < numStripes) {
+    folly::toAppend(stripePlacement_->getStripeDir(stripe), fileName,
+                    &fullPath);
+  } else {
+    folly::toAppend(rootDir_, fileName, &fullPath);
+  }
+  if (stripe < 0 || stripe >= numStripes) {
+    WLOG(ERROR) << "File " << fileName << " created on stripe " << stripe
+                << ", only " << numStripes << " stripes configured";
+  } else if (stat(fullPath.c_str(), &buffer) != 0) {
     WPLOG(ERROR) << "stat failed for " << fileName;
   } else {
     if (options_.shouldPreallocateFiles()) {
@@ -861,6 +895,7 @@ ErrorCode LogParser::processFileCreationEntry(char *buf, int64_t size) {
     fileInfoMap_.emplace(seqId,
                          FileChunksInfo(seqId, fileName, buffer.st_size));
     seqIdToSizeMap_.emplace(seqId, fileSize);
+    seqIdToStripeMap_.emplace(seqId, stripe);
   } else {
     WLOG(INFO) << "Sanity check failed for " << fileName << " seq-id " << seqId
                << " file-size " << fileSize;
@@ -1078,7 +1113,10 @@ ErrorCode LogParser::parseLog(int fd, string &senderIp,
         status = processHeaderEntry(buf, bufSize, entryLen, senderIp);
         break;
       case TransferLogManager::FILE_CREATION:
-        status = processFileCreationEntry(buf, entryLen);
+        status = processFileCreationEntry(buf, entryLen, false);
+        break;
+      case TransferLogManager::STRIPED_FILE_CREATION:
+        status = processFileCreationEntry(buf, entryLen, true);
         break;
       case TransferLogManager::BLOCK_WRITE:
         status = processBlockWriteEntry(buf, entryLen);
@@ -1107,6 +1145,10 @@ ErrorCode LogParser::parseLog(int fd, string &senderIp,
   if (status == OK) {
     for (auto &pair : fileInfoMap_) {
       FileChunksInfo &fileInfo = pair.second;
+      if (stripePlacement_ != nullptr) {
+        stripePlacement_->recordStripe(fileInfo.getFileName(),
+                                       seqIdToStripeMap_[pair.first]);
+      }
       fileInfo.mergeChunks();
       fileChunksInfo.emplace_back(std::move(fileInfo));
     }
@@ -10,6 +10,7 @@
 
 #include <wdt/Protocol.h>
 #include <wdt/WdtOptions.h>
+#include <wdt/util/StripePlacement.h>
 
 #include <condition_variable>
 #include <iostream>
@@ -58,15 +59,16 @@ class LogEncoderDecoder {
                        int &version, std::string &recoveryId,
                        std::string &senderIp, int64_t &config);
 
-  /// encodes file creation entry
+  /// encodes file creation entry, a striped one if stripe is not negative
   int64_t encodeFileCreationEntry(char *dest, int64_t max,
                                   const std::string &fileName,
-                                  const int64_t seqId, const int64_t fileSize);
+                                  const int64_t seqId, const int64_t fileSize,
+                                  const int64_t stripe = -1);
 
-  /// decodes file creation entry
+  /// decodes file creation entry, stripe is only decoded if not null
   bool decodeFileCreationEntry(char *buf, int16_t size, int64_t &timestamp,
                                std::string &fileName, int64_t &seqId,
-                               int64_t &fileSize);
+                               int64_t &fileSize, int64_t *stripe = nullptr);
 
   /// encodes block write entry
   int64_t encodeBlockWriteEntry(char *dest, int64_t max, const int64_t seqId,
@@ -122,11 +124,13 @@ class TransferLogManager {
     FILE_INVALIDATION,       // Missing file
     FILE_RESIZE,             // File Resized
     DIRECTORY_INVALIDATION,  // Directory content is invalid
+    STRIPED_FILE_CREATION,   // File created on one of the stripe directories
   };
 
   /// 2 bytes for entry size, 1 byte for entry-type, PATH_MAX for file-name, 10
-  /// bytes for seq-id, 10 bytes for file-size, 10 bytes for timestamp
-  static const int64_t kMaxEntryLength = 2 + 1 + 10 + PATH_MAX + 2 * 10;
+  /// bytes for seq-id, 10 bytes for file-size, 10 bytes for timestamp, 10
+  /// bytes for stripe
+  static const int64_t kMaxEntryLength = 2 + 1 + 10 + PATH_MAX + 3 * 10;
 
   TransferLogManager(const WdtOptions &options, const std::string &rootDir)
       : options_(options) {
@@ -146,6 +150,16 @@ class TransferLogManager {
   /// Start the log writer thread
   ErrorCode startThread();
 
+  /**
+   * Sets the placement of the files across stripe directories. Stripes of the
+   * files found by parsing the log are recorded in it, and file creation
+   * entries then carry the stripe of the file. Must be called before the log
+   * is parsed.
+   */
+  void setStripePlacement(StripePlacement *stripePlacement) {
+    stripePlacement_ = stripePlacement;
+  }
+
   /**
    * In case of log based resumption, signals to the writer thread to finish.
    * Waits for the writer thread to finish. Closes the transfer log.
@@ -173,9 +187,10 @@ class TransferLogManager {
    * @param fileName  Name of the file
    * @param seqId     seq-id of the file
    * @param fileSize  size of the file
+   * @param stripe    stripe the file is created on, -1 if not striping
    */
   void addFileCreationEntry(const std::string &fileName, int64_t seqId,
-                            int64_t fileSize);
+                            int64_t fileSize, int64_t stripe = -1);
 
   /**
    * Adds a block write entry to the log buffer
@@ -291,6 +306,9 @@ class TransferLogManager {
 
   const WdtOptions &options_;
 
+  /// placement of the files across stripes, null if not striping
+  StripePlacement *stripePlacement_{nullptr};
+
   /// File handler for writing
   int fd_{-1};
   /// root directory
@@ -323,7 +341,8 @@ class LogParser {
  public:
   LogParser(const WdtOptions &options, LogEncoderDecoder &encoderDecoder,
             const std::string &rootDir, const std::string &recoveryId,
-            int64_t config, bool parseOnly);
+            int64_t config, bool parseOnly,
+            StripePlacement *stripePlacement = nullptr);
 
   ErrorCode parseLog(int fd, std::string &senderIp,
                      std::vector<FileChunksInfo> &fileChunksInfo);
@@ -354,7 +373,7 @@ class LogParser {
                                std::string &senderIp);
 
   // TODO: switch to ByteRange
-  ErrorCode processFileCreationEntry(char *buf, int64_t size);
+  ErrorCode processFileCreationEntry(char *buf, int64_t size, bool striped);
 
   ErrorCode processBlockWriteEntry(char *buf, int64_t size);
 
@@ -370,6 +389,8 @@ class LogParser {
   std::string recoveryId_;
   int64_t config_;
   bool parseOnly_;
+  /// placement of the files, stripes of the parsed files are recorded in it
+  StripePlacement *stripePlacement_;
   /// whether header is parsed or not
   bool headerParsed_{false};
 
@@ -377,6 +398,8 @@ class LogParser {
   std::map<int64_t, FileChunksInfo> fileInfoMap_;
   /// seq-id to file-size map
   std::map<int64_t, int64_t> seqIdToSizeMap_;
+  /// seq-id to stripe map
+  std::map<int64_t, int64_t> seqIdToStripeMap_;
   /// set of invalid seq-ids
   std::set<int64_t> invalidSeqIds_;
 };
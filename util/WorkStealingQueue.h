@@ -0,0 +1,93 @@
+/**
+ * Copyright (c) 2014-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+#pragma once
+
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace facebook {
+namespace wdt {
+
+/**
+ * Set of deques, one per worker. A worker pushes to and pops from the back
+ * of its own deque, so it keeps working on what it produced last, and steals
+ * from the front of the others' deques, taking the oldest items, when its own
+ * one is empty. Every deque has its own lock, so workers only contend when
+ * stealing.
+ */
+template <typename T>
+class WorkStealingQueue {
+ public:
+  /// @param numWorkers   number of workers, indices go from 0 to numWorkers-1
+  explicit WorkStealingQueue(int numWorkers) {
+    for (int i = 0; i < numWorkers; i++) {
+      deques_.emplace_back(std::make_unique<WorkerDeque>());
+    }
+  }
+
+  /// @return   number of workers
+  int getNumWorkers() const {
+    return deques_.size();
+  }
+
+  /**
+   * @param worker  index of the pushing worker
+   * @param item    item to push
+   */
+  void push(int worker, T item) {
+    WorkerDeque &workerDeque = *deques_[worker];
+    std::lock_guard<std::mutex> lock(workerDeque.mutex);
+    workerDeque.items.push_back(std::move(item));
+  }
+
+  /**
+   * Pops the last item of the worker's deque, or steals the first item of
+   * another deque
+   *
+   * @param worker  index of the popping worker
+   * @param item    set to the item popped
+   *
+   * @return        false if all the deques were seen empty
+   */
+  bool tryPop(int worker, T &item) {
+    {
+      WorkerDeque &workerDeque = *deques_[worker];
+      std::lock_guard<std::mutex> lock(workerDeque.mutex);
+      if (!workerDeque.items.empty()) {
+        item = std::move(workerDeque.items.back());
+        workerDeque.items.pop_back();
+        return true;
+      }
+    }
+    const int numWorkers = getNumWorkers();
+    for (int i = 1; i < numWorkers; i++) {
+      WorkerDeque &victim = *deques_[(worker + i) % numWorkers];
+      std::lock_guard<std::mutex> lock(victim.mutex);
+      if (!victim.items.empty()) {
+        item = std::move(victim.items.front());
+        victim.items.pop_front();
+        return true;
+      }
+    }
+    return false;
+  }
+
+ private:
+  struct WorkerDeque {
+    std::mutex mutex;
+    std::deque<T> items;
+  };
+
+  /// deque of each worker, allocated separately to not share cache lines
+  std::vector<std::unique_ptr<WorkerDeque>> deques_;
+};
+}
+}
@@ -0,0 +1,175 @@
+/**
+ * Copyright (c) 2014-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+#include <wdt/util/WritebackController.h>
+#include <wdt/WdtConfig.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+
+namespace facebook {
+namespace wdt {
+
+/// weight of the latest sample in the bandwidth average
+const double kBandwidthSmoothingFactor = 0.3;
+
+WritebackController &WritebackController::get() {
+  static WritebackController writebackController;
+  return writebackController;
+}
+
+bool WritebackController::isEnabled(const WdtOptions &options) {
+  return options.writeback_dirty_limit_mb > 0 &&
+         options.disk_sync_interval_mb >= 0;
+}
+
+void WritebackController::addDirtyBytes(int64_t bytes) {
+  dirtyBytes_ += bytes;
+}
+
+void WritebackController::removeDirtyBytes(int64_t bytes, bool writtenBack) {
+  dirtyBytes_ -= bytes;
+  if (!writtenBack) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  sampleBytes_ += bytes;
+  const auto now = Clock::now();
+  const int64_t elapsedMillis = durationMillis(now - sampleStartTime_);
+  if (elapsedMillis < kBandwidthSampleMillis) {
+    return;
+  }
+  const double sample = sampleBytes_ * 1000.0 / elapsedMillis;
+  if (bandwidth_ <= 0) {
+    bandwidth_ = sample;
+  } else {
+    bandwidth_ = kBandwidthSmoothingFactor * sample +
+                 (1 - kBandwidthSmoothingFactor) * bandwidth_;
+  }
+  WVLOG(1) << "Writeback bandwidth sample " << sample / kMbToB
+           << " Mbytes/sec, average " << bandwidth_ / kMbToB
+           << " Mbytes/sec, dirty bytes " << dirtyBytes_.load();
+  sampleBytes_ = 0;
+  sampleStartTime_ = now;
+}
+
+void WritebackController::addClosedRange(int fd, int64_t offset,
+                                         int64_t length, int64_t dirtyBytes) {
+  ClosedRange oldest{-1, 0, 0, 0};
+  bool tooManyRanges;
+  {
+    std::lock_guard<std::mutex> lock(closedRangesMutex_);
+    closedRanges_.push_back({fd, offset, length, dirtyBytes});
+    tooManyRanges = closedRanges_.size() > kMaxClosedRanges;
+    if (tooManyRanges) {
+      oldest = closedRanges_.front();
+      closedRanges_.pop_front();
+    }
+  }
+  if (tooManyRanges) {
+    // only the limit on the dirty bytes is worth a wait
+    dropClosedRange(oldest);
+  }
+}
+
+bool WritebackController::waitForClosedRanges(ThreadCtx &threadCtx) {
+  bool success = true;
+  while (isOverLimit(threadCtx.getOptions())) {
+    ClosedRange oldest{-1, 0, 0, 0};
+    {
+      std::lock_guard<std::mutex> lock(closedRangesMutex_);
+      if (closedRanges_.empty()) {
+        break;
+      }
+      oldest = closedRanges_.front();
+      closedRanges_.pop_front();
+    }
+    success &= waitForClosedRange(threadCtx, oldest);
+  }
+  return success;
+}
+
+void WritebackController::drainClosedRanges() {
+  std::deque<ClosedRange> closedRanges;
+  {
+    std::lock_guard<std::mutex> lock(closedRangesMutex_);
+    closedRanges.swap(closedRanges_);
+  }
+  if (!closedRanges.empty()) {
+    WVLOG(1) << "Dropping " << closedRanges.size() << " closed ranges";
+  }
+  for (const ClosedRange &range : closedRanges) {
+    dropClosedRange(range);
+  }
+}
+
+void WritebackController::dropClosedRange(const ClosedRange &range) {
+#ifdef HAS_SYNC_FILE_RANGE
+  if (sync_file_range(range.fd, range.offset, range.length,
+                      SYNC_FILE_RANGE_WRITE) != 0) {
+    WPLOG(ERROR) << "sync_file_range() failed for closed fd " << range.fd;
+  }
+#endif
+  removeDirtyBytes(range.dirtyBytes, false);
+  if (::close(range.fd) != 0) {
+    WPLOG(ERROR) << "Unable to close fd " << range.fd;
+  }
+}
+
+bool WritebackController::waitForClosedRange(ThreadCtx &threadCtx,
+                                             const ClosedRange &range) {
+  int status = 0;
+#ifdef HAS_SYNC_FILE_RANGE
+  {
+    PerfStatCollector statCollector(threadCtx, PerfStatReport::WRITEBACK_WAIT);
+    status = sync_file_range(range.fd, range.offset, range.length,
+                             SYNC_FILE_RANGE_WAIT_BEFORE |
+                                 SYNC_FILE_RANGE_WRITE |
+                                 SYNC_FILE_RANGE_WAIT_AFTER);
+  }
+  if (status != 0) {
+    WPLOG(ERROR) << "sync_file_range() wait failed for closed fd " << range.fd;
+  }
+#endif
+  // the bytes can not be waited for again
+  removeDirtyBytes(range.dirtyBytes, status == 0);
+  if (::close(range.fd) != 0) {
+    WPLOG(ERROR) << "Unable to close fd " << range.fd;
+  }
+  return status == 0;
+}
+
+int64_t WritebackController::getDirtyBytes() const {
+  return dirtyBytes_.load();
+}
+
+bool WritebackController::isOverLimit(const WdtOptions &options) const {
+  if (!isEnabled(options)) {
+    return false;
+  }
+  return dirtyBytes_.load() > options.writeback_dirty_limit_mb * kMbToB;
+}
+
+double WritebackController::getWritebackBandwidth() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return bandwidth_;
+}
+
+int64_t WritebackController::getSyncIntervalBytes(const WdtOptions &options) {
+  const int64_t minIntervalBytes = options.disk_sync_interval_mb * kMbToB;
+  if (!isEnabled(options) || options.writeback_target_latency_millis <= 0) {
+    return minIntervalBytes;
+  }
+  const int64_t maxIntervalBytes = options.writeback_dirty_limit_mb * kMbToB / 4;
+  const int64_t intervalBytes = getWritebackBandwidth() *
+                                options.writeback_target_latency_millis / 1000;
+  return std::max(minIntervalBytes, std::min(intervalBytes, maxIntervalBytes));
+}
+}
+}
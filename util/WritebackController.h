@@ -0,0 +1,154 @@
+/**
+ * Copyright (c) 2014-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+#pragma once
+
+#include <wdt/WdtOptions.h>
+#include <wdt/util/CommonImpl.h>
+
+#include <atomic>
+#include <deque>
+#include <mutex>
+
+namespace facebook {
+namespace wdt {
+
+/**
+ * Process wide accounting of bytes written by the receiver threads which are
+ * not yet known to be written back to disk. FileWriters add the bytes they
+ * write and remove them once they waited for the writeback of a range. The
+ * ranges still dirty when a file is closed are handed to the controller and
+ * stay counted till waited for, dropped when too many are held, or drained at
+ * the end of a transfer. When the total goes above writeback_dirty_limit_mb,
+ * the writers wait for the ranges of the closed files, then for their own
+ * older ranges, before dirtying more pages. This keeps several concurrent
+ * receivers from piling up gigabytes of dirty pages and triggering global
+ * writeback stalls.
+ *
+ * The controller also measures the rate at which bytes are written back and
+ * uses it to size the sync_file_range intervals.
+ */
+class WritebackController {
+ public:
+  /// @return     Singleton instance of the controller
+  static WritebackController &get();
+
+  /// @return     whether the controller is enabled for these options
+  static bool isEnabled(const WdtOptions &options);
+
+  /// Adds bytes newly dirtied by a writer
+  void addDirtyBytes(int64_t bytes);
+
+  /**
+   * Removes bytes from the outstanding count
+   *
+   * @param bytes       number of bytes
+   * @param writtenBack whether the caller waited for the bytes to reach the
+   *                    disk, only those are used to measure bandwidth
+   */
+  void removeDirtyBytes(int64_t bytes, bool writtenBack);
+
+  /**
+   * Takes over the dirty bytes of a range of a file being closed, which stay
+   * counted till waitForClosedRanges waits for their writeback. When too many
+   * ranges are held, the oldest one is closed and its bytes dropped from the
+   * count without waiting.
+   *
+   * @param fd            duplicate of the descriptor of the file, owned and
+   *                      closed by the controller
+   * @param offset        start of the range
+   * @param length        length of the range
+   * @param dirtyBytes    bytes of the range counted as dirty
+   */
+  void addClosedRange(int fd, int64_t offset, int64_t length,
+                      int64_t dirtyBytes);
+
+  /**
+   * While the outstanding bytes are above the limit, waits for the writeback
+   * of the oldest ranges of closed files
+   *
+   * @param threadCtx     context of the calling thread
+   * @return              false if a wait failed
+   */
+  bool waitForClosedRanges(ThreadCtx &threadCtx);
+
+  /**
+   * Starts the writeback of all the ranges of closed files without waiting,
+   * closes their descriptors and drops their bytes from the count. Called at
+   * the end of a transfer, so that a long running process keeps neither the
+   * descriptors nor the bytes for the next one
+   */
+  void drainClosedRanges();
+
+  /// @return     outstanding dirty bytes across the process
+  int64_t getDirtyBytes() const;
+
+  /// @return     whether the outstanding bytes are above the limit
+  bool isOverLimit(const WdtOptions &options) const;
+
+  /// @return     measured writeback bandwidth in bytes/sec, 0 if unknown
+  double getWritebackBandwidth();
+
+  /**
+   * @param options   wdt options
+   * @return          number of bytes to write before starting writeback of
+   *                  a range. With the controller enabled, the interval is
+   *                  sized so that a range is written back in about
+   *                  writeback_target_latency_millis at the measured
+   *                  bandwidth. It is never below disk_sync_interval_mb and
+   *                  never above a quarter of the dirty limit.
+   */
+  int64_t getSyncIntervalBytes(const WdtOptions &options);
+
+ private:
+  WritebackController() {
+  }
+
+  /// minimum time window over which bandwidth samples are taken
+  static const int64_t kBandwidthSampleMillis = 100;
+
+  /// most ranges of closed files held, each keeps a descriptor open
+  static const size_t kMaxClosedRanges = 1024;
+
+  /// dirty range of a closed file
+  struct ClosedRange {
+    int fd;
+    int64_t offset;
+    int64_t length;
+    int64_t dirtyBytes;
+  };
+
+  /**
+   * Waits for the writeback of a range, removes its dirty bytes and closes
+   * its descriptor
+   *
+   * @return      whether the wait succeeded
+   */
+  bool waitForClosedRange(ThreadCtx &threadCtx, const ClosedRange &range);
+
+  /// starts the writeback of a range without waiting, drops its dirty bytes
+  /// and closes its descriptor
+  void dropClosedRange(const ClosedRange &range);
+
+  /// outstanding dirty bytes
+  std::atomic<int64_t> dirtyBytes_{0};
+  /// protects the bandwidth measurement
+  std::mutex mutex_;
+  /// bytes written back since the start of the current sample
+  int64_t sampleBytes_{0};
+  /// start of the current sample
+  Clock::time_point sampleStartTime_{Clock::now()};
+  /// exponentially weighted bandwidth in bytes/sec
+  double bandwidth_{0};
+  /// protects closedRanges_
+  std::mutex closedRangesMutex_;
+  /// ranges of closed files not yet waited for, oldest first
+  std::deque<ClosedRange> closedRanges_;
+};
+}
+}
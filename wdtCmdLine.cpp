@@ -9,6 +9,7 @@
 #include <wdt/Receiver.h>
 #include <wdt/Wdt.h>
 #include <wdt/WdtResourceController.h>
+#include <wdt/util/BinaryManifest.h>
 
 #include <folly/String.h>
 #include <gflags/gflags.h>
@@ -16,6 +17,7 @@
 #include <signal.h>
 #include <chrono>
 #include <fstream>
+#include <functional>
 #include <future>
 #include <iostream>
 #include <thread>
@@ -37,10 +39,21 @@ DEFINE_bool(fork, false,
 DEFINE_bool(run_as_daemon, false,
             "If true, run the receiver as never ending process");
 
+DEFINE_bool(watch_directory, false,
+            "If true, the sender keeps watching the directory after sending "
+            "it and sends the changes, until aborted. For a receiver running "
+            "with -run_as_daemon -overwrite -delete_extra_files");
+
 DEFINE_string(directory, ".", "Source/Destination directory");
 DEFINE_string(manifest, "",
               "If specified, then we will read a list of files and optional "
-              "sizes from this file, use - for stdin");
+              "sizes from this file, use - for stdin. Either a text manifest "
+              "or a binary one (see -convert_manifest)");
+DEFINE_string(convert_manifest, "",
+              "If specified, the text manifest given by -manifest is converted "
+              "to a binary manifest written to this path, and wdt exits. "
+              "Binary manifests are read as the files are sent, for lists of "
+              "millions of files");
 DEFINE_string(
     destination, "",
     "empty is server (destination) mode, non empty is destination host");
@@ -143,7 +156,12 @@ void cancelAbort() {
   std::this_thread::yield();
 }
 
-void readManifest(std::istream &fin, WdtTransferRequest &req, bool dfltDirect) {
+/// Parses a text manifest: each line has the file name and optionally the
+/// size and whether to use direct reads, separated by tabs
+void parseManifest(
+    std::istream &fin,
+    const std::function<void(const std::string &, int64_t,
+                             BinaryManifest::DirectReads)> &addEntry) {
   std::string line;
   while (std::getline(fin, line)) {
     std::vector<std::string> fields;
@@ -152,12 +170,40 @@ void readManifest(std::istream &fin, WdtTransferRequest &req, bool dfltDirect) {
       WLOG(FATAL) << "Invalid input manifest: " << line;
     }
     int64_t filesize = fields.size() > 1 ? folly::to<int64_t>(fields[1]) : -1;
-    bool odirect = fields.size() > 2 ? folly::to<bool>(fields[2]) : dfltDirect;
-    req.fileInfo.emplace_back(fields[0], filesize, odirect);
+    BinaryManifest::DirectReads odirect = BinaryManifest::DIRECT_READS_DEFAULT;
+    if (fields.size() > 2) {
+      odirect = folly::to<bool>(fields[2]) ? BinaryManifest::DIRECT_READS_ON
+                                           : BinaryManifest::DIRECT_READS_OFF;
+    }
+    addEntry(fields[0], filesize, odirect);
   }
+}
+
+void readManifest(std::istream &fin, WdtTransferRequest &req, bool dfltDirect) {
+  parseManifest(fin, [&](const std::string &fileName, int64_t fileSize,
+                         BinaryManifest::DirectReads odirect) {
+    const bool direct = (odirect == BinaryManifest::DIRECT_READS_DEFAULT)
+                            ? dfltDirect
+                            : (odirect == BinaryManifest::DIRECT_READS_ON);
+    req.fileInfo.emplace_back(fileName, fileSize, direct);
+  });
   req.disableDirectoryTraversal = true;
 }
 
+/// Converts the text manifest to a binary one, entry by entry
+bool convertManifest(std::istream &fin, const std::string &binaryManifest) {
+  BinaryManifestWriter writer(binaryManifest);
+  if (!writer.open()) {
+    return false;
+  }
+  bool ok = true;
+  parseManifest(fin, [&](const std::string &fileName, int64_t fileSize,
+                         BinaryManifest::DirectReads odirect) {
+    ok = ok && writer.add(fileName, fileSize, odirect);
+  });
+  return ok && writer.close();
+}
+
 namespace GFLAGS_NAMESPACE {
 extern GFLAGS_DLL_DECL void (*gflags_exitfunc)(int);
 }
@@ -263,6 +309,23 @@ int main(int argc, char *argv[]) {
     return success ? OK : ERROR;
   }
 
+  // Odd ball case of manifest conversion
+  if (!FLAGS_convert_manifest.empty()) {
+    bool success;
+    if (FLAGS_manifest == "-") {
+      success = convertManifest(std::cin, FLAGS_convert_manifest);
+    } else {
+      std::ifstream fin(FLAGS_manifest);
+      if (!fin) {
+        WLOG(ERROR) << "Unable to open manifest " << FLAGS_manifest;
+        return ERROR;
+      }
+      success = convertManifest(fin, FLAGS_convert_manifest);
+    }
+    WLOG_IF(ERROR, !success) << "Manifest conversion failed";
+    return success ? OK : ERROR;
+  }
+
   // General case : Sender or Receiver
   std::unique_ptr<WdtTransferRequest> reqPtr;
   if (connectUrl.empty()) {
@@ -359,18 +422,33 @@ int main(int argc, char *argv[]) {
       // the filesize separated by a single space
       if (FLAGS_manifest == "-") {
         readManifest(std::cin, req, options.odirect_reads);
+      } else if (BinaryManifest::isBinaryManifest(FLAGS_manifest)) {
+        // read by the sender as the files are queued
+        req.binaryManifest = FLAGS_manifest;
+        req.disableDirectoryTraversal = true;
       } else {
         std::ifstream fin(FLAGS_manifest);
         readManifest(fin, req, options.odirect_reads);
         fin.close();
       }
-      WLOG(INFO) << "Using files lists, number of files "
-                 << req.fileInfo.size();
+      if (req.binaryManifest.empty()) {
+        WLOG(INFO) << "Using files lists, number of files "
+                   << req.fileInfo.size();
+      }
     }
     WLOG(INFO) << "Making Sender with encryption set = "
                << req.encryptionData.isSet();
 
-    retCode = wdt.wdtSend(req, setupAbortChecker());
+    if (FLAGS_watch_directory) {
+      WLOG_IF(WARNING, !FLAGS_manifest.empty())
+          << "Ignoring the manifest, watching the whole directory";
+      req.fileInfo.clear();
+      req.binaryManifest.clear();
+      req.disableDirectoryTraversal = false;
+      retCode = wdt.wdtReplicate(req, setupAbortChecker());
+    } else {
+      retCode = wdt.wdtSend(req, setupAbortChecker());
+    }
   }
   cancelAbort();
   if (retCode == OK) {